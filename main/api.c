@@ -0,0 +1,143 @@
+#include "api.h"
+#include "patch_json.h"
+#include "control.h"
+
+#include <inttypes.h>
+#include <sys/param.h>
+#include <esp_log.h>
+
+static const char *TAG = "api";
+
+#define API_MAX_BODY (4096)
+
+static const persistent_state_t * g_state = NULL;
+
+bool api_parse_patch(const char * json, size_t len, state_patch_t * out)
+{
+  return patch_json_parse(json, len, SCENE_COUNT, out);
+}
+
+// Read the request body as JSON patches, base is the depth of the patch objects.
+static esp_err_t read_patches(httpd_req_t *req, int base, state_patch_t * out, int * count)
+{
+  if(req->content_len > API_MAX_BODY){
+    return ESP_ERR_INVALID_SIZE;
+  }
+  patch_reader_t pr;
+  json_reader_t reader;
+  patch_reader_init(&pr, &reader, base, SCENE_COUNT);
+
+  char buf[128];
+  size_t left = req->content_len;
+  while(left > 0){
+    int n = httpd_req_recv(req, buf, MIN(left, sizeof(buf)));
+    if(n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+    if(n <= 0) return ESP_FAIL;
+    left -= n;
+    if(!json_reader_feed(&reader, buf, n)) return ESP_ERR_INVALID_ARG;
+  }
+  if(!json_reader_finish(&reader)) return ESP_ERR_INVALID_ARG;
+  *out = pr.merged;
+  *count = pr.count;
+  return ESP_OK;
+}
+
+static esp_err_t send_bad_request(httpd_req_t *req, esp_err_t err)
+{
+  if(err == ESP_FAIL) return ESP_FAIL; // Connection error, nothing to answer
+  return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+			     err == ESP_ERR_INVALID_SIZE ? "Body too long" : "Invalid state JSON");
+}
+
+int api_state_json(const persistent_state_t * s, char * out, size_t size)
+{
+  rgb_t rgb = rgb_16_to_8(s->rgb);
+  hsv_t hsv = hsv_16_to_8(s->hsv);
+  const int16_t * m = &s->cal.matrix[0][0];
+  return snprintf(out, size,
+	   "{\"rgb\":{\"r\":%d,\"g\":%d,\"b\":%d},"
+	   "\"hsv\":{\"h\":%d,\"s\":%d,\"v\":%d},"
+	   "\"cal\":{\"matrix\":[%d,%d,%d,%d,%d,%d,%d,%d,%d],\"offset\":[%d,%d,%d]},"
+	   "\"mode\":\"%s\",\"transition_ms\":%" PRIu32 ",\"on\":%s,\"audio\":\"%s\"}",
+	   rgb.r, rgb.g, rgb.b,
+	   hsv.h, hsv.s, hsv.v,
+	   m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8],
+	   s->cal.offset[0], s->cal.offset[1], s->cal.offset[2],
+	   patch_json_modes[s->cursor_mode % 3], s->transition_ms, s->on ? "true" : "false",
+	   patch_json_audio[s->audio % 4]);
+}
+
+static esp_err_t state_get_handler(httpd_req_t *req)
+{
+  char out[API_STATE_MAX];
+  api_state_json(g_state, out, sizeof(out));
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t state_put_handler(httpd_req_t *req)
+{
+  state_patch_t patch;
+  int count;
+  esp_err_t err = read_patches(req, 1, &patch, &count);
+  if(err != ESP_OK) return send_bad_request(req, err);
+  if(req->method == HTTP_PUT && !(patch.fields & (PATCH_RGB | PATCH_HSV))){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "PUT needs a color");
+  }
+  ESP_LOGD(TAG, "State patch %08" PRIx32, patch.fields);
+  control_submit(&patch);
+  httpd_resp_set_status(req, HTTPD_204);
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t batch_post_handler(httpd_req_t *req)
+{
+  state_patch_t patch;
+  int count;
+  esp_err_t err = read_patches(req, 2, &patch, &count);
+  if(err != ESP_OK) return send_bad_request(req, err);
+  ESP_LOGD(TAG, "Batch of %d patches (%08" PRIx32 ")", count, patch.fields);
+  // Merged into a single patch, so it is applied in one render tick
+  control_submit(&patch);
+  char out[32];
+  snprintf(out, sizeof(out), "{\"applied\":%d}", count);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+}
+
+static const httpd_uri_t state_get = {
+  .uri       = "/api/state",
+  .method    = HTTP_GET,
+  .handler   = state_get_handler,
+  .user_ctx  = NULL
+};
+
+static const httpd_uri_t state_put = {
+  .uri       = "/api/state",
+  .method    = HTTP_PUT,
+  .handler   = state_put_handler,
+  .user_ctx  = NULL
+};
+
+static const httpd_uri_t state_patch = {
+  .uri       = "/api/state",
+  .method    = HTTP_PATCH,
+  .handler   = state_put_handler,
+  .user_ctx  = NULL
+};
+
+static const httpd_uri_t batch_post = {
+  .uri       = "/api/batch",
+  .method    = HTTP_POST,
+  .handler   = batch_post_handler,
+  .user_ctx  = NULL
+};
+
+void api_register(httpd_handle_t server, const persistent_state_t * state)
+{
+  g_state = state;
+  httpd_register_uri_handler(server, &state_get);
+  httpd_register_uri_handler(server, &state_put);
+  httpd_register_uri_handler(server, &state_patch);
+  httpd_register_uri_handler(server, &batch_post);
+}
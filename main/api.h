@@ -0,0 +1,30 @@
+#pragma once
+#include <esp_http_server.h>
+#include "storage.h"
+#include "patch.h"
+
+/*
+ * JSON REST API:
+ *   GET /api/state         current state
+ *   PUT/PATCH /api/state   change some of the state, e.g. {"hsv":{"v":128}}
+ *   POST /api/batch        array of changes applied together in one render tick
+ *
+ * A state document looks like:
+ *   {"rgb":{"r":255,"g":30,"b":0},"hsv":{"h":5,"s":255,"v":255},
+ *    "cal":{"matrix":[4096,0,0,0,2048,0,0,0,2848],"offset":[0,0,0]},
+ *    "mode":"value","transition_ms":0,"on":true,"audio":"off"}
+ * PUT must set a color (rgb or hsv), PATCH accepts any subset; calibration
+ * numbers are in 1/4096 (see calib.h) and its arrays are set whole.
+ * {"scene":n} plays a stored scene. Setting a color turns the light on
+ * unless "on" is set too. "audio" is one of "off", "value", "hue" or "scene"
+ * (see audio.h).
+ */
+#define API_STATE_MAX (384)
+
+void api_register(httpd_handle_t server, const persistent_state_t * state);
+
+// The state document of GET /api/state, returns its length as snprintf
+int api_state_json(const persistent_state_t * state, char * out, size_t size);
+
+// Parse one patch document as accepted by PATCH /api/state
+bool api_parse_patch(const char * json, size_t len, state_patch_t * out);
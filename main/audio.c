@@ -0,0 +1,196 @@
+#include "audio.h"
+#include "rtos.h"
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/i2s.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#ifdef CONFIG_AUDIO_ENABLE
+
+static const char *TAG = "audio";
+
+#define SAMPLE_RATE (CONFIG_AUDIO_SAMPLE_RATE)
+#define BUDGET_US (CONFIG_AUDIO_BUDGET_US)
+#define I2S_PORT (I2S_NUM_0) // The built-in ADC only works on port 0
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static audio_features_t g_features;
+static int g_beats = 0;       // Since the last take
+static bool g_analyzed = false;  // A first block was analyzed
+static bool g_ready = false;     // A block was analyzed and not taken yet
+static QueueHandle_t g_wakeup = NULL;
+static audio_stats_t g_stats;
+static audio_dsp_t g_dsp;     // 2.5 KB of tables and buffers
+RTOS_TASK_DEFINE(g_task, "audio", CONFIG_AUDIO_STACK);
+
+#ifdef CONFIG_AUDIO_SOURCE_I2S
+typedef int32_t word_t;
+#define SWAP (0)
+
+// The microphone sends 24 bits in the top of 32 bit words
+static int16_t to_sample(int32_t w)
+{
+  return w >> 16;
+}
+
+static esp_err_t source_init(void)
+{
+  i2s_config_t config = {
+    .mode = I2S_MODE_MASTER | I2S_MODE_RX,
+    .sample_rate = SAMPLE_RATE,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
+    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+    .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+    .dma_buf_count = 4,
+    .dma_buf_len = AUDIO_BLOCK,
+  };
+  i2s_pin_config_t pins = {
+    .bck_io_num = CONFIG_AUDIO_I2S_BCK_GPIO,
+    .ws_io_num = CONFIG_AUDIO_I2S_WS_GPIO,
+    .data_out_num = I2S_PIN_NO_CHANGE,
+    .data_in_num = CONFIG_AUDIO_I2S_DATA_GPIO,
+  };
+  esp_err_t err = i2s_driver_install(I2S_PORT, &config, 0, NULL);
+  if(err != ESP_OK) return err;
+  return i2s_set_pin(I2S_PORT, &pins);
+}
+#else
+typedef uint16_t word_t;
+#define SWAP (1) // The DMA stores 16 bit words in swapped pairs
+
+// 12 bits of ADC1 with the channel number on top
+static int16_t to_sample(uint16_t w)
+{
+  return ((int)(w & 0xfff) - 2048) << 4;
+}
+
+static esp_err_t source_init(void)
+{
+  i2s_config_t config = {
+    .mode = I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN,
+    .sample_rate = SAMPLE_RATE,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+    .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+    .dma_buf_count = 4,
+    .dma_buf_len = AUDIO_BLOCK,
+  };
+  esp_err_t err = i2s_driver_install(I2S_PORT, &config, 0, NULL);
+  if(err != ESP_OK) return err;
+  err = i2s_set_adc_mode(ADC_UNIT_1, CONFIG_AUDIO_ADC_CHANNEL);
+  if(err != ESP_OK) return err;
+  return i2s_adc_enable(I2S_PORT);
+}
+#endif
+
+static void audio_task(void * arg)
+{
+  static word_t words[AUDIO_BLOCK];
+  static int16_t samples[AUDIO_BLOCK];
+  bool skip = false;
+  while(1){
+    size_t read = 0;
+    if(i2s_read(I2S_PORT, words, sizeof(words), &read, portMAX_DELAY) != ESP_OK ||
+       read != sizeof(words)){
+      continue;
+    }
+    if(skip){
+      // Keeps the DMA drained, the time goes back to the other tasks
+      skip = false;
+      g_stats.skipped++;
+      continue;
+    }
+    int64_t start = esp_timer_get_time();
+    for(int i = 0; i < AUDIO_BLOCK; ++i){
+      samples[i] = to_sample(words[i ^ SWAP]);
+    }
+    audio_features_t features;
+    audio_dsp_block(&g_dsp, samples, &features);
+
+    portENTER_CRITICAL(&g_lock);
+    g_features = features;
+    g_beats += features.beat;
+    g_analyzed = true;
+    bool wake = !g_ready;
+    g_ready = true;
+    portEXIT_CRITICAL(&g_lock);
+    if(wake){
+      audio_event_t ev = {AUDIO_EVID, 0};
+      xQueueOverwrite(g_wakeup, &ev);
+    }
+
+    uint32_t us = esp_timer_get_time() - start;
+    g_stats.blocks++;
+    g_stats.last_us = us;
+    if(us > g_stats.max_us) g_stats.max_us = us;
+    skip = us > BUDGET_US;
+  }
+}
+
+esp_err_t audio_init(QueueHandle_t wakeup)
+{
+  g_wakeup = wakeup;
+  audio_dsp_init(&g_dsp, SAMPLE_RATE);
+  esp_err_t err = source_init();
+  if(err != ESP_OK){
+    ESP_LOGE(TAG, "No audio input: %s", esp_err_to_name(err));
+    return err;
+  }
+  // Below the input tasks, on the core WiFi does not use
+  if(!rtos_task_start(&g_task, audio_task, NULL, 3, CONFIG_AUDIO_CORE)){
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_LOGI(TAG, "%d Hz, blocks of %d samples on core %d", SAMPLE_RATE, AUDIO_BLOCK,
+	   CONFIG_AUDIO_CORE);
+  return ESP_OK;
+}
+
+bool audio_ready(void)
+{
+  return g_ready;
+}
+
+bool audio_take(audio_features_t * features, int * beats)
+{
+  portENTER_CRITICAL(&g_lock);
+  bool ready = g_analyzed;
+  *features = g_features;
+  *beats = g_beats;
+  g_beats = 0;
+  g_ready = false;
+  portEXIT_CRITICAL(&g_lock);
+  return ready;
+}
+
+void audio_get_stats(audio_stats_t * stats)
+{
+  *stats = g_stats;
+}
+
+rgb_t audio_apply(int map, rgb_t color, const audio_features_t * features)
+{
+  switch(map){
+  case AUDIO_VALUE: {
+    // A quarter of the brightness is left in the quiet parts
+    uint32_t gain = 0x4000 + ((features->level * 0xc000u) >> 16);
+    color.r = (color.r * gain) >> 16;
+    color.g = (color.g * gain) >> 16;
+    color.b = (color.b * gain) >> 16;
+    return color;
+  }
+  case AUDIO_HUE: {
+    hsv16_t hsv = rgb16_to_hsv16(rgb_8_to_16(color));
+    hsv.h += features->balance - 0x8000; // Wraps around the circle
+    return rgb_16_to_8(hsv16_to_rgb16(hsv));
+  }
+  default:
+    return color;
+  }
+}
+
+#endif // CONFIG_AUDIO_ENABLE
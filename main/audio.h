@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "color.h"
+#include "state.h"
+#include "audio_dsp.h"
+
+/*
+ * Audio-reactive modes, set with "audio" in the state API (enum audio_map):
+ *   value   the brightness follows the loudness
+ *   hue     the hue turns with the spectral balance, bass one way and
+ *           treble the other
+ *   scene   the saved scenes change on the beats, every
+ *           CONFIG_AUDIO_SCENE_BEATS beats
+ *
+ * A task pinned to CONFIG_AUDIO_CORE, away from WiFi and the main task,
+ * reads blocks of AUDIO_BLOCK samples from I2S (a MEMS microphone, or ADC1
+ * through the I2S DMA) and analyzes them (audio_dsp.h). A block that takes
+ * longer than CONFIG_AUDIO_BUDGET_US makes the task skip the next one, so
+ * the analysis cannot take more of the core than that.
+ *
+ * The main loop takes the latest analysis at each render. The first block
+ * after a take wakes it (with an AUDIO_EVID event), so it renders every tick
+ * while a mode is on and the blocks keep coming, and stops when they stop.
+ * Traces (trace.h) record the colors before the audio is applied.
+ */
+
+static const uint32_t AUDIO_EVID = 0xA0D10B10;
+
+typedef struct {
+  uint32_t id0;
+  uint32_t id1;
+} audio_event_t;
+
+typedef struct {
+  uint32_t blocks;     // Analyzed
+  uint32_t skipped;    // After a block over the budget
+  uint32_t last_us;    // Time of the last block
+  uint32_t max_us;
+} audio_stats_t;
+
+#ifdef CONFIG_AUDIO_ENABLE
+// Without an input the error is logged and audio stays off (audio_ready
+// never becomes true), the caller can go on
+esp_err_t audio_init(QueueHandle_t wakeup);
+
+// True if a block was analyzed since the last take
+bool audio_ready(void);
+
+// The latest analysis, and the beats since the last take. False until the
+// first block is analyzed.
+bool audio_take(audio_features_t * features, int * beats);
+
+void audio_get_stats(audio_stats_t * stats);
+
+// 'color' as shown in the mode 'map'
+rgb_t audio_apply(int map, rgb_t color, const audio_features_t * features);
+#else
+static inline esp_err_t audio_init(QueueHandle_t wakeup) { return ESP_OK; }
+static inline bool audio_ready(void) { return false; }
+static inline bool audio_take(audio_features_t * features, int * beats) { return false; }
+static inline rgb_t audio_apply(int map, rgb_t color, const audio_features_t * features)
+{
+  return color;
+}
+#endif
@@ -0,0 +1,197 @@
+#include "audio_dsp.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ONSET_MIN (128)      // Rise in the bass that can be a beat, 1.5 dB
+#define ONSET_DEVS (2)       // Above the mean flux by this many deviations
+#define BPM_MIN (50)
+#define BPM_MAX (200)
+#define LEVEL_RANGE_MIN (512) // 6 dB, the level of silence does not jump around
+#define TEMPO_MISSES (4)      // Intervals off the tempo before it is found again
+
+static int32_t clamp(int32_t x, int32_t lo, int32_t hi)
+{
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+uint16_t audio_log2_q8(uint64_t x)
+{
+  if(x == 0) return 0;
+  int b = 63 - __builtin_clzll(x);
+  // The bits below the leading one are the fraction, which is close enough
+  // to the mantissa of the logarithm for levels
+  uint32_t frac = b >= 8 ? (x >> (b - 8)) & 0xff : (x << (8 - b)) & 0xff;
+  return b * 256 + frac;
+}
+
+void audio_dsp_init(audio_dsp_t * dsp, uint32_t sample_rate)
+{
+  memset(dsp, 0, sizeof(*dsp));
+  const int n = AUDIO_BLOCK;
+  for(int i = 0; i < n; ++i){
+    dsp->window[i] = lroundf(32767.0f * 0.5f * (1.0f - cosf(2.0f * (float)M_PI * i / n)));
+    int r = 0;
+    for(int b = 0; b < AUDIO_FFT_BITS; ++b){
+      r |= ((i >> b) & 1) << (AUDIO_FFT_BITS - 1 - b);
+    }
+    dsp->reverse[i] = r;
+  }
+  for(int k = 0; k < n / 2; ++k){
+    dsp->cos[k] = lroundf(32767.0f * cosf(2.0f * (float)M_PI * k / n));
+    dsp->sin[k] = lroundf(32767.0f * sinf(2.0f * (float)M_PI * k / n));
+  }
+  // Log spaced from bin 1 (DC is left out) to n / 2, at least a bin each
+  dsp->edges[0] = 1;
+  for(int b = 1; b <= AUDIO_BANDS; ++b){
+    int edge = lroundf(powf(n / 2, (float)b / AUDIO_BANDS));
+    if(edge <= dsp->edges[b - 1]) edge = dsp->edges[b - 1] + 1;
+    dsp->edges[b] = edge;
+  }
+  dsp->edges[AUDIO_BANDS] = n / 2;
+  dsp->block_ms_q8 = ((uint64_t)n * 1000 * 256) / sample_rate;
+}
+
+// In place, the output is the transform / AUDIO_BLOCK
+static void fft(audio_dsp_t * dsp)
+{
+  audio_complex_t * x = dsp->x;
+  for(int i = 0; i < AUDIO_BLOCK; ++i){
+    int j = dsp->reverse[i];
+    if(j > i){
+      audio_complex_t t = x[i];
+      x[i] = x[j];
+      x[j] = t;
+    }
+  }
+  for(int half = 1, step = AUDIO_BLOCK / 2; half < AUDIO_BLOCK; half <<= 1, step >>= 1){
+    for(int i = 0; i < AUDIO_BLOCK; i += 2 * half){
+      for(int j = 0; j < half; ++j){
+	int32_t wr = dsp->cos[j * step];
+	int32_t wi = -dsp->sin[j * step];
+	audio_complex_t * a = &x[i + j];
+	audio_complex_t * b = &x[i + j + half];
+	int32_t tr = (b->re * wr - b->im * wi) >> 15;
+	int32_t ti = (b->re * wi + b->im * wr) >> 15;
+	int32_t ar = a->re, ai = a->im;
+	a->re = (ar + tr) >> 1;
+	a->im = (ai + ti) >> 1;
+	b->re = (ar - tr) >> 1;
+	b->im = (ai - ti) >> 1;
+      }
+    }
+  }
+}
+
+static void beat(audio_dsp_t * dsp, int32_t total, audio_features_t * out)
+{
+  int32_t flux = 0;
+  for(int b = 0; b < AUDIO_BEAT_BANDS; ++b){
+    int32_t rise = (int32_t)out->bands[b] - dsp->last[b];
+    if(rise > 0) flux += rise;
+  }
+  int32_t threshold = dsp->flux_mean + ONSET_DEVS * dsp->flux_dev + ONSET_MIN;
+  uint32_t min_interval = (60000u * 256 / BPM_MAX) / dsp->block_ms_q8;
+  uint32_t max_interval = (60000u * 256 / BPM_MIN) / dsp->block_ms_q8;
+  dsp->since_beat++;
+
+  out->beat = flux > threshold && dsp->since_beat >= min_interval &&
+    total > dsp->floor + LEVEL_RANGE_MIN;
+  if(out->beat){
+    if(dsp->since_beat <= max_interval){
+      // Off-beats and missed beats leave the tempo alone, until they are
+      // the new tempo
+      int32_t interval = dsp->since_beat << 8;
+      int32_t error = interval - (int32_t)dsp->interval_q8;
+      if(dsp->interval_q8 == 0 || dsp->tempo_misses >= TEMPO_MISSES){
+	dsp->interval_q8 = interval;
+	dsp->tempo_misses = 0;
+      } else if(abs(error) < (int32_t)dsp->interval_q8 / 4){
+	dsp->interval_q8 += error / 4;
+	dsp->tempo_misses = 0;
+      } else {
+	dsp->tempo_misses++;
+      }
+    }
+    dsp->since_beat = 0;
+  } else if(dsp->since_beat > 4 * max_interval){
+    dsp->interval_q8 = 0; // The music stopped
+  }
+  dsp->flux_mean += (flux - dsp->flux_mean) / 16;
+  int32_t dev = flux > dsp->flux_mean ? flux - dsp->flux_mean : dsp->flux_mean - flux;
+  dsp->flux_dev += (dev - dsp->flux_dev) / 16;
+
+  out->bpm = dsp->interval_q8 == 0 ? 0 :
+    ((60000ull << 16) + dsp->interval_q8 * dsp->block_ms_q8 / 2) /
+    ((uint64_t)dsp->interval_q8 * dsp->block_ms_q8);
+}
+
+static void level(audio_dsp_t * dsp, int32_t total, audio_features_t * out)
+{
+  if(dsp->peak == 0){
+    dsp->floor = dsp->peak = total;
+  }
+  // The floor follows drops at once and rises slowly (seconds), the peak
+  // the other way round
+  if(total < dsp->floor) dsp->floor = total;
+  else dsp->floor += (total - dsp->floor) / 512;
+  if(total > dsp->peak) dsp->peak = total;
+  else dsp->peak -= (dsp->peak - total) / 256;
+
+  int32_t range = dsp->peak - dsp->floor;
+  if(range < LEVEL_RANGE_MIN) range = LEVEL_RANGE_MIN;
+  uint32_t now = clamp((total - dsp->floor) * 65535 / range, 0, 0xffff);
+  // Fast attack, slower release
+  if(now > dsp->level) dsp->level = now;
+  else dsp->level -= (dsp->level - now) / 4;
+  out->level = dsp->level;
+}
+
+static void balance(audio_features_t * out)
+{
+  uint16_t lowest = out->bands[0];
+  for(int b = 1; b < AUDIO_BANDS; ++b){
+    if(out->bands[b] < lowest) lowest = out->bands[b];
+  }
+  // Centroid of the bands on a log scale: pink noise is in the middle
+  uint32_t sum = 0, moment = 0;
+  for(int b = 0; b < AUDIO_BANDS; ++b){
+    uint32_t w = out->bands[b] - lowest;
+    sum += w;
+    moment += w * b;
+  }
+  out->balance = sum == 0 ? 0x8000 : (uint64_t)moment * 0xffff / (sum * (AUDIO_BANDS - 1));
+}
+
+void audio_dsp_block(audio_dsp_t * dsp, const int16_t * samples, audio_features_t * out)
+{
+  int32_t mean = 0;
+  for(int i = 0; i < AUDIO_BLOCK; ++i){
+    mean += samples[i];
+  }
+  mean /= AUDIO_BLOCK;
+  for(int i = 0; i < AUDIO_BLOCK; ++i){
+    int32_t s = clamp(samples[i] - mean, INT16_MIN, INT16_MAX);
+    dsp->x[i].re = (s * dsp->window[i]) >> 15;
+    dsp->x[i].im = 0;
+  }
+  fft(dsp);
+
+  uint64_t all = 0;
+  for(int b = 0; b < AUDIO_BANDS; ++b){
+    uint64_t energy = 0;
+    for(int k = dsp->edges[b]; k < dsp->edges[b + 1]; ++k){
+      int32_t re = dsp->x[k].re, im = dsp->x[k].im;
+      energy += (uint32_t)(re * re) + (uint32_t)(im * im);
+    }
+    all += energy;
+    out->bands[b] = audio_log2_q8(energy);
+  }
+  int32_t total = audio_log2_q8(all);
+
+  level(dsp, total, out);
+  beat(dsp, total, out);
+  balance(out);
+  memcpy(dsp->last, out->bands, sizeof(dsp->last));
+}
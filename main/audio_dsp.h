@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Music analysis for the audio-reactive modes, one block of samples at a
+ * time:
+ *
+ *   DC removal, Hann window, 256 point fixed-point FFT (Q15, scaled by 1/2
+ *   at each stage so it cannot overflow), band energies on a log scale,
+ *   loudness relative to the recent range, spectral balance, and beats as
+ *   onsets in the bass (spectral flux over an adaptive threshold).
+ *
+ * The work per block is fixed: no allocation, no floating point and no
+ * branches that depend on the signal beyond the beat decision. Tables are
+ * built once by audio_dsp_init.
+ */
+
+#define AUDIO_FFT_BITS (8)
+#define AUDIO_BLOCK (1 << AUDIO_FFT_BITS) // Samples per block
+#define AUDIO_BANDS (8)                   // Log spaced from the first bin to Nyquist
+#define AUDIO_BEAT_BANDS (3)              // The bands beats are detected in
+
+typedef struct {
+  uint16_t level;               // Loudness, 0 (quietest recently) to 0xffff (loudest)
+  uint16_t balance;             // Spectral balance, 0 all bass to 0xffff all treble
+  uint16_t bands[AUDIO_BANDS];  // log2 of the band energies, Q8
+  uint16_t bpm;                 // Tempo from the beats, 0 until known
+  bool beat;                    // A beat starts in this block
+} audio_features_t;
+
+typedef struct {
+  int16_t re;
+  int16_t im;
+} audio_complex_t;
+
+typedef struct {
+  // Tables
+  int16_t window[AUDIO_BLOCK];
+  int16_t cos[AUDIO_BLOCK / 2];
+  int16_t sin[AUDIO_BLOCK / 2];
+  uint8_t reverse[AUDIO_BLOCK];
+  uint8_t edges[AUDIO_BANDS + 1]; // First bin of each band
+  uint32_t block_ms_q8;           // Length of a block
+  // Work buffer
+  audio_complex_t x[AUDIO_BLOCK];
+  // Running values, log2 Q8 unless noted
+  uint16_t last[AUDIO_BANDS];
+  int32_t floor;
+  int32_t peak;
+  uint32_t level;                 // Smoothed, 0..0xffff
+  int32_t flux_mean;
+  int32_t flux_dev;
+  uint32_t since_beat;            // Blocks
+  uint32_t interval_q8;           // Blocks between beats, 0 until known
+  uint32_t tempo_misses;          // Beats in a row off the tempo
+} audio_dsp_t;
+
+void audio_dsp_init(audio_dsp_t * dsp, uint32_t sample_rate);
+
+// Analyzes AUDIO_BLOCK samples
+void audio_dsp_block(audio_dsp_t * dsp, const int16_t * samples, audio_features_t * out);
+
+// log2(x) in Q8, 0 for 0
+uint16_t audio_log2_q8(uint64_t x);
@@ -1,35 +1,129 @@
 #include "button.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
+#include "power.h"
+#include "rtos.h"
 
 #define TAG "button"
 
 #define EVENT_QUEUE_LENGTH 1
+#define EDGE_QUEUE_LENGTH 8
+
+static const gesture_timing_t _timing = {
+  .lockout_us = CONFIG_BUTTON_DEBOUNCE_MS * 1000LL,
+  .min_press_us = 30 * 1000LL,
+  .double_us = CONFIG_BUTTON_DOUBLE_CLICK_MS * 1000LL,
+  .long_us = CONFIG_BUTTON_LONG_PRESS_MS * 1000LL,
+  .repeat_us = CONFIG_BUTTON_REPEAT_MS * 1000LL,
+};
+
+typedef struct {
+  int64_t time;
+  bool pressed;
+} button_edge_t;
+
+// One button, g_events is the main queue of leds.c
+RTOS_TASK_DEFINE(g_task, "button", CONFIG_BUTTON_STACK);
+RTOS_QUEUE_DEFINE(g_edges, button_edge_t, EDGE_QUEUE_LENGTH);
+RTOS_QUEUE_DEFINE(g_events, button_event_t, EVENT_QUEUE_LENGTH);
+
+// The button pulls the pin low
+static inline bool button_pressed(button_info_t * info)
+{
+  return gpio_get_level(info->pin) == 0;
+}
 
 static void _isr_button(void * args)
 {
   button_info_t * info = (button_info_t *)args;
-  button_event_t queue_event = {BUTTON_EVID,BUTTON_EVID};
+  button_edge_t edge = {esp_timer_get_time(), button_pressed(info)};
+  portENTER_CRITICAL_ISR(&info->lock);
+  bool accepted = gesture_filter_edge(&info->filter, &_timing, edge.time, edge.pressed);
+  portEXIT_CRITICAL_ISR(&info->lock);
+  if (!accepted){
+    return; // Bounce, nobody is woken up
+  }
   BaseType_t task_woken = pdFALSE;
-  xQueueOverwriteFromISR(info->queue, &queue_event, &task_woken);
+  xQueueSendFromISR(info->edges, &edge, &task_woken);
   if (task_woken){
     portYIELD_FROM_ISR();
   }
 }
 
+static void button_deliver(void * arg, gesture_t gesture, int64_t now_us)
+{
+  button_info_t * info = arg;
+  ESP_LOGD(TAG, "%s", gesture_name(gesture));
+  portENTER_CRITICAL(&info->lock);
+  if (info->count < BUTTON_GESTURES){
+    info->gestures[(info->first + info->count++) % BUTTON_GESTURES] = gesture;
+  }
+  portEXIT_CRITICAL(&info->lock);
+  if (info->queue){
+    button_event_t queue_event = {BUTTON_EVID, gesture};
+    xQueueOverwrite(info->queue, &queue_event);
+  }
+}
+
+static bool button_sample(void * arg, int64_t now_us, bool * pressed)
+{
+  button_info_t * info = arg;
+  *pressed = button_pressed(info);
+  portENTER_CRITICAL(&info->lock);
+  bool accepted = gesture_filter_edge(&info->filter, &_timing, now_us, *pressed);
+  portEXIT_CRITICAL(&info->lock);
+  return accepted;
+}
+
+static void button_task(void * arg)
+{
+  button_info_t * info = arg;
+  const gesture_io_t io = {button_deliver, button_sample, info};
+  gesture_loop_t loop;
+  gesture_loop_init(&loop, &_timing, &io);
+
+  while (1){
+    int64_t deadline = gesture_loop_deadline(&loop);
+    TickType_t wait = portMAX_DELAY;
+    if (deadline != GESTURE_NO_DEADLINE){
+      int64_t left = deadline - esp_timer_get_time();
+      wait = left <= 0 ? 0 : pdMS_TO_TICKS((left + 999) / 1000) + 1;
+    }
+    button_edge_t edge;
+    if (xQueueReceive(info->edges, &edge, wait) == pdTRUE){
+      power_activity();
+      gesture_loop_edge(&loop, edge.time, edge.pressed);
+    } else {
+      gesture_loop_wake(&loop, esp_timer_get_time());
+    }
+  }
+}
+
 esp_err_t button_init(button_info_t * info, gpio_num_t pin)
 {
   esp_err_t err = ESP_OK;
   if (info){
     info->pin = pin;
-    
+    info->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    info->first = info->count = 0;
+
     // configure GPIOs
     gpio_pad_select_gpio(info->pin);
-    gpio_set_pull_mode(info->pin, GPIO_FLOATING);
+    gpio_set_pull_mode(info->pin, GPIO_PULLUP_ONLY);
     gpio_set_direction(info->pin, GPIO_MODE_INPUT);
-    gpio_set_intr_type(info->pin, GPIO_INTR_NEGEDGE);
-    
+    gpio_set_intr_type(info->pin, GPIO_INTR_ANYEDGE);
+    info->filter.pressed = button_pressed(info);
+    info->filter.last_us = esp_timer_get_time();
+
+    info->edges = rtos_queue_create(&g_edges);
+    if (!info->edges ||
+	!(info->task = rtos_task_start(&g_task, button_task, info, 5, tskNO_AFFINITY))){
+      ESP_LOGE(TAG, "No memory for the button");
+      return ESP_ERR_NO_MEM;
+    }
+
     // install interrupt handlers
     gpio_isr_handler_add(info->pin, _isr_button, info);
   } else {
@@ -44,6 +138,9 @@ esp_err_t button_uninit(button_info_t * info)
   esp_err_t err = ESP_OK;
   if (info){
     gpio_isr_handler_remove(info->pin);
+    rtos_task_delete(&g_task);
+    info->task = NULL;
+    vQueueDelete(info->edges);
   }else{
     ESP_LOGE(TAG, "info is NULL");
     err = ESP_ERR_INVALID_ARG;
@@ -53,7 +150,7 @@ esp_err_t button_uninit(button_info_t * info)
 
 QueueHandle_t button_create_queue(void)
 {
-  return xQueueCreate(EVENT_QUEUE_LENGTH, sizeof(button_event_t));
+  return rtos_queue_create(&g_events);
 }
 
 esp_err_t button_set_queue(button_info_t * info, QueueHandle_t queue)
@@ -68,3 +165,27 @@ esp_err_t button_set_queue(button_info_t * info, QueueHandle_t queue)
   return err;
 }
 
+void button_check(void * arg)
+{
+  button_info_t * info = arg;
+  button_edge_t edge = {esp_timer_get_time(), button_pressed(info)};
+  portENTER_CRITICAL(&info->lock);
+  bool accepted = gesture_filter_edge(&info->filter, &_timing, edge.time, edge.pressed);
+  portEXIT_CRITICAL(&info->lock);
+  if (accepted){
+    xQueueSend(info->edges, &edge, 0);
+  }
+}
+
+gesture_t button_take(button_info_t * info)
+{
+  gesture_t gesture = GESTURE_NONE;
+  portENTER_CRITICAL(&info->lock);
+  if (info->count > 0){
+    gesture = info->gestures[info->first];
+    info->first = (info->first + 1) % BUTTON_GESTURES;
+    info->count--;
+  }
+  portEXIT_CRITICAL(&info->lock);
+  return gesture;
+}
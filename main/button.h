@@ -2,12 +2,31 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/task.h"
 #include <driver/rtc_io.h>
+#include "gesture.h"
 
+/*
+ * Push button with gestures.
+ *
+ * The ISR filters bounce (see gesture.h) and passes the real transitions to
+ * a task that recognizes the gestures. Recognized gestures wait in the
+ * button until taken with button_take; the queue set with button_set_queue
+ * gets a BUTTON_EVID event when one is ready.
+ */
+
+#define BUTTON_GESTURES (4)
 
 typedef struct {
   gpio_num_t pin;
   QueueHandle_t queue;
+  QueueHandle_t edges;      // Accepted edges, ISR -> task
+  TaskHandle_t task;
+  portMUX_TYPE lock;
+  gesture_filter_t filter;
+  gesture_t gestures[BUTTON_GESTURES]; // Recognized, not taken yet
+  uint8_t first;
+  uint8_t count;
 } button_info_t;
 
 typedef struct {
@@ -21,3 +40,9 @@ esp_err_t button_init(button_info_t * info, gpio_num_t pin);
 esp_err_t button_uninit(button_info_t * info);
 QueueHandle_t button_create_queue(void);
 esp_err_t button_set_queue(button_info_t * info, QueueHandle_t queue);
+
+// Take the oldest recognized gesture, GESTURE_NONE if there is none
+gesture_t button_take(button_info_t * info);
+
+// Check the level now, for an edge the interrupt missed in light sleep
+void button_check(void * info);
@@ -0,0 +1,27 @@
+#include "calib.h"
+
+#include <math.h>
+
+int16_t calib_from_scale(int32_t scale, float gamma)
+{
+  if(scale < -128) scale = -128;
+  float x = powf((scale + 128) / 256.0f, gamma) * RGB_CAL_ONE;
+  return x < INT16_MAX ? lroundf(x) : INT16_MAX;
+}
+
+void calib_fold(calib_lut_t * lut, const rgb_calibration_t * cal, float gamma, int32_t duty_max)
+{
+  lut->duty_max = duty_max;
+  for(int v = 0; v < 256; ++v){
+    int32_t lin = lroundf(powf(v / 255.0f, gamma) * duty_max);
+    for(int o = 0; o < 3; ++o){
+      for(int i = 0; i < 3; ++i){
+	// |matrix| and |offset| <= 8 * RGB_CAL_ONE, each adds at most 8 * duty_max
+	// and duty_max < 2048, so this fits in int16
+	int32_t x = (cal->matrix[o][i] * lin + RGB_CAL_ONE / 2) >> 12;
+	if(i == 0) x += cal->offset[o] * duty_max / RGB_CAL_ONE;
+	lut->lut[o][i][v] = x;
+      }
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include "color.h"
+
+/*
+ * Color calibration of the output stage.
+ *
+ * Gamma and the calibration matrix are folded into one table per matrix
+ * entry: lut[o][i][v] is what input channel i at value v adds to the duty of
+ * output channel o (the offsets are folded into i = 0). A color then costs
+ * nine lookups, six additions and a branch-free clamp.
+ */
+
+#define RGB_CAL_ONE (4096) // 1.0 in the calibration
+
+typedef struct
+{
+  // In linear light (after gamma), out of full scale:
+  //   out[o] = (sum_i matrix[o][i] * in[i] + offset[o]) / RGB_CAL_ONE
+  // with in and out as fractions of full scale. The diagonal sets the white
+  // point, the rest removes cross-talk between the channels.
+  int16_t matrix[3][3];
+  int16_t offset[3];
+} rgb_calibration_t;
+
+typedef struct
+{
+  int16_t lut[3][3][256];
+  int32_t duty_max;
+} calib_lut_t;
+
+// The channel scales of the older firmware, (scale + 128) / 256 of the
+// color value, as a diagonal entry of the matrix: the same output through
+// the given gamma
+int16_t calib_from_scale(int32_t scale, float gamma);
+
+// Duties go from 0 to duty_max, which must be below 2048: with any int16
+// matrix and offsets the tables then hold their sums
+void calib_fold(calib_lut_t * lut, const rgb_calibration_t * cal, float gamma, int32_t duty_max);
+
+static inline uint32_t calib_clamp(int32_t x, int32_t max)
+{
+  x &= ~(x >> 31);                // Negative -> 0
+  int32_t over = (max - x) >> 31; // All ones above max
+  return (x & ~over) | (max & over);
+}
+
+// Duty of output channel o for the color 'in'
+static inline uint32_t calib_duty(const calib_lut_t * lut, int o, rgb_t in)
+{
+  return calib_clamp(lut->lut[o][0][in.r] + lut->lut[o][1][in.g] + lut->lut[o][2][in.b],
+		     lut->duty_max);
+}
@@ -0,0 +1,107 @@
+#include "clock_sync.h"
+
+#include <string.h>
+
+// Shortest time the drift is measured over: between two samples a quarter
+// of a second apart, the jitter of the round trips is all the slope shows
+#define DRIFT_MIN_US (4 * 1000 * 1000LL)
+
+int64_t clock_model_offset(const clock_model_t * m, int64_t local)
+{
+  return m->base_offset + (local - m->base_local) * m->drift_ppb / 1000000000LL;
+}
+
+/*
+ * Fold a measured offset into the model: the offset error is corrected by
+ * half at every step and the drift follows the slope of the error, which
+ * converges without overshooting on the jitter of a WiFi link.
+ */
+static void model_update(clock_model_t * m, int64_t local, int64_t measured)
+{
+  int64_t predicted = clock_model_offset(m, local);
+  int64_t error = measured - predicted;
+  int64_t elapsed = local - m->base_local;
+  if(elapsed > 0 && m->base_local != 0){
+    if(elapsed < DRIFT_MIN_US) elapsed = DRIFT_MIN_US;
+    int64_t drift = m->drift_ppb + error * 1000000000LL / elapsed / 4;
+    // A crystal is good to ~100 ppm, anything above is noise
+    if(drift > 200000) drift = 200000;
+    if(drift < -200000) drift = -200000;
+    m->drift_ppb = drift;
+  }
+  m->base_offset = m->base_local == 0 ? measured : predicted + error / 2;
+  m->base_local = local;
+}
+
+static void set_leader(clock_sync_t * cs, uint64_t node, int64_t now)
+{
+  if(node != cs->leader){
+    cs->leader = node;
+    cs->nsamples = 0;
+    cs->good = 0;
+    cs->locked = node == cs->self;
+  }
+  cs->leader_seen = now;
+}
+
+void clock_sync_init(clock_sync_t * cs, uint64_t self, int64_t now)
+{
+  memset(cs, 0, sizeof(*cs));
+  cs->self = self;
+  cs->leader = self;
+  cs->locked = true;
+  cs->leader_seen = now;
+}
+
+bool clock_sync_announce(clock_sync_t * cs, uint64_t node, int64_t now)
+{
+  // The lowest id wins. The leader is never above this node, which takes
+  // over when the leader stops announcing.
+  if(node == cs->self || node > cs->leader) return false;
+  set_leader(cs, node, now);
+  return true;
+}
+
+bool clock_sync_check(clock_sync_t * cs, int64_t now)
+{
+  if(clock_sync_leading(cs) || now - cs->leader_seen <= CLOCK_SYNC_PEER_TIMEOUT_US){
+    return false;
+  }
+  set_leader(cs, cs->self, now); // Nobody with a lower id left
+  return true;
+}
+
+clock_sample_result_t clock_sync_sample(clock_sync_t * cs, int64_t t1, int64_t t2,
+					int64_t t3, int64_t t4)
+{
+  clock_sample_t s;
+  s.offset = ((t2 - t1) + (t3 - t4)) / 2;
+  s.delay = (t4 - t1) - (t3 - t2);
+  s.local = t4;
+  if(s.delay < 0 || s.delay > CLOCK_SYNC_MAX_DELAY_US) return CLOCK_SAMPLE_DROPPED;
+
+  cs->samples[cs->nsamples % CLOCK_SYNC_SAMPLES] = s;
+  cs->nsamples++;
+  // Clock filter: the shortest round trip has the least queuing error
+  int n = cs->nsamples < CLOCK_SYNC_SAMPLES ? cs->nsamples : CLOCK_SYNC_SAMPLES;
+  const clock_sample_t * best = &cs->samples[0];
+  for(int i = 1; i < n; ++i){
+    if(cs->samples[i].delay < best->delay) best = &cs->samples[i];
+  }
+  // Only use new samples
+  if(best != &cs->samples[(cs->nsamples - 1) % CLOCK_SYNC_SAMPLES]) return CLOCK_SAMPLE_KEPT;
+
+  if(cs->good == 0){
+    // First sample from this leader, halving the error from the previous
+    // one would take seconds and pull the drift to its limit
+    cs->model.base_offset = best->offset;
+    cs->model.base_local = best->local;
+  } else {
+    model_update(&cs->model, best->local, best->offset);
+  }
+  if(++cs->good == CLOCK_SYNC_LOCK_SAMPLES){
+    cs->locked = true;
+    return CLOCK_SAMPLE_LOCKED;
+  }
+  return CLOCK_SAMPLE_USED;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Leader election and clock model of the shared time (timesync.h).
+ *
+ * The node with the lowest id is the leader; a follower takes the lead when
+ * it has not heard from a lower id for CLOCK_SYNC_PEER_TIMEOUT_US. Followers
+ * measure their offset to the leader NTP style (four timestamps), keep the
+ * sample with the shortest round trip out of the last CLOCK_SYNC_SAMPLES
+ * and fold it into a model of offset and drift:
+ *   shared = local + base_offset + drift * (local - base_local)
+ * so the shared time stays continuous between measurements, and when the
+ * leader leaves: the node that takes over keeps the time. A follower of a
+ * new leader takes the offset of its first sample as it is, the old
+ * leader may have been seconds away.
+ *
+ * The caller sends and receives the messages (sync_node.c); tools/syncsim.c
+ * runs several nodes on a simulated network, tools/syncnet.c over loopback.
+ */
+
+#define CLOCK_SYNC_ANNOUNCE_US (1000 * 1000LL)      // Announce period
+#define CLOCK_SYNC_PEER_TIMEOUT_US (3500 * 1000LL)  // A peer is gone after this
+#define CLOCK_SYNC_REQUEST_US (250 * 1000LL)        // Sync request period
+#define CLOCK_SYNC_MAX_DELAY_US (20 * 1000LL)       // Round trips above are ignored
+#define CLOCK_SYNC_SAMPLES (8)
+#define CLOCK_SYNC_LOCK_SAMPLES (4)
+
+typedef struct {
+  int64_t base_local;
+  int64_t base_offset;
+  int32_t drift_ppb;
+} clock_model_t;
+
+typedef struct {
+  int64_t offset;
+  int64_t delay;
+  int64_t local;
+} clock_sample_t;
+
+typedef struct {
+  uint64_t self;
+  uint64_t leader;
+  int64_t leader_seen;
+  clock_model_t model;
+  clock_sample_t samples[CLOCK_SYNC_SAMPLES];
+  int nsamples;
+  int good;          // Samples folded into the model since the leader changed
+  bool locked;       // The offset to the leader is known, always on the leader
+} clock_sync_t;
+
+typedef enum {
+  CLOCK_SAMPLE_DROPPED,  // Round trip too long
+  CLOCK_SAMPLE_KEPT,     // Not better than the recent ones
+  CLOCK_SAMPLE_USED,     // Folded into the model
+  CLOCK_SAMPLE_LOCKED,   // Folded, and the node is now locked to the leader
+} clock_sample_result_t;
+
+// Offset of the shared time to the local one at local time 'local'
+int64_t clock_model_offset(const clock_model_t * m, int64_t local);
+
+// The node starts as its own leader
+void clock_sync_init(clock_sync_t * cs, uint64_t self, int64_t now);
+
+// An announce of 'node' received at 'now', returns true if it is the leader
+bool clock_sync_announce(clock_sync_t * cs, uint64_t node, int64_t now);
+
+// Call regularly: this node takes the lead when the leader has been silent,
+// returns true then
+bool clock_sync_check(clock_sync_t * cs, int64_t now);
+
+// A response of the leader: t1 and t4 are the local send and receive times
+// of the request and the response, t2 and t3 the shared receive and send
+// times of the leader. The model changes, readers from other tasks need a
+// lock around it.
+clock_sample_result_t clock_sync_sample(clock_sync_t * cs, int64_t t1, int64_t t2,
+					int64_t t3, int64_t t4);
+
+static inline bool clock_sync_leading(const clock_sync_t * cs)
+{
+  return cs->leader == cs->self;
+}
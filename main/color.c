@@ -0,0 +1,195 @@
+#include "color.h"
+
+rgb_t hsv_to_rgb(hsv_t hsv){
+  rgb_t rgb;
+  unsigned char region, p, q, t;
+  unsigned int h, s, v, remainder;
+  
+  if (hsv.s == 0){
+    rgb.r = hsv.v;
+    rgb.g = hsv.v;
+    rgb.b = hsv.v;
+    return rgb;
+  }
+  
+  // converting to 16 bit to prevent overflow
+  h = hsv.h;
+  s = hsv.s;
+  v = hsv.v;
+
+  region = h / 43;
+  remainder = (h - (region * 43)) * 6; 
+
+  p = (v * (255 - s)) >> 8;
+  q = (v * (255 - ((s * remainder) >> 8))) >> 8;
+  t = (v * (255 - ((s * (255 - remainder)) >> 8))) >> 8;
+  
+  switch (region){
+  case 0:
+    rgb.r = v;
+    rgb.g = t;
+    rgb.b = p;
+    break;
+  case 1:
+    rgb.r = q;
+    rgb.g = v;
+    rgb.b = p;
+    break;
+  case 2:
+    rgb.r = p;
+    rgb.g = v;
+    rgb.b = t;
+    break;
+  case 3:
+    rgb.r = p;
+    rgb.g = q;
+    rgb.b = v;
+    break;
+  case 4:
+    rgb.r = t;
+    rgb.g = p;
+    rgb.b = v;
+    break;
+  default:
+    rgb.r = v;
+    rgb.g = p;
+    rgb.b = q;
+    break;
+  }
+  return rgb;
+}
+
+hsv_t rgb_to_hsv(rgb_t rgb)
+{
+  hsv_t hsv;
+  unsigned char rgbMin, rgbMax;
+  
+  rgbMin = rgb.r < rgb.g ? (rgb.r < rgb.b ? rgb.r : rgb.b) : (rgb.g < rgb.b ? rgb.g : rgb.b);
+  rgbMax = rgb.r > rgb.g ? (rgb.r > rgb.b ? rgb.r : rgb.b) : (rgb.g > rgb.b ? rgb.g : rgb.b);
+  
+  hsv.v = rgbMax;
+  if (hsv.v == 0){
+    hsv.h = 0;
+    hsv.s = 0;
+    return hsv;
+  }
+  
+  hsv.s = 255 * ((long)(rgbMax - rgbMin)) / hsv.v;
+  if (hsv.s == 0){
+    hsv.h = 0;
+    return hsv;
+  }
+  
+  if (rgbMax == rgb.r)
+    hsv.h = 0 + 43 * (rgb.g - rgb.b) / (rgbMax - rgbMin);
+  else if (rgbMax == rgb.g)
+    hsv.h = 85 + 43 * (rgb.b - rgb.r) / (rgbMax - rgbMin);
+  else
+    hsv.h = 171 + 43 * (rgb.r - rgb.g) / (rgbMax - rgbMin);
+  
+  return hsv;
+}
+
+// round(a * b / 65535), exact for 16 bit operands
+static inline uint16_t mul16(uint32_t a, uint32_t b)
+{
+  uint32_t x = a * b + 32768;
+  return (x + (x >> 16)) >> 16;
+}
+
+rgb16_t hsv16_to_rgb16(hsv16_t hsv)
+{
+  rgb16_t rgb;
+  uint16_t v = hsv.v;
+  if (hsv.s == 0){
+    rgb.r = rgb.g = rgb.b = v;
+    return rgb;
+  }
+
+  // Six regions of the hue circle, 'f' is the position in the region
+  uint32_t h6 = (uint32_t)hsv.h * 6;
+  unsigned int region = h6 >> 16;
+  uint32_t f = h6 & 0xffff;
+
+  uint16_t p = mul16(v, 65535 - hsv.s);
+  uint16_t q = mul16(v, 65535 - mul16(hsv.s, f));
+  uint16_t t = mul16(v, 65535 - mul16(hsv.s, 65535 - f));
+
+  switch (region){
+  case 0: rgb.r = v; rgb.g = t; rgb.b = p; break;
+  case 1: rgb.r = q; rgb.g = v; rgb.b = p; break;
+  case 2: rgb.r = p; rgb.g = v; rgb.b = t; break;
+  case 3: rgb.r = p; rgb.g = q; rgb.b = v; break;
+  case 4: rgb.r = t; rgb.g = p; rgb.b = v; break;
+  default: rgb.r = v; rgb.g = p; rgb.b = q; break;
+  }
+  return rgb;
+}
+
+hsv16_t rgb16_to_hsv16(rgb16_t rgb)
+{
+  hsv16_t hsv;
+  uint16_t max = rgb.r > rgb.g ? (rgb.r > rgb.b ? rgb.r : rgb.b) : (rgb.g > rgb.b ? rgb.g : rgb.b);
+  uint16_t min = rgb.r < rgb.g ? (rgb.r < rgb.b ? rgb.r : rgb.b) : (rgb.g < rgb.b ? rgb.g : rgb.b);
+  uint32_t delta = max - min;
+
+  hsv.v = max;
+  if (delta == 0){
+    hsv.h = 0;
+    hsv.s = 0;
+    return hsv;
+  }
+  hsv.s = (delta * 65535 + max / 2) / max;
+
+  // Hue in sixths of the circle: region start plus the position in it
+  int32_t h6;
+  int32_t diff;
+  if (max == rgb.r){
+    h6 = 0;
+    diff = (int32_t)rgb.g - rgb.b;
+  } else if (max == rgb.g){
+    h6 = 2 << 16;
+    diff = (int32_t)rgb.b - rgb.r;
+  } else {
+    h6 = 4 << 16;
+    diff = (int32_t)rgb.r - rgb.g;
+  }
+  uint32_t frac = (((uint32_t)(diff < 0 ? -diff : diff) << 16) + delta / 2) / delta;
+  h6 += diff < 0 ? -(int32_t)frac : (int32_t)frac;
+  if (h6 < 0) h6 += 6 << 16;
+  hsv.h = (h6 + 3) / 6; // 65536 wraps to 0
+  return hsv;
+}
+
+// Blackbody colors from 1000 K to 10000 K in steps of 500 K, full brightness
+static const rgb_t _blackbody[] = {
+  {255, 56, 0}, {255, 109, 0}, {255, 137, 18}, {255, 161, 72}, {255, 180, 107},
+  {255, 196, 137}, {255, 209, 163}, {255, 219, 186}, {255, 228, 206}, {255, 236, 224},
+  {255, 243, 239}, {255, 249, 253}, {245, 243, 255}, {235, 238, 255}, {227, 233, 255},
+  {220, 229, 255}, {214, 225, 255}, {208, 222, 255}, {204, 219, 255},
+};
+
+#define BLACKBODY_MIN (1000)
+#define BLACKBODY_STEP (500)
+#define BLACKBODY_COUNT (sizeof(_blackbody) / sizeof(_blackbody[0]))
+
+static uint8_t mix(uint8_t a, uint8_t b, uint32_t t, uint8_t level)
+{
+  uint32_t c = (a * (BLACKBODY_STEP - t) + b * t) / BLACKBODY_STEP;
+  return (c * level + 127) / 255;
+}
+
+rgb_t color_temperature(uint16_t kelvin, uint8_t level)
+{
+  uint32_t k = kelvin < BLACKBODY_MIN ? 0 : kelvin - BLACKBODY_MIN;
+  uint32_t i = k / BLACKBODY_STEP;
+  uint32_t t = k % BLACKBODY_STEP;
+  if(i >= BLACKBODY_COUNT - 1){
+    i = BLACKBODY_COUNT - 2;
+    t = BLACKBODY_STEP;
+  }
+  const rgb_t * a = &_blackbody[i];
+  const rgb_t * b = &_blackbody[i + 1];
+  rgb_t out = {mix(a->r, b->r, t, level), mix(a->g, b->g, t, level), mix(a->b, b->b, t, level)};
+  return out;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Color types and conversions.
+ *
+ * The state keeps colors as 16 bit RGB and HSV so repeated conversions and
+ * edits do not drift. Hue covers the whole circle in 0..65535 (it wraps), the
+ * other components go from 0 to 65535. 8 bit values are only used at the
+ * edges: the API, the web page and the LED output.
+ */
+
+typedef struct
+{
+  uint8_t h;
+  uint8_t s;
+  uint8_t v;
+} hsv_t;
+
+typedef struct
+{
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+} rgb_t;
+
+typedef struct
+{
+  uint16_t h;
+  uint16_t s;
+  uint16_t v;
+} hsv16_t;
+
+typedef struct
+{
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+} rgb16_t;
+
+// 8 bit conversions, hue in 0..255 (regions of 43)
+rgb_t hsv_to_rgb(hsv_t hsv);
+hsv_t rgb_to_hsv(rgb_t rgb);
+
+// 16 bit conversions
+rgb16_t hsv16_to_rgb16(hsv16_t hsv);
+hsv16_t rgb16_to_hsv16(rgb16_t rgb);
+
+// White of a color temperature (1000 K to 10000 K) at 'level' brightness
+rgb_t color_temperature(uint16_t kelvin, uint8_t level);
+
+static inline uint16_t color_8_to_16(uint8_t c) { return c * 257; }
+static inline uint8_t color_16_to_8(uint16_t c) { return (c * 255u + 32767) / 65535; }
+static inline uint16_t hue_8_to_16(uint8_t h) { return h << 8; }
+static inline uint8_t hue_16_to_8(uint16_t h) { return (h + 128) >> 8; }
+
+static inline rgb16_t rgb_8_to_16(rgb_t c)
+{
+  rgb16_t out = {color_8_to_16(c.r), color_8_to_16(c.g), color_8_to_16(c.b)};
+  return out;
+}
+
+static inline rgb_t rgb_16_to_8(rgb16_t c)
+{
+  rgb_t out = {color_16_to_8(c.r), color_16_to_8(c.g), color_16_to_8(c.b)};
+  return out;
+}
+
+static inline hsv16_t hsv_8_to_16(hsv_t c)
+{
+  hsv16_t out = {hue_8_to_16(c.h), color_8_to_16(c.s), color_8_to_16(c.v)};
+  return out;
+}
+
+static inline hsv_t hsv_16_to_8(hsv16_t c)
+{
+  hsv_t out = {hue_16_to_8(c.h), color_16_to_8(c.s), color_16_to_8(c.v)};
+  return out;
+}
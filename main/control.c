@@ -0,0 +1,36 @@
+#include "control.h"
+
+#include <string.h>
+
+static QueueHandle_t g_queue = NULL;
+static state_patch_t g_pending;
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void control_init(QueueHandle_t queue)
+{
+  g_queue = queue;
+}
+
+esp_err_t control_submit(const state_patch_t * patch)
+{
+  if(!g_queue) return ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&g_lock);
+  patch_merge(&g_pending, patch);
+  portEXIT_CRITICAL(&g_lock);
+  control_event_t ev = {CONTROL_EVID, 0};
+  xQueueOverwrite(g_queue, &ev);
+  return ESP_OK;
+}
+
+bool control_take(state_patch_t * out)
+{
+  bool pending = false;
+  portENTER_CRITICAL(&g_lock);
+  if(g_pending.fields){
+    *out = g_pending;
+    memset(&g_pending, 0, sizeof(g_pending));
+    pending = true;
+  }
+  portEXIT_CRITICAL(&g_lock);
+  return pending;
+}
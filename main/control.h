@@ -0,0 +1,29 @@
+#pragma once
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <esp_err.h>
+#include "patch.h"
+
+/*
+ * Mailbox of state changes for the main loop.
+ *
+ * Any task can submit a patch: it is merged into the pending one and the
+ * main loop is woken up with a CONTROL_EVID event. The main loop takes the
+ * merged patch and applies it in a single render tick, so nothing submitted
+ * is lost even if the wake-up event is overwritten in the queue.
+ */
+
+static const uint32_t CONTROL_EVID = 0x5EA7C0DE;
+
+typedef struct {
+  uint32_t id0;
+  uint32_t id1;
+} control_event_t;
+
+void control_init(QueueHandle_t queue);
+
+esp_err_t control_submit(const state_patch_t * patch);
+
+// Take the pending patch, returns false if there is none
+bool control_take(state_patch_t * out);
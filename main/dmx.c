@@ -0,0 +1,131 @@
+#include "dmx.h"
+#include "dmx_packet.h"
+#include "dmx_socket.h"
+#include "rtos.h"
+
+#include <string.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#ifdef CONFIG_DMX_ENABLE
+
+static const char *TAG = "dmx";
+
+#define DMX_UNIVERSE (CONFIG_DMX_UNIVERSE)
+#define DMX_START_ADDRESS (CONFIG_DMX_START_ADDRESS)
+#define DMX_TIMEOUT_US (CONFIG_DMX_TIMEOUT_MS * 1000LL)
+
+#define MAX_PACKET (638) // Largest E1.31 data packet
+
+static QueueHandle_t g_queue = NULL;
+static volatile bool g_active = false;
+static dmx_receiver_t g_rx;
+static uint8_t g_packet[MAX_PACKET];
+static rgb_t g_last;
+
+// Mailbox of the color for the main loop, the only writer of the outputs
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static rgb_t g_color;
+static bool g_pending = false;          // A color was posted and not taken yet
+
+RTOS_TASK_DEFINE(g_task, "dmx", CONFIG_DMX_STACK);
+
+bool dmx_active(void)
+{
+  return g_active;
+}
+
+bool dmx_take(rgb_t * out)
+{
+  portENTER_CRITICAL(&g_lock);
+  bool taken = g_pending;
+  g_pending = false;
+  *out = g_color;
+  portEXIT_CRITICAL(&g_lock);
+  return taken && g_active;
+}
+
+bool dmx_pending(void)
+{
+  return g_pending;
+}
+
+// Posts the console state to the main loop. Only the first post after a
+// take wakes it, the main loop also checks dmx_pending.
+static void post(bool active, rgb_t color)
+{
+  portENTER_CRITICAL(&g_lock);
+  g_active = active;
+  g_color = color;
+  bool wake = !g_pending;
+  g_pending = true;
+  portEXIT_CRITICAL(&g_lock);
+  if(wake){
+    dmx_event_t ev = {DMX_EVID, 0};
+    xQueueOverwrite(g_queue, &ev);
+  }
+}
+
+static void source_release(void)
+{
+  ESP_LOGI(TAG, "Source lost, back to the stored color");
+  post(false, g_last);
+}
+
+static void handle_packet(int len)
+{
+  rgb_t rgb;
+  uint32_t sources = g_rx.sources;
+  dmx_result_t result = dmx_receive(&g_rx, g_packet, len, esp_timer_get_time(), &rgb);
+  if(g_rx.sources != sources){
+    ESP_LOGI(TAG, "New %s source (priority %d)",
+	     g_rx.source.protocol == DMX_E131 ? "E1.31" : "Art-Net", g_rx.source.priority);
+  }
+  if(result == DMX_RELEASED){
+    source_release();
+  } else if(result == DMX_COLOR && (!g_active || memcmp(&rgb, &g_last, sizeof(rgb)) != 0)){
+    g_last = rgb;
+    post(true, rgb);
+  }
+}
+
+static void dmx_task(void * arg)
+{
+  static dmx_socket_t sock;
+  if(!dmx_socket_open(&sock, DMX_SOCKET_E131_PORT, DMX_SOCKET_ARTNET_PORT, DMX_UNIVERSE)){
+    ESP_LOGE(TAG, "No socket to listen to");
+    rtos_task_exit(&g_task);
+    return;
+  }
+  if(sock.socks[DMX_SOCKET_E131] < 0){
+    ESP_LOGE(TAG, "Failed to bind port %d, Art-Net only", DMX_SOCKET_E131_PORT);
+  } else if(!sock.multicast){
+    ESP_LOGW(TAG, "Failed to join the E1.31 multicast group, unicast only");
+  }
+  if(sock.socks[DMX_SOCKET_ARTNET] < 0){
+    ESP_LOGE(TAG, "Failed to bind port %d, E1.31 only", DMX_SOCKET_ARTNET_PORT);
+  }
+  ESP_LOGI(TAG, "Listening to universe %d, start address %d",
+	   DMX_UNIVERSE, DMX_START_ADDRESS);
+
+  while(1){
+    int len = dmx_socket_read(&sock, 100, g_packet, sizeof(g_packet));
+    if(len > 0) handle_packet(len);
+    if(dmx_timeout(&g_rx, esp_timer_get_time())){
+      source_release();
+    }
+  }
+}
+
+esp_err_t dmx_init(QueueHandle_t queue)
+{
+  g_queue = queue;
+  dmx_receiver_init(&g_rx, DMX_UNIVERSE, DMX_START_ADDRESS, DMX_TIMEOUT_US);
+  if(!rtos_task_start(&g_task, dmx_task, NULL, 6, tskNO_AFFINITY)){
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+#endif // CONFIG_DMX_ENABLE
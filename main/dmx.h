@@ -0,0 +1,45 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <esp_err.h>
+#include "color.h"
+
+/*
+ * Realtime input from a lighting console over E1.31 (sACN) and Art-Net.
+ *
+ * A dedicated task receives the DMX universe CONFIG_DMX_UNIVERSE and posts
+ * the three slots at CONFIG_DMX_START_ADDRESS (red, green, blue) to the main
+ * loop, which writes them to the LEDs without going through the state: the
+ * main loop stays the only writer of the outputs. A DMX_EVID event wakes it
+ * when the color changes, and once the source stops sending for
+ * CONFIG_DMX_TIMEOUT_MS, so it renders the persisted color again. While a
+ * source is active the main loop shows the console color instead of the
+ * state (see dmx_active).
+ */
+
+static const uint32_t DMX_EVID = 0xD3C0FFEE;
+
+typedef struct {
+  uint32_t id0;
+  uint32_t id1;
+} dmx_event_t;
+
+#ifdef CONFIG_DMX_ENABLE
+esp_err_t dmx_init(QueueHandle_t queue);
+
+// True while a console drives the output
+bool dmx_active(void);
+
+// Take the color of the console, returns false if it has not changed since
+// the last take or no console drives the output
+bool dmx_take(rgb_t * out);
+
+// True if there is something to take (a color or the end of the source)
+bool dmx_pending(void);
+#else
+static inline bool dmx_active(void) { return false; }
+static inline bool dmx_take(rgb_t * out) { return false; }
+static inline bool dmx_pending(void) { return false; }
+#endif
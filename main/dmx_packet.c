@@ -0,0 +1,126 @@
+#include "dmx_packet.h"
+
+#include <string.h>
+
+static const uint8_t E131_ID[12] = {'A','S','C','-','E','1','.','1','7',0,0,0};
+static const uint8_t ARTNET_ID[8] = {'A','r','t','-','N','e','t',0};
+
+static inline uint16_t be16(const uint8_t * p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t be32(const uint8_t * p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*
+ * Packet parsers: they validate a packet in place and return a pointer to
+ * its DMX slots (start code excluded), or NULL if it is not for us.
+ */
+static const uint8_t * e131_parse(const uint8_t * p, int len, uint16_t universe, int * slots,
+				  dmx_source_t * src, bool * terminated)
+{
+  if(len < 126) return NULL;
+  if(be16(p) != 0x0010 || memcmp(p + 4, E131_ID, sizeof(E131_ID)) != 0) return NULL;
+  if(be32(p + 18) != 0x00000004) return NULL;  // VECTOR_ROOT_E131_DATA
+  if(be32(p + 40) != 0x00000002) return NULL;  // VECTOR_E131_DATA_PACKET
+  if(p[117] != 0x02 || p[118] != 0xa1) return NULL; // DMP set property
+  if(be16(p + 113) != universe) return NULL;
+  if(p[112] & 0x80) return NULL; // Preview data, not for output
+  if(p[125] != 0) return NULL;   // Only the null start code carries levels
+  int count = be16(p + 123) - 1;
+  if(count < 0 || 126 + count > len) return NULL;
+
+  src->protocol = DMX_E131;
+  memcpy(src->cid, p + 22, sizeof(src->cid));
+  src->priority = p[108];
+  src->sequence = p[111];
+  *terminated = (p[112] & 0x40) != 0;
+  *slots = count;
+  return p + 126;
+}
+
+static const uint8_t * artnet_parse(const uint8_t * p, int len, uint16_t universe, int * slots,
+				    dmx_source_t * src, bool * terminated)
+{
+  if(len < 18) return NULL;
+  if(memcmp(p, ARTNET_ID, sizeof(ARTNET_ID)) != 0) return NULL;
+  if(p[8] != 0x00 || p[9] != 0x50) return NULL; // OpDmx, little endian
+  // Art-Net universes start at 0, E1.31 ones at 1
+  uint16_t port_address = ((p[15] & 0x7f) << 8) | p[14];
+  if(port_address != universe - 1) return NULL;
+  int count = be16(p + 16);
+  if(count > 512 || 18 + count > len) return NULL;
+
+  src->protocol = DMX_ARTNET;
+  memset(src->cid, 0, sizeof(src->cid));
+  src->priority = 100; // E1.31 default priority
+  src->sequence = p[12];
+  *terminated = false;
+  *slots = count;
+  return p + 18;
+}
+
+// Decide if the packet from 'src' drives the output
+static bool source_accept(dmx_receiver_t * rx, const dmx_source_t * src, int64_t now)
+{
+  dmx_source_t * cur = &rx->source;
+  bool same = cur->active && cur->protocol == src->protocol &&
+    memcmp(cur->cid, src->cid, sizeof(cur->cid)) == 0;
+  if(same){
+    // E1.31 6.7.2: drop packets up to 20 behind the last one (out of order).
+    // Art-Net uses 0 to disable sequencing.
+    int8_t diff = (int8_t)(src->sequence - cur->sequence);
+    bool disabled = src->protocol == DMX_ARTNET && src->sequence == 0;
+    if(!disabled && diff <= 0 && diff > -20) return false;
+  } else if(cur->active && now - cur->last_us < rx->timeout_us &&
+	    src->priority <= cur->priority){
+    return false; // Another source owns the output
+  }
+  if(!same) rx->sources++;
+  *cur = *src;
+  cur->active = true;
+  cur->last_us = now;
+  return true;
+}
+
+void dmx_receiver_init(dmx_receiver_t * rx, uint16_t universe, uint16_t address,
+		       int64_t timeout_us)
+{
+  memset(rx, 0, sizeof(*rx));
+  rx->universe = universe;
+  rx->address = address;
+  rx->timeout_us = timeout_us;
+}
+
+dmx_result_t dmx_receive(dmx_receiver_t * rx, const uint8_t * packet, int len,
+			 int64_t now_us, rgb_t * color)
+{
+  dmx_source_t src;
+  bool terminated = false;
+  int slots = 0;
+  const uint8_t * data = e131_parse(packet, len, rx->universe, &slots, &src, &terminated);
+  if(!data) data = artnet_parse(packet, len, rx->universe, &slots, &src, &terminated);
+  if(!data) return DMX_IGNORED;
+
+  if(!source_accept(rx, &src, now_us)) return DMX_IGNORED;
+  if(terminated){
+    rx->source.active = false;
+    return DMX_RELEASED;
+  }
+  int addr = rx->address - 1;
+  if(slots < addr + 3) return DMX_IGNORED;
+  color->r = data[addr];
+  color->g = data[addr + 1];
+  color->b = data[addr + 2];
+  return DMX_COLOR;
+}
+
+bool dmx_timeout(dmx_receiver_t * rx, int64_t now_us)
+{
+  if(!rx->source.active || now_us - rx->source.last_us <= rx->timeout_us) return false;
+  rx->source.active = false;
+  return true;
+}
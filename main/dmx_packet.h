@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "color.h"
+
+/*
+ * E1.31 (sACN) and Art-Net packets of one fixture, and the choice of the
+ * source that drives it.
+ *
+ * Packets of the universe are validated in place and the three slots at the
+ * start address are the color. Of several sources, the one with the highest
+ * E1.31 priority keeps the output (Art-Net has the default priority, 100)
+ * until it stops sending for the timeout or sends the stream terminated
+ * option. Out of order packets of a source are dropped by their sequence
+ * number.
+ *
+ *   dmx_receiver_init(&rx, universe, address, timeout_us);
+ *   switch(dmx_receive(&rx, packet, len, now_us, &color)) ...
+ *   if(dmx_timeout(&rx, now_us)) ...       // Regularly, without packets too
+ */
+
+enum {
+  DMX_E131 = 1,
+  DMX_ARTNET,
+};
+
+typedef enum {
+  DMX_IGNORED,    // Not for this fixture, or from a source that does not drive it
+  DMX_COLOR,      // A color of the source that drives the output
+  DMX_RELEASED,   // The source ended its stream, nothing drives the output
+} dmx_result_t;
+
+typedef struct {
+  bool active;
+  uint8_t protocol;
+  uint8_t cid[16];  // E1.31 component identifier, zeros for Art-Net
+  uint8_t priority;
+  uint8_t sequence;
+  int64_t last_us;
+} dmx_source_t;
+
+typedef struct {
+  uint16_t universe;   // E1.31 numbering from 1, Art-Net universe - 1
+  uint16_t address;    // First slot (red), from 1
+  int64_t timeout_us;
+  dmx_source_t source; // The source driving the output, when active
+  uint32_t sources;    // Times a new source took the output
+} dmx_receiver_t;
+
+void dmx_receiver_init(dmx_receiver_t * rx, uint16_t universe, uint16_t address,
+		       int64_t timeout_us);
+
+dmx_result_t dmx_receive(dmx_receiver_t * rx, const uint8_t * packet, int len,
+			 int64_t now_us, rgb_t * color);
+
+// Returns true once when the source driving the output stopped sending
+bool dmx_timeout(dmx_receiver_t * rx, int64_t now_us);
@@ -0,0 +1,72 @@
+#include "dmx_socket.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+static int open_udp(uint16_t port)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if(sock < 0) return -1;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+bool dmx_socket_open(dmx_socket_t * s, uint16_t e131_port, uint16_t artnet_port,
+		     uint16_t universe)
+{
+  s->socks[DMX_SOCKET_E131] = open_udp(e131_port);
+  s->socks[DMX_SOCKET_ARTNET] = open_udp(artnet_port);
+  s->multicast = false;
+  s->next = 0;
+  if(s->socks[DMX_SOCKET_E131] >= 0){
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr.s_addr = htonl(0xefff0000 | universe);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    s->multicast = setsockopt(s->socks[DMX_SOCKET_E131], IPPROTO_IP, IP_ADD_MEMBERSHIP,
+			      &mreq, sizeof(mreq)) == 0;
+  }
+  return s->socks[DMX_SOCKET_E131] >= 0 || s->socks[DMX_SOCKET_ARTNET] >= 0;
+}
+
+int dmx_socket_read(dmx_socket_t * s, int timeout_ms, uint8_t * buf, int size)
+{
+  fd_set fds;
+  FD_ZERO(&fds);
+  int maxfd = -1;
+  for(int i = 0; i < DMX_SOCKETS; ++i){
+    if(s->socks[i] < 0) continue;
+    FD_SET(s->socks[i], &fds);
+    if(s->socks[i] > maxfd) maxfd = s->socks[i];
+  }
+  if(maxfd < 0) return -1;
+  struct timeval tv = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+  if(select(maxfd + 1, &fds, NULL, NULL, &tv) <= 0) return 0;
+  for(int k = 0; k < DMX_SOCKETS; ++k){
+    int i = (s->next + k) % DMX_SOCKETS;
+    if(s->socks[i] < 0 || !FD_ISSET(s->socks[i], &fds)) continue;
+    s->next = (i + 1) % DMX_SOCKETS;
+    int len = recv(s->socks[i], buf, size, 0);
+    return len > 0 ? len : 0;
+  }
+  return 0;
+}
+
+void dmx_socket_close(dmx_socket_t * s)
+{
+  for(int i = 0; i < DMX_SOCKETS; ++i){
+    if(s->socks[i] >= 0) close(s->socks[i]);
+    s->socks[i] = -1;
+  }
+}
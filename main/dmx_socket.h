@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The sockets of the DMX receiver (dmx.h).
+ *
+ * E1.31 is received on its port, joined to the multicast group of the
+ * universe (239.255.<universe high>.<universe low>), and Art-Net on its
+ * own port. Packets of both are read one at a time with a timeout, taking
+ * turns when both have some. Plain BSD sockets, lwIP on the ESP32;
+ * tools/dmxcheck.c sends packets to it over loopback.
+ */
+
+#define DMX_SOCKET_E131_PORT (5568)
+#define DMX_SOCKET_ARTNET_PORT (6454)
+
+enum {
+  DMX_SOCKET_E131,
+  DMX_SOCKET_ARTNET,
+  DMX_SOCKETS,
+};
+
+typedef struct {
+  int socks[DMX_SOCKETS];  // -1 if it could not be opened
+  bool multicast;          // The E1.31 socket joined the group of the universe
+  int next;                // Socket read first, they take turns
+} dmx_socket_t;
+
+// Opens the sockets, returns false if none could be. Other ports than the
+// standard ones are for the tests.
+bool dmx_socket_open(dmx_socket_t * s, uint16_t e131_port, uint16_t artnet_port,
+		     uint16_t universe);
+
+// Waits up to timeout_ms for a packet and reads it into buf. Returns its
+// length, 0 on a timeout or -1 if no socket is open.
+int dmx_socket_read(dmx_socket_t * s, int timeout_ms, uint8_t * buf, int size);
+
+void dmx_socket_close(dmx_socket_t * s);
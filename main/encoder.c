@@ -0,0 +1,124 @@
+#include "encoder.h"
+
+#include <stdlib.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "rotary_encoder.h"
+#include "power.h"
+#include "rtos.h"
+
+static const char *TAG = "encoder";
+
+#define ACCEL_MAX (CONFIG_ENCODER_ACCEL_MAX)
+#define ACCEL_SLOW_US (CONFIG_ENCODER_ACCEL_SLOW_MS * 1000LL)
+#define ACCEL_FAST_US (CONFIG_ENCODER_ACCEL_FAST_MS * 1000LL)
+#define GAIN_ONE (256) // Steps are summed in 1/256, the rest waits for the next take
+
+static rotary_encoder_info_t g_encoder;
+static QueueHandle_t g_events = NULL;  // From the ISR of the component
+static QueueHandle_t g_wakeup = NULL;  // The main queue
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static int32_t g_sum = 0;              // In 1/GAIN_ONE steps
+static bool g_pending = false;         // A wakeup was sent and not taken yet
+
+RTOS_TASK_DEFINE(g_task, "encoder", CONFIG_ENCODER_STACK);
+// As rotary_encoder_create_queue does: the ISR overwrites the one event
+RTOS_QUEUE_DEFINE(g_events_queue, rotary_encoder_event_t, 1);
+
+// Gain of a step given the time since the previous one, times GAIN_ONE
+static int32_t encoder_gain(int64_t interval_us)
+{
+  if(interval_us >= ACCEL_SLOW_US) return GAIN_ONE;
+  if(interval_us <= ACCEL_FAST_US) return ACCEL_MAX * GAIN_ONE;
+  // Speed between the two limits, 0..GAIN_ONE, squared
+  int32_t x = (ACCEL_SLOW_US - interval_us) * GAIN_ONE / (ACCEL_SLOW_US - ACCEL_FAST_US);
+  return GAIN_ONE + (ACCEL_MAX - 1) * x * x / GAIN_ONE;
+}
+
+static void encoder_task(void * arg)
+{
+  rotary_encoder_state_t state;
+  rotary_encoder_get_state(&g_encoder, &state);
+  int32_t position = state.position;
+  int64_t last = 0;
+  int last_dir = 0;
+
+  rotary_encoder_event_t event;
+  while(xQueueReceive(g_events, &event, portMAX_DELAY) == pdTRUE){
+    int64_t now = esp_timer_get_time();
+    int delta = event.state.position - position;
+    position = event.state.position;
+    if(delta == 0) continue;
+    power_activity();
+
+    // The queue holds one event, steps that came in while this task was
+    // busy show up together: spread the time over them
+    int dir = delta > 0 ? 1 : -1;
+    int32_t gain = dir == last_dir ? encoder_gain((now - last) / abs(delta)) : GAIN_ONE;
+    last = now;
+
+    portENTER_CRITICAL(&g_lock);
+    if(dir != last_dir){
+      g_sum = g_sum / GAIN_ONE * GAIN_ONE; // A part step back the other way is lost
+    }
+    g_sum += delta * gain;
+    bool wake = !g_pending;
+    g_pending = true;
+    portEXIT_CRITICAL(&g_lock);
+    last_dir = dir;
+
+    if(wake){
+      encoder_event_t ev = {ENCODER_EVID, 0};
+      xQueueOverwrite(g_wakeup, &ev);
+    }
+  }
+}
+
+esp_err_t encoder_init(gpio_num_t pin_a, gpio_num_t pin_b, bool half_steps,
+		       QueueHandle_t wakeup)
+{
+  g_wakeup = wakeup;
+  esp_err_t err = rotary_encoder_init(&g_encoder, pin_a, pin_b);
+  if(err != ESP_OK) return err;
+  ESP_ERROR_CHECK(rotary_encoder_enable_half_steps(&g_encoder, half_steps));
+  ESP_ERROR_CHECK(rotary_encoder_flip_direction(&g_encoder));
+
+  g_events = rtos_queue_create(&g_events_queue);
+  if(!g_events) return ESP_ERR_NO_MEM;
+  ESP_ERROR_CHECK(rotary_encoder_set_queue(&g_encoder, g_events));
+
+  // Above the main task, so steps are timestamped when they happen
+  if(!rtos_task_start(&g_task, encoder_task, NULL, 5, tskNO_AFFINITY)){
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_LOGI(TAG, "Acceleration up to x%d between %d and %d ms per step", ACCEL_MAX,
+	   CONFIG_ENCODER_ACCEL_SLOW_MS, CONFIG_ENCODER_ACCEL_FAST_MS);
+  return ESP_OK;
+}
+
+esp_err_t encoder_uninit(void)
+{
+  esp_err_t err = rotary_encoder_uninit(&g_encoder);
+  rtos_task_delete(&g_task);
+  if(g_events){
+    vQueueDelete(g_events);
+    g_events = NULL;
+  }
+  return err;
+}
+
+int encoder_take(void)
+{
+  portENTER_CRITICAL(&g_lock);
+  int steps = g_sum / GAIN_ONE;
+  g_sum -= steps * GAIN_ONE;
+  g_pending = false;
+  portEXIT_CRITICAL(&g_lock);
+  return steps;
+}
+
+bool encoder_pending(void)
+{
+  return g_pending;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <driver/gpio.h>
+#include <esp_err.h>
+
+/*
+ * Rotary encoder with acceleration.
+ *
+ * The esp32-rotary-encoder ISR counts the steps into a private queue. A small
+ * task timestamps them, scales each step by how fast the knob turns and adds
+ * it to a sum that the main loop takes once per render. Only the first step
+ * after a take wakes the main loop (with an ENCODER_EVID event), so a fast
+ * spin costs one wakeup per render instead of one per detent. The event
+ * carries nothing: it can overwrite, or be overwritten by, the wakeup of
+ * another input in the one slot of the main queue, which is why the main
+ * loop also polls encoder_pending.
+ *
+ * Steps slower than CONFIG_ENCODER_ACCEL_SLOW_MS apart count as one, steps
+ * CONFIG_ENCODER_ACCEL_FAST_MS apart or less count as CONFIG_ENCODER_ACCEL_MAX,
+ * with a quadratic curve in between so turning at a moderate pace stays
+ * precise. Changing direction always starts again at one.
+ */
+
+static const uint32_t ENCODER_EVID = 0xE7C0DE12;
+
+typedef struct {
+  uint32_t id0;
+  uint32_t id1;
+} encoder_event_t;
+
+esp_err_t encoder_init(gpio_num_t pin_a, gpio_num_t pin_b, bool half_steps,
+		       QueueHandle_t wakeup);
+
+esp_err_t encoder_uninit(void);
+
+// Take the steps summed since the last take, with the acceleration applied
+int encoder_take(void);
+
+// True if there are steps to take
+bool encoder_pending(void);
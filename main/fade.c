@@ -0,0 +1,48 @@
+#include "fade.h"
+
+#include <string.h>
+
+static uint8_t lerp(uint8_t a, uint8_t b, uint32_t t, uint32_t length)
+{
+  return a + ((int)b - (int)a) * (int64_t)t / (int64_t)length;
+}
+
+bool fade_step(fade_t * fade, rgb_t target, uint32_t transition_ms, uint32_t now_ms)
+{
+  if(memcmp(&target, &fade->to, sizeof(rgb_t)) != 0){
+    fade->from = fade->shown;
+    fade->to = target;
+    fade->start = now_ms;
+    fade->length = transition_ms;
+  }
+  uint32_t t = now_ms - fade->start;
+  if(t >= fade->length){
+    fade->shown = fade->to;
+    return false;
+  }
+  fade->shown.r = lerp(fade->from.r, fade->to.r, t, fade->length);
+  fade->shown.g = lerp(fade->from.g, fade->to.g, t, fade->length);
+  fade->shown.b = lerp(fade->from.b, fade->to.b, t, fade->length);
+  return true;
+}
+
+void fade_set(fade_t * fade, rgb_t color)
+{
+  fade->from = fade->to = fade->shown = color;
+}
+
+bool fade_render(fade_t * fade, const persistent_state_t * s, const rgb_t * frame,
+		 int32_t * ramp_ms, uint32_t now_ms)
+{
+  uint32_t transition_ms = *ramp_ms >= 0 ? (uint32_t)*ramp_ms : s->transition_ms;
+  *ramp_ms = -1;
+  if(!s->on){
+    rgb_t black = {0, 0, 0};
+    return fade_step(fade, black, transition_ms, now_ms);
+  }
+  if(frame){
+    fade_set(fade, *frame);
+    return false;
+  }
+  return fade_step(fade, rgb_16_to_8(s->rgb), transition_ms, now_ms);
+}
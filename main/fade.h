@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "color.h"
+#include "state.h"
+
+/*
+ * Fade from the color shown to the color of the state, in render ticks.
+ * Times are in ms (esp_timer time / 1000, wrapping).
+ */
+
+typedef struct {
+  rgb_t from;
+  rgb_t to;
+  rgb_t shown;
+  uint32_t start;
+  uint32_t length;
+} fade_t;
+
+// Moves the fade one render tick towards 'target', returns true while fading.
+bool fade_step(fade_t * fade, rgb_t target, uint32_t transition_ms, uint32_t now_ms);
+
+// Show 'color' right away, e.g. a frame of an effect
+void fade_set(fade_t * fade, rgb_t color);
+
+// The render step of the main loop: black when the state is off, else the
+// frame of a running effect right away (NULL without one), else the color of
+// the state. A ramp (PATCH_RAMP, -1 for none) replaces the transition of the
+// state for this render and is used up. Returns true while fading.
+bool fade_render(fade_t * fade, const persistent_state_t * s, const rgb_t * frame,
+		 int32_t * ramp_ms, uint32_t now_ms);
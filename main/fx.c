@@ -0,0 +1,422 @@
+#include "fx.h"
+#include "json.h"
+
+#include <string.h>
+
+#define STACK_SIZE (8)
+#define ONE (65535)
+
+enum {
+  OP_END = 0,
+  OP_CONST,    // u16 value                 push value
+  OP_TIME,     // u32 period_ms             push phase of t in the period
+  OP_FIXTURE,  // u16 count                 push position of the fixture in count
+  OP_DUP,
+  OP_ADD,      //                           a + b, wrapping (phase offset)
+  OP_SIN,      //                           x -> (1 - cos(2 pi x)) / 2
+  OP_TRI,      //                           x -> 0..1..0
+  OP_SQUARE,   // u16 duty                  x -> x < duty ? 1 : 0
+  OP_NOISE,    // u32 step_ms               push smooth noise, new value every step
+  OP_LERP,     // u8 a, u8 b                x -> a + (b - a) * x
+  OP_OUT,      // u8 channel                pop into channel
+  OP_KEYS,     // u8 count, u8 loop, count * (u32 t_ms, u8 r, u8 g, u8 b)
+};
+
+enum { CH_R, CH_G, CH_B, CH_H, CH_S, CH_V, CH_COUNT };
+
+// (1 - cos(2 pi i / 64)) / 2
+static const uint16_t _wave[65] = {
+  0, 158, 630, 1411, 2494, 3869, 5522, 7438,
+  9597, 11980, 14563, 17321, 20228, 23256, 26375, 29556,
+  32767, 35979, 39160, 42279, 45307, 48214, 50972, 53555,
+  55938, 58097, 60013, 61666, 63041, 64124, 64905, 65377,
+  65535, 65377, 64905, 64124, 63041, 61666, 60013, 58097,
+  55938, 53555, 50972, 48214, 45307, 42279, 39160, 35979,
+  32768, 29556, 26375, 23256, 20228, 17321, 14563, 11980,
+  9597, 7438, 5522, 3869, 2494, 1411, 630, 158,
+  0,
+};
+
+static inline uint16_t rd16(const uint8_t * p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t * p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t phase(uint32_t t, uint32_t period)
+{
+  return (uint32_t)((uint64_t)(t % period) * 65536 / period);
+}
+
+static inline uint32_t hash(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x & 0xffff;
+}
+
+static inline uint32_t lerp16(uint32_t a, uint32_t b, uint32_t x)
+{
+  return (int32_t)a + (((int32_t)b - (int32_t)a) * (int32_t)x >> 16);
+}
+
+static void eval_keys(const uint8_t * p, uint32_t t, uint8_t * out)
+{
+  int count = p[0];
+  bool loop = p[1];
+  const uint8_t * k = p + 2;
+  uint32_t end = rd32(k + (count - 1) * 7);
+  if(loop && end > 0) t %= end;
+  // Find the keyframes around t
+  int i = 0;
+  while(i < count - 1 && rd32(k + (i + 1) * 7) <= t) ++i;
+  const uint8_t * a = k + i * 7;
+  if(i == count - 1 || t < rd32(a)){
+    memcpy(out + CH_R, a + 4, 3);
+    return;
+  }
+  const uint8_t * b = a + 7;
+  uint32_t t0 = rd32(a), t1 = rd32(b);
+  uint32_t x = (uint64_t)(t - t0) * 65536 / (t1 - t0);
+  for(int c = 0; c < 3; ++c){
+    out[CH_R + c] = lerp16(a[4 + c], b[4 + c], x);
+  }
+}
+
+rgb_t fx_eval(const fx_program_t * program, uint32_t t, uint16_t fixture)
+{
+  uint32_t stack[STACK_SIZE];
+  int sp = 0;
+  uint8_t out[CH_COUNT] = {0};
+  const uint8_t * pc = program->code;
+  const uint8_t * end = program->code + program->len;
+
+#define POP() (sp > 0 ? stack[--sp] : 0)
+#define PUSH(v) do { if(sp < STACK_SIZE) stack[sp++] = (v); } while(0)
+  while(pc < end){
+    uint32_t x;
+    switch(*pc++){
+    case OP_CONST:
+      PUSH(rd16(pc));
+      pc += 2;
+      break;
+    case OP_TIME:
+      PUSH(phase(t, rd32(pc)));
+      pc += 4;
+      break;
+    case OP_FIXTURE: {
+      uint16_t count = rd16(pc);
+      pc += 2;
+      PUSH(count > 1 ? (fixture % count) * ONE / (count - 1) : 0);
+      break;
+    }
+    case OP_DUP:
+      x = POP();
+      PUSH(x);
+      PUSH(x);
+      break;
+    case OP_ADD: {
+      uint32_t a = POP(), b = POP();
+      PUSH((a + b) & 0xffff);
+      break;
+    }
+    case OP_SIN: {
+      x = POP() & 0xffff;
+      uint32_t i = x >> 10, frac = x & 0x3ff;
+      PUSH(_wave[i] + (((int32_t)_wave[i + 1] - _wave[i]) * (int32_t)frac >> 10));
+      break;
+    }
+    case OP_TRI:
+      x = POP() & 0xffff;
+      PUSH(x < 0x8000 ? x * 2 : (0xffff - x) * 2);
+      break;
+    case OP_SQUARE:
+      x = POP();
+      PUSH(x < rd16(pc) ? ONE : 0);
+      pc += 2;
+      break;
+    case OP_NOISE: {
+      uint32_t step = rd32(pc);
+      pc += 4;
+      uint32_t n = t / step;
+      uint32_t frac = (uint64_t)(t % step) * 65536 / step;
+      PUSH(lerp16(hash(n), hash(n + 1), frac));
+      break;
+    }
+    case OP_LERP:
+      x = POP();
+      PUSH(lerp16(pc[0] * 257, pc[1] * 257, x));
+      pc += 2;
+      break;
+    case OP_OUT:
+      if(*pc < CH_COUNT) out[*pc] = POP() >> 8;
+      pc += 1;
+      break;
+    case OP_KEYS:
+      eval_keys(pc, t, out);
+      pc += 2 + pc[0] * 7;
+      break;
+    default:
+      pc = end;
+      break;
+    }
+  }
+#undef POP
+#undef PUSH
+
+  if(program->flags & FX_HSV){
+    hsv_t hsv = {out[CH_H], out[CH_S], out[CH_V]};
+    return hsv_to_rgb(hsv);
+  }
+  rgb_t rgb = {out[CH_R], out[CH_G], out[CH_B]};
+  return rgb;
+}
+
+/*
+ * Compiler
+ */
+
+typedef struct {
+  char effect[16];
+  uint8_t color[3];
+  uint8_t to[3];
+  bool has_color;
+  uint32_t period;
+  int min;        // Levels are clamped to 0..255 when parsed
+  int max;
+  int duty;       // -1 if not set
+  int depth;      // -1 if not set
+  int fixtures;
+  bool loop;
+  int frames;
+  struct {
+    uint32_t t;
+    uint8_t color[3];
+  } frame[FX_MAX_KEYFRAMES];
+  int scene;
+} fx_desc_t;
+
+typedef struct {
+  fx_program_t * p;
+  bool overflow;
+} emitter_t;
+
+static void emit8(emitter_t * e, uint8_t v)
+{
+  if(e->p->len >= FX_MAX_CODE){
+    e->overflow = true;
+    return;
+  }
+  e->p->code[e->p->len++] = v;
+}
+
+static void emit16(emitter_t * e, uint16_t v)
+{
+  emit8(e, v);
+  emit8(e, v >> 8);
+}
+
+static void emit32(emitter_t * e, uint32_t v)
+{
+  emit16(e, v);
+  emit16(e, v >> 16);
+}
+
+static void emit_out(emitter_t * e, uint8_t channel, uint8_t value)
+{
+  emit8(e, OP_CONST);
+  emit16(e, value * 257);
+  emit8(e, OP_OUT);
+  emit8(e, channel);
+}
+
+static uint8_t scale(uint8_t level, uint8_t v)
+{
+  return level * v / 255;
+}
+
+static bool compile(const fx_desc_t * d, fx_program_t * p)
+{
+  emitter_t e = {p, false};
+  memset(p, 0, sizeof(*p));
+  rgb_t rgb = {d->color[0], d->color[1], d->color[2]};
+  hsv_t hsv = rgb_to_hsv(rgb);
+  uint32_t period = d->period;
+
+  if(strcmp(d->effect, "static") == 0){
+    for(int c = 0; c < 3; ++c) emit_out(&e, CH_R + c, d->color[c]);
+  } else if(strcmp(d->effect, "breathe") == 0){
+    p->flags = FX_ANIMATED | FX_HSV;
+    emit_out(&e, CH_H, hsv.h);
+    emit_out(&e, CH_S, hsv.s);
+    emit8(&e, OP_TIME); emit32(&e, period ? period : 4000);
+    emit8(&e, OP_SIN);
+    emit8(&e, OP_LERP); emit8(&e, scale(d->min, hsv.v)); emit8(&e, scale(d->max, hsv.v));
+    emit8(&e, OP_OUT); emit8(&e, CH_V);
+  } else if(strcmp(d->effect, "hue") == 0){
+    p->flags = FX_ANIMATED | FX_HSV;
+    if(!d->has_color){
+      hsv.s = 255;
+      hsv.v = 255;
+    }
+    emit8(&e, OP_TIME); emit32(&e, period ? period : 10000);
+    emit8(&e, OP_OUT); emit8(&e, CH_H);
+    emit_out(&e, CH_S, hsv.s);
+    emit_out(&e, CH_V, hsv.v);
+  } else if(strcmp(d->effect, "strobe") == 0){
+    p->flags = FX_ANIMATED | FX_HSV;
+    emit_out(&e, CH_H, hsv.h);
+    emit_out(&e, CH_S, hsv.s);
+    emit8(&e, OP_TIME); emit32(&e, period ? period : 100);
+    emit8(&e, OP_SQUARE); emit16(&e, (d->duty >= 0 ? d->duty : 128) * 257);
+    emit8(&e, OP_LERP); emit8(&e, 0); emit8(&e, hsv.v);
+    emit8(&e, OP_OUT); emit8(&e, CH_V);
+  } else if(strcmp(d->effect, "candle") == 0){
+    p->flags = FX_ANIMATED | FX_HSV;
+    if(!d->has_color){
+      rgb_t flame = {255, 100, 20};
+      hsv = rgb_to_hsv(flame);
+    }
+    int depth = d->depth >= 0 ? d->depth : 96;
+    emit_out(&e, CH_H, hsv.h);
+    emit_out(&e, CH_S, hsv.s);
+    emit8(&e, OP_NOISE); emit32(&e, period ? period : 120);
+    emit8(&e, OP_LERP); emit8(&e, scale(255 - depth, hsv.v)); emit8(&e, hsv.v);
+    emit8(&e, OP_OUT); emit8(&e, CH_V);
+  } else if(strcmp(d->effect, "gradient") == 0){
+    emit8(&e, OP_FIXTURE); emit16(&e, d->fixtures);
+    if(period){
+      // Scroll and bounce back so the ends meet smoothly
+      p->flags = FX_ANIMATED;
+      emit8(&e, OP_TIME); emit32(&e, period);
+      emit8(&e, OP_ADD);
+      emit8(&e, OP_TRI);
+    }
+    for(int c = 0; c < 3; ++c){
+      emit8(&e, OP_DUP);
+      emit8(&e, OP_LERP); emit8(&e, d->color[c]); emit8(&e, d->to[c]);
+      emit8(&e, OP_OUT); emit8(&e, CH_R + c);
+    }
+  } else if(strcmp(d->effect, "keyframes") == 0){
+    if(d->frames == 0) return false;
+    p->flags = d->frames > 1 ? FX_ANIMATED : 0;
+    emit8(&e, OP_KEYS); emit8(&e, d->frames); emit8(&e, d->loop);
+    uint32_t last = 0;
+    for(int i = 0; i < d->frames; ++i){
+      if(d->frame[i].t < last) return false; // Must be in order
+      last = d->frame[i].t;
+      emit32(&e, d->frame[i].t);
+      for(int c = 0; c < 3; ++c) emit8(&e, d->frame[i].color[c]);
+    }
+  } else if(strcmp(d->effect, "show") == 0){
+    p->flags = FX_ANIMATED | FX_SHOW;
+    for(int c = 0; c < 3; ++c) emit_out(&e, CH_R + c, 0);
+  } else {
+    return false;
+  }
+  return !e.overflow;
+}
+
+static bool set_color(uint8_t * color, const json_reader_t * r)
+{
+  int i = r->index[r->depth - 1];
+  if(i > 2) return false;
+  color[i] = r->number < 0 ? 0 : r->number > 255 ? 255 : r->number;
+  return true;
+}
+
+// Levels are 0..255, duty * 257 has to fit in 16 bits
+static int level(int32_t n)
+{
+  return n < 0 ? 0 : n > 255 ? 255 : n;
+}
+
+static bool desc_json_cb(json_reader_t * r, json_event_t event, void * arg)
+{
+  fx_desc_t * d = arg;
+  const char * key = json_reader_key(r, 1);
+  if(r->depth == 1 && (event == JSON_OBJECT_START || event == JSON_OBJECT_END)) return true;
+  if(r->depth == 1 && event == JSON_STRING && strcmp(key, "effect") == 0){
+    size_t len = strlen(r->token);
+    if(len >= sizeof(d->effect)) return false; // No such effect
+    memcpy(d->effect, r->token, len + 1);
+    return true;
+  }
+  if(r->depth == 1 && event == JSON_NUMBER){
+    int32_t n = r->number;
+    if(strcmp(key, "period") == 0) d->period = n > 0 ? n : 0;
+    else if(strcmp(key, "min") == 0) d->min = level(n);
+    else if(strcmp(key, "max") == 0) d->max = level(n);
+    else if(strcmp(key, "duty") == 0) d->duty = level(n);
+    else if(strcmp(key, "depth") == 0) d->depth = level(n);
+    else if(strcmp(key, "fixtures") == 0) d->fixtures = n < 1 ? 1 : n > UINT16_MAX ? UINT16_MAX : n;
+    else if(strcmp(key, "scene") == 0) d->scene = n;
+    else return false;
+    return true;
+  }
+  if(r->depth == 1 && (event == JSON_TRUE || event == JSON_FALSE) && strcmp(key, "loop") == 0){
+    d->loop = event == JSON_TRUE;
+    return true;
+  }
+  // Colors: "color":[r,g,b], "to":[r,g,b]
+  if(r->depth == 2 && (strcmp(key, "color") == 0 || strcmp(key, "to") == 0)){
+    if(event == JSON_ARRAY_START || event == JSON_ARRAY_END) return true;
+    if(event != JSON_NUMBER) return false;
+    if(key[0] == 'c') d->has_color = true;
+    return set_color(key[0] == 'c' ? d->color : d->to, r);
+  }
+  // Keyframes: "frames":[{"t":0,"color":[r,g,b]}, ...]
+  if(r->depth >= 2 && strcmp(key, "frames") == 0){
+    int i = r->index[1];
+    if(i >= FX_MAX_KEYFRAMES) return false;
+    if(r->depth == 2) return event == JSON_ARRAY_START || event == JSON_ARRAY_END;
+    if(event == JSON_OBJECT_END && r->depth == 3){
+      d->frames = i + 1;
+      return true;
+    }
+    const char * field = json_reader_key(r, 3);
+    if(r->depth == 3 && event == JSON_NUMBER && strcmp(field, "t") == 0){
+      d->frame[i].t = r->number > 0 ? r->number : 0;
+      return true;
+    }
+    if(r->depth == 4 && strcmp(field, "color") == 0){
+      if(event == JSON_NUMBER) return set_color(d->frame[i].color, r);
+      return event == JSON_ARRAY_START || event == JSON_ARRAY_END;
+    }
+    return r->depth == 3 && event == JSON_OBJECT_START;
+  }
+  return false;
+}
+
+bool fx_compile_json(const char * json, size_t len, fx_request_t * out)
+{
+  fx_desc_t d;
+  memset(&d, 0, sizeof(d));
+  d.max = 255;
+  d.duty = -1;
+  d.depth = -1;
+  d.fixtures = 1;
+  d.scene = -1;
+  d.color[0] = d.color[1] = d.color[2] = 255;
+
+  json_reader_t reader;
+  json_reader_init(&reader, desc_json_cb, &d);
+  if(!json_reader_feed(&reader, json, len) || !json_reader_finish(&reader)) return false;
+
+  memset(out, 0, sizeof(*out));
+  out->scene = d.scene;
+  if(d.effect[0] == 0) return d.scene >= 0; // Scene recall
+  if(strcmp(d.effect, "none") == 0){
+    out->stop = true;
+    return true;
+  }
+  out->has_effect = compile(&d, &out->program);
+  return out->has_effect;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "color.h"
+
+/*
+ * Effects engine.
+ *
+ * Effects are described declaratively in JSON, e.g.
+ *   {"effect":"breathe","color":[255,30,0],"period":4000,"min":20}
+ * and compiled once into a compact program for a small stack machine that
+ * works on 16 bit fixed point values (0..65535 stands for 0..1). The
+ * program is evaluated at every render tick with the shared time; the
+ * interpreter does not allocate and uses no floating point.
+ *
+ * Effects:
+ *   static    color
+ *   breathe   color, period, min, max     brightness follows a sine
+ *   hue       color (s, v), period        hue rotation
+ *   strobe    color, period, duty
+ *   candle    color, period, depth        smooth random flicker
+ *   gradient  color, to, fixtures, period position of this fixture among
+ *                                         'fixtures', scrolling if period
+ *   keyframes frames [{"t":ms,"color":[r,g,b]}, ...], loop
+ *   show      plays the show stored in flash (see show.h), black without one
+ * Colors are [r,g,b], times are in milliseconds, levels in 0..255 (values
+ * outside are clamped).
+ */
+
+#define FX_MAX_CODE (80)
+#define FX_MAX_KEYFRAMES (8)
+
+enum {
+  FX_ANIMATED = 1 << 0, // Output depends on time, render every tick
+  FX_HSV = 1 << 1,      // Program writes h, s, v instead of r, g, b
+  FX_SHOW = 1 << 2,     // Play the flash show, the program is the fallback
+};
+
+typedef struct {
+  uint8_t flags;
+  uint8_t len;
+  uint8_t code[FX_MAX_CODE];
+} fx_program_t;
+
+// Effect request as found in a JSON document
+typedef struct {
+  bool has_effect;    // program is valid
+  bool stop;          // {"effect":"none"}
+  int scene;          // "scene" member, -1 if none
+  fx_program_t program;
+} fx_request_t;
+
+// Parse and compile a JSON effect description
+bool fx_compile_json(const char * json, size_t len, fx_request_t * out);
+
+// Evaluate a program at time t_ms for the fixture with the given index
+rgb_t fx_eval(const fx_program_t * program, uint32_t t_ms, uint16_t fixture);
@@ -0,0 +1,119 @@
+#include "gesture.h"
+
+enum {
+  STATE_IDLE = 0,
+  STATE_DOWN,  // Pressed, not long yet
+  STATE_UP,    // Released after a click, waiting for a second press
+  STATE_HELD,  // Long press, repeating until released
+};
+
+static const char * const _names[] = {"none", "click", "double click", "long press", "hold repeat"};
+
+const char * gesture_name(gesture_t g)
+{
+  return g <= GESTURE_HOLD_REPEAT ? _names[g] : "?";
+}
+
+void gesture_init(gesture_recognizer_t * r, const gesture_timing_t * timing)
+{
+  r->timing = timing;
+  r->state = STATE_IDLE;
+  r->second = false;
+  r->since = 0;
+  r->deadline = GESTURE_NO_DEADLINE;
+  r->click_deadline = GESTURE_NO_DEADLINE;
+}
+
+gesture_t gesture_edge(gesture_recognizer_t * r, int64_t now_us, bool pressed)
+{
+  const gesture_timing_t * t = r->timing;
+  switch(r->state){
+  case STATE_IDLE:
+  case STATE_UP:
+    if(pressed){
+      r->second = r->state == STATE_UP;
+      r->state = STATE_DOWN;
+      r->since = now_us;
+      r->deadline = now_us + t->long_us;
+    }
+    return GESTURE_NONE;
+  case STATE_DOWN:
+    if(pressed) return GESTURE_NONE;
+    if(now_us - r->since < t->min_press_us){
+      // Too short to be a press, go back to where it started
+      r->state = r->second ? STATE_UP : STATE_IDLE;
+      r->deadline = r->second ? r->click_deadline : GESTURE_NO_DEADLINE;
+      return GESTURE_NONE;
+    }
+    if(r->second){
+      r->state = STATE_IDLE;
+      r->deadline = GESTURE_NO_DEADLINE;
+      return GESTURE_DOUBLE_CLICK;
+    }
+    r->state = STATE_UP;
+    r->deadline = r->click_deadline = now_us + t->double_us;
+    return GESTURE_NONE;
+  case STATE_HELD:
+    if(!pressed){
+      r->state = STATE_IDLE;
+      r->deadline = GESTURE_NO_DEADLINE;
+    }
+    return GESTURE_NONE;
+  }
+  return GESTURE_NONE;
+}
+
+gesture_t gesture_timeout(gesture_recognizer_t * r, int64_t now_us)
+{
+  if(now_us < r->deadline) return GESTURE_NONE;
+  switch(r->state){
+  case STATE_DOWN:
+    r->state = STATE_HELD;
+    r->deadline += r->timing->repeat_us;
+    return GESTURE_LONG_PRESS;
+  case STATE_HELD:
+    r->deadline += r->timing->repeat_us;
+    return GESTURE_HOLD_REPEAT;
+  case STATE_UP:
+    r->state = STATE_IDLE;
+    r->deadline = GESTURE_NO_DEADLINE;
+    return GESTURE_CLICK;
+  }
+  return GESTURE_NONE;
+}
+
+static void deliver(gesture_loop_t * l, gesture_t gesture, int64_t now_us)
+{
+  if(gesture != GESTURE_NONE) l->io->deliver(l->io->arg, gesture, now_us);
+}
+
+void gesture_loop_init(gesture_loop_t * l, const gesture_timing_t * timing,
+		       const gesture_io_t * io)
+{
+  gesture_init(&l->recognizer, timing);
+  l->io = io;
+  l->resync = GESTURE_NO_DEADLINE;
+}
+
+void gesture_loop_edge(gesture_loop_t * l, int64_t time_us, bool pressed)
+{
+  // A deadline that passed before the edge goes first
+  deliver(l, gesture_timeout(&l->recognizer, time_us), time_us);
+  deliver(l, gesture_edge(&l->recognizer, time_us, pressed), time_us);
+  l->resync = time_us + l->recognizer.timing->lockout_us;
+}
+
+void gesture_loop_wake(gesture_loop_t * l, int64_t now_us)
+{
+  if(now_us >= l->resync){
+    // A bounce can end on a level the ISR threw away, check it settled on
+    // the accepted one
+    bool pressed;
+    l->resync = GESTURE_NO_DEADLINE;
+    if(l->io->sample(l->io->arg, now_us, &pressed)){
+      deliver(l, gesture_edge(&l->recognizer, now_us, pressed), now_us);
+      l->resync = now_us + l->recognizer.timing->lockout_us;
+    }
+  }
+  deliver(l, gesture_timeout(&l->recognizer, now_us), now_us);
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Button edge filtering and gesture recognition.
+ *
+ * The filter runs in the ISR on every edge, with the level read there: an
+ * edge back to the level already accepted is a spike or bounce that is
+ * already over, and edges within 'lockout_us' of an accepted one are bounce.
+ * When a bounce ends on the other level inside the lockout, no edge is left
+ * to report it, so the owner samples the pin once the lockout is over and
+ * feeds the level through the same filter.
+ *
+ * The recognizer gets the accepted edges and is called back at its deadline:
+ *   click          press and release, no second press within double_us
+ *   double click   two clicks within double_us
+ *   long press     held for long_us (a click just before it is dropped)
+ *   hold repeat    every repeat_us while still held after a long press
+ * Presses shorter than min_press_us are ignored.
+ *
+ * The loop ties them together for the task that owns the button: it gets
+ * the edges accepted in the ISR, and is woken at its deadline to run the
+ * recognizer and, once the lockout of the last edge is over, to sample the
+ * pin through the filter.
+ */
+
+#define GESTURE_NO_DEADLINE INT64_MAX
+
+typedef enum {
+  GESTURE_NONE = 0,
+  GESTURE_CLICK,
+  GESTURE_DOUBLE_CLICK,
+  GESTURE_LONG_PRESS,
+  GESTURE_HOLD_REPEAT,
+} gesture_t;
+
+typedef struct {
+  int64_t lockout_us;
+  int64_t min_press_us;
+  int64_t double_us;
+  int64_t long_us;
+  int64_t repeat_us;
+} gesture_timing_t;
+
+typedef struct {
+  bool pressed;     // Accepted level
+  int64_t last_us;  // Time of the last accepted edge
+} gesture_filter_t;
+
+typedef struct {
+  const gesture_timing_t * timing;
+  int state;
+  bool second;            // This is the second press of a double click
+  int64_t since;          // Start of the press
+  int64_t deadline;
+  int64_t click_deadline; // End of the wait for a second press, kept during it
+} gesture_recognizer_t;
+
+// Returns true if the edge is a real transition. Inline so the ISR can run it.
+static inline bool gesture_filter_edge(gesture_filter_t * f, const gesture_timing_t * t,
+				       int64_t now_us, bool pressed)
+{
+  if(pressed == f->pressed) return false;
+  if(now_us - f->last_us < t->lockout_us) return false;
+  f->pressed = pressed;
+  f->last_us = now_us;
+  return true;
+}
+
+const char * gesture_name(gesture_t g);
+
+void gesture_init(gesture_recognizer_t * r, const gesture_timing_t * timing);
+
+// Feed an accepted edge
+gesture_t gesture_edge(gesture_recognizer_t * r, int64_t now_us, bool pressed);
+
+// Call at the deadline (or later)
+gesture_t gesture_timeout(gesture_recognizer_t * r, int64_t now_us);
+
+// Time gesture_timeout has to be called at, GESTURE_NO_DEADLINE if none
+static inline int64_t gesture_deadline(const gesture_recognizer_t * r)
+{
+  return r->deadline;
+}
+
+typedef struct {
+  void (*deliver)(void * arg, gesture_t gesture, int64_t now_us);
+  // Read the pin and run its level through the filter, true if accepted
+  bool (*sample)(void * arg, int64_t now_us, bool * pressed);
+  void * arg;
+} gesture_io_t;
+
+typedef struct {
+  gesture_recognizer_t recognizer;
+  const gesture_io_t * io;
+  int64_t resync;  // End of the lockout of the last edge
+} gesture_loop_t;
+
+void gesture_loop_init(gesture_loop_t * l, const gesture_timing_t * timing,
+		       const gesture_io_t * io);
+
+// An edge accepted by the filter
+void gesture_loop_edge(gesture_loop_t * l, int64_t time_us, bool pressed);
+
+// No edge came before the deadline (or later)
+void gesture_loop_wake(gesture_loop_t * l, int64_t now_us);
+
+// Time to call gesture_loop_wake at, GESTURE_NO_DEADLINE if none
+static inline int64_t gesture_loop_deadline(const gesture_loop_t * l)
+{
+  int64_t d = gesture_deadline(&l->recognizer);
+  return d < l->resync ? d : l->resync;
+}
@@ -12,6 +12,21 @@
 #include "esp_eth.h"
 
 #include <esp_http_server.h>
+#include <esp_heap_caps.h>
+#include <inttypes.h>
+
+#include "pool.h"
+#include "ws_session.h"
+#include "rtos.h"
+#include "api.h"
+#include "control.h"
+#include "fx.h"
+#include "show.h"
+#include "ota.h"
+#include "trace.h"
+#include "audio.h"
+#include "power.h"
+#include "schedule.h"
 
 /* A simple example that demonstrates how to create GET and POST
  * handlers for the web server.
@@ -20,10 +35,32 @@
 static const char *TAG = "http";
 
 typedef struct {
-  const rgb_t * color;
+  const persistent_state_t * leds;
   QueueHandle_t queue;
 } server_state_t;
 
+typedef struct {
+  char * buf;
+  size_t size;
+  size_t len;
+  bool first;
+} stats_writer_t;
+
+// Frames up to this size are received on the stack
+#define WS_SMALL_FRAME (128)
+
+// All the server memory is static, the clients and the jobs are in the
+// pools of ws_session.c
+static server_state_t g_server_state;
+// Set by the httpd task when some client is owed an ack, cleared by the render loop
+static volatile bool g_ack_pending = false;
+static httpd_handle_t g_server = NULL;
+
+// Mailbox of the color picker for the main loop
+static portMUX_TYPE g_color_lock = portMUX_INITIALIZER_UNLOCKED;
+static rgb_t g_color;
+static bool g_color_pending = false;    // A color was posted and not taken yet
+
 /* Serve a file from context */
 static esp_err_t root_get_handler(httpd_req_t *req)
 {
@@ -50,20 +87,12 @@ static const httpd_uri_t js_picker= {
     .user_ctx  = web_file_kellycolorpicker
 };
 
-struct async_resp_arg {
-  httpd_handle_t hd;
-  int fd;
-};
-
 /*
  * async send function, which we put into the httpd work queue
  */
-static void ws_async_send(void *arg)
+static void ws_async_send(void * hd, int fd)
 {
   static const char * data = "Async data";
-  struct async_resp_arg *resp_arg = arg;
-  httpd_handle_t hd = resp_arg->hd;
-  int fd = resp_arg->fd;
   httpd_ws_frame_t ws_pkt;
   memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
   ws_pkt.payload = (uint8_t*)data;
@@ -71,44 +100,198 @@ static void ws_async_send(void *arg)
   ws_pkt.type = HTTPD_WS_TYPE_TEXT;
   
   httpd_ws_send_frame_async(hd, fd, &ws_pkt);
-  free(resp_arg);
 }
 
 static esp_err_t trigger_async_send(httpd_handle_t handle, httpd_req_t *req)
 {
-  struct async_resp_arg *resp_arg = malloc(sizeof(struct async_resp_arg));
-  resp_arg->hd = req->handle;
-  resp_arg->fd = httpd_req_to_sockfd(req);
-  return httpd_queue_work(handle, ws_async_send, resp_arg);
+  bool queued = ws_job_queue(httpd_queue_work, handle, httpd_req_to_sockfd(req),
+			     ws_async_send);
+  return queued ? ESP_OK : ESP_FAIL;
 }
 
-static esp_err_t ws_handler(httpd_req_t *req)
+// Find (or create) the state of the connection of req
+static ws_client_t * ws_client_get(httpd_req_t *req)
+{
+  if(req->sess_ctx) return req->sess_ctx;
+  ws_client_t * client = ws_client_open(httpd_req_to_sockfd(req));
+  if(!client) return NULL;
+  req->sess_ctx = client;
+  req->free_ctx = ws_client_free;
+  return client;
+}
+
+/*
+ * Work item that returns the credits of every client with rendered frames.
+ */
+static void ws_send_acks(void *arg)
+{
+  httpd_handle_t hd = arg;
+  for(ws_client_t * client = ws_client_first(); client; client = client->next){
+    if(client->unacked == 0) continue;
+    char out[24];
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    ws_pkt.payload = (uint8_t*)out;
+    ws_pkt.len = snprintf(out, sizeof(out), "{\"ack\":%d}", client->unacked);
+    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+    if(httpd_ws_send_frame_async(hd, client->fd, &ws_pkt) == ESP_OK){
+      client->unacked = 0;
+    }
+  }
+}
+
+bool http_take_color(rgb_t * out)
+{
+  portENTER_CRITICAL(&g_color_lock);
+  bool taken = g_color_pending;
+  g_color_pending = false;
+  *out = g_color;
+  portEXIT_CRITICAL(&g_color_lock);
+  return taken;
+}
+
+// Posts a color of the picker to the main loop. Only the first post after a
+// take wakes it: the queue only carries wakeups, any of them can overwrite
+// this one and the main loop takes the color whatever woke it.
+static void post_color(QueueHandle_t queue, rgb_t color)
+{
+  portENTER_CRITICAL(&g_color_lock);
+  g_color = color;
+  bool wake = !g_color_pending;
+  g_color_pending = true;
+  portEXIT_CRITICAL(&g_color_lock);
+  if(wake){
+    web_color_event_t ev = {WEB_COLOR_EVID, 0};
+    xQueueOverwrite(queue, &ev);
+  }
+}
+
+void http_notify_rendered(void)
+{
+  if(g_ack_pending && g_server){
+    g_ack_pending = false;
+    httpd_queue_work(g_server, ws_send_acks, g_server);
+  }
+}
+
+/*
+ * Calibration, numbers in 1/RGB_CAL_ONE:
+ *   <r,g,b>                  channel scales of the older firmware, of the
+ *                            color value (value + 128) / 256 at any gamma
+ *   <m00,m01,...,m22>        the matrix by rows
+ *   <m00,...,m22,or,og,ob>   the matrix and the offsets
+ * Too big for the input queue, it goes through control.h
+ */
+static esp_err_t ws_handle_calibration(char * p)
+{
+  int32_t values[12];
+  int n = 0;
+  while(n < 12){
+    char * end;
+    long v = strtol(p, &end, 10);
+    if(end == p) break;
+    values[n++] = MAX(INT16_MIN, MIN(INT16_MAX, v));
+    p = end;
+    if(*p != ',') break;
+    p++;
+  }
+  if(*p != '>'){
+    ESP_LOGW(TAG, "Bad calibration");
+    return ESP_OK;
+  }
+
+  state_patch_t patch;
+  memset(&patch, 0, sizeof(patch));
+  int16_t * m = &patch.cal.matrix[0][0];
+  if(n == 3){
+    for(int c = 0; c < 3; ++c){
+      patch.cal.matrix[c][c] = calib_from_scale(values[c], RGB_GAMMA);
+    }
+    patch.fields = PATCH_CAL_MATRIX;
+  } else if(n == 9 || n == 12){
+    for(int i = 0; i < 9; ++i) m[i] = values[i];
+    patch.fields = PATCH_CAL_MATRIX;
+    if(n == 12){
+      for(int c = 0; c < 3; ++c) patch.cal.offset[c] = values[9 + c];
+      patch.fields |= PATCH_CAL_OFFSET;
+    }
+  } else {
+    ESP_LOGW(TAG, "Calibration needs 3, 9 or 12 numbers, got %d", n);
+    return ESP_OK;
+  }
+  return control_submit(&patch);
+}
+
+// Compile an effect description (see fx.h) and run it, or store it as a scene
+static esp_err_t ws_handle_effect(httpd_req_t *req, httpd_ws_frame_t * ws_pkt)
+{
+  fx_request_t request;
+  state_patch_t patch;
+  memset(&patch, 0, sizeof(patch));
+  bool ok = fx_compile_json((const char*)ws_pkt->payload, ws_pkt->len, &request);
+  if(ok && request.has_effect){
+    if(request.scene >= 0){
+      esp_err_t err = storage_save_scene(request.scene, &request.program);
+      if(err != ESP_OK){
+	ESP_LOGW(TAG, "Scene %d not saved: %s", request.scene, esp_err_to_name(err));
+	ok = false;
+      }
+    }
+    patch.fields = PATCH_EFFECT;
+    patch.effect = request.program;
+  } else if(ok && request.stop){
+    patch.fields = PATCH_EFFECT; // Empty program
+  } else if(ok && request.scene >= 0 && request.scene < SCENE_COUNT){
+    patch.fields = PATCH_SCENE;
+    patch.scene = request.scene;
+  } else {
+    ok = false;
+  }
+  if(ok){
+    control_submit(&patch);
+  }
+  ESP_LOGI(TAG, "Effect %s (%d bytes of code)", ok ? "accepted" : "rejected", patch.effect.len);
+
+  char out[16];
+  snprintf(out, sizeof(out), "{\"fx\":%s}", ok ? "true" : "false");
+  ws_pkt->payload = (uint8_t*)out;
+  ws_pkt->len = strlen(out);
+  ws_pkt->type = HTTPD_WS_TYPE_TEXT;
+  return httpd_ws_send_frame(req, ws_pkt);
+}
+
+// Handle a complete (reassembled) websocket message.
+// payload is NUL terminated and can be modified in place.
+static esp_err_t ws_handle_message(httpd_req_t *req, ws_client_t * client,
+				   httpd_ws_type_t type, uint8_t * payload, size_t len)
 {
   server_state_t * state = (server_state_t*)
     httpd_get_global_user_ctx(req->handle);
-  uint8_t buf[128] = { 0 };
   httpd_ws_frame_t ws_pkt;
   memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-  ws_pkt.payload = buf;
-  ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-  esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, sizeof(buf));
-  if (ret != ESP_OK) {
-    ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
-    return ret;
-  }
-  ESP_LOGI(TAG, "Got packet with message: %s", ws_pkt.payload);
-  ESP_LOGI(TAG, "Packet type: %d", ws_pkt.type);
+  ws_pkt.payload = payload;
+  ws_pkt.len = len;
+  ws_pkt.type = type;
+  ESP_LOGD(TAG, "Got packet with message: %s", ws_pkt.payload);
+  ESP_LOGD(TAG, "Packet type: %d", ws_pkt.type);
   if (ws_pkt.type == HTTPD_WS_TYPE_TEXT){
     // On new connection, send the current rgb value
     if(strcmp((char*)ws_pkt.payload,"get") == 0) {
-      uint8_t out[128];
+      uint8_t out[256];
       if(!state){
 	ESP_LOGE(TAG, "No context found");
       }
-      int r=state->color->r;
-      int g=state->color->g;
-      int b=state->color->b;
-      snprintf((char*)out,sizeof(out), "{\"r\":%d,\"g\":%d,\"b\":%d}", r,g,b);
+      rgb_t rgb = rgb_16_to_8(state->leds->rgb);
+      int r=rgb.r;
+      int g=rgb.g;
+      int b=rgb.b;
+      const rgb_calibration_t * cal = &state->leds->cal;
+      const int16_t * m = &cal->matrix[0][0];
+      snprintf((char*)out,sizeof(out), "{\"r\":%d,\"g\":%d,\"b\":%d,\"credits\":%d,"
+	       "\"cal\":[%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d]}",
+	       r,g,b,CONFIG_WS_CREDITS,
+	       m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8],
+	       cal->offset[0], cal->offset[1], cal->offset[2]);
       ws_pkt.payload = out;
       ws_pkt.len = strlen((char*)out);
       ESP_LOGI(TAG, "New connection on ws, sending color.");
@@ -116,59 +299,122 @@ static esp_err_t ws_handler(httpd_req_t *req)
     }
 
     if(ws_pkt.payload[0] == '[') {
-      ESP_LOGI(TAG, "Got color %s.", ws_pkt.payload);
-      char * data = (char*) ws_pkt.payload;
-      char * parts[3] = {NULL,NULL,NULL};
-      int ipart = 0;
-      for(char *p = data; *p;++p){
-	if(*p == ']' || *p == ',' || *p == '['){
-	  *p = 0;
-	  if(ipart < 3){
-	    parts[ipart++] = p+1;
-	  }
-	}
-      }      
-      if(ipart == 3){
-	ESP_LOGI(TAG, "red: %s, green: %s, blue %s.",
-		 parts[0], parts[1], parts[2]);
-	web_color_event_t msg;
-	msg.id0 = WEB_COLOR_EVID;
-	msg.color.r = atoi(parts[0]);
-	msg.color.g = atoi(parts[1]);
-	msg.color.b = atoi(parts[2]);
-	BaseType_t task_woken = pdFALSE;
-	xQueueOverwrite(state->queue, &msg);
+      ESP_LOGD(TAG, "Got color %s.", ws_pkt.payload);
+      // The client spent a credit on the frame, valid or not: it is returned
+      // at the next render, or at once if nothing is rendered for it
+      int values[3];
+      int n = 0;
+      char * p = (char*) ws_pkt.payload + 1;
+      while(n < 3){
+	char * end;
+	double v = strtod(p, &end); // JSON numbers, the picker may send fractions
+	if(end == p) break;
+	values[n++] = !(v > 0) ? 0 : v >= 255 ? 255 : (int)(v + 0.5); // NaN is 0
+	p = end;
+	if(*p != ',') break;
+	p++;
+      }
+      bool valid = n == 3 && *p == ']';
+      if(valid){
+	rgb_t color = {values[0], values[1], values[2]};
+	// Latest wins: a frame that was not rendered yet is replaced by this one
+	post_color(state->queue, color);
+      } else {
+	ESP_LOGW(TAG, "Bad color %s", ws_pkt.payload);
+      }
+      if(valid && client){
+	client->unacked++;
+	g_ack_pending = true;
+	return ESP_OK;
       }
-      return ESP_OK;
+      static const char ack[] = "{\"ack\":1}";
+      ws_pkt.payload = (uint8_t*)ack;
+      ws_pkt.len = strlen(ack);
+      return httpd_ws_send_frame(req, &ws_pkt);
+    }
+
+    if(ws_pkt.payload[0] == '{') {
+      return ws_handle_effect(req, &ws_pkt);
     }
 
     if(ws_pkt.payload[0] == '<') {
-      ESP_LOGI(TAG, "Got corr %s.", ws_pkt.payload);
-      char * data = (char*) ws_pkt.payload;
-      char * parts[3] = {NULL,NULL,NULL};
-      int ipart = 0;
-      for(char *p = data; *p;++p){
-	if(*p == '>' || *p == ',' || *p == '<'){
-	  *p = 0;
-	  if(ipart < 3){
-	    parts[ipart++] = p+1;
-	  }
-	}
-      }      
-      if(ipart == 3){
-	ESP_LOGI(TAG, "red: %s, green: %s, blue %s.",
-		 parts[0], parts[1], parts[2]);
-	web_calibration_event_t msg;
-	msg.id0 = WEB_CALIBRATION_EVID;
-	msg.color.r_scale = atoi(parts[0]);
-	msg.color.g_scale = atoi(parts[1]);
-	msg.color.b_scale = atoi(parts[2]);
-	BaseType_t task_woken = pdFALSE;
-	xQueueOverwrite(state->queue, &msg);
+      ESP_LOGI(TAG, "Got calibration %s.", ws_pkt.payload);
+      return ws_handle_calibration((char*)ws_pkt.payload + 1);
+    }
+  }
+  return ESP_OK;
+}
+
+/*
+ * Websocket frames are received in two steps: the header first, to learn the
+ * payload length, then the payload itself straight into its final buffer.
+ * Small unfragmented frames (the common case) use the stack, bigger frames and
+ * fragmented messages are assembled into a buffer of ws_session.c.
+ */
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+  uint8_t buf[WS_SMALL_FRAME + 1];
+  httpd_ws_frame_t ws_pkt;
+  memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+  esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
+    return ret;
+  }
+  ws_client_t * client = ws_client_get(req);
+  bool continuation = ws_pkt.type == HTTPD_WS_TYPE_CONTINUE;
+  bool fragmented = continuation || !ws_pkt.final;
+
+  if(!fragmented && ws_pkt.len <= WS_SMALL_FRAME){
+    ws_pkt.payload = buf;
+    if(ws_pkt.len > 0){
+      ret = httpd_ws_recv_frame(req, &ws_pkt, WS_SMALL_FRAME);
+      if (ret != ESP_OK) {
+	ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
+	return ret;
       }
-      return ESP_OK;
     }
+    buf[ws_pkt.len] = 0;
+    return ws_handle_message(req, client, ws_pkt.type, buf, ws_pkt.len);
+  }
+
+  if(!client){
+    return ESP_ERR_NO_MEM;
+  }
+  if(!continuation){
+    // A new message, drop any unfinished one
+    ws_client_drop_rx(client);
+    client->rx_type = ws_pkt.type;
+  } else if(!client->rx){
+    ESP_LOGW(TAG, "Continuation frame without a message start");
+    return ESP_FAIL;
   }
+  if(!ws_client_rx(client)){
+    ESP_LOGW(TAG, "No free websocket receive buffer for %d bytes", ws_pkt.len);
+    return ESP_ERR_NO_MEM;
+  }
+  if(client->rx_len + ws_pkt.len > WS_RX_BUFFER_SIZE){
+    ESP_LOGW(TAG, "Websocket message too long (%d bytes)", client->rx_len + ws_pkt.len);
+    ws_client_drop_rx(client);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  ws_pkt.payload = client->rx->data + client->rx_len;
+  if(ws_pkt.len > 0){
+    ret = httpd_ws_recv_frame(req, &ws_pkt, WS_RX_BUFFER_SIZE - client->rx_len);
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
+      ws_client_drop_rx(client);
+      return ret;
+    }
+  }
+  client->rx_len += ws_pkt.len;
+  if(!ws_pkt.final){
+    return ESP_OK; // Wait for the remaining fragments
+  }
+  client->rx->data[client->rx_len] = 0;
+  ret = ws_handle_message(req, client, client->rx_type,
+			  client->rx->data, client->rx_len);
+  ws_client_drop_rx(client);
   return ret;
 }
 
@@ -180,16 +426,95 @@ static const httpd_uri_t ws = {
   .is_websocket = true
 };
 
-static httpd_handle_t start_webserver(const rgb_t * color, QueueHandle_t queue)
+static void stats_add_pool(pool_t * pool, void * arg)
+{
+  stats_writer_t * w = arg;
+  pool_stats_t st;
+  pool_get_stats(pool, &st);
+  w->len += snprintf(w->buf + w->len, w->size - w->len,
+		     "%s{\"name\":\"%s\",\"size\":%d,\"capacity\":%d,\"in_use\":%d,"
+		     "\"high_water\":%d,\"allocs\":%" PRIu32 ",\"exhausted\":%" PRIu32 "}",
+		     w->first ? "" : ",", st.name, st.item_size, st.capacity,
+		     st.in_use, st.high_water, st.allocs, st.exhausted);
+  if(w->len > w->size) w->len = w->size;
+  w->first = false;
+}
+
+static void stats_add_task(rtos_task_t * task, void * arg)
 {
-  server_state_t * state = (server_state_t *) calloc(1, sizeof(server_state_t));
-  state->color = color;
+  stats_writer_t * w = arg;
+  rtos_task_stats_t st;
+  rtos_task_get_stats(task, &st);
+  w->len += snprintf(w->buf + w->len, w->size - w->len,
+		     "%s{\"name\":\"%s\",\"stack\":%" PRIu32 ",\"stack_free_min\":%" PRIu32
+		     ",\"running\":%s,\"static\":%s}",
+		     w->first ? "" : ",", st.name, st.stack_size, st.stack_free_min,
+		     st.running ? "true" : "false", st.is_static ? "true" : "false");
+  if(w->len > w->size) w->len = w->size;
+  w->first = false;
+}
+
+/* Memory statistics, to check the heap stays flat over long runs */
+static esp_err_t stats_get_handler(httpd_req_t *req)
+{
+  static char buf[2048]; // Handlers run one at a time
+  stats_writer_t w = {buf, sizeof(buf), 0, true};
+  w.len = snprintf(buf, sizeof(buf),
+		   "{\"heap_free\":%u,\"heap_min_free\":%u,\"heap_largest_block\":%u,\"pools\":[",
+		   heap_caps_get_free_size(MALLOC_CAP_8BIT),
+		   heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+		   heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  pool_for_each(stats_add_pool, &w);
+  w.len += snprintf(buf + w.len, sizeof(buf) - w.len, "],\"tasks\":[");
+  w.first = true;
+  rtos_task_for_each(stats_add_task, &w);
+  w.len += snprintf(buf + w.len, sizeof(buf) - w.len, "]");
+#ifdef CONFIG_AUDIO_ENABLE
+  audio_stats_t audio;
+  audio_get_stats(&audio);
+  w.len += snprintf(buf + w.len, sizeof(buf) - w.len,
+		    ",\"audio\":{\"blocks\":%" PRIu32 ",\"skipped\":%" PRIu32
+		    ",\"last_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+		    audio.blocks, audio.skipped, audio.last_us, audio.max_us);
+#endif
+  limit_stats_t limit;
+  uint32_t budget_ma;
+  rgb_get_limit_stats(&limit, &budget_ma);
+  uint32_t mean_scale = limit.limited ? limit.scale_sum / limit.limited : LIMIT_SCALE_ONE;
+  w.len += snprintf(buf + w.len, sizeof(buf) - w.len,
+		    ",\"limit\":{\"budget_ma\":%" PRIu32 ",\"draw_ma\":%" PRIu32
+		    ",\"peak_ma\":%" PRIu32 ",\"frames\":%" PRIu32 ",\"limited\":%" PRIu32
+		    ",\"min_scale_pct\":%" PRIu32 ",\"mean_scale_pct\":%" PRIu32 "}",
+		    budget_ma, limit.draw_ma, limit.peak_ma, limit.frames, limit.limited,
+		    limit.min_scale * 100 / LIMIT_SCALE_ONE, mean_scale * 100 / LIMIT_SCALE_ONE);
+  w.len += snprintf(buf + w.len, sizeof(buf) - w.len, "}");
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+}
+
+static const httpd_uri_t stats = {
+  .uri        = "/stats",
+  .method     = HTTP_GET,
+  .handler    = stats_get_handler,
+  .user_ctx   = NULL
+};
+
+// The server state is static, nothing to free
+static void static_ctx_free(void * ctx)
+{
+}
+
+static httpd_handle_t start_webserver(const persistent_state_t * leds, QueueHandle_t queue)
+{
+  server_state_t * state = &g_server_state;
+  state->leds = leds;
   state->queue = queue;
 
   httpd_handle_t server = NULL;
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.global_user_ctx = state;
-  config.global_user_ctx_free_fn = free;
+  config.global_user_ctx_free_fn = static_ctx_free;
+  config.max_uri_handlers = 20;
   
   // Start the httpd server
   ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
@@ -199,6 +524,13 @@ static httpd_handle_t start_webserver(const rgb_t * color, QueueHandle_t queue)
     httpd_register_uri_handler(server, &root);
     httpd_register_uri_handler(server, &js_picker);
     httpd_register_uri_handler(server, &ws);
+    httpd_register_uri_handler(server, &stats);
+    api_register(server, leds);
+    show_register(server);
+    ota_register(server);
+    trace_register(server);
+    power_register(server);
+    schedule_register(server);
     return server;
   }
 
@@ -224,7 +556,7 @@ static void disconnect_handler(void* arg, esp_event_base_t event_base,
 }
 
 // Filthy
-static const rgb_t * g_color;
+static const persistent_state_t * g_leds;
 static QueueHandle_t g_queue;
 
 static void connect_handler(void* arg, esp_event_base_t event_base,
@@ -233,16 +565,15 @@ static void connect_handler(void* arg, esp_event_base_t event_base,
   httpd_handle_t* server = (httpd_handle_t*) arg;
   if (*server == NULL) {
     ESP_LOGI(TAG, "Starting webserver");
-    *server = start_webserver(g_color, g_queue);
+    *server = start_webserver(g_leds, g_queue);
   }
 }
 
-void init_httpd(const rgb_t * color, QueueHandle_t queue)
+void init_httpd(const persistent_state_t * leds, QueueHandle_t queue)
 {
-  g_color = color;
+  g_leds = leds;
   g_queue = queue;
-  static httpd_handle_t server = NULL;
-  ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, &server));
-  ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, &server));
-  server = start_webserver(color, queue);
+  ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, &g_server));
+  ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, &g_server));
+  g_server = start_webserver(leds, queue);
 }
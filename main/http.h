@@ -1,5 +1,6 @@
 #pragma once
 #include "rgb.h"
+#include "storage.h"
 #include <stdint.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -10,22 +11,30 @@
 // receive a function that in turns queues events, its a lot more flexible than
 // hacky id's.
 static const uint32_t WEB_COLOR_EVID = 0x177EB011;
-static const uint32_t WEB_CALIBRATION_EVID = 0x38f134ab;
 
+// Wakes the main loop up, the color is taken with http_take_color
 typedef struct {
   uint32_t id0;
-  rgb_t color;
+  uint32_t id1;
 } web_color_event_t;
 
-typedef struct {
-  uint32_t id0;
-  rgb_calibration_t color;
-} web_calibration_event_t;
-
 
 /**
- * color points to a structure that holds the current rgb state of the leds.
+ * state points to the current state of the leds.
  * The structure is read over time, so it needs to be in memory and up-to-date
  * queue  Is the queue that receives events from the web.
  */
-void init_httpd(const rgb_t * color, QueueHandle_t queue);
+void init_httpd(const persistent_state_t * state, QueueHandle_t queue);
+
+/**
+ * Tell the web clients that the latest state has been rendered.
+ * Called from the render loop after the LEDs are updated, it returns the
+ * credits of the color frames received so far (see CONFIG_WS_CREDITS).
+ */
+void http_notify_rendered(void);
+
+/**
+ * Take the latest color of the web color picker, returns false if none came
+ * since the last take. Colors that came in between are dropped, latest wins.
+ */
+bool http_take_color(rgb_t * out);
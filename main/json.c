@@ -0,0 +1,277 @@
+#include "json.h"
+
+#include <string.h>
+#include <limits.h>
+
+enum {
+  S_VALUE,          // Expecting a value
+  S_VALUE_OR_END,   // After '[': a value or ']'
+  S_KEY_OR_END,     // After '{': a key or '}'
+  S_KEY,            // After ',' in an object
+  S_COLON,
+  S_AFTER_VALUE,    // Expecting ',' or the end of the container
+  S_STRING,
+  S_ESCAPE,
+  S_UNICODE,
+  S_NUMBER,
+  S_LITERAL,
+  S_DONE,
+};
+
+static inline bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool in_array(const json_reader_t * r)
+{
+  return r->depth > 0 && (r->arrays & (1u << (r->depth - 1)));
+}
+
+static bool emit(json_reader_t * r, json_event_t event)
+{
+  if(!r->callback(r, event, r->arg)) r->error = true;
+  return !r->error;
+}
+
+static void token_add(json_reader_t * r, char c)
+{
+  if(r->token_len < JSON_TOKEN_MAX - 1) r->token[r->token_len++] = c;
+}
+
+static void token_start(json_reader_t * r)
+{
+  r->token_len = 0;
+}
+
+static const char * token_end(json_reader_t * r)
+{
+  r->token[r->token_len] = 0;
+  return r->token;
+}
+
+static void value_done(json_reader_t * r)
+{
+  r->state = r->depth == 0 ? S_DONE : S_AFTER_VALUE;
+}
+
+static bool open_container(json_reader_t * r, bool array)
+{
+  if(r->depth >= JSON_MAX_DEPTH) return false;
+  if(array){
+    r->arrays |= 1u << r->depth;
+  } else {
+    r->arrays &= ~(1u << r->depth);
+  }
+  r->keys[r->depth][0] = 0;
+  r->index[r->depth] = 0;
+  r->depth++;
+  r->state = array ? S_VALUE_OR_END : S_KEY_OR_END;
+  return emit(r, array ? JSON_ARRAY_START : JSON_OBJECT_START);
+}
+
+static bool close_container(json_reader_t * r, bool array)
+{
+  if(r->depth == 0 || in_array(r) != array) return false;
+  if(!emit(r, array ? JSON_ARRAY_END : JSON_OBJECT_END)) return false;
+  r->depth--;
+  value_done(r);
+  return true;
+}
+
+// Parse the number in token, rounding any fraction and ignoring exponents
+static bool number_end(json_reader_t * r)
+{
+  const char * p = token_end(r);
+  bool negative = false;
+  int64_t value = 0;
+  if(*p == '-'){
+    negative = true;
+    ++p;
+  }
+  if(*p < '0' || *p > '9') return false;
+  for(; *p >= '0' && *p <= '9'; ++p){
+    if(value < INT32_MAX) value = value * 10 + (*p - '0');
+  }
+  if(*p == '.'){
+    ++p;
+    if(*p < '0' || *p > '9') return false;
+    if(*p >= '5') value++;
+    while(*p >= '0' && *p <= '9') ++p;
+  }
+  if(*p == 'e' || *p == 'E') return false;
+  if(*p) return false;
+  if(value > INT32_MAX) value = INT32_MAX;
+  r->number = negative ? -value : value;
+  value_done(r);
+  return emit(r, JSON_NUMBER);
+}
+
+static bool literal_end(json_reader_t * r)
+{
+  const char * t = token_end(r);
+  json_event_t event;
+  if(strcmp(t, "true") == 0) event = JSON_TRUE;
+  else if(strcmp(t, "false") == 0) event = JSON_FALSE;
+  else if(strcmp(t, "null") == 0) event = JSON_NULL;
+  else return false;
+  value_done(r);
+  return emit(r, event);
+}
+
+static bool string_end(json_reader_t * r)
+{
+  const char * t = token_end(r);
+  if(r->is_key){
+    strcpy(r->keys[r->depth - 1], t);
+    r->state = S_COLON;
+    return true;
+  }
+  value_done(r);
+  return emit(r, JSON_STRING);
+}
+
+// Start reading a value with its first character
+static bool value_start(json_reader_t * r, char c)
+{
+  token_start(r);
+  if(c == '{') return open_container(r, false);
+  if(c == '[') return open_container(r, true);
+  if(c == '"'){
+    r->is_key = false;
+    r->state = S_STRING;
+    return true;
+  }
+  if(c == '-' || (c >= '0' && c <= '9')){
+    token_add(r, c);
+    r->state = S_NUMBER;
+    return true;
+  }
+  if(c >= 'a' && c <= 'z'){
+    token_add(r, c);
+    r->state = S_LITERAL;
+    return true;
+  }
+  return false;
+}
+
+static bool step(json_reader_t * r, char c)
+{
+  switch(r->state){
+  case S_VALUE:
+    if(is_space(c)) return true;
+    return value_start(r, c);
+  case S_VALUE_OR_END:
+    if(is_space(c)) return true;
+    if(c == ']') return close_container(r, true);
+    return value_start(r, c);
+  case S_KEY_OR_END:
+    if(is_space(c)) return true;
+    if(c == '}') return close_container(r, false);
+    // fall through
+  case S_KEY:
+    if(is_space(c)) return true;
+    if(c != '"') return false;
+    token_start(r);
+    r->is_key = true;
+    r->state = S_STRING;
+    return true;
+  case S_COLON:
+    if(is_space(c)) return true;
+    if(c != ':') return false;
+    r->state = S_VALUE;
+    return true;
+  case S_AFTER_VALUE:
+    if(is_space(c)) return true;
+    if(c == ','){
+      if(in_array(r)){
+	r->index[r->depth - 1]++;
+	r->state = S_VALUE;
+      } else {
+	r->state = S_KEY;
+      }
+      return true;
+    }
+    if(c == '}') return close_container(r, false);
+    if(c == ']') return close_container(r, true);
+    return false;
+  case S_STRING:
+    if(c == '"') return string_end(r);
+    if(c == '\\'){
+      r->state = S_ESCAPE;
+      return true;
+    }
+    if((unsigned char) c < 0x20) return false;
+    token_add(r, c);
+    return true;
+  case S_ESCAPE:
+    r->state = S_STRING;
+    switch(c){
+    case '"': case '\\': case '/': token_add(r, c); return true;
+    case 'b': token_add(r, '\b'); return true;
+    case 'f': token_add(r, '\f'); return true;
+    case 'n': token_add(r, '\n'); return true;
+    case 'r': token_add(r, '\r'); return true;
+    case 't': token_add(r, '\t'); return true;
+    case 'u':
+      // Non ASCII characters are not needed, keep a placeholder
+      token_add(r, '?');
+      r->unicode_left = 4;
+      r->state = S_UNICODE;
+      return true;
+    default:
+      return false;
+    }
+  case S_UNICODE:
+    if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')))
+      return false;
+    if(--r->unicode_left == 0) r->state = S_STRING;
+    return true;
+  case S_NUMBER:
+    if((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'e' || c == 'E'){
+      token_add(r, c);
+      return true;
+    }
+    return number_end(r) && step(r, c);
+  case S_LITERAL:
+    if(c >= 'a' && c <= 'z'){
+      token_add(r, c);
+      return true;
+    }
+    return literal_end(r) && step(r, c);
+  case S_DONE:
+    return is_space(c);
+  }
+  return false;
+}
+
+void json_reader_init(json_reader_t * reader, json_callback_t callback, void * arg)
+{
+  memset(reader, 0, sizeof(*reader));
+  reader->callback = callback;
+  reader->arg = arg;
+  reader->state = S_VALUE;
+}
+
+bool json_reader_feed(json_reader_t * reader, const char * data, size_t len)
+{
+  for(size_t i = 0; i < len && !reader->error; ++i){
+    if(!step(reader, data[i])) reader->error = true;
+  }
+  return !reader->error;
+}
+
+bool json_reader_finish(json_reader_t * reader)
+{
+  if(reader->error) return false;
+  // A document made of a single number or literal ends with the input
+  if(reader->state == S_NUMBER && !number_end(reader)) reader->error = true;
+  if(reader->state == S_LITERAL && !literal_end(reader)) reader->error = true;
+  return !reader->error && reader->state == S_DONE;
+}
+
+const char * json_reader_key(const json_reader_t * reader, int depth)
+{
+  if(depth < 1 || depth > reader->depth) return "";
+  return reader->keys[depth - 1];
+}
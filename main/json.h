@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Streaming, non-allocating JSON reader.
+ *
+ * The input is fed in chunks of any size (e.g. as it is received from a
+ * socket) and the reader calls back for every value it finds, SAX style.
+ * Nothing is built in memory: the reader only keeps the key (or array
+ * index) of every open container, so the callback can tell where a value
+ * is, and the text of the token being read.
+ *
+ * Limits: JSON_MAX_DEPTH nested containers, strings and keys are truncated
+ * to JSON_TOKEN_MAX - 1 characters, numbers are rounded to integers.
+ */
+
+#define JSON_MAX_DEPTH (6)
+#define JSON_TOKEN_MAX (24)
+
+typedef enum {
+  JSON_OBJECT_START,
+  JSON_OBJECT_END,
+  JSON_ARRAY_START,
+  JSON_ARRAY_END,
+  JSON_STRING,
+  JSON_NUMBER,
+  JSON_TRUE,
+  JSON_FALSE,
+  JSON_NULL,
+} json_event_t;
+
+struct json_reader;
+
+// Return false to stop parsing (the reader then reports an error)
+typedef bool (*json_callback_t)(struct json_reader * reader, json_event_t event, void * arg);
+
+typedef struct json_reader {
+  json_callback_t callback;
+  void * arg;
+  uint8_t state;
+  uint8_t depth;        // Open containers, values are reported at this depth
+  uint32_t arrays;      // Bit d is set if container d is an array
+  bool error;
+  bool is_key;          // The string being read is a key
+  char keys[JSON_MAX_DEPTH][JSON_TOKEN_MAX]; // Current key of each open object
+  uint16_t index[JSON_MAX_DEPTH];            // Current index of each open array
+  char token[JSON_TOKEN_MAX]; // Text of the current string / number / literal
+  uint8_t token_len;
+  uint8_t unicode_left;
+  int32_t number;       // Value of the last JSON_NUMBER
+} json_reader_t;
+
+void json_reader_init(json_reader_t * reader, json_callback_t callback, void * arg);
+
+// Feed the next chunk of input. Returns false once the input is invalid.
+bool json_reader_feed(json_reader_t * reader, const char * data, size_t len);
+
+// Signal the end of the input. Returns true if a complete document was read.
+bool json_reader_finish(json_reader_t * reader);
+
+// Key of the value (or container) at the given depth, "" inside arrays
+const char * json_reader_key(const json_reader_t * reader, int depth);
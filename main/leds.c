@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <string.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -6,12 +7,25 @@
 #include <esp_system.h>
 #include <esp_log.h>
 
-#include "rotary_encoder.h"
+#include "encoder.h"
 #include "button.h"
 #include "rgb.h"
 #include "wifi.h"
 #include "http.h"
 #include "storage.h"
+#include "control.h"
+#include "dmx.h"
+#include "timesync.h"
+#include "fx.h"
+#include "show.h"
+#include "ota.h"
+#include "mqtt.h"
+#include "state.h"
+#include "fade.h"
+#include "trace.h"
+#include "audio.h"
+#include "power.h"
+#include "schedule.h"
 
 #define TAG "LED"
 
@@ -21,32 +35,29 @@
 #define RED_GPIO (CONFIG_RGB_RED)
 #define GREEN_GPIO (CONFIG_RGB_GREEN)
 #define BLUE_GPIO (CONFIG_RGB_BLUE)
+#define RENDER_MAX_FPS (CONFIG_RENDER_MAX_FPS)
+#define FX_FIXTURE_INDEX (CONFIG_FX_FIXTURE_INDEX)
 
 typedef persistent_state_t state_t; // All state is persistent state.
 
 static const bool ENABLE_HALF_STEPS = true; // true: Full resol. encoder, worse error recovery
-static const uint32_t DEBOUNCE_TIME = 400;   // in milliseconds
+static const TickType_t IDLE_WAIT = 1000 / portTICK_PERIOD_MS;
 
 static inline int max(int a, int b){
   return (a > b) ? a : b;
 }
 
-static inline int min(int a, int b){
-  return (a < b) ? a : b;
-}
-
-enum mode {
-  MODE_HUE = 0,
-  MODE_SAT,
-  MODE_VALUE
-};
+// The effect being played, it takes over the color until a color is set
+typedef struct {
+  bool running;
+  fx_program_t program;
+} effect_t;
 
 typedef struct {
-  rotary_encoder_info_t encoder;
   button_info_t button;
   QueueHandle_t queue; 
-  int encoder_ref; // The encoder value is never reset, we use this to keep track of its delta.
-  uint32_t btn_last_time; // Last time the button was pressed, for shitty debounce
+  int scene; // Last scene recalled with the button
+  int beats; // Counted towards the next scene in the audio scene mode
 } input_t;
 
 void setup_input(input_t * input)
@@ -54,96 +65,218 @@ void setup_input(input_t * input)
   // esp32-rotary-encoder and button require that the GPIO ISR service
   ESP_ERROR_CHECK(gpio_install_isr_service(0));
   
-  // Initialise the rotary encoder device with the GPIOs for A and B signals
-  ESP_ERROR_CHECK(rotary_encoder_init(&input->encoder,
-				      ROT_ENC_A_GPIO, ROT_ENC_B_GPIO));
-  ESP_ERROR_CHECK(rotary_encoder_enable_half_steps(&input->encoder,
-						   ENABLE_HALF_STEPS));
-  ESP_ERROR_CHECK(rotary_encoder_flip_direction(&input->encoder));
+  // queue
+  input->queue = button_create_queue();
+
+  // Initialise the rotary encoder device with the GPIOs for A and B signals,
+  // it only wakes us up with its summed steps
+  ESP_ERROR_CHECK(encoder_init(ROT_ENC_A_GPIO, ROT_ENC_B_GPIO,
+			       ENABLE_HALF_STEPS, input->queue));
 
   // Initialise the button
   ESP_ERROR_CHECK(button_init(&input->button, BUTTON_GPIO));
-  
-  // queue
-  input->queue = rotary_encoder_create_queue();
-  ESP_ERROR_CHECK(rotary_encoder_set_queue(&input->encoder,
-					   input->queue));
   ESP_ERROR_CHECK(button_set_queue(&input->button,
 				   input->queue));
-  
+  input->scene = -1;
+
+  // Light sleep misses the interrupts, see power.h
+  power_watch(BUTTON_GPIO, button_check, &input->button);
+  power_watch(ROT_ENC_A_GPIO, NULL, NULL);
+  power_watch(ROT_ENC_B_GPIO, NULL, NULL);
 }
 
 esp_err_t unsetup_input(input_t * input){
-  ESP_ERROR_CHECK(rotary_encoder_uninit(&input->encoder));
+  ESP_ERROR_CHECK(encoder_uninit());
   return 0;
 }
 
 static const char * const _color_fields[] = {"hue","sat","value"};
 
 // Handles physical interface, returns true if something is updated.
-bool handle_input(input_t * input, state_t * state) {
+// Waits at most 'wait' ticks for an event.
+bool handle_input(input_t * input, state_t * state, effect_t * effect, TickType_t wait) {
+  // Every event is a wake up without data, the one slot of the queue can
+  // be overwritten: what they announce is taken from the mailboxes
   union {
-    rotary_encoder_event_t re;
     button_event_t bt;
     web_color_event_t web_color;
-    web_calibration_event_t web_cal;
   } event;
-  if (xQueueReceive(input->encoder.queue, &event,
-		    1000/portTICK_PERIOD_MS) == pdTRUE){
+  if (xQueueReceive(input->queue, &event, wait) == pdTRUE){
     if(event.bt.id0 == BUTTON_EVID){
-      // Ask/Google debouncing if you are looking at this code
-      uint32_t now = esp_log_timestamp();
-      if(now - input->btn_last_time > DEBOUNCE_TIME) {
-	input->btn_last_time = now;
-	
-	state->cursor_mode = state->cursor_mode + 1;
-	if(state->cursor_mode > 2) state->cursor_mode = 0;
-	ESP_LOGI(TAG, "Encoder mode: %s", _color_fields[state->cursor_mode]);
-      } else {
-	ESP_LOGW(TAG, "Encoder mode debounce override");
-	return false; // Nothing changed
-      }
+      return false; // Just a wake up, the gestures are taken by handle_button
     }else if(event.bt.id0 == WEB_COLOR_EVID){
-      ESP_LOGI(TAG, "Web color event");
-      state->rgb = event.web_color.color;
-      state->hsv = rgb_to_hsv(state->rgb);
-      return true;
-    }else if(event.bt.id0 == WEB_CALIBRATION_EVID){
-      ESP_LOGI(TAG, "Web calibration event");
-      state->cal = event.web_cal.color;
-      return true;
+      return false; // Just a wake up, the color is taken by handle_web_color
+    }else if(event.bt.id0 == DMX_EVID){
+      return true; // A console color, or the console is gone: render
+    }else if(event.bt.id0 == CONTROL_EVID){
+      return false; // Just a wake up, the patch is applied by handle_control
+    }else if(event.bt.id0 == AUDIO_EVID){
+      return false; // Just a wake up, the analysis is taken at the next render
+    }else if(event.bt.id0 == ENCODER_EVID){
+      return true; // The steps are taken by handle_encoder at the next render
     }else{
-      int delta = event.re.state.position - input->encoder_ref;
-      input->encoder_ref = event.re.state.position;
-
-      // Use an int to prevent overflow "wrap-around"
-      uint8_t * target = &((uint8_t*)(&state->hsv))[state->cursor_mode];
-      int new_value = max(0,min(0xff,*target + delta));
-      
-      ESP_LOGI(TAG, "Encoder: %s = %d + %d",
-	       _color_fields[state->cursor_mode],
-	       *target, delta);
-      
-      *target = new_value & 0xff;
-      state->rgb = hsv_to_rgb(state->hsv);
+      ESP_LOGW(TAG, "Unknown event %08x", event.bt.id0);
+      return false;
     }
     return true;
   }
   return false;
 }
 
+// Applies the encoder steps summed since the last render, returns true if
+// something is updated.
+bool handle_encoder(state_t * state, effect_t * effect)
+{
+  int delta = encoder_take();
+  if(delta == 0){
+    return false;
+  }
+  ESP_LOGD(TAG, "Encoder: %s + %d", _color_fields[state->cursor_mode], delta);
+  trace_encoder(delta);
+  state_step(state, delta);
+  effect->running = false;
+  return true;
+}
+
+// Plays the next scene that is saved after the last one recalled, the
+// caller turns the light on
+static bool recall_next_scene(input_t * input, state_t * state, effect_t * effect)
+{
+  for(int i = 1; i <= SCENE_COUNT; ++i){
+    int scene = (input->scene + i) % SCENE_COUNT;
+    if(storage_load_scene(scene, &effect->program) == ESP_OK){
+      ESP_LOGI(TAG, "Playing scene %d", scene);
+      input->scene = scene;
+      effect->running = true;
+      if(effect->program.flags & FX_SHOW){
+	show_start(timesync_now_us());
+      }
+      return true;
+    }
+  }
+  ESP_LOGW(TAG, "No scene saved");
+  return false;
+}
+
+// Applies the gestures of the button (state_gesture), returns true if
+// something is updated.
+bool handle_button(input_t * input, state_t * state, effect_t * effect)
+{
+  bool updated = false;
+  gesture_t gesture;
+  while((gesture = button_take(&input->button)) != GESTURE_NONE){
+    bool scene = gesture == GESTURE_DOUBLE_CLICK && recall_next_scene(input, state, effect);
+    bool applied = state_gesture(state, gesture, scene);
+    if(applied && gesture == GESTURE_CLICK){
+      ESP_LOGI(TAG, "Encoder mode: %s", _color_fields[state->cursor_mode]);
+    } else if(applied && gesture == GESTURE_LONG_PRESS){
+      ESP_LOGI(TAG, "Power %s", state->on ? "on" : "off");
+    }
+    trace_gesture(gesture, applied);
+    updated |= applied;
+  }
+  return updated;
+}
+
+// Applies the latest color of the web color picker, returns true if something is updated.
+bool handle_web_color(state_t * state, effect_t * effect)
+{
+  rgb_t color;
+  if(!http_take_color(&color)){
+    return false;
+  }
+  ESP_LOGD(TAG, "Web color %d,%d,%d", color.r, color.g, color.b);
+  trace_web_color(color);
+  effect->running = false;
+  state_set_rgb(state, color);
+  return true;
+}
+
+// Applies the changes submitted through control.h, returns true if something is updated.
+// A ramp goes to 'ramp_ms'.
+bool handle_control(state_t * state, effect_t * effect, int32_t * ramp_ms)
+{
+  state_patch_t patch;
+  if(!control_take(&patch)){
+    return false;
+  }
+  ESP_LOGD(TAG, "Control patch %08x", patch.fields);
+  trace_control(&patch);
+  bool updated = patch_apply(state, &patch);
+  if(patch.fields & (PATCH_RGB | PATCH_HSV)){
+    effect->running = false;
+  }
+  if(patch.fields & PATCH_RAMP){
+    *ramp_ms = patch.ramp_s * 1000;
+    updated = true;
+  }
+  if(patch.fields & PATCH_EFFECT){
+    effect->program = patch.effect;
+    effect->running = patch.effect.len > 0;
+    updated = true;
+  }
+  if(patch.fields & PATCH_SCENE){
+    esp_err_t err = storage_load_scene(patch.scene, &effect->program);
+    if(err == ESP_OK){
+      ESP_LOGI(TAG, "Playing scene %d", patch.scene);
+      effect->running = true;
+      updated = true;
+    } else {
+      ESP_LOGW(TAG, "Scene %d not loaded: %s", patch.scene, esp_err_to_name(err));
+    }
+  }
+  if(effect->running && (patch.fields & (PATCH_EFFECT | PATCH_SCENE)) &&
+     (effect->program.flags & FX_SHOW)){
+    show_start(timesync_now_us());
+  }
+  return updated;
+}
+
+#ifdef CONFIG_AUDIO_ENABLE
+// Takes the analysis of the music for this render, returns false without
+// it. In the scene mode the beats step through the saved scenes.
+bool handle_audio(input_t * input, state_t * state, effect_t * effect, audio_features_t * audio)
+{
+  int beats = 0;
+  if(state->audio == AUDIO_OFF || !audio_take(audio, &beats)){
+    return false;
+  }
+  if(state->audio == AUDIO_SCENE && state->on && beats > 0){
+    input->beats += beats;
+    if(input->beats >= CONFIG_AUDIO_SCENE_BEATS){
+      input->beats = 0;
+      if(recall_next_scene(input, state, effect)){
+	// Recorded as the patch it amounts to
+	state_patch_t patch = {.fields = PATCH_SCENE, .scene = input->scene};
+	trace_control(&patch);
+      }
+    }
+  }
+  return true;
+}
+#else
+static inline bool handle_audio(input_t * input, state_t * state, effect_t * effect,
+				audio_features_t * audio)
+{
+  return false;
+}
+#endif
+
 void initialize_state(persistent_state_t * s){
-  s->rgb.r = 255;
-  s->rgb.g = 30;
-  s->rgb.b = 0;
-  s->hsv = rgb_to_hsv(s->rgb);
-
-  // Calibrated by hand
-  s->cal.r_scale = 128;
-  s->cal.g_scale = 0;
-  s->cal.b_scale = 50;
+  rgb_t rgb = {255, 30, 0};
+  s->rgb = rgb_8_to_16(rgb);
+  s->hsv = rgb16_to_hsv16(s->rgb);
+
+  // Calibrated by hand: green at 1/2 and blue at 0.7 of the color value,
+  // the same white point with any gamma
+  static const int32_t scales[3] = {128, 0, 50};
+  memset(&s->cal, 0, sizeof(s->cal));
+  for(int c = 0; c < 3; ++c) s->cal.matrix[c][c] = calib_from_scale(scales[c], RGB_GAMMA);
   
   s->cursor_mode = MODE_VALUE;
+  s->transition_ms = 0;
+  s->on = true;
+  s->audio = AUDIO_OFF;
 }
 
 void app_main()
@@ -152,19 +285,101 @@ void app_main()
   state_t * state = storage_initialize(initialize_state);
   input_t input = {0};
   // init stuff
+  ESP_ERROR_CHECK(power_init());
   rgb_init(RED_GPIO, GREEN_GPIO, BLUE_GPIO);
   wifi_main();
   setup_input(&input);
-  init_httpd(&state->rgb, input.queue);
+  control_init(input.queue);
+  ESP_ERROR_CHECK(show_init());
+  init_httpd(state, input.queue);
+#ifdef CONFIG_DMX_ENABLE
+  ESP_ERROR_CHECK(dmx_init(input.queue));
+#endif
+#ifdef CONFIG_TIMESYNC_ENABLE
+  ESP_ERROR_CHECK(timesync_init());
+#endif
+  ESP_ERROR_CHECK(ota_init());
+#ifdef CONFIG_MQTT_ENABLE
+  ESP_ERROR_CHECK(mqtt_init(state));
+#endif
+  ESP_ERROR_CHECK(trace_init(state));
+  if(audio_init(input.queue) != ESP_OK){
+    ESP_LOGW(TAG, "Going on without audio");
+  }
+  ESP_ERROR_CHECK(schedule_init());
   
   rgb_set_calib(state->cal);
-  rgb_set(state->rgb);
+  rgb_t shown = rgb_16_to_8(state->rgb);
+  rgb_set(shown);
+  fade_t fade = {shown, shown, shown, 0, 0};
+  static effect_t effect; // Too big for the stack of the main task
+
+  // Input is applied to the state as it arrives, but the LEDs are updated at
+  // most RENDER_MAX_FPS times per second: a burst of events costs one render.
+  // Encoder steps are summed until the render that follows them.
+  // Render ticks fall on multiples of the period of the shared time, so
+  // synchronized controllers render in step.
+  const int64_t render_period = 1000000 / RENDER_MAX_FPS;
+  int64_t next_render = 0;
+  bool dirty = false;
+  int32_t ramp_ms = -1; // Transition of the next render instead of the state's (PATCH_RAMP)
   while (1) {
-    bool updated = handle_input(&input, state);
-    if(updated){
+    TickType_t wait = IDLE_WAIT;
+    if(dirty){
+      int64_t left = next_render - esp_timer_get_time();
+      wait = left <= 0 ? 0 : max(1, pdMS_TO_TICKS((left + 999) / 1000));
+    }
+    if(handle_input(&input, state, &effect, wait)){
+      dirty = true;
+    }
+    if(handle_button(&input, state, &effect)){
+      dirty = true;
+    }
+    if(handle_web_color(state, &effect)){
+      dirty = true;
+    }
+    if(handle_control(state, &effect, &ramp_ms)){
+      dirty = true;
+    }
+    if(encoder_pending() || dmx_pending()){
+      dirty = true; // Their wakeup may have been overwritten by another event
+    }
+    if(state->audio != AUDIO_OFF && audio_ready()){
+      dirty = true; // A new block of music changes the color
+    }
+    int64_t now = esp_timer_get_time();
+    if(dirty && now >= next_render){
+      uint32_t now_ms = now / 1000;
+      handle_encoder(state, &effect);
+      audio_features_t audio;
+      bool heard = handle_audio(&input, state, &effect, &audio);
       rgb_set_calib(state->cal);
-      rgb_set(state->rgb);
-      // ToDo notify clients
+      rgb_t frame;
+      bool playing = state->on && effect.running;
+      if(playing){
+	// Effects run on the shared time, synchronized fixtures stay in phase.
+	// When the effect stops, the fade starts from its last color.
+	int64_t t = timesync_now_us();
+	if(!(effect.program.flags & FX_SHOW) || !show_frame(t, FX_FIXTURE_INDEX, &frame)){
+	  frame = fx_eval(&effect.program, t / 1000, FX_FIXTURE_INDEX);
+	}
+      }
+      // Keep rendering until the fade is over, or while the effect moves
+      bool fading = fade_render(&fade, state, playing ? &frame : NULL, &ramp_ms, now_ms);
+      dirty = playing ? (effect.program.flags & FX_ANIMATED) != 0 : fading;
+      trace_render(state, fade.shown, effect.running, now_ms);
+      rgb_t out = heard ? audio_apply(state->audio, fade.shown, &audio) : fade.shown;
+      // A console drives the output instead of the state while it is there
+      rgb_t console;
+      bool from_console = dmx_take(&console);
+      if(!dmx_active()){
+	rgb_set(out);
+      } else if(from_console){
+	rgb_set(console);
+      }
+      next_render = timesync_next_tick(now, render_period);
+      http_notify_rendered();
+      mqtt_notify_changed();
     }
   }
   
@@ -0,0 +1,41 @@
+#include "limit.h"
+
+#include <string.h>
+
+void limit_init(limit_t * l, uint32_t count, const uint16_t * ma, uint32_t * duty,
+		uint32_t duty_max, uint32_t budget_ma)
+{
+  memset(l, 0, sizeof(*l));
+  l->budget_ma = budget_ma;
+  l->duty_max = duty_max;
+  l->count = count;
+  l->ma = ma;
+  l->duty = duty;
+  memset(duty, 0, count * sizeof(*duty));
+  l->scale = LIMIT_SCALE_ONE;
+  l->stats.min_scale = LIMIT_SCALE_ONE;
+}
+
+uint32_t limit_draw_ma(const limit_t * l)
+{
+  return l->sum / l->duty_max;
+}
+
+uint32_t limit_frame(limit_t * l)
+{
+  limit_stats_t * st = &l->stats;
+  uint64_t budget = (uint64_t)l->budget_ma * l->duty_max;
+  st->frames++;
+  st->draw_ma = limit_draw_ma(l);
+  if(st->draw_ma > st->peak_ma) st->peak_ma = st->draw_ma;
+  if(!l->budget_ma || l->sum <= budget){
+    l->scale = LIMIT_SCALE_ONE;
+    return l->scale;
+  }
+  // Rounded down, the scaled duties (rounded down too) fit the budget
+  l->scale = (budget << 16) / l->sum;
+  st->limited++;
+  st->scale_sum += l->scale;
+  if(l->scale < st->min_scale) st->min_scale = l->scale;
+  return l->scale;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Current limiter of the outputs, after calibration (calib.h).
+ *
+ * Each output channel draws a current at full duty and the supply has a
+ * budget. The draw is estimated as linear in the duty and kept as a running
+ * sum that limit_set updates with the change of one channel, so a change
+ * costs the same whatever the number of channels. When the draw of a frame
+ * is over the budget, every channel of that frame is scaled by the same
+ * factor: the colors stay, the light goes down until the draw fits.
+ *
+ *   limit_set(&l, 0, r); ...          // The channels that changed
+ *   limit_frame(&l);                  // Once per frame
+ *   r = limit_apply(&l, r); ...       // Every duty written out
+ */
+
+#define LIMIT_SCALE_ONE (1 << 16)
+
+typedef struct {
+  uint32_t frames;
+  uint32_t limited;      // Frames scaled down
+  uint32_t draw_ma;      // Of the last frame, before limiting
+  uint32_t peak_ma;      // Highest draw asked for
+  uint32_t min_scale;    // Deepest scale, LIMIT_SCALE_ONE when never limited
+  uint64_t scale_sum;    // Of the limited frames, for the mean
+} limit_stats_t;
+
+typedef struct {
+  uint32_t budget_ma;    // 0 for no limit, the draw is still estimated
+  uint32_t duty_max;
+  uint32_t count;
+  const uint16_t * ma;   // Draw of each channel at duty_max
+  uint32_t * duty;       // Of each channel, before limiting
+  uint64_t sum;          // Of duty * ma over the channels
+  uint32_t scale;        // Of the last frame, LIMIT_SCALE_ONE when not limited
+  limit_stats_t stats;
+} limit_t;
+
+// 'ma' and 'duty' have 'count' entries, the duties start at 0
+void limit_init(limit_t * l, uint32_t count, const uint16_t * ma, uint32_t * duty,
+		uint32_t duty_max, uint32_t budget_ma);
+
+// Sets the duty of one channel, O(1)
+static inline void limit_set(limit_t * l, uint32_t channel, uint32_t duty)
+{
+  l->sum += ((int64_t)duty - l->duty[channel]) * l->ma[channel];
+  l->duty[channel] = duty;
+}
+
+// Ends a frame: the scale of its duties, LIMIT_SCALE_ONE within the budget
+uint32_t limit_frame(limit_t * l);
+
+// A duty of the frame as it goes out
+static inline uint32_t limit_apply(const limit_t * l, uint32_t duty)
+{
+  return (uint64_t)duty * l->scale >> 16;
+}
+
+// Estimated draw of the duties set, before limiting
+uint32_t limit_draw_ma(const limit_t * l);
@@ -0,0 +1,196 @@
+#include "mqtt.h"
+#include "api.h"
+#include "control.h"
+#include "rtos.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_ota_ops.h>
+#include <mqtt_client.h>
+
+#ifdef CONFIG_MQTT_ENABLE
+
+static const char *TAG = "mqtt";
+
+#define MQTT_BASE CONFIG_MQTT_TOPIC_PREFIX "/" CONFIG_HOSTNAME
+#define MQTT_STATUS_TOPIC MQTT_BASE "/status"
+#define MQTT_STATE_TOPIC MQTT_BASE "/state"
+#define MQTT_DISCOVERY_TOPIC CONFIG_MQTT_DISCOVERY_PREFIX "/light/" CONFIG_HOSTNAME "/config"
+#define MQTT_PUBLISH_PERIOD_US (CONFIG_MQTT_PUBLISH_MS * 1000LL)
+#define MQTT_COMMAND_MAX (512)
+#define MQTT_DISCOVERY_MAX (1536)
+
+// Command topics under MQTT_BASE, the payload is made into a patch document
+typedef struct {
+  const char * topic;
+  const char * format;
+} mqtt_command_t;
+
+static const mqtt_command_t _commands[] = {
+  {"set",       "%.*s"},
+  {"rgb/set",   "{\"rgb\":%.*s}"},
+  {"hsv/set",   "{\"hsv\":%.*s}"},
+  {"cal/set",   "{\"cal\":%.*s}"},
+  {"scene/set", "{\"scene\":%.*s}"},
+};
+#define N_COMMANDS (sizeof(_commands) / sizeof(_commands[0]))
+
+// Home Assistant template light, the commands are patch documents and the
+// state is read from the state document
+static const char * const _on_template =
+  "{\\\"on\\\":true"
+  "{% if red is defined %},\\\"rgb\\\":{\\\"r\\\":{{red}},\\\"g\\\":{{green}},\\\"b\\\":{{blue}}}"
+  "{% elif brightness is defined %},\\\"hsv\\\":{\\\"v\\\":{{brightness}}}{% endif %}"
+  "{% if transition is defined %},\\\"transition_ms\\\":{{(transition*1000)|int}}{% endif %}}";
+static const char * const _off_template = "{\\\"on\\\":false}";
+
+static esp_mqtt_client_handle_t g_client = NULL;
+static const persistent_state_t * g_state = NULL;
+static esp_timer_handle_t g_publish_timer = NULL;
+static volatile bool g_connected = false;
+static volatile bool g_scheduled = false; // The publish timer is started
+static int64_t g_last_publish = 0;
+static char g_published[API_STATE_MAX];   // Last state sent
+RTOS_BUFFER_DEFINE(g_discovery, MQTT_DISCOVERY_MAX);
+
+static void publish_discovery(void)
+{
+  char * out = rtos_buffer_take(&g_discovery);
+  if(!out) return;
+  const esp_app_desc_t * app = esp_ota_get_app_description();
+  int n = snprintf(out, MQTT_DISCOVERY_MAX,
+		   "{\"name\":\"%s\",\"unique_id\":\"%s_light\",\"schema\":\"template\","
+		   "\"command_topic\":\"%s/set\",\"state_topic\":\"%s\","
+		   "\"availability_topic\":\"%s\","
+		   "\"command_on_template\":\"%s\",\"command_off_template\":\"%s\","
+		   "\"state_template\":\"{{'on' if value_json.on else 'off'}}\","
+		   "\"brightness_template\":\"{{value_json.hsv.v}}\","
+		   "\"red_template\":\"{{value_json.rgb.r}}\","
+		   "\"green_template\":\"{{value_json.rgb.g}}\","
+		   "\"blue_template\":\"{{value_json.rgb.b}}\","
+		   "\"device\":{\"identifiers\":[\"%s\"],\"name\":\"%s\","
+		   "\"model\":\"esp32_leds\",\"sw_version\":\"%s\"}}",
+		   CONFIG_HOSTNAME, CONFIG_HOSTNAME, MQTT_BASE, MQTT_STATE_TOPIC,
+		   MQTT_STATUS_TOPIC, _on_template, _off_template,
+		   CONFIG_HOSTNAME, CONFIG_HOSTNAME, app->version);
+  if(n < MQTT_DISCOVERY_MAX){
+    esp_mqtt_client_publish(g_client, MQTT_DISCOVERY_TOPIC, out, n, 1, 1);
+  } else {
+    ESP_LOGE(TAG, "Discovery message too long (%d)", n);
+  }
+  rtos_buffer_give(&g_discovery, out);
+}
+
+static void publish_callback(void * arg)
+{
+  // Cleared before reading the state, a change notified from now on starts
+  // the timer again
+  g_scheduled = false;
+  g_last_publish = esp_timer_get_time();
+  char state[API_STATE_MAX];
+  api_state_json(g_state, state, sizeof(state));
+  if(!g_connected || strcmp(state, g_published) == 0){
+    return;
+  }
+  // Sent by the task of the client, this one is shared with other timers
+  if(esp_mqtt_client_enqueue(g_client, MQTT_STATE_TOPIC, state, 0, 1, 1, true) < 0){
+    ESP_LOGW(TAG, "State not queued");
+    return; // Tried again at the next change
+  }
+  strcpy(g_published, state);
+}
+
+void mqtt_notify_changed(void)
+{
+  if(!g_connected || g_scheduled) return;
+  g_scheduled = true;
+  int64_t wait = g_last_publish + MQTT_PUBLISH_PERIOD_US - esp_timer_get_time();
+  esp_timer_start_once(g_publish_timer, wait > 0 ? wait : 1);
+}
+
+static void handle_command(const char * topic, int topic_len, const char * data, int len)
+{
+  const size_t base_len = strlen(MQTT_BASE);
+  if(topic_len <= base_len || strncmp(topic, MQTT_BASE "/", base_len + 1) != 0){
+    return;
+  }
+  topic += base_len + 1;
+  topic_len -= base_len + 1;
+  for(int i = 0; i < N_COMMANDS; ++i){
+    const mqtt_command_t * c = &_commands[i];
+    if(strlen(c->topic) != topic_len || strncmp(c->topic, topic, topic_len) != 0){
+      continue;
+    }
+    char doc[MQTT_COMMAND_MAX];
+    int n = snprintf(doc, sizeof(doc), c->format, len, data);
+    state_patch_t patch;
+    if(n >= sizeof(doc) || !api_parse_patch(doc, n, &patch)){
+      ESP_LOGW(TAG, "Bad command on %s: %.*s", c->topic, len, data);
+      return;
+    }
+    ESP_LOGD(TAG, "Patch %08x from %s", patch.fields, c->topic);
+    control_submit(&patch);
+    return;
+  }
+}
+
+static void mqtt_event_handler(void * arg, esp_event_base_t base, int32_t id, void * data)
+{
+  esp_mqtt_event_handle_t event = data;
+  switch((esp_mqtt_event_id_t)id){
+  case MQTT_EVENT_CONNECTED:
+    ESP_LOGI(TAG, "Connected to %s", CONFIG_MQTT_URI);
+    esp_mqtt_client_subscribe(g_client, MQTT_BASE "/set", 1);
+    esp_mqtt_client_subscribe(g_client, MQTT_BASE "/+/set", 1);
+    esp_mqtt_client_publish(g_client, MQTT_STATUS_TOPIC, "online", 0, 1, 1);
+    publish_discovery();
+    g_published[0] = 0; // The broker may have lost it
+    g_connected = true;
+    mqtt_notify_changed();
+    break;
+  case MQTT_EVENT_DISCONNECTED:
+    ESP_LOGW(TAG, "Disconnected");
+    g_connected = false;
+    break;
+  case MQTT_EVENT_DATA:
+    if(event->data_len != event->total_data_len){
+      ESP_LOGW(TAG, "Command of %d bytes dropped", event->total_data_len);
+      break; // Only sent in pieces when larger than the buffer of the client
+    }
+    handle_command(event->topic, event->topic_len, event->data, event->data_len);
+    break;
+  default:
+    break;
+  }
+}
+
+esp_err_t mqtt_init(const persistent_state_t * state)
+{
+  g_state = state;
+  const esp_timer_create_args_t args = {
+    .callback = &publish_callback,
+    .name = "mqtt-publish"
+  };
+  esp_err_t err = esp_timer_create(&args, &g_publish_timer);
+  if(err != ESP_OK) return err;
+
+  const esp_mqtt_client_config_t config = {
+    .uri = CONFIG_MQTT_URI,
+    .client_id = CONFIG_HOSTNAME,
+    .lwt_topic = MQTT_STATUS_TOPIC,
+    .lwt_msg = "offline",
+    .lwt_qos = 1,
+    .lwt_retain = 1,
+  };
+  g_client = esp_mqtt_client_init(&config);
+  if(!g_client) return ESP_ERR_NO_MEM;
+  err = esp_mqtt_client_register_event(g_client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
+  if(err != ESP_OK) return err;
+  // Connects in the background and keeps reconnecting
+  return esp_mqtt_client_start(g_client);
+}
+
+#endif // CONFIG_MQTT_ENABLE
@@ -0,0 +1,30 @@
+#pragma once
+#include <esp_err.h>
+#include "storage.h"
+
+/*
+ * MQTT client, for home automation and fleets of fixtures.
+ *
+ * Topics are under CONFIG_MQTT_TOPIC_PREFIX/CONFIG_HOSTNAME:
+ *   .../set         a patch document, as PATCH /api/state (see api.h)
+ *   .../rgb/set     {"r":255,"g":30,"b":0}, any subset
+ *   .../hsv/set     {"h":5,"s":255,"v":255}, any subset
+ *   .../cal/set     {"matrix":[...],"offset":[...]}
+ *   .../scene/set   a scene number
+ *   .../state       the state document of GET /api/state, retained
+ *   .../status      "online" / "offline", retained (last will)
+ *
+ * Commands go through control_submit like the web socket calibration and the
+ * REST API. The state is published only when it changes, at most once every
+ * CONFIG_MQTT_PUBLISH_MS, so a fast edit costs a few messages. A Home
+ * Assistant discovery message (template light) is published on connection.
+ */
+
+#ifdef CONFIG_MQTT_ENABLE
+esp_err_t mqtt_init(const persistent_state_t * state);
+
+// Call after each render: publishes the state if it changed
+void mqtt_notify_changed(void);
+#else
+static inline void mqtt_notify_changed(void) {}
+#endif
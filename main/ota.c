@@ -0,0 +1,287 @@
+#include "ota.h"
+#include "rtos.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+
+static const char *TAG = "ota";
+
+#define OTA_BUFFERS (CONFIG_OTA_BUFFERS)
+#define OTA_BUFFER_SIZE (CONFIG_OTA_BUFFER_SIZE)
+#define OTA_CONFIRM_TIMEOUT_US (CONFIG_OTA_CONFIRM_TIMEOUT * 1000000LL)
+#define OTA_CONFIRM_PERIOD_US (2 * 1000000LL)
+#define OTA_RESTART_DELAY_US (500 * 1000LL)
+
+typedef struct {
+  uint8_t * data;
+  size_t len;      // 0 ends the image
+  bool commit;     // With len 0: the image checked out, boot from it
+} ota_chunk_t;
+
+// Buffers go around: free -> filled by the server task -> full -> flashed by
+// the writer task -> free
+typedef struct {
+  const esp_partition_t * partition;
+  QueueHandle_t free;
+  QueueHandle_t full;
+  QueueHandle_t done;         // esp_err_t result of the writer
+  volatile esp_err_t status;  // First error of the writer, to stop early
+} ota_pipe_t;
+
+static esp_timer_handle_t g_confirm_timer = NULL;
+static bool g_pending = false; // Running a new image that is not confirmed yet
+
+// Only taken for the length of an update (unless CONFIG_STATIC_ALLOC)
+RTOS_TASK_DEFINE(g_writer, "ota", CONFIG_OTA_STACK);
+RTOS_BUFFER_DEFINE(g_buffers, OTA_BUFFERS * OTA_BUFFER_SIZE);
+RTOS_QUEUE_DEFINE(g_free, uint8_t *, OTA_BUFFERS);
+RTOS_QUEUE_DEFINE(g_full, ota_chunk_t, OTA_BUFFERS + 1);
+RTOS_QUEUE_DEFINE(g_done, esp_err_t, 1);
+
+static void ota_writer_task(void * arg)
+{
+  ota_pipe_t * pipe = arg;
+  esp_ota_handle_t handle = 0;
+  // Sequential writes erase each sector as it is reached instead of the whole
+  // partition up front
+  esp_err_t err = esp_ota_begin(pipe->partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+  bool begun = err == ESP_OK;
+  pipe->status = err;
+
+  ota_chunk_t chunk;
+  while(xQueueReceive(pipe->full, &chunk, portMAX_DELAY) == pdTRUE && chunk.len > 0){
+    if(err == ESP_OK){
+      err = esp_ota_write(handle, chunk.data, chunk.len);
+      pipe->status = err;
+    }
+    xQueueSend(pipe->free, &chunk.data, portMAX_DELAY);
+  }
+
+  if(err == ESP_OK && chunk.commit){
+    err = esp_ota_end(handle);
+    if(err == ESP_OK) err = esp_ota_set_boot_partition(pipe->partition);
+  } else if(begun){
+    esp_ota_abort(handle);
+  }
+  xQueueSend(pipe->done, &err, portMAX_DELAY);
+  rtos_task_exit(&g_writer);
+}
+
+static bool parse_sha256(const char * hex, uint8_t * out)
+{
+  for(int i = 0; i < 32; ++i){
+    unsigned int byte;
+    if(sscanf(hex + 2 * i, "%2x", &byte) != 1) return false;
+    out[i] = byte;
+  }
+  return hex[64] == 0;
+}
+
+// Receive the body into the pipe, hashing it on the way
+static esp_err_t ota_receive(httpd_req_t *req, ota_pipe_t * pipe, uint8_t * sha)
+{
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+
+  esp_err_t err = ESP_OK;
+  size_t left = req->content_len;
+  while(left > 0 && err == ESP_OK){
+    uint8_t * buf;
+    xQueueReceive(pipe->free, &buf, portMAX_DELAY);
+    // Fill whole buffers, flash writes are cheaper in big pieces
+    size_t want = MIN(left, OTA_BUFFER_SIZE);
+    size_t got = 0;
+    while(got < want){
+      int n = httpd_req_recv(req, (char*)buf + got, want - got);
+      if(n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+      if(n <= 0){
+	err = ESP_FAIL;
+	break;
+      }
+      got += n;
+    }
+    if(err != ESP_OK){
+      xQueueSend(pipe->free, &buf, portMAX_DELAY);
+      break;
+    }
+    mbedtls_sha256_update_ret(&ctx, buf, got);
+    ota_chunk_t chunk = {buf, got, false};
+    xQueueSend(pipe->full, &chunk, portMAX_DELAY);
+    left -= got;
+    if(pipe->status != ESP_OK) err = pipe->status;
+  }
+  mbedtls_sha256_finish_ret(&ctx, sha);
+  mbedtls_sha256_free(&ctx);
+  return err;
+}
+
+static void restart_callback(void * arg)
+{
+  esp_restart();
+}
+
+static esp_err_t ota_post_handler(httpd_req_t *req)
+{
+  char hex[65];
+  uint8_t expected[32];
+  uint8_t sha[32];
+  if(httpd_req_get_hdr_value_str(req, "X-SHA256", hex, sizeof(hex)) != ESP_OK ||
+     !parse_sha256(hex, expected)){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "X-SHA256 header needed");
+  }
+  ota_pipe_t pipe = {0};
+  pipe.partition = esp_ota_get_next_update_partition(NULL);
+  if(!pipe.partition){
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No update partition");
+  }
+  if(req->content_len == 0 || req->content_len > pipe.partition->size){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad image size");
+  }
+
+  uint8_t * buffers = rtos_buffer_take(&g_buffers);
+  pipe.free = rtos_queue_create(&g_free);
+  pipe.full = rtos_queue_create(&g_full);
+  pipe.done = rtos_queue_create(&g_done);
+  esp_err_t err = ESP_ERR_NO_MEM;
+  // The writer runs at the priority of the main task, so rendering and the
+  // encoder are not held up while it waits on flash
+  if(buffers && pipe.free && pipe.full && pipe.done &&
+     rtos_task_start(&g_writer, ota_writer_task, &pipe, 1, tskNO_AFFINITY)){
+    for(int i = 0; i < OTA_BUFFERS; ++i){
+      uint8_t * buf = buffers + i * OTA_BUFFER_SIZE;
+      xQueueSend(pipe.free, &buf, 0);
+    }
+    ESP_LOGI(TAG, "Receiving %d bytes into %s", req->content_len, pipe.partition->label);
+    int64_t start = esp_timer_get_time();
+    err = ota_receive(req, &pipe, sha);
+    bool match = err == ESP_OK && memcmp(sha, expected, sizeof(sha)) == 0;
+    ota_chunk_t end = {NULL, 0, match};
+    xQueueSend(pipe.full, &end, portMAX_DELAY);
+    esp_err_t result;
+    xQueueReceive(pipe.done, &result, portMAX_DELAY);
+    if(err == ESP_OK) err = match ? result : ESP_ERR_INVALID_CRC;
+
+    int ms = MAX(1, (esp_timer_get_time() - start) / 1000);
+    int kbps = (int64_t)req->content_len * 1000 / 1024 / ms;
+    ESP_LOGI(TAG, "Update of %d bytes in %d ms (%d KB/s): %s",
+	     req->content_len, ms, kbps, esp_err_to_name(err));
+    if(err == ESP_OK){
+      char out[96];
+      snprintf(out, sizeof(out), "{\"bytes\":%d,\"ms\":%d,\"kbps\":%d,\"partition\":\"%s\"}",
+	       req->content_len, ms, kbps, pipe.partition->label);
+      httpd_resp_set_type(req, "application/json");
+      httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+    }
+  }
+  if(pipe.done) vQueueDelete(pipe.done);
+  if(pipe.full) vQueueDelete(pipe.full);
+  if(pipe.free) vQueueDelete(pipe.free);
+  rtos_buffer_give(&g_buffers, buffers);
+
+  switch(err){
+  case ESP_OK:
+    break;
+  case ESP_FAIL:
+    return ESP_FAIL; // Connection error, nothing to answer
+  case ESP_ERR_INVALID_CRC:
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "SHA-256 mismatch");
+  case ESP_ERR_OTA_VALIDATE_FAILED:
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid image");
+  default:
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+  }
+
+  // Restart once the answer is out
+  const esp_timer_create_args_t args = {
+    .callback = &restart_callback,
+    .name = "ota-restart"
+  };
+  esp_timer_handle_t timer;
+  ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+  ESP_ERROR_CHECK(esp_timer_start_once(timer, OTA_RESTART_DELAY_US));
+  return ESP_OK;
+}
+
+static esp_err_t ota_get_handler(httpd_req_t *req)
+{
+  const esp_partition_t * running = esp_ota_get_running_partition();
+  const esp_app_desc_t * app = esp_ota_get_app_description();
+  char out[128];
+  snprintf(out, sizeof(out), "{\"version\":\"%s\",\"partition\":\"%s\",\"pending\":%s}",
+	   app->version, running->label, g_pending ? "true" : "false");
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+}
+
+// A new image is good once it is back on the network (so it can be updated
+// again). If it does not get there in time, restart: the bootloader then
+// goes back to the previous image.
+static void confirm_callback(void * arg)
+{
+  static int64_t waited = 0;
+  wifi_ap_record_t ap;
+  if(esp_wifi_sta_get_ap_info(&ap) == ESP_OK){
+    ESP_LOGI(TAG, "Connected, keeping the new firmware");
+    esp_ota_mark_app_valid_cancel_rollback();
+    esp_timer_stop(g_confirm_timer);
+    g_pending = false;
+    return;
+  }
+  waited += OTA_CONFIRM_PERIOD_US;
+  if(waited >= OTA_CONFIRM_TIMEOUT_US){
+    ESP_LOGE(TAG, "New firmware did not connect, rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+}
+
+esp_err_t ota_init(void)
+{
+  esp_ota_img_states_t state;
+  const esp_partition_t * running = esp_ota_get_running_partition();
+  if(esp_ota_get_state_partition(running, &state) != ESP_OK ||
+     state != ESP_OTA_IMG_PENDING_VERIFY){
+    return ESP_OK;
+  }
+  ESP_LOGI(TAG, "First boot of %s, waiting for the network", running->label);
+  const esp_timer_create_args_t args = {
+    .callback = &confirm_callback,
+    .name = "ota-confirm"
+  };
+  esp_err_t err = esp_timer_create(&args, &g_confirm_timer);
+  if(err != ESP_OK) return err;
+  g_pending = true;
+  return esp_timer_start_periodic(g_confirm_timer, OTA_CONFIRM_PERIOD_US);
+}
+
+static const httpd_uri_t ota_post = {
+  .uri       = "/api/ota",
+  .method    = HTTP_POST,
+  .handler   = ota_post_handler,
+  .user_ctx  = NULL
+};
+
+static const httpd_uri_t ota_get = {
+  .uri       = "/api/ota",
+  .method    = HTTP_GET,
+  .handler   = ota_get_handler,
+  .user_ctx  = NULL
+};
+
+void ota_register(httpd_handle_t server)
+{
+  httpd_register_uri_handler(server, &ota_post);
+  httpd_register_uri_handler(server, &ota_get);
+}
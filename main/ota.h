@@ -0,0 +1,23 @@
+#pragma once
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+/*
+ * Firmware updates over HTTP:
+ *   POST /api/ota    the application image as the body, with its SHA-256 in
+ *                    hex in the X-SHA256 header
+ *   GET /api/ota     running version and partition
+ *
+ *   curl --data-binary @build/leds.bin -H "X-SHA256: $(sha256sum build/leds.bin | cut -c-64)" \
+ *        http://leds.local/api/ota
+ *
+ * The image is received and hashed by the server task while a writer task
+ * flashes the previous buffers, so erasing never holds up the network. The
+ * device restarts into the new image, which is kept only if it gets back on
+ * the network, otherwise the bootloader rolls back to the previous one.
+ */
+
+// Call once everything else is up: confirms a freshly updated image
+esp_err_t ota_init(void);
+
+void ota_register(httpd_handle_t server);
@@ -0,0 +1,62 @@
+#include "patch.h"
+
+#include <string.h>
+
+void patch_merge(state_patch_t * into, const state_patch_t * patch)
+{
+  uint32_t f = patch->fields;
+  // The color is either set as rgb or hsv, the latest one wins
+  if(f & PATCH_RGB) into->fields &= ~PATCH_HSV;
+  if(f & PATCH_HSV) into->fields &= ~PATCH_RGB;
+  // A color stops the effect, the effect is either a program or a scene
+  if(f & (PATCH_RGB | PATCH_HSV)) into->fields &= ~(PATCH_EFFECT | PATCH_SCENE);
+  if(f & PATCH_EFFECT) into->fields &= ~(PATCH_SCENE | PATCH_RGB | PATCH_HSV);
+  if(f & PATCH_SCENE) into->fields &= ~(PATCH_EFFECT | PATCH_RGB | PATCH_HSV);
+  // A ramp goes with its own color, not with the ones that come after it
+  if(f & (PATCH_RGB | PATCH_HSV | PATCH_POWER)) into->fields &= ~PATCH_RAMP;
+
+  if(f & PATCH_RGB_R) into->rgb.r = patch->rgb.r;
+  if(f & PATCH_RGB_G) into->rgb.g = patch->rgb.g;
+  if(f & PATCH_RGB_B) into->rgb.b = patch->rgb.b;
+  if(f & PATCH_HSV_H) into->hsv.h = patch->hsv.h;
+  if(f & PATCH_HSV_S) into->hsv.s = patch->hsv.s;
+  if(f & PATCH_HSV_V) into->hsv.v = patch->hsv.v;
+  if(f & PATCH_CAL_MATRIX) memcpy(into->cal.matrix, patch->cal.matrix, sizeof(into->cal.matrix));
+  if(f & PATCH_CAL_OFFSET) memcpy(into->cal.offset, patch->cal.offset, sizeof(into->cal.offset));
+  if(f & PATCH_MODE) into->cursor_mode = patch->cursor_mode;
+  if(f & PATCH_TRANSITION) into->transition_ms = patch->transition_ms;
+  if(f & PATCH_POWER) into->on = patch->on;
+  if(f & PATCH_AUDIO) into->audio = patch->audio;
+  if(f & PATCH_SCENE) into->scene = patch->scene;
+  if(f & PATCH_EFFECT) into->effect = patch->effect;
+  if(f & PATCH_RAMP) into->ramp_s = patch->ramp_s;
+  into->fields |= f;
+}
+
+bool patch_apply(persistent_state_t * state, const state_patch_t * patch)
+{
+  uint32_t f = patch->fields;
+  if(f & PATCH_RGB){
+    // Patches are 8 bit, the components that are not set keep their precision
+    if(f & PATCH_RGB_R) state->rgb.r = color_8_to_16(patch->rgb.r);
+    if(f & PATCH_RGB_G) state->rgb.g = color_8_to_16(patch->rgb.g);
+    if(f & PATCH_RGB_B) state->rgb.b = color_8_to_16(patch->rgb.b);
+    state->hsv = rgb16_to_hsv16(state->rgb);
+  } else if(f & PATCH_HSV){
+    if(f & PATCH_HSV_H) state->hsv.h = hue_8_to_16(patch->hsv.h);
+    if(f & PATCH_HSV_S) state->hsv.s = color_8_to_16(patch->hsv.s);
+    if(f & PATCH_HSV_V) state->hsv.v = color_8_to_16(patch->hsv.v);
+    state->rgb = hsv16_to_rgb16(state->hsv);
+  }
+  if(f & PATCH_CAL_MATRIX) memcpy(state->cal.matrix, patch->cal.matrix, sizeof(state->cal.matrix));
+  if(f & PATCH_CAL_OFFSET) memcpy(state->cal.offset, patch->cal.offset, sizeof(state->cal.offset));
+  if(f & PATCH_MODE) state->cursor_mode = patch->cursor_mode;
+  if(f & PATCH_TRANSITION) state->transition_ms = patch->transition_ms;
+  if(f & PATCH_AUDIO) state->audio = patch->audio;
+  if(f & PATCH_POWER){
+    state->on = patch->on;
+  } else if(f & (PATCH_RGB | PATCH_HSV | PATCH_EFFECT | PATCH_SCENE)){
+    state->on = true;
+  }
+  return (f & ~(PATCH_EFFECT | PATCH_SCENE | PATCH_RAMP)) != 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "state.h"
+#include "fx.h"
+
+/*
+ * A partial update of the persistent state.
+ *
+ * Only the components flagged in 'fields' are changed, so a patch can e.g.
+ * set the brightness alone. Patches are merged in order (later values win),
+ * which is how a batch of changes becomes a single update.
+ */
+
+enum {
+  PATCH_RGB_R = 1 << 0,
+  PATCH_RGB_G = 1 << 1,
+  PATCH_RGB_B = 1 << 2,
+  PATCH_HSV_H = 1 << 3,
+  PATCH_HSV_S = 1 << 4,
+  PATCH_HSV_V = 1 << 5,
+  PATCH_CAL_MATRIX = 1 << 6,
+  PATCH_CAL_OFFSET = 1 << 7,
+  PATCH_POWER = 1 << 8,
+  PATCH_MODE = 1 << 9,
+  PATCH_TRANSITION = 1 << 10,
+  PATCH_EFFECT = 1 << 11, // Run 'effect', an empty program stops it
+  PATCH_SCENE = 1 << 12,  // Run the effect saved as 'scene'
+  PATCH_AUDIO = 1 << 13,
+  PATCH_RAMP = 1 << 14,   // Fade to the color (or off) of this patch in 'ramp_s', once
+};
+
+#define PATCH_RGB (PATCH_RGB_R | PATCH_RGB_G | PATCH_RGB_B)
+#define PATCH_HSV (PATCH_HSV_H | PATCH_HSV_S | PATCH_HSV_V)
+#define PATCH_CAL (PATCH_CAL_MATRIX | PATCH_CAL_OFFSET)
+
+typedef struct {
+  uint32_t fields;
+  rgb_t rgb;
+  hsv_t hsv;
+  rgb_calibration_t cal;
+  int cursor_mode;
+  uint32_t transition_ms;
+  bool on;
+  int scene;
+  uint8_t audio;
+  uint16_t ramp_s;
+  fx_program_t effect;
+} state_patch_t;
+
+// Merge 'patch' on top of 'into'
+void patch_merge(state_patch_t * into, const state_patch_t * patch);
+
+// Apply a patch to the state, returns true if anything was set. Setting a
+// color or an effect turns the light on, unless the patch sets the power
+// as well.
+// Effects and ramps are not part of the state, PATCH_EFFECT, PATCH_SCENE
+// and PATCH_RAMP are left to the caller.
+bool patch_apply(persistent_state_t * state, const state_patch_t * patch);
@@ -0,0 +1,188 @@
+#include "patch_json.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <sys/param.h>
+
+const char * const patch_json_modes[3] = {"hue","sat","value"};
+const char * const patch_json_audio[4] = {"off","value","hue","scene"}; // enum audio_map
+
+// Numeric components of a patch, addressed as {"group":{"key":value}}
+typedef struct {
+  const char * group;
+  const char * key;
+  uint32_t field;
+  size_t offset;
+} patch_field_t;
+
+static const patch_field_t _fields[] = {
+  {"rgb", "r", PATCH_RGB_R, offsetof(state_patch_t, rgb.r)},
+  {"rgb", "g", PATCH_RGB_G, offsetof(state_patch_t, rgb.g)},
+  {"rgb", "b", PATCH_RGB_B, offsetof(state_patch_t, rgb.b)},
+  {"hsv", "h", PATCH_HSV_H, offsetof(state_patch_t, hsv.h)},
+  {"hsv", "s", PATCH_HSV_S, offsetof(state_patch_t, hsv.s)},
+  {"hsv", "v", PATCH_HSV_V, offsetof(state_patch_t, hsv.v)},
+};
+
+#define N_FIELDS (sizeof(_fields) / sizeof(_fields[0]))
+
+static bool is_group(const char * name)
+{
+  if(strcmp(name, "cal") == 0) return true;
+  for(size_t i = 0; i < N_FIELDS; ++i){
+    if(strcmp(_fields[i].group, name) == 0) return true;
+  }
+  return false;
+}
+
+static bool set_field(state_patch_t * patch, const char * group, const char * key, int32_t value)
+{
+  for(size_t i = 0; i < N_FIELDS; ++i){
+    const patch_field_t * f = &_fields[i];
+    if(strcmp(f->group, group) == 0 && strcmp(f->key, key) == 0){
+      ((uint8_t *)patch)[f->offset] = MAX(0, MIN(0xff, value));
+      patch->fields |= f->field;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool set_mode(state_patch_t * patch, int mode)
+{
+  if(mode < 0 || mode > 2) return false;
+  patch->cursor_mode = mode;
+  patch->fields |= PATCH_MODE;
+  return true;
+}
+
+// Calibration arrays: {"cal":{"matrix":[9 numbers, by rows],"offset":[3 numbers]}}
+// in 1/RGB_CAL_ONE, each array has to be complete
+static bool cal_json(patch_reader_t * pr, json_reader_t * r, json_event_t event, const char * name)
+{
+  bool matrix = strcmp(name, "matrix") == 0;
+  if(!matrix && strcmp(name, "offset") != 0) return false;
+  int size = matrix ? 9 : 3;
+  switch(event){
+  case JSON_ARRAY_START:
+    pr->cal_items = 0;
+    return true;
+  case JSON_NUMBER: {
+    if(pr->cal_items >= size) return false;
+    int16_t * dst = matrix ? &pr->patch.cal.matrix[0][0] : pr->patch.cal.offset;
+    dst[pr->cal_items++] = MAX(INT16_MIN, MIN(INT16_MAX, r->number));
+    return true;
+  }
+  case JSON_ARRAY_END:
+    pr->patch.fields |= matrix ? PATCH_CAL_MATRIX : PATCH_CAL_OFFSET;
+    return pr->cal_items == size;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Containers start at their own depth and values are reported at the depth
+ * of their container, so with d relative to the patch object:
+ *   d == 0   the patch object and its values ("mode", "transition_ms", ...)
+ *   d == 1   the groups ("rgb", "hsv", "cal") and their values
+ *   d == 2   the calibration arrays and their numbers
+ */
+static bool patch_json_cb(json_reader_t * r, json_event_t event, void * arg)
+{
+  patch_reader_t * pr = arg;
+  int d = r->depth - pr->base;
+
+  if(d < 0){
+    // Outside the patches: only the batch array
+    return event == JSON_ARRAY_START || event == JSON_ARRAY_END;
+  }
+  if(d == 0){
+    const char * key = json_reader_key(r, r->depth);
+    switch(event){
+    case JSON_OBJECT_START:
+      memset(&pr->patch, 0, sizeof(pr->patch));
+      return true;
+    case JSON_OBJECT_END:
+      patch_merge(&pr->merged, &pr->patch);
+      pr->count++;
+      return true;
+    case JSON_NUMBER:
+      if(strcmp(key, "transition_ms") == 0 && r->number >= 0){
+	pr->patch.transition_ms = r->number;
+	pr->patch.fields |= PATCH_TRANSITION;
+	return true;
+      }
+      if(strcmp(key, "mode") == 0) return set_mode(&pr->patch, r->number);
+      if(strcmp(key, "scene") == 0 && r->number >= 0 && r->number < pr->scenes){
+	pr->patch.scene = r->number;
+	pr->patch.fields |= PATCH_SCENE;
+	return true;
+      }
+      return false;
+    case JSON_TRUE:
+    case JSON_FALSE:
+      if(strcmp(key, "on") == 0){
+	pr->patch.on = event == JSON_TRUE;
+	pr->patch.fields |= PATCH_POWER;
+	return true;
+      }
+      return false;
+    case JSON_STRING:
+      if(strcmp(key, "mode") == 0){
+	for(int i = 0; i < 3; ++i){
+	  if(strcmp(r->token, patch_json_modes[i]) == 0) return set_mode(&pr->patch, i);
+	}
+      }
+      if(strcmp(key, "audio") == 0){
+	for(int i = 0; i < 4; ++i){
+	  if(strcmp(r->token, patch_json_audio[i]) == 0){
+	    pr->patch.audio = i;
+	    pr->patch.fields |= PATCH_AUDIO;
+	    return true;
+	  }
+	}
+      }
+      return false;
+    default:
+      return false;
+    }
+  }
+
+  const char * group = json_reader_key(r, pr->base);
+  if(d == 1){
+    switch(event){
+    case JSON_OBJECT_START:
+    case JSON_OBJECT_END:
+      return is_group(group);
+    case JSON_NUMBER:
+      return set_field(&pr->patch, group, json_reader_key(r, pr->base + 1), r->number);
+    default:
+      return false;
+    }
+  }
+  if(d == 2 && strcmp(group, "cal") == 0){
+    return cal_json(pr, r, event, json_reader_key(r, pr->base + 1));
+  }
+  return false;
+}
+
+void patch_reader_init(patch_reader_t * pr, json_reader_t * reader, int base, int scenes)
+{
+  memset(pr, 0, sizeof(*pr));
+  pr->base = base;
+  pr->scenes = scenes;
+  json_reader_init(reader, patch_json_cb, pr);
+}
+
+bool patch_json_parse(const char * json, size_t len, int scenes, state_patch_t * out)
+{
+  patch_reader_t pr;
+  json_reader_t reader;
+  patch_reader_init(&pr, &reader, 1, scenes);
+  if(!json_reader_feed(&reader, json, len) || !json_reader_finish(&reader) || pr.count != 1){
+    return false;
+  }
+  *out = pr.merged;
+  return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "json.h"
+#include "patch.h"
+
+/*
+ * Patches as JSON documents, read with the streaming reader (json.h).
+ *
+ *   {"rgb":{"r":255,"g":30,"b":0},"mode":"value","transition_ms":500}
+ *
+ * The reader merges every patch object found at its base depth: 1 for a
+ * single document, 2 for an array of them (a batch). See api.h for the
+ * documents accepted.
+ */
+
+typedef struct {
+  int base;              // Depth of the patch objects in the document
+  int scenes;            // Scenes that can be played
+  int count;             // Patches read
+  state_patch_t patch;   // Patch being read
+  state_patch_t merged;  // Patches read so far
+  int cal_items;         // Numbers in the calibration array being read
+} patch_reader_t;
+
+// base is the depth of the patch objects, the document is then fed to 'reader'
+void patch_reader_init(patch_reader_t * pr, json_reader_t * reader, int base, int scenes);
+
+// Parse one patch document
+bool patch_json_parse(const char * json, size_t len, int scenes, state_patch_t * out);
+
+// Names of the cursor modes and audio mappings in the documents
+extern const char * const patch_json_modes[3];
+extern const char * const patch_json_audio[4];
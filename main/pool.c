@@ -0,0 +1,82 @@
+#include "pool.h"
+
+#include <string.h>
+#include <esp_log.h>
+
+static const char * const TAG = "pool";
+
+static pool_t * g_pools = NULL;
+static portMUX_TYPE g_pools_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void pool_register(pool_t * pool)
+{
+  portENTER_CRITICAL(&g_pools_lock);
+  if(!pool->registered){
+    pool->registered = true;
+    pool->next_pool = g_pools;
+    g_pools = pool;
+  }
+  portEXIT_CRITICAL(&g_pools_lock);
+}
+
+void * pool_alloc(pool_t * pool)
+{
+  void * item = NULL;
+  if(!pool->registered) pool_register(pool);
+
+  portENTER_CRITICAL(&pool->lock);
+  if(pool->free){
+    item = pool->free;
+    pool->free = pool->free->next;
+  } else if(pool->unused < pool->capacity){
+    item = pool->storage + pool->unused * pool->item_size;
+    pool->unused++;
+  }
+  if(item){
+    pool->allocs++;
+    pool->in_use++;
+    if(pool->in_use > pool->high_water) pool->high_water = pool->in_use;
+  } else {
+    pool->exhausted++;
+  }
+  portEXIT_CRITICAL(&pool->lock);
+
+  if(item){
+    memset(item, 0, pool->item_size);
+  } else {
+    ESP_LOGW(TAG, "Pool %s exhausted (%d items)", pool->name, (int)pool->capacity);
+  }
+  return item;
+}
+
+void pool_free(pool_t * pool, void * item)
+{
+  if(!item) return;
+  pool_slot_t * slot = item;
+  portENTER_CRITICAL(&pool->lock);
+  slot->next = pool->free;
+  pool->free = slot;
+  pool->in_use--;
+  portEXIT_CRITICAL(&pool->lock);
+}
+
+void pool_get_stats(pool_t * pool, pool_stats_t * out)
+{
+  portENTER_CRITICAL(&pool->lock);
+  out->name = pool->name;
+  out->item_size = pool->item_size;
+  out->capacity = pool->capacity;
+  out->in_use = pool->in_use;
+  out->high_water = pool->high_water;
+  out->allocs = pool->allocs;
+  out->exhausted = pool->exhausted;
+  portEXIT_CRITICAL(&pool->lock);
+}
+
+void pool_for_each(void (*fn)(pool_t * pool, void * arg), void * arg)
+{
+  // Pools are only ever prepended, walking a snapshot of the head is safe.
+  for(pool_t * pool = g_pools; pool; pool = pool->next_pool){
+    fn(pool, arg);
+  }
+}
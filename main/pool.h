@@ -0,0 +1,72 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+
+/*
+ * Fixed-capacity object pool.
+ *
+ * The storage is a static array sized at compile time, so allocating from a
+ * pool never touches the heap. A pool is thread safe (spinlock protected) and
+ * keeps counters to size it: items in use, high water mark and the number of
+ * allocations that failed because the pool was exhausted.
+ *
+ *   POOL_DEFINE(g_jobs, job_t, 8);
+ *   job_t * job = pool_alloc(&g_jobs);
+ *   ...
+ *   pool_free(&g_jobs, job);
+ */
+
+typedef struct pool_slot {
+  struct pool_slot * next;
+} pool_slot_t;
+
+typedef struct pool {
+  const char * name;
+  uint8_t * storage;
+  size_t item_size;
+  size_t capacity;
+  size_t unused;       // Slots [unused, capacity) were never handed out
+  pool_slot_t * free;  // Slots returned with pool_free
+  size_t in_use;
+  size_t high_water;
+  uint32_t allocs;
+  uint32_t exhausted;  // Failed allocations
+  bool registered;
+  struct pool * next_pool;
+  portMUX_TYPE lock;
+} pool_t;
+
+typedef struct {
+  const char * name;
+  size_t item_size;
+  size_t capacity;
+  size_t in_use;
+  size_t high_water;
+  uint32_t allocs;
+  uint32_t exhausted;
+} pool_stats_t;
+
+// Items are rounded up so that a free slot can hold the free list link.
+#define POOL_ITEM_SIZE(type_)						\
+  ((sizeof(type_) + sizeof(pool_slot_t) - 1) / sizeof(pool_slot_t) * sizeof(pool_slot_t))
+
+#define POOL_DEFINE(name_, type_, capacity_)				\
+  static pool_slot_t name_##_storage[(capacity_) * POOL_ITEM_SIZE(type_) / sizeof(pool_slot_t)]; \
+  static pool_t name_ = {						\
+    .name = #name_,							\
+    .storage = (uint8_t *) name_##_storage,				\
+    .item_size = POOL_ITEM_SIZE(type_),					\
+    .capacity = (capacity_),						\
+    .lock = portMUX_INITIALIZER_UNLOCKED				\
+  }
+
+// Returns a zeroed item, or NULL if the pool is exhausted
+void * pool_alloc(pool_t * pool);
+void pool_free(pool_t * pool, void * item);
+
+void pool_get_stats(pool_t * pool, pool_stats_t * out);
+
+// Call fn for every pool that has been used at least once
+void pool_for_each(void (*fn)(pool_t * pool, void * arg), void * arg);
@@ -0,0 +1,269 @@
+#include "power.h"
+#include "rtos.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+
+#ifdef CONFIG_POWER_SAVE
+
+static const char *TAG = "power";
+
+#define WAKE_MS (CONFIG_POWER_WAKE_MS)
+#define ACTIVE_US (CONFIG_POWER_ACTIVE_MS * 1000LL)
+#define WATCHES (4)
+
+enum power_state {
+  POWER_INPUT,  // Awake for the inputs
+  POWER_LIT,    // An LED is on
+  POWER_IDLE,
+  POWER_STATES
+};
+
+static const char * const g_state_names[POWER_STATES] = {"input", "lit", "idle"};
+
+// Static figures for the ESP32 alone from the datasheet, nothing here is
+// measured and the LEDs are not included: modem sleep at the lowest clock,
+// with the APB clock held, and light sleep with the radio waking up for the
+// beacons
+#ifdef CONFIG_RGB_PWM_RTC8M
+#define LIT_MA (6) // Sleeps as when idle, with the RTC oscillator on
+#else
+#define LIT_MA (25)
+#endif
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+#define IDLE_MA (5)
+#else
+#define IDLE_MA (20)
+#endif
+static const uint16_t g_datasheet_ma[POWER_STATES] = {30, LIT_MA, IDLE_MA};
+
+typedef struct {
+  gpio_num_t pin;
+  int level;
+  void (*changed)(void * arg);
+  void * arg;
+} watch_t;
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_pm_lock_handle_t g_input_lock = NULL; // Held while awake for the inputs
+static esp_pm_lock_handle_t g_apb_lock = NULL;   // Held while lit, APB clock PWM only
+static TaskHandle_t g_task = NULL;
+RTOS_TASK_DEFINE(g_power_task, "power", CONFIG_POWER_STACK);
+static watch_t g_watches[WATCHES];
+static int g_watch_count = 0;
+static int64_t g_active_until = 0;
+static bool g_input = false;
+static bool g_lit = false;
+static bool g_apb_held = false;
+
+// How late the input checks wake up, by the power state they slept in
+typedef struct {
+  uint32_t count;
+  uint64_t sum_us;
+  uint32_t max_us;
+} wake_stats_t;
+
+// Accounting
+static enum power_state g_state = POWER_IDLE;
+static int64_t g_state_since = 0;
+static uint64_t g_state_us[POWER_STATES];
+static wake_stats_t g_wakes[POWER_STATES];
+
+// Call with the lock held, after changing g_input or g_lit
+static void power_account(void)
+{
+  int64_t now = esp_timer_get_time();
+  g_state_us[g_state] += now - g_state_since;
+  g_state_since = now;
+  g_state = g_input ? POWER_INPUT : g_lit ? POWER_LIT : POWER_IDLE;
+}
+
+// Call with the lock held
+static void power_update_apb(void)
+{
+#ifndef CONFIG_RGB_PWM_RTC8M
+  if(!g_apb_lock || g_lit == g_apb_held) return;
+  if(g_lit){
+    esp_pm_lock_acquire(g_apb_lock);
+  } else {
+    esp_pm_lock_release(g_apb_lock);
+  }
+  g_apb_held = g_lit;
+#endif
+}
+
+void power_set_lit(bool lit)
+{
+  portENTER_CRITICAL(&g_lock);
+  if(lit != g_lit){
+    g_lit = lit;
+    power_update_apb();
+    power_account();
+  }
+  portEXIT_CRITICAL(&g_lock);
+}
+
+void power_activity(void)
+{
+  portENTER_CRITICAL(&g_lock);
+  g_active_until = esp_timer_get_time() + ACTIVE_US;
+  bool wake = !g_input;
+  portEXIT_CRITICAL(&g_lock);
+  if(wake && g_task) xTaskNotifyGive(g_task);
+}
+
+void power_watch(gpio_num_t pin, void (*changed)(void * arg), void * arg)
+{
+  portENTER_CRITICAL(&g_lock);
+  if(g_watch_count < WATCHES){
+    g_watches[g_watch_count] = (watch_t){pin, gpio_get_level(pin), changed, arg};
+    g_watch_count++;
+  }
+  portEXIT_CRITICAL(&g_lock);
+}
+
+static void power_task(void * arg)
+{
+  while(1){
+    portENTER_CRITICAL(&g_lock);
+    enum power_state slept = g_state;
+    portEXIT_CRITICAL(&g_lock);
+    int64_t before = esp_timer_get_time();
+    bool notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WAKE_MS)) > 0;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&g_lock);
+    int count = g_watch_count;
+    if(!notified && g_state == slept){
+      // Late by the time it took to wake up from the sleep of that state
+      int64_t late = now - before - WAKE_MS * 1000LL;
+      if(late < 0) late = 0;
+      wake_stats_t * w = &g_wakes[slept];
+      w->count++;
+      w->sum_us += late;
+      if(late > w->max_us) w->max_us = late;
+    }
+    portEXIT_CRITICAL(&g_lock);
+
+    // A level that changed while the interrupts slept
+    for(int i = 0; i < count; ++i){
+      watch_t * w = &g_watches[i];
+      int level = gpio_get_level(w->pin);
+      if(level == w->level) continue;
+      w->level = level;
+      if(w->changed) w->changed(w->arg);
+      power_activity();
+    }
+
+    portENTER_CRITICAL(&g_lock);
+    bool active = esp_timer_get_time() < g_active_until;
+    bool changed = active != g_input;
+    if(changed){
+      g_input = active;
+      power_account();
+    }
+    portEXIT_CRITICAL(&g_lock);
+    if(!changed) continue;
+    if(active){
+      esp_pm_lock_acquire(g_input_lock);
+    } else {
+      esp_pm_lock_release(g_input_lock);
+    }
+    ESP_LOGD(TAG, "%s", active ? "Awake for the inputs" : "Idle");
+  }
+}
+
+esp_err_t power_init(void)
+{
+  esp_pm_config_esp32_t config = {
+    .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = CONFIG_POWER_MIN_MHZ,
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+    .light_sleep_enable = true,
+#endif
+  };
+  esp_err_t err = esp_pm_configure(&config);
+  if(err != ESP_OK){
+    ESP_LOGE(TAG, "No power management: %s", esp_err_to_name(err));
+    return err;
+  }
+  err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "input", &g_input_lock);
+  if(err != ESP_OK) return err;
+  err = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "pwm", &g_apb_lock);
+  if(err != ESP_OK) return err;
+
+  portENTER_CRITICAL(&g_lock);
+  g_state_since = esp_timer_get_time();
+  power_update_apb(); // The LEDs may be on already
+  power_account();
+  portEXIT_CRITICAL(&g_lock);
+
+  // Above the input tasks, its callbacks stand in for their interrupts
+  g_task = rtos_task_start(&g_power_task, power_task, NULL, 6, tskNO_AFFINITY);
+  if(!g_task){
+    return ESP_ERR_NO_MEM;
+  }
+  power_activity(); // Awake for a while after boot
+  ESP_LOGI(TAG, "%d-%d MHz, light sleep %s, inputs checked every %d ms, listen interval %d",
+	   CONFIG_POWER_MIN_MHZ, CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+	   "on",
+#else
+	   "off",
+#endif
+	   WAKE_MS, POWER_LISTEN_INTERVAL);
+  return ESP_OK;
+}
+
+static esp_err_t power_get_handler(httpd_req_t *req)
+{
+  uint64_t state_us[POWER_STATES];
+  wake_stats_t wakes[POWER_STATES];
+  portENTER_CRITICAL(&g_lock);
+  power_account();
+  for(int i = 0; i < POWER_STATES; ++i){
+    state_us[i] = g_state_us[i];
+    wakes[i] = g_wakes[i];
+  }
+  enum power_state state = g_state;
+  portEXIT_CRITICAL(&g_lock);
+
+  // ms and the wake latency are measured, datasheet_ma is a static figure
+  char buf[768];
+  int len = snprintf(buf, sizeof(buf), "{\"state\":\"%s\",\"states\":{", g_state_names[state]);
+  uint64_t total_us = 0, charge = 0; // mA us
+  for(int i = 0; i < POWER_STATES; ++i){
+    const wake_stats_t * w = &wakes[i];
+    len += snprintf(buf + len, sizeof(buf) - len,
+		    "%s\"%s\":{\"ms\":%" PRIu64 ",\"datasheet_ma\":%u,\"wakes\":%" PRIu32
+		    ",\"mean_late_us\":%" PRIu64 ",\"max_late_us\":%" PRIu32 "}",
+		    i ? "," : "", g_state_names[i], state_us[i] / 1000, g_datasheet_ma[i],
+		    w->count, w->count ? w->sum_us / w->count : 0, w->max_us);
+    total_us += state_us[i];
+    charge += state_us[i] * g_datasheet_ma[i];
+  }
+  len += snprintf(buf + len, sizeof(buf) - len,
+		  "},\"datasheet_mean_ma\":%" PRIu64 ",\"poll_ms\":%d,\"listen_interval\":%d}",
+		  total_us ? charge / total_us : 0, WAKE_MS, POWER_LISTEN_INTERVAL);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+}
+
+static const httpd_uri_t power_get = {
+  .uri       = "/api/power",
+  .method    = HTTP_GET,
+  .handler   = power_get_handler,
+  .user_ctx  = NULL
+};
+
+void power_register(httpd_handle_t server)
+{
+  httpd_register_uri_handler(server, &power_get);
+}
+
+#endif // CONFIG_POWER_SAVE
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <driver/gpio.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+/*
+ * Power management while idle (CONFIG_POWER_SAVE, needs CONFIG_PM_ENABLE).
+ *
+ * The CPU clock scales between CONFIG_POWER_MIN_MHZ and the default clock,
+ * with light sleep when every task waits (CONFIG_POWER_LIGHT_SLEEP, needs
+ * tickless idle) and WiFi modem sleep. The fixture spends most of its life
+ * showing a color nobody changes, which then costs a few mA.
+ *
+ * Light sleep stops the GPIO interrupts, and the wakeup GPIOs of the ESP32
+ * would take over the edge interrupts of the inputs. Instead a task wakes
+ * every CONFIG_POWER_WAKE_MS and compares the levels of the watched pins:
+ * a change keeps the chip awake (and its interrupts on) for
+ * CONFIG_POWER_ACTIVE_MS, as does any event of the inputs. The network is
+ * bounded by the WiFi listen interval, POWER_LISTEN_INTERVAL beacons.
+ *
+ * The PWM either holds the APB clock while lit or runs from the RTC clock,
+ * see rgb.c. GET /api/power reports the time spent and the latency of the
+ * input checks measured in each power state, with a static datasheet
+ * figure of its current (not a measurement).
+ */
+
+#ifdef CONFIG_POWER_SAVE
+#define POWER_BEACON_MS (102) // The usual beacon interval, 100 TU
+#define POWER_LISTEN_INTERVAL \
+  (CONFIG_POWER_NET_LATENCY_MS < 2 * POWER_BEACON_MS ? 1 : CONFIG_POWER_NET_LATENCY_MS / POWER_BEACON_MS)
+
+esp_err_t power_init(void);
+void power_register(httpd_handle_t server);
+
+// Checked between sleeps, 'changed' (if any) runs in the power task when
+// the level is not the one of the last check
+void power_watch(gpio_num_t pin, void (*changed)(void * arg), void * arg);
+
+// An input event, stay awake for a while
+void power_activity(void);
+
+// Some LED is on. With the APB clock PWM this holds the APB clock at its
+// maximum, which also prevents light sleep.
+void power_set_lit(bool lit);
+#else
+static inline esp_err_t power_init(void) { return ESP_OK; }
+static inline void power_register(httpd_handle_t server) {}
+static inline void power_watch(gpio_num_t pin, void (*changed)(void * arg), void * arg) {}
+static inline void power_activity(void) {}
+static inline void power_set_lit(bool lit) {}
+#endif
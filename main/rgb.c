@@ -1,13 +1,19 @@
 #include "rgb.h"
 
+#include "calib.h"
+#include "limit.h"
+#include "power.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
 #include <driver/ledc.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_sleep.h>
 
 const char * TAG = "RGB";
 
-static rgb_calibration_t rgb_cal = {128, 128, 128};
-
 /* channels */
 #define LED_R_PWM_CHANNEL LEDC_CHANNEL_1 
 #define LED_G_PWM_CHANNEL LEDC_CHANNEL_2
@@ -16,18 +22,40 @@ static rgb_calibration_t rgb_cal = {128, 128, 128};
 /* timer */
 #define LED_PWM_TIMER LEDC_TIMER_1
 // #define LED_PWM_BIT_NUM LEDC_TIMER_10_BIT  // 1024 ( 1023 )
-#define LED_PWM_BIT_NUM LEDC_TIMER_8_BIT    // 256 ( 255 )
+// #define LED_PWM_BIT_NUM LEDC_TIMER_8_BIT    // 256 ( 255 )
+#define LED_PWM_BIT_NUM LEDC_TIMER_11_BIT   // 2048 ( 2047 ), the most at 25kHz, RGB_DUTY_MAX
 
-static rgb_t correct_rgb(rgb_t in, rgb_calibration_t cal){
-  unsigned int r = (in.r * (cal.r_scale + 128)) / 256;
-  unsigned int g = (in.g * (cal.g_scale + 128)) / 256;
-  unsigned int b = (in.b * (cal.b_scale + 128)) / 256;
-  rgb_t color = {
-    r>0xFF ? 0xFF : r,
-    g>0xFF ? 0xFF : g,
-    b>0xFF ? 0xFF : b};
-  return color;
-}
+/*
+ * The clock of the PWM has to stay put when power management changes the
+ * clocks (power.h):
+ *   APB    25 kHz from the 80 MHz APB clock. The APB clock is held at 80 MHz
+ *          while any channel is on, which also keeps the chip out of light
+ *          sleep.
+ *   RTC8M  3.9 kHz from the 8 MHz RTC oscillator, which is left running in
+ *          light sleep: the LEDs do not care about frequency scaling or
+ *          sleep at all. Only the low speed timers take this clock.
+ */
+#ifdef CONFIG_RGB_PWM_RTC8M
+#define LED_PWM_MODE LEDC_LOW_SPEED_MODE
+#define LED_PWM_CLOCK LEDC_USE_RTC8M_CLK
+#define LED_PWM_HZ (3900)
+#else
+#define LED_PWM_MODE LEDC_HIGH_SPEED_MODE
+#define LED_PWM_CLOCK LEDC_USE_APB_CLK
+#define LED_PWM_HZ (25000)
+#endif
+
+// Output stage, see calib.h
+static calib_lut_t g_lut;
+static rgb_calibration_t g_cal;
+static bool g_folded = false;
+
+// Current limiter, after the calibration
+static const uint16_t g_limit_ma[3] = {CONFIG_RGB_RED_MA, CONFIG_RGB_GREEN_MA, CONFIG_RGB_BLUE_MA};
+static uint32_t g_limit_duty[3];
+static limit_t g_limit;
+// The statistics are read by other tasks (/stats), as a whole
+static portMUX_TYPE g_limit_lock = portMUX_INITIALIZER_UNLOCKED;
 
 void rgb_init(gpio_num_t red_pin,
 	      gpio_num_t green_pin,
@@ -39,7 +67,7 @@ void rgb_init(gpio_num_t red_pin,
     
   /* set channel r */
   ledc_channel_r.gpio_num = red_pin; 
-  ledc_channel_r.speed_mode = LEDC_HIGH_SPEED_MODE;
+  ledc_channel_r.speed_mode = LED_PWM_MODE;
   ledc_channel_r.channel = LED_R_PWM_CHANNEL;
   ledc_channel_r.intr_type = LEDC_INTR_DISABLE;
   ledc_channel_r.timer_sel = LED_PWM_TIMER;
@@ -47,7 +75,7 @@ void rgb_init(gpio_num_t red_pin,
   
   /* set channel g */
   ledc_channel_g.gpio_num = green_pin; 
-  ledc_channel_g.speed_mode = LEDC_HIGH_SPEED_MODE;
+  ledc_channel_g.speed_mode = LED_PWM_MODE;
   ledc_channel_g.channel = LED_G_PWM_CHANNEL;
   ledc_channel_g.intr_type = LEDC_INTR_DISABLE;
   ledc_channel_g.timer_sel = LED_PWM_TIMER;
@@ -55,7 +83,7 @@ void rgb_init(gpio_num_t red_pin,
   
   /* set channel b */
   ledc_channel_b.gpio_num = blue_pin; 
-  ledc_channel_b.speed_mode = LEDC_HIGH_SPEED_MODE;
+  ledc_channel_b.speed_mode = LED_PWM_MODE;
   ledc_channel_b.channel = LED_B_PWM_CHANNEL;
   ledc_channel_b.intr_type = LEDC_INTR_DISABLE;
   ledc_channel_b.timer_sel = LED_PWM_TIMER;
@@ -63,128 +91,64 @@ void rgb_init(gpio_num_t red_pin,
   
   /* set timer  */	
   ledc_timer_config_t ledc_timer = {0};
-  ledc_timer.speed_mode = LEDC_HIGH_SPEED_MODE;
+  ledc_timer.speed_mode = LED_PWM_MODE;
   ledc_timer.bit_num = LED_PWM_BIT_NUM;
   ledc_timer.timer_num = LED_PWM_TIMER;
-  ledc_timer.freq_hz = 25000; 
+  ledc_timer.freq_hz = LED_PWM_HZ;
+  ledc_timer.clk_cfg = LED_PWM_CLOCK;
   
   ESP_ERROR_CHECK( ledc_channel_config(&ledc_channel_r) );
   ESP_ERROR_CHECK( ledc_channel_config(&ledc_channel_g) );
   ESP_ERROR_CHECK( ledc_channel_config(&ledc_channel_b) );
   
   ESP_ERROR_CHECK( ledc_timer_config(&ledc_timer) );
+  limit_init(&g_limit, 3, g_limit_ma, g_limit_duty, RGB_DUTY_MAX, CONFIG_RGB_LIMIT_MA);
+#ifdef CONFIG_RGB_PWM_RTC8M
+  ESP_ERROR_CHECK( esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON) );
+#endif
 }
 
-void rgb_set(rgb_t rgb_in)
+void rgb_set(rgb_t rgb)
 {
-  rgb_t rgb = correct_rgb(rgb_in, rgb_cal);
-  ESP_LOGI(TAG, "RGB: Color set to r:%d g:%d b:%d ",
-	   rgb_in.r, rgb_in.g, rgb_in.b);
-  ESP_LOGI(TAG, "RGB: Color corrected to r:%d g:%d b:%d ",
+  uint32_t duty[3];
+  for(int i = 0; i < 3; ++i) duty[i] = calib_duty(&g_lut, i, rgb);
+  portENTER_CRITICAL(&g_limit_lock);
+  for(int i = 0; i < 3; ++i) limit_set(&g_limit, i, duty[i]);
+  limit_frame(&g_limit);
+  uint32_t r = limit_apply(&g_limit, g_limit_duty[0]);
+  uint32_t g = limit_apply(&g_limit, g_limit_duty[1]);
+  uint32_t b = limit_apply(&g_limit, g_limit_duty[2]);
+  portEXIT_CRITICAL(&g_limit_lock);
+  ESP_LOGD(TAG, "RGB: Color set to r:%d g:%d b:%d ",
 	   rgb.r, rgb.g, rgb.b);
+  ESP_LOGD(TAG, "RGB: Duty r:%d g:%d b:%d ", r, g, b);
+  bool lit = (r | g | b) != 0;
+  if(lit) power_set_lit(true); // Before the duty, the clock is right from the start
   /* LED R */
-  ESP_ERROR_CHECK(ledc_set_duty(LEDC_HIGH_SPEED_MODE, LED_R_PWM_CHANNEL, rgb.r));
-  ESP_ERROR_CHECK(ledc_update_duty(LEDC_HIGH_SPEED_MODE, LED_R_PWM_CHANNEL) );
+  ESP_ERROR_CHECK(ledc_set_duty(LED_PWM_MODE, LED_R_PWM_CHANNEL, r));
+  ESP_ERROR_CHECK(ledc_update_duty(LED_PWM_MODE, LED_R_PWM_CHANNEL) );
   
   /* LED G */
-  ESP_ERROR_CHECK(ledc_set_duty(LEDC_HIGH_SPEED_MODE, LED_G_PWM_CHANNEL, rgb.g));
-  ESP_ERROR_CHECK(ledc_update_duty(LEDC_HIGH_SPEED_MODE, LED_G_PWM_CHANNEL) );
+  ESP_ERROR_CHECK(ledc_set_duty(LED_PWM_MODE, LED_G_PWM_CHANNEL, g));
+  ESP_ERROR_CHECK(ledc_update_duty(LED_PWM_MODE, LED_G_PWM_CHANNEL) );
   
   /* LED B */
-  ESP_ERROR_CHECK(ledc_set_duty(LEDC_HIGH_SPEED_MODE, LED_B_PWM_CHANNEL, rgb.b));
-  ESP_ERROR_CHECK(ledc_update_duty(LEDC_HIGH_SPEED_MODE, LED_B_PWM_CHANNEL) );
+  ESP_ERROR_CHECK(ledc_set_duty(LED_PWM_MODE, LED_B_PWM_CHANNEL, b));
+  ESP_ERROR_CHECK(ledc_update_duty(LED_PWM_MODE, LED_B_PWM_CHANNEL) );
+  if(!lit) power_set_lit(false);
 }
 
 void rgb_set_calib(rgb_calibration_t cal){
-  rgb_cal = cal;
+  if(g_folded && memcmp(&cal, &g_cal, sizeof(cal)) == 0) return;
+  g_cal = cal;
+  calib_fold(&g_lut, &g_cal, RGB_GAMMA, RGB_DUTY_MAX);
+  g_folded = true;
 }
 
-rgb_t hsv_to_rgb(hsv_t hsv){
-  rgb_t rgb;
-  unsigned char region, p, q, t;
-  unsigned int h, s, v, remainder;
-  
-  if (hsv.s == 0){
-    rgb.r = hsv.v;
-    rgb.g = hsv.v;
-    rgb.b = hsv.v;
-    return rgb;
-  }
-  
-  // converting to 16 bit to prevent overflow
-  h = hsv.h;
-  s = hsv.s;
-  v = hsv.v;
-
-  region = h / 43;
-  remainder = (h - (region * 43)) * 6; 
-
-  p = (v * (255 - s)) >> 8;
-  q = (v * (255 - ((s * remainder) >> 8))) >> 8;
-  t = (v * (255 - ((s * (255 - remainder)) >> 8))) >> 8;
-  
-  switch (region){
-  case 0:
-    rgb.r = v;
-    rgb.g = t;
-    rgb.b = p;
-    break;
-  case 1:
-    rgb.r = q;
-    rgb.g = v;
-    rgb.b = p;
-    break;
-  case 2:
-    rgb.r = p;
-    rgb.g = v;
-    rgb.b = t;
-    break;
-  case 3:
-    rgb.r = p;
-    rgb.g = q;
-    rgb.b = v;
-    break;
-  case 4:
-    rgb.r = t;
-    rgb.g = p;
-    rgb.b = v;
-    break;
-  default:
-    rgb.r = v;
-    rgb.g = p;
-    rgb.b = q;
-    break;
-  }
-  return rgb;
-}
-
-hsv_t rgb_to_hsv(rgb_t rgb)
+void rgb_get_limit_stats(limit_stats_t * stats, uint32_t * budget_ma)
 {
-  hsv_t hsv;
-  unsigned char rgbMin, rgbMax;
-  
-  rgbMin = rgb.r < rgb.g ? (rgb.r < rgb.b ? rgb.r : rgb.b) : (rgb.g < rgb.b ? rgb.g : rgb.b);
-  rgbMax = rgb.r > rgb.g ? (rgb.r > rgb.b ? rgb.r : rgb.b) : (rgb.g > rgb.b ? rgb.g : rgb.b);
-  
-  hsv.v = rgbMax;
-  if (hsv.v == 0){
-    hsv.h = 0;
-    hsv.s = 0;
-    return hsv;
-  }
-  
-  hsv.s = 255 * ((long)(rgbMax - rgbMin)) / hsv.v;
-  if (hsv.s == 0){
-    hsv.h = 0;
-    return hsv;
-  }
-  
-  if (rgbMax == rgb.r)
-    hsv.h = 0 + 43 * (rgb.g - rgb.b) / (rgbMax - rgbMin);
-  else if (rgbMax == rgb.g)
-    hsv.h = 85 + 43 * (rgb.b - rgb.r) / (rgbMax - rgbMin);
-  else
-    hsv.h = 171 + 43 * (rgb.r - rgb.g) / (rgbMax - rgbMin);
-  
-  return hsv;
+  portENTER_CRITICAL(&g_limit_lock);
+  *stats = g_limit.stats;
+  *budget_ma = g_limit.budget_ma;
+  portEXIT_CRITICAL(&g_limit_lock);
 }
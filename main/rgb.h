@@ -1,37 +1,25 @@
 #pragma once
 #include <stdint.h>
 #include <driver/gpio.h>
+#include "color.h"
+#include "calib.h"
+#include "limit.h"
 
-
-typedef struct
-{
-  uint8_t h;
-  uint8_t s;
-  uint8_t v;
-} hsv_t;
-
-typedef struct
-{
-  uint8_t r;
-  uint8_t g;
-  uint8_t b;
-} rgb_t;
-
-typedef struct
-{
-  // color = value * (scale + 128) / 256
-  uint8_t r_scale;
-  uint8_t g_scale;
-  uint8_t b_scale;
-} rgb_calibration_t;
+// Gamma of the output, 1 drives the PWM with the color values
+#define RGB_GAMMA (CONFIG_RGB_GAMMA / 10.0f)
+#define RGB_DUTY_MAX ((1 << 11) - 1) // 11 bit PWM
 
 void rgb_init(gpio_num_t red_pin,
 	      gpio_num_t green_pin,
 	      gpio_num_t blue_pin);
 
+// The main loop is the only caller of rgb_set and rgb_set_calib, other
+// tasks post their colors to it (control.h, dmx.h)
 void rgb_set(rgb_t rgb);
 
+// Cheap when the calibration does not change
 void rgb_set_calib(rgb_calibration_t cal);
 
-rgb_t hsv_to_rgb(hsv_t hsv);
-hsv_t rgb_to_hsv(rgb_t rgb);
+// How often and how hard the current limiter scaled the outputs down, a
+// consistent copy from any task
+void rgb_get_limit_stats(limit_stats_t * stats, uint32_t * budget_ma);
@@ -0,0 +1,116 @@
+#include "rtos.h"
+
+#include <stdlib.h>
+#include <esp_log.h>
+
+static const char * const TAG = "rtos";
+
+static rtos_task_t * g_tasks = NULL;
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void task_register(rtos_task_t * task)
+{
+  portENTER_CRITICAL(&g_lock);
+  if(!task->registered){
+    task->registered = true;
+    task->next_task = g_tasks;
+    g_tasks = task;
+  }
+  portEXIT_CRITICAL(&g_lock);
+}
+
+TaskHandle_t rtos_task_start(rtos_task_t * task, TaskFunction_t fn, void * arg,
+			     UBaseType_t priority, BaseType_t core)
+{
+  TaskHandle_t handle = NULL;
+  if(task->handle){
+    ESP_LOGE(TAG, "Task %s is running already", task->name);
+    return NULL;
+  }
+  if(task->stack){
+    // The stack depth is in StackType_t, bytes on the ESP32
+    handle = xTaskCreateStaticPinnedToCore(fn, task->name, task->stack_size / sizeof(StackType_t),
+					   arg, priority, task->stack, task->tcb, core);
+  } else if(xTaskCreatePinnedToCore(fn, task->name, task->stack_size, arg, priority,
+				    &handle, core) != pdPASS){
+    handle = NULL;
+  }
+  if(!handle){
+    ESP_LOGE(TAG, "No memory for task %s (%d bytes of stack)", task->name, task->stack_size);
+    return NULL;
+  }
+  task->handle = handle;
+  task_register(task);
+  return handle;
+}
+
+void rtos_task_delete(rtos_task_t * task)
+{
+  TaskHandle_t handle = task->handle;
+  task->handle = NULL;
+  if(handle) vTaskDelete(handle);
+}
+
+void rtos_task_exit(rtos_task_t * task)
+{
+  task->handle = NULL;
+  vTaskDelete(NULL);
+}
+
+QueueHandle_t rtos_queue_create(rtos_queue_t * queue)
+{
+  if(queue->storage){
+    return xQueueCreateStatic(queue->length, queue->item_size, queue->storage, queue->queue);
+  }
+  return xQueueCreate(queue->length, queue->item_size);
+}
+
+SemaphoreHandle_t rtos_mutex_create(rtos_mutex_t * mutex)
+{
+  if(mutex->mutex){
+    return xSemaphoreCreateMutexStatic(mutex->mutex);
+  }
+  return xSemaphoreCreateMutex();
+}
+
+void * rtos_buffer_take(rtos_buffer_t * buffer)
+{
+  bool taken = false;
+  portENTER_CRITICAL(&g_lock);
+  if(!buffer->taken){
+    buffer->taken = true;
+    taken = true;
+  }
+  portEXIT_CRITICAL(&g_lock);
+  if(!taken) return NULL;
+  if(buffer->storage) return buffer->storage;
+  void * data = malloc(buffer->size);
+  if(!data) buffer->taken = false;
+  return data;
+}
+
+void rtos_buffer_give(rtos_buffer_t * buffer, void * data)
+{
+  if(!data) return;
+  if(!buffer->storage) free(data);
+  buffer->taken = false;
+}
+
+void rtos_task_get_stats(rtos_task_t * task, rtos_task_stats_t * out)
+{
+  out->name = task->name;
+  out->stack_size = task->stack_size;
+  out->is_static = task->stack != NULL;
+  TaskHandle_t handle = task->handle;
+  out->running = handle != NULL;
+  // In bytes on the ESP32, where StackType_t is a byte
+  out->stack_free_min = handle ? uxTaskGetStackHighWaterMark(handle) * sizeof(StackType_t) : 0;
+}
+
+void rtos_task_for_each(void (*fn)(rtos_task_t * task, void * arg), void * arg)
+{
+  // Tasks are only ever prepended, walking a snapshot of the head is safe.
+  for(rtos_task_t * task = g_tasks; task; task = task->next_task){
+    fn(task, arg);
+  }
+}
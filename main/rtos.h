@@ -0,0 +1,134 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+/*
+ * Tasks, queues, mutexes and large buffers of the firmware.
+ *
+ * Each one is defined at file scope with its size, like a pool (pool.h).
+ * With CONFIG_STATIC_ALLOC the stacks, control blocks and queue storage are
+ * static arrays, so they show up in .bss of the module (tools/footprint.py)
+ * and the heap only holds what ESP-IDF allocates itself. Otherwise they are
+ * taken from the heap when created, as xTaskCreate / xQueueCreate / malloc
+ * do, and buffers only take memory while they are used.
+ *
+ *   RTOS_TASK_DEFINE(g_task, "dmx", CONFIG_DMX_STACK);
+ *   RTOS_QUEUE_DEFINE(g_edges, edge_t, 8);
+ *   ...
+ *   if(!rtos_task_start(&g_task, dmx_task, NULL, 6, tskNO_AFFINITY)) ...
+ *   QueueHandle_t edges = rtos_queue_create(&g_edges);
+ *
+ * Started tasks are listed with their stack high water mark in /stats.
+ */
+
+typedef struct rtos_task {
+  const char * name;
+  uint32_t stack_size;     // Bytes
+  StackType_t * stack;     // Static storage, NULL to take it from the heap
+  StaticTask_t * tcb;
+  TaskHandle_t handle;     // While it runs
+  bool registered;
+  struct rtos_task * next_task;
+} rtos_task_t;
+
+typedef struct {
+  UBaseType_t length;
+  UBaseType_t item_size;
+  uint8_t * storage;       // Static storage, NULL to take it from the heap
+  StaticQueue_t * queue;
+} rtos_queue_t;
+
+typedef struct {
+  StaticSemaphore_t * mutex; // NULL to take it from the heap
+} rtos_mutex_t;
+
+typedef struct {
+  size_t size;
+  uint8_t * storage;       // Static storage, NULL to take it from the heap
+  bool taken;
+} rtos_buffer_t;
+
+typedef struct {
+  const char * name;
+  uint32_t stack_size;
+  uint32_t stack_free_min; // Bytes never used, 0 once the task is deleted
+  bool running;
+  bool is_static;
+} rtos_task_stats_t;
+
+#ifdef CONFIG_STATIC_ALLOC
+
+#define RTOS_TASK_DEFINE(name_, label_, stack_size_)			\
+  static StackType_t name_##_stack[(stack_size_) / sizeof(StackType_t)]; \
+  static StaticTask_t name_##_tcb;					\
+  static rtos_task_t name_ = {						\
+    .name = (label_),							\
+    .stack_size = (stack_size_),					\
+    .stack = name_##_stack,						\
+    .tcb = &name_##_tcb							\
+  }
+
+#define RTOS_QUEUE_DEFINE(name_, type_, length_)			\
+  static uint8_t name_##_storage[(length_) * sizeof(type_)];		\
+  static StaticQueue_t name_##_queue;					\
+  static rtos_queue_t name_ = {						\
+    .length = (length_),						\
+    .item_size = sizeof(type_),						\
+    .storage = name_##_storage,						\
+    .queue = &name_##_queue						\
+  }
+
+#define RTOS_MUTEX_DEFINE(name_)					\
+  static StaticSemaphore_t name_##_mutex;				\
+  static rtos_mutex_t name_ = { .mutex = &name_##_mutex }
+
+#define RTOS_BUFFER_DEFINE(name_, size_)				\
+  static uint8_t name_##_storage[size_] __attribute__((aligned(8)));	\
+  static rtos_buffer_t name_ = { .size = (size_), .storage = name_##_storage }
+
+#else
+
+#define RTOS_TASK_DEFINE(name_, label_, stack_size_)			\
+  static rtos_task_t name_ = { .name = (label_), .stack_size = (stack_size_) }
+
+#define RTOS_QUEUE_DEFINE(name_, type_, length_)			\
+  static rtos_queue_t name_ = { .length = (length_), .item_size = sizeof(type_) }
+
+#define RTOS_MUTEX_DEFINE(name_)		\
+  static rtos_mutex_t name_ = { .mutex = NULL }
+
+#define RTOS_BUFFER_DEFINE(name_, size_)		\
+  static rtos_buffer_t name_ = { .size = (size_) }
+
+#endif
+
+// Starts the task on 'core' (tskNO_AFFINITY for any), returns its handle or
+// NULL. It fails while the task runs, it may be started again once it is
+// deleted.
+TaskHandle_t rtos_task_start(rtos_task_t * task, TaskFunction_t fn, void * arg,
+			     UBaseType_t priority, BaseType_t core);
+
+// Deletes a task started with rtos_task_start
+void rtos_task_delete(rtos_task_t * task);
+
+// Ends the calling task, started with rtos_task_start
+void rtos_task_exit(rtos_task_t * task);
+
+// Returns NULL without memory. A static queue is the same storage every time,
+// delete it before it is created again.
+QueueHandle_t rtos_queue_create(rtos_queue_t * queue);
+
+SemaphoreHandle_t rtos_mutex_create(rtos_mutex_t * mutex);
+
+// Returns the buffer (not zeroed), NULL without memory or while it is taken
+void * rtos_buffer_take(rtos_buffer_t * buffer);
+void rtos_buffer_give(rtos_buffer_t * buffer, void * data);
+
+void rtos_task_get_stats(rtos_task_t * task, rtos_task_stats_t * out);
+
+// Call fn for every task that has been started at least once
+void rtos_task_for_each(void (*fn)(rtos_task_t * task, void * arg), void * arg);
@@ -0,0 +1,408 @@
+#include "schedule.h"
+#include "storage.h"
+#include "control.h"
+#include "json.h"
+#include "rtos.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#ifdef CONFIG_SCHEDULE_SNTP
+#include <esp_sntp.h>
+#endif
+
+#ifdef CONFIG_SCHEDULE_ENABLE
+
+static const char *TAG = "schedule";
+
+#define SLEEP_MAX_S (15 * 60)
+#define TIME_VALID (1600000000) // Before that the clock was never set
+#define MAX_BODY (4096)
+
+static const char * const _days = "smtwtfs";
+
+static SemaphoreHandle_t g_lock = NULL; // Task against the API
+static TaskHandle_t g_task = NULL;
+RTOS_TASK_DEFINE(g_schedule_task, "schedule", CONFIG_SCHEDULE_STACK);
+RTOS_MUTEX_DEFINE(g_lock_def);
+static schedule_table_t g_table;
+static schedule_t g_schedule;
+static const char * g_clock = "unset"; // Where the time came from
+
+// Local time in seconds, false until the clock is set
+static bool local_now(int64_t * out)
+{
+  time_t t = time(NULL);
+  if(t < TIME_VALID) return false;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  *out = schedule_local_time(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			     tm.tm_hour, tm.tm_min, tm.tm_sec);
+  return true;
+}
+
+static void local_format(int64_t local, char * out, size_t size)
+{
+  time_t t = local;
+  struct tm tm;
+  gmtime_r(&t, &tm); // Local time already
+  strftime(out, size, "%Y-%m-%dT%H:%M:%S", &tm);
+}
+
+// Called by schedule_update, with g_lock held
+static void schedule_run(const schedule_entry_t * entry, uint32_t late, void * arg)
+{
+  state_patch_t patch;
+  memset(&patch, 0, sizeof(patch));
+  // Late, it fades for what is left of the ramp
+  patch.ramp_s = entry->ramp_s > late ? entry->ramp_s - late : 0;
+  switch(entry->action){
+  case SCHEDULE_SCENE:
+    patch.fields = PATCH_SCENE;
+    patch.scene = entry->scene;
+    break;
+  case SCHEDULE_COLOR:
+    patch.fields = PATCH_RGB | PATCH_RAMP;
+    patch.rgb = entry->rgb;
+    break;
+  default:
+    patch.fields = PATCH_POWER | PATCH_RAMP;
+    patch.on = false;
+    break;
+  }
+  ESP_LOGI(TAG, "Running the entry of %02d:%02d, %u s late", entry->minute / 60,
+	   entry->minute % 60, late);
+  control_submit(&patch);
+  esp_err_t err = storage_save_schedule(&g_table); // For last_run
+  if(err != ESP_OK) ESP_LOGW(TAG, "Not saved: %s", esp_err_to_name(err));
+}
+
+static void schedule_task(void * arg)
+{
+  while(1){
+    TickType_t wait = pdMS_TO_TICKS(SLEEP_MAX_S * 1000);
+    int64_t now;
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if(local_now(&now)){
+      schedule_update(&g_schedule, now);
+      int64_t due = schedule_due(&g_schedule);
+      if(due - now < SLEEP_MAX_S){
+	// To the start of the second it is due, and a bit
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	wait = pdMS_TO_TICKS((due - now) * 1000 - tv.tv_usec / 1000 + 10);
+      }
+    }
+    xSemaphoreGive(g_lock);
+    ulTaskNotifyTake(pdTRUE, MAX(wait, 1));
+  }
+}
+
+#ifdef CONFIG_SCHEDULE_SNTP
+static void sntp_synced(struct timeval * tv)
+{
+  if(strcmp(g_clock, "sntp") != 0) ESP_LOGI(TAG, "Clock set by SNTP");
+  g_clock = "sntp";
+  xTaskNotifyGive(g_task);
+}
+#endif
+
+/* JSON */
+
+typedef struct {
+  schedule_table_t table;
+  schedule_entry_t entry;
+  bool entries;     // The table is replaced
+  bool has_now;
+  int64_t now;
+  uint16_t kelvin;
+  uint8_t level;
+} schedule_reader_t;
+
+static bool parse_time(const char * s, uint16_t * minute)
+{
+  char * end;
+  long h = strtol(s, &end, 10);
+  if(*end != ':') return false;
+  long m = strtol(end + 1, &end, 10);
+  if(*end || h < 0 || h > 23 || m < 0 || m > 59) return false;
+  *minute = h * 60 + m;
+  return true;
+}
+
+static bool parse_days(const char * s, uint8_t * days)
+{
+  if(strlen(s) != 7) return false;
+  *days = 0;
+  for(int d = 0; d < 7; ++d){
+    if(s[d] != '-') *days |= 1 << d;
+  }
+  return true;
+}
+
+// Values of an entry object, at depth 3
+static bool entry_value(schedule_reader_t * sr, json_reader_t * r, json_event_t event)
+{
+  const char * key = json_reader_key(r, r->depth);
+  schedule_entry_t * e = &sr->entry;
+  switch(event){
+  case JSON_STRING:
+    if(strcmp(key, "time") == 0) return parse_time(r->token, &e->minute);
+    if(strcmp(key, "days") == 0) return parse_days(r->token, &e->days);
+    return false;
+  case JSON_NUMBER:
+    if(strcmp(key, "ramp_s") == 0 && r->number >= 0){
+      e->ramp_s = MIN(r->number, UINT16_MAX);
+      return true;
+    }
+    if(strcmp(key, "scene") == 0 && r->number >= 0 && r->number < SCENE_COUNT){
+      e->action = SCHEDULE_SCENE;
+      e->scene = r->number;
+      return true;
+    }
+    if(strcmp(key, "kelvin") == 0 && r->number >= 1000 && r->number <= 10000){
+      e->action = SCHEDULE_COLOR;
+      sr->kelvin = r->number;
+      return true;
+    }
+    if(strcmp(key, "level") == 0 && r->number >= 0 && r->number <= 255){
+      sr->level = r->number;
+      return true;
+    }
+    return false;
+  case JSON_TRUE:
+    if(strcmp(key, "off") == 0){
+      e->action = SCHEDULE_OFF;
+      return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Depths: 1 the document and "now", 2 the entries array, 3 an entry and its
+ * values, 4 the rgb object of an entry and its values.
+ */
+static bool schedule_json_cb(json_reader_t * r, json_event_t event, void * arg)
+{
+  schedule_reader_t * sr = arg;
+  switch(r->depth){
+  case 1:
+    if(event == JSON_OBJECT_START || event == JSON_OBJECT_END) return true;
+    if(event == JSON_NUMBER && strcmp(json_reader_key(r, 1), "now") == 0){
+      sr->now = strtoll(r->token, NULL, 10);
+      sr->has_now = true;
+      return true;
+    }
+    return false;
+  case 2:
+    if(strcmp(json_reader_key(r, 1), "entries") != 0) return false;
+    if(event == JSON_ARRAY_START){
+      sr->entries = true;
+      sr->table.count = 0;
+      return true;
+    }
+    return event == JSON_ARRAY_END;
+  case 3:
+    if(event == JSON_OBJECT_START){
+      memset(&sr->entry, 0, sizeof(sr->entry));
+      sr->entry.days = SCHEDULE_ALL_DAYS;
+      sr->entry.action = SCHEDULE_ACTIONS; // Has to be set
+      sr->kelvin = 0;
+      sr->level = 255;
+      return true;
+    }
+    if(event == JSON_OBJECT_END){
+      if(sr->entry.action == SCHEDULE_ACTIONS || sr->table.count >= SCHEDULE_MAX_ENTRIES){
+	return false;
+      }
+      if(sr->kelvin) sr->entry.rgb = color_temperature(sr->kelvin, sr->level);
+      sr->table.entries[sr->table.count++] = sr->entry;
+      return true;
+    }
+    return entry_value(sr, r, event);
+  case 4:
+    if(strcmp(json_reader_key(r, 3), "rgb") != 0) return false;
+    if(event == JSON_OBJECT_START){
+      sr->entry.action = SCHEDULE_COLOR;
+      return true;
+    }
+    if(event == JSON_OBJECT_END) return true;
+    if(event == JSON_NUMBER){
+      const char * key = json_reader_key(r, 4);
+      uint8_t v = MAX(0, MIN(255, r->number));
+      if(strcmp(key, "r") == 0) sr->entry.rgb.r = v;
+      else if(strcmp(key, "g") == 0) sr->entry.rgb.g = v;
+      else if(strcmp(key, "b") == 0) sr->entry.rgb.b = v;
+      else return false;
+      return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+static esp_err_t read_schedule(httpd_req_t *req, schedule_reader_t * sr)
+{
+  if(req->content_len > MAX_BODY){
+    return ESP_ERR_INVALID_SIZE;
+  }
+  json_reader_t reader;
+  memset(sr, 0, sizeof(*sr));
+  json_reader_init(&reader, schedule_json_cb, sr);
+  char buf[128];
+  size_t left = req->content_len;
+  while(left > 0){
+    int n = httpd_req_recv(req, buf, MIN(left, sizeof(buf)));
+    if(n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+    if(n <= 0) return ESP_FAIL;
+    left -= n;
+    if(!json_reader_feed(&reader, buf, n)) return ESP_ERR_INVALID_ARG;
+  }
+  if(!json_reader_finish(&reader)) return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
+static int entry_json(const schedule_entry_t * e, char * out, size_t size)
+{
+  char days[8];
+  for(int d = 0; d < 7; ++d){
+    days[d] = e->days & (1 << d) ? _days[d] : '-';
+  }
+  days[7] = 0;
+  int len = snprintf(out, size, "{\"time\":\"%02d:%02d\",\"days\":\"%s\",",
+		     e->minute / 60, e->minute % 60, days);
+  switch(e->action){
+  case SCHEDULE_SCENE:
+    len += snprintf(out + len, size - len, "\"scene\":%d}", e->scene);
+    break;
+  case SCHEDULE_COLOR:
+    len += snprintf(out + len, size - len, "\"rgb\":{\"r\":%d,\"g\":%d,\"b\":%d},\"ramp_s\":%u}",
+		    e->rgb.r, e->rgb.g, e->rgb.b, e->ramp_s);
+    break;
+  default:
+    len += snprintf(out + len, size - len, "\"off\":true,\"ramp_s\":%u}", e->ramp_s);
+    break;
+  }
+  return len;
+}
+
+static esp_err_t schedule_get_handler(httpd_req_t *req)
+{
+  char buf[160];
+  char local[24] = "", next[24] = "";
+  int64_t now;
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  schedule_table_t table = g_table;
+  xSemaphoreGive(g_lock);
+  bool valid = local_now(&now);
+  if(valid){
+    local_format(now, local, sizeof(local));
+    int64_t first = INT64_MAX;
+    for(int i = 0; i < table.count; ++i){
+      first = MIN(first, schedule_next(&table.entries[i], now));
+    }
+    if(first != INT64_MAX) local_format(first, next, sizeof(next));
+  }
+  snprintf(buf, sizeof(buf), "{\"now\":%lld,\"local\":\"%s\",\"clock\":\"%s\",\"next\":\"%s\",\"entries\":[",
+	   (long long)time(NULL), local, g_clock, next);
+  httpd_resp_set_type(req, "application/json");
+  esp_err_t err = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+  for(int i = 0; i < table.count && err == ESP_OK; ++i){
+    int len = i ? snprintf(buf, sizeof(buf), ",") : 0;
+    entry_json(&table.entries[i], buf + len, sizeof(buf) - len);
+    err = httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+  }
+  if(err == ESP_OK) err = httpd_resp_send_chunk(req, "]}", 2);
+  if(err == ESP_OK) err = httpd_resp_send_chunk(req, NULL, 0);
+  return err;
+}
+
+static esp_err_t schedule_put_handler(httpd_req_t *req)
+{
+  static schedule_reader_t sr; // Handlers run one at a time
+  esp_err_t err = read_schedule(req, &sr);
+  if(err == ESP_FAIL) return ESP_FAIL; // Connection error, nothing to answer
+  if(err != ESP_OK){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+			       err == ESP_ERR_INVALID_SIZE ? "Body too long" : "Invalid schedule JSON");
+  }
+  if(sr.has_now && strcmp(g_clock, "sntp") != 0){
+    // Stands in for SNTP, until it answers
+    struct timeval tv = {sr.now, 0};
+    settimeofday(&tv, NULL);
+    g_clock = "client";
+    ESP_LOGI(TAG, "Clock set by a client");
+  }
+  if(sr.entries){
+    int64_t now;
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    sr.table.last_run = g_table.last_run;
+    g_table = sr.table;
+    if(local_now(&now)) schedule_changed(&g_schedule, now);
+    err = storage_save_schedule(&g_table);
+    xSemaphoreGive(g_lock);
+    ESP_LOGI(TAG, "%d entries", g_table.count);
+    if(err != ESP_OK){
+      return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not saved");
+    }
+  }
+  xTaskNotifyGive(g_task);
+  httpd_resp_set_status(req, HTTPD_204);
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static const httpd_uri_t schedule_get = {
+  .uri       = "/api/schedule",
+  .method    = HTTP_GET,
+  .handler   = schedule_get_handler,
+  .user_ctx  = NULL
+};
+
+static const httpd_uri_t schedule_put = {
+  .uri       = "/api/schedule",
+  .method    = HTTP_PUT,
+  .handler   = schedule_put_handler,
+  .user_ctx  = NULL
+};
+
+void schedule_register(httpd_handle_t server)
+{
+  httpd_register_uri_handler(server, &schedule_get);
+  httpd_register_uri_handler(server, &schedule_put);
+}
+
+esp_err_t schedule_init(void)
+{
+  setenv("TZ", CONFIG_SCHEDULE_TZ, 1);
+  tzset();
+  if(storage_load_schedule(&g_table) != ESP_OK){
+    memset(&g_table, 0, sizeof(g_table));
+  }
+  schedule_plan_init(&g_schedule, &g_table, schedule_run, NULL);
+  g_lock = rtos_mutex_create(&g_lock_def);
+  if(!g_lock) return ESP_ERR_NO_MEM;
+  g_task = rtos_task_start(&g_schedule_task, schedule_task, NULL, 2, tskNO_AFFINITY);
+  if(!g_task){
+    return ESP_ERR_NO_MEM;
+  }
+#ifdef CONFIG_SCHEDULE_SNTP
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, CONFIG_SCHEDULE_SNTP_SERVER);
+  sntp_set_time_sync_notification_cb(sntp_synced);
+  sntp_init();
+#endif
+  ESP_LOGI(TAG, "%d entries, time zone %s", g_table.count, CONFIG_SCHEDULE_TZ);
+  return ESP_OK;
+}
+
+#endif // CONFIG_SCHEDULE_ENABLE
@@ -0,0 +1,40 @@
+#pragma once
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include "schedule_plan.h"
+
+/*
+ * Daily programs (schedule_plan.h) on the wall clock.
+ *
+ * The clock comes from SNTP (CONFIG_SCHEDULE_SNTP) or from the clients,
+ * "now" in PUT /api/schedule (the web page sends its own time). Local time
+ * is CONFIG_SCHEDULE_TZ. A task sleeps until the next entry is due, waking
+ * up at least every quarter of an hour to notice DST changes and clock
+ * steps, and hands the entries to the main loop as patches (control.h):
+ *   scene  PATCH_SCENE
+ *   color  PATCH_RGB with PATCH_RAMP, a white of a color temperature too
+ *   off    PATCH_POWER with PATCH_RAMP
+ *
+ * The table and the time of the last entry run are kept in NVS
+ * (storage.h), so entries missed while the controller was off run late
+ * when it starts again.
+ *
+ *   GET /api/schedule  {"now":<unix time>,"local":"...","clock":"sntp","next":"...",
+ *                       "entries":[...]}
+ *   PUT /api/schedule  {"now":<unix time>,"entries":[
+ *                         {"time":"06:30","days":"-mtwtf-","kelvin":2700,"level":255,"ramp_s":1800},
+ *                         {"time":"23:00","off":true,"ramp_s":600},
+ *                         {"time":"19:00","days":"s-----s","scene":2},
+ *                         {"time":"21:00","rgb":{"r":255,"g":80,"b":0},"ramp_s":3600}]}
+ * "days" has one character per weekday from Sunday, '-' skips the day, all
+ * days without it. Both keys of the PUT are optional, "entries" replaces
+ * the whole table.
+ */
+
+#ifdef CONFIG_SCHEDULE_ENABLE
+esp_err_t schedule_init(void);
+void schedule_register(httpd_handle_t server);
+#else
+static inline esp_err_t schedule_init(void) { return ESP_OK; }
+static inline void schedule_register(httpd_handle_t server) {}
+#endif
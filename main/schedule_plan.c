@@ -0,0 +1,126 @@
+#include "schedule_plan.h"
+
+#include <stddef.h>
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+  return a / b - (a % b < 0);
+}
+
+int64_t schedule_local_time(int year, int month, int day, int hour, int minute, int second)
+{
+  return days_from_civil(year, month, day) * SCHEDULE_DAY + hour * 3600 + minute * 60 + second;
+}
+
+int schedule_weekday(int64_t local)
+{
+  int64_t days = floor_div(local, SCHEDULE_DAY);
+  return (int)(((days + 4) % 7 + 7) % 7); // 1970-01-01 was a Thursday
+}
+
+int64_t schedule_next(const schedule_entry_t * entry, int64_t after)
+{
+  int64_t day = floor_div(after, SCHEDULE_DAY);
+  for(int k = 0; k <= 7; ++k){
+    int64_t t = (day + k) * SCHEDULE_DAY + entry->minute * 60;
+    if(t > after && (entry->days & (1 << schedule_weekday(t)))) return t;
+  }
+  return INT64_MAX;
+}
+
+int64_t schedule_last(const schedule_entry_t * entry, int64_t at)
+{
+  int64_t day = floor_div(at, SCHEDULE_DAY);
+  for(int k = 0; k <= 7; ++k){
+    int64_t t = (day - k) * SCHEDULE_DAY + entry->minute * 60;
+    if(t <= at && (entry->days & (1 << schedule_weekday(t)))) return t;
+  }
+  return INT64_MIN;
+}
+
+void schedule_plan_init(schedule_t * s, schedule_table_t * table, schedule_run_fn run, void * arg)
+{
+  s->table = table;
+  s->run = run;
+  s->arg = arg;
+  s->started = false;
+  s->due = -1;
+}
+
+// Keeps the latest entry due, the next time of the entry goes in the wheel
+static void schedule_expired(wheel_node_t * node, void * arg)
+{
+  schedule_t * s = arg;
+  int i = node - s->nodes;
+  int64_t at = node->expires;
+  if(at > s->due_at || (at == s->due_at && i > s->due)){
+    s->due = i;
+    s->due_at = at;
+  }
+  int64_t next = schedule_next(&s->table->entries[i], at);
+  if(next != INT64_MAX) wheel_insert(&s->wheel, node, next);
+}
+
+// Fills the wheel from 'now' on, and finds the latest entry missed since
+// the last one run
+static void schedule_start(schedule_t * s, int64_t now)
+{
+  schedule_table_t * t = s->table;
+  wheel_init(&s->wheel, now + 1);
+  int64_t from = t->last_run > now - SCHEDULE_CATCH_UP ? t->last_run : now - SCHEDULE_CATCH_UP;
+  for(int i = 0; i < t->count; ++i){
+    const schedule_entry_t * e = &t->entries[i];
+    s->nodes[i].pprev = NULL;
+    int64_t last = schedule_last(e, now);
+    if(last > from && last >= s->due_at){
+      s->due = i;
+      s->due_at = last;
+    }
+    // After the clock went back, what ran already waits for its next day
+    int64_t next = schedule_next(e, now > t->last_run ? now : t->last_run);
+    if(next != INT64_MAX) wheel_insert(&s->wheel, &s->nodes[i], next);
+  }
+  s->started = true;
+}
+
+void schedule_update(schedule_t * s, int64_t now)
+{
+  s->due = -1;
+  s->due_at = INT64_MIN;
+  if(!s->started || now < s->now){
+    schedule_start(s, now); // Backwards, last_run keeps what ran from running again
+  } else {
+    wheel_advance(&s->wheel, now, schedule_expired, s);
+  }
+  s->now = now;
+  if(s->due >= 0){
+    s->table->last_run = s->due_at;
+    s->run(&s->table->entries[s->due], now - s->due_at, s->arg);
+  }
+}
+
+void schedule_changed(schedule_t * s, int64_t now)
+{
+  if(s->table->count > SCHEDULE_MAX_ENTRIES) s->table->count = SCHEDULE_MAX_ENTRIES;
+  s->table->last_run = now;
+  s->started = false;
+  schedule_update(s, now);
+}
+
+int64_t schedule_due(const schedule_t * s)
+{
+  if(!s->started) return INT64_MAX;
+  uint64_t next = wheel_next(&s->wheel);
+  return next == WHEEL_NEVER ? INT64_MAX : (int64_t)next;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "color.h"
+#include "wheel.h"
+
+/*
+ * Daily programs: each entry does something at a time of day on some days
+ * of the week (wake-up ramps, an evening warm-down, off at night).
+ *
+ * Times are local time in seconds since 1970 (as if the local time were
+ * UTC), the entries wait in a timer wheel (wheel.h) that ticks in seconds,
+ * and schedule_update is called with the local time whenever the caller
+ * wakes up, at the latest at schedule_due.
+ *
+ * Each update applies at most one entry, the one that decides the light at
+ * that time: the latest one due (the last one in the table if several are
+ * due together). Clock jumps are handled the same way:
+ *   forward    the latest entry in the gap is applied, late
+ *   backward   nothing runs again, entries continue after the last one run
+ *   start      the latest entry since last_run (at most a week back) that
+ *              was missed while the controller was off is applied, late
+ * A late entry fades for the rest of its ramp only.
+ */
+
+#define SCHEDULE_MAX_ENTRIES (32)
+#define SCHEDULE_DAY (24 * 3600)
+#define SCHEDULE_CATCH_UP (7 * SCHEDULE_DAY)
+#define SCHEDULE_ALL_DAYS (0x7f)
+
+enum schedule_action {
+  SCHEDULE_SCENE = 0, // Play the saved scene 'scene'
+  SCHEDULE_COLOR,     // Fade to 'rgb'
+  SCHEDULE_OFF,       // Fade out
+  SCHEDULE_ACTIONS
+};
+
+typedef struct {
+  uint16_t minute;    // Of the day
+  uint8_t days;       // Bit d: weekday d, 0 is Sunday
+  uint8_t action;     // enum schedule_action
+  rgb_t rgb;
+  uint8_t scene;
+  uint16_t ramp_s;    // Length of the fade of colors and off
+} schedule_entry_t;
+
+// Persisted as is
+typedef struct {
+  int64_t last_run;   // Local time the last entry applied was due
+  uint8_t count;
+  schedule_entry_t entries[SCHEDULE_MAX_ENTRIES];
+} schedule_table_t;
+
+// 'late' is how long after its time the entry runs, in seconds
+typedef void (*schedule_run_fn)(const schedule_entry_t * entry, uint32_t late, void * arg);
+
+typedef struct {
+  schedule_table_t * table;
+  schedule_run_fn run;
+  void * arg;
+  bool started;
+  int64_t now;        // Last update
+  wheel_t wheel;
+  wheel_node_t nodes[SCHEDULE_MAX_ENTRIES];
+  int due;            // Latest entry expired in this update, -1 for none
+  int64_t due_at;
+} schedule_t;
+
+void schedule_plan_init(schedule_t * s, schedule_table_t * table, schedule_run_fn run, void * arg);
+
+// Runs what is due at local time 'now'
+void schedule_update(schedule_t * s, int64_t now);
+
+// Call after changing the table: it starts again at local time 'now',
+// without running anything it would have run before 'now'
+void schedule_changed(schedule_t * s, int64_t now);
+
+// Local time of the next update with something to do, at most the time of
+// the next entry. INT64_MAX if there is none or it has not started.
+int64_t schedule_due(const schedule_t * s);
+
+// First time an entry is due after 'after', INT64_MAX if it has no days
+int64_t schedule_next(const schedule_entry_t * entry, int64_t after);
+
+// Last time an entry was due at or before 'at', INT64_MIN if it has no days
+int64_t schedule_last(const schedule_entry_t * entry, int64_t at);
+
+// Local time of a calendar date and time, month and day from 1
+int64_t schedule_local_time(int year, int month, int day, int hour, int minute, int second);
+
+// 0 is Sunday
+int schedule_weekday(int64_t local);
@@ -0,0 +1,178 @@
+#include "show.h"
+#include "show_format.h"
+#include "rtos.h"
+
+#include <string.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+
+static const char *TAG = "show";
+
+#define SHOW_PARTITION_SUBTYPE (0x40) // See partitions.csv
+#define SHOW_SECTOR (4096)
+#define SHOW_UPLOAD_CHUNK (2048)
+
+static const esp_partition_t * g_partition = NULL;
+static SemaphoreHandle_t g_lock = NULL; // Render task against uploads
+RTOS_MUTEX_DEFINE(g_lock_def);
+static spi_flash_mmap_handle_t g_map;
+static bool g_loaded = false;
+static show_decoder_t g_decoder;
+static uint8_t g_channels[3];           // The decoded color of this fixture
+static int64_t g_start = 0;
+
+// Called with g_lock held
+static void show_unload(void)
+{
+  if(g_loaded){
+    spi_flash_munmap(g_map);
+    g_loaded = false;
+  }
+}
+
+// Called with g_lock held
+static esp_err_t show_load(void)
+{
+  show_header_t header;
+  esp_err_t err = esp_partition_read(g_partition, 0, &header, sizeof(header));
+  if(err != ESP_OK) return err;
+  size_t size = show_file_size(&header);
+  if(size == 0 || size > g_partition->size){
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  const void * file;
+  err = esp_partition_mmap(g_partition, 0, size, SPI_FLASH_MMAP_DATA, &file, &g_map);
+  if(err != ESP_OK) return err;
+  if(!show_open(&g_decoder, file, size)){
+    spi_flash_munmap(g_map);
+    return ESP_ERR_INVALID_CRC;
+  }
+  memset(g_channels, 0, sizeof(g_channels));
+  g_loaded = true;
+  ESP_LOGI(TAG, "Show of %d frames at %d fps for %d fixtures (%d bytes)",
+	   header.frames, header.fps, header.fixtures, size);
+  return ESP_OK;
+}
+
+esp_err_t show_init(void)
+{
+  g_lock = rtos_mutex_create(&g_lock_def);
+  if(!g_lock) return ESP_ERR_NO_MEM;
+  g_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SHOW_PARTITION_SUBTYPE, NULL);
+  if(!g_partition){
+    ESP_LOGW(TAG, "No show partition");
+    return ESP_OK;
+  }
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  esp_err_t err = show_load();
+  xSemaphoreGive(g_lock);
+  if(err != ESP_OK){
+    ESP_LOGI(TAG, "No show loaded: %s", esp_err_to_name(err));
+  }
+  return ESP_OK;
+}
+
+void show_start(int64_t now_us)
+{
+  g_start = (now_us / 1000000 + 1) * 1000000;
+}
+
+bool show_frame(int64_t now_us, uint16_t fixture, rgb_t * out)
+{
+  if(!g_lock || xSemaphoreTake(g_lock, 0) != pdTRUE){
+    return false; // Not there or being replaced
+  }
+  bool ok = g_loaded;
+  if(ok){
+    const show_header_t * h = g_decoder.header;
+    uint64_t t = now_us > g_start ? now_us - g_start : 0;
+    uint64_t frame = t * h->fps / 1000000;
+    if(h->flags & SHOW_LOOP) frame %= h->frames;
+    ok = show_seek(&g_decoder, MIN(frame, h->frames - 1), g_channels, 3 * fixture, 3);
+    if(ok){
+      out->r = g_channels[0];
+      out->g = g_channels[1];
+      out->b = g_channels[2];
+    } else {
+      ESP_LOGE(TAG, "Corrupt frame %d", (int)frame);
+      show_unload();
+    }
+  }
+  xSemaphoreGive(g_lock);
+  return ok;
+}
+
+// Called with g_lock held, the show is unloaded. Sectors are erased as the
+// data arrives, so the upload never waits for the whole partition to erase.
+static esp_err_t show_receive(httpd_req_t *req)
+{
+  static uint8_t buf[SHOW_UPLOAD_CHUNK]; // Handlers run one at a time
+  size_t offset = 0;
+  size_t erased = 0;
+  while(offset < req->content_len){
+    size_t want = MIN(req->content_len - offset, sizeof(buf));
+    size_t got = 0;
+    while(got < want){
+      int n = httpd_req_recv(req, (char*)buf + got, want - got);
+      if(n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+      if(n <= 0) return ESP_FAIL;
+      got += n;
+    }
+    if(offset == 0){
+      size_t size = show_file_size((const show_header_t *)buf);
+      if(got < sizeof(show_header_t) || size != req->content_len){
+	return ESP_ERR_INVALID_ARG;
+      }
+    }
+    if(offset + got > erased){
+      size_t end = (offset + got + SHOW_SECTOR - 1) / SHOW_SECTOR * SHOW_SECTOR;
+      esp_err_t err = esp_partition_erase_range(g_partition, erased, end - erased);
+      if(err != ESP_OK) return err;
+      erased = end;
+    }
+    esp_err_t err = esp_partition_write(g_partition, offset, buf, got);
+    if(err != ESP_OK) return err;
+    offset += got;
+  }
+  // A show cut short is rejected by the crc when it is loaded
+  return show_load();
+}
+
+static esp_err_t show_post_handler(httpd_req_t *req)
+{
+  if(!g_partition){
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No show partition");
+  }
+  if(req->content_len < sizeof(show_header_t) || req->content_len > g_partition->size){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad show size");
+  }
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  show_unload();
+  esp_err_t err = show_receive(req);
+  xSemaphoreGive(g_lock);
+  ESP_LOGI(TAG, "Show upload of %d bytes: %s", req->content_len, esp_err_to_name(err));
+
+  if(err == ESP_FAIL) return ESP_FAIL; // Connection error, nothing to answer
+  if(err != ESP_OK){
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid show");
+  }
+  httpd_resp_set_status(req, HTTPD_204);
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static const httpd_uri_t show_post = {
+  .uri       = "/api/show",
+  .method    = HTTP_POST,
+  .handler   = show_post_handler,
+  .user_ctx  = NULL
+};
+
+void show_register(httpd_handle_t server)
+{
+  httpd_register_uri_handler(server, &show_post);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include "rgb.h"
+
+/*
+ * Show player: plays long precomputed animations (show_format.h) from the
+ * "show" data partition. The partition is memory mapped and frames are
+ * decoded straight from the flash cache, only the three channels of this
+ * fixture are kept in RAM.
+ *
+ * Shows are started with the "show" effect (fx.h) and uploaded with
+ *   POST /api/show   the show file as the body (tools/showenc.py)
+ */
+
+// Find and map the show partition, fine if there is none
+esp_err_t show_init(void);
+
+// Restart the show at the next whole second of the shared time 'now_us', so
+// fixtures started by separate requests stay together.
+void show_start(int64_t now_us);
+
+// Color of 'fixture' at shared time now_us, false if no show is loaded
+bool show_frame(int64_t now_us, uint16_t fixture, rgb_t * out);
+
+void show_register(httpd_handle_t server);
@@ -0,0 +1,105 @@
+#include "show_format.h"
+
+#include <string.h>
+
+size_t show_file_size(const show_header_t * h)
+{
+  if(h->magic != SHOW_MAGIC || h->version != SHOW_VERSION) return 0;
+  if(h->fixtures == 0 || h->fps == 0 || h->frames == 0 || h->keyframe_interval == 0) return 0;
+  if(h->keyframes != (h->frames + h->keyframe_interval - 1) / h->keyframe_interval) return 0;
+  return sizeof(show_header_t) + (size_t)h->keyframes * sizeof(uint32_t) + h->data_len;
+}
+
+bool show_open(show_decoder_t * d, const void * file, size_t size)
+{
+  const show_header_t * h = file;
+  if(size < sizeof(show_header_t)) return false;
+  size_t need = show_file_size(h);
+  if(need == 0 || need > size) return false;
+
+  const uint8_t * body = (const uint8_t *)file + sizeof(show_header_t);
+  if(show_crc32(0, body, need - sizeof(show_header_t)) != h->crc) return false;
+
+  memset(d, 0, sizeof(*d));
+  d->header = h;
+  d->index = (const uint32_t *)body;
+  d->data = body + h->keyframes * sizeof(uint32_t);
+  d->channels = 3 * h->fixtures;
+  for(uint32_t k = 0; k < h->keyframes; ++k){
+    if(d->index[k] >= h->data_len || (k == 0 && d->index[k] != 0)) return false;
+  }
+  return true;
+}
+
+// Decode frame d->next, writing the channels of the window into out
+static bool decode_frame(show_decoder_t * d, uint8_t * out, uint32_t first, uint32_t end)
+{
+  const uint8_t * data = d->data;
+  uint32_t len = d->header->data_len;
+  uint32_t pos = d->pos;
+  uint32_t c = 0;
+  while(c < d->channels){
+    if(pos >= len) return false;
+    uint8_t run = data[pos++];
+    uint32_t n = (run & (SHOW_RUN_MAX - 1)) + 1;
+    if(c + n > d->channels) return false;
+    uint32_t lo = c > first ? c : first;
+    uint32_t hi = c + n < end ? c + n : end;
+    switch(run & ~(SHOW_RUN_MAX - 1)){
+    case SHOW_RUN_SKIP:
+      break;
+    case SHOW_RUN_FILL:
+      if(pos + 1 > len) return false;
+      if(lo < hi) memset(out + lo - first, data[pos], hi - lo);
+      pos += 1;
+      break;
+    case SHOW_RUN_COPY:
+      if(pos + n > len) return false;
+      if(lo < hi) memcpy(out + lo - first, data + pos + lo - c, hi - lo);
+      pos += n;
+      break;
+    default:
+      return false;
+    }
+    c += n;
+  }
+  d->pos = pos;
+  d->next++;
+  return true;
+}
+
+bool show_seek(show_decoder_t * d, uint32_t frame, uint8_t * out, uint32_t first, uint32_t count)
+{
+  const show_header_t * h = d->header;
+  if(frame >= h->frames) frame = h->frames - 1;
+  if(frame + 1 == d->next) return true; // Already there
+
+  // Going back, or a key frame is closer than the next frame: start over from it
+  uint32_t key = frame / h->keyframe_interval;
+  if(frame < d->next || key * h->keyframe_interval > d->next){
+    d->next = key * h->keyframe_interval;
+    d->pos = d->index[key];
+  }
+  while(d->next <= frame){
+    if(!decode_frame(d, out, first, first + count)) return false;
+  }
+  return true;
+}
+
+// zlib compatible, a nibble at a time: small table, fast enough for a check at load
+uint32_t show_crc32(uint32_t crc, const uint8_t * data, size_t len)
+{
+  static const uint32_t table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+  };
+  crc = ~crc;
+  for(size_t i = 0; i < len; ++i){
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
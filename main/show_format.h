@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Show file format, for long precomputed animations stored in flash.
+ *
+ * All numbers are little endian. The file is:
+ *   header     show_header_t
+ *   index      one uint32 per key frame: offset of the key frame in data
+ *   data       the frames, one after the other
+ *
+ * A frame holds 'channels' = 3 * fixtures bytes (r, g, b of each fixture)
+ * encoded as a sequence of runs, each one a control byte followed by its
+ * operands. The two top bits are the kind of run and the six low bits the
+ * number of channels minus one (1..64):
+ *   SKIP     channels keep the value of the previous frame
+ *   FILL v   channels are set to v
+ *   COPY ... channels are set to the next bytes
+ * The runs of a frame cover exactly 'channels' channels. Every
+ * keyframe_interval-th frame is a key frame, which has no SKIP runs, so
+ * playback can start from it.
+ *
+ * This file has no ESP-IDF dependencies, it is also built by the host tools.
+ */
+
+#define SHOW_MAGIC (0x5748534C) // "LSHW"
+#define SHOW_VERSION (1)
+
+enum {
+  SHOW_LOOP = 1 << 0,
+};
+
+enum {
+  SHOW_RUN_SKIP = 0x00,
+  SHOW_RUN_FILL = 0x40,
+  SHOW_RUN_COPY = 0x80,
+};
+
+#define SHOW_RUN_MAX (64)
+
+typedef struct {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t flags;
+  uint16_t fixtures;
+  uint16_t fps;
+  uint16_t keyframe_interval;
+  uint32_t frames;
+  uint32_t keyframes;     // Entries in the index
+  uint32_t data_len;      // Bytes of frame data
+  uint32_t crc;           // CRC-32 (zlib) of index and data
+} show_header_t;
+
+_Static_assert(sizeof(show_header_t) == 28, "show_header_t must match the file layout");
+
+typedef struct {
+  const show_header_t * header;
+  const uint32_t * index;
+  const uint8_t * data;
+  uint32_t channels;
+  uint32_t next;          // Frame that the next decode call reads
+  uint32_t pos;           // Offset of frame 'next' in data
+} show_decoder_t;
+
+// Size of the file described by a header, 0 if the header is not valid
+size_t show_file_size(const show_header_t * header);
+
+// Check a whole show file in memory (header, bounds and crc) and prepare to
+// decode it. 'file' must stay readable while decoding.
+bool show_open(show_decoder_t * d, const void * file, size_t size);
+
+// Decode up to 'frame' into 'out', which holds channels [first, first + count)
+// and must keep the previous contents between calls (frames are deltas).
+// Other channels are only skipped over. Returns false on corrupt data.
+bool show_seek(show_decoder_t * d, uint32_t frame, uint8_t * out, uint32_t first, uint32_t count);
+
+uint32_t show_crc32(uint32_t crc, const uint8_t * data, size_t len);
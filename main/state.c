@@ -0,0 +1,50 @@
+#include "state.h"
+
+static const int ENCODER_STEP = 257; // 1/255 of the range of a component
+
+static inline int max(int a, int b){
+  return (a > b) ? a : b;
+}
+
+static inline int min(int a, int b){
+  return (a < b) ? a : b;
+}
+
+void state_step(persistent_state_t * s, int steps)
+{
+  // Use an int to prevent overflow "wrap-around". A step is one 8 bit
+  // level, the other components keep their 16 bits.
+  uint16_t * target = &((uint16_t*)(&s->hsv))[s->cursor_mode];
+  *target = max(0, min(0xffff, *target + steps * ENCODER_STEP));
+  s->rgb = hsv16_to_rgb16(s->hsv);
+  s->on = true;
+}
+
+void state_set_rgb(persistent_state_t * s, rgb_t rgb)
+{
+  s->rgb = rgb_8_to_16(rgb);
+  s->hsv = rgb16_to_hsv16(s->rgb);
+  s->on = true;
+}
+
+void state_next_mode(persistent_state_t * s)
+{
+  s->cursor_mode = (s->cursor_mode + 1) % 3;
+}
+
+bool state_gesture(persistent_state_t * s, gesture_t gesture, bool scene)
+{
+  switch(gesture){
+  case GESTURE_CLICK:
+    state_next_mode(s);
+    return true;
+  case GESTURE_DOUBLE_CLICK:
+    if(scene) s->on = true;
+    return scene;
+  case GESTURE_LONG_PRESS:
+    s->on = !s->on;
+    return true;
+  default:
+    return false; // Hold repeat is free for other actions
+  }
+}
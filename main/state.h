@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "color.h"
+#include "calib.h"
+#include "gesture.h"
+
+/*
+ * The state of the light and the changes the inputs make to it.
+ */
+
+enum mode {
+  MODE_HUE = 0,
+  MODE_SAT,
+  MODE_VALUE
+};
+
+// What the music changes (audio.h)
+enum audio_map {
+  AUDIO_OFF = 0,
+  AUDIO_VALUE,
+  AUDIO_HUE,
+  AUDIO_SCENE
+};
+
+typedef struct {
+  hsv16_t hsv;
+  rgb16_t rgb;
+  rgb_calibration_t cal;
+  int cursor_mode;        // Component the encoder changes
+  uint32_t transition_ms; // Fade length for color changes
+  bool on;                // Off shows black, the color is kept
+  uint8_t audio;          // enum audio_map
+} persistent_state_t;
+
+// Encoder: move the component of the cursor mode by 'steps' 8 bit levels
+void state_step(persistent_state_t * s, int steps);
+
+// A color from the web page
+void state_set_rgb(persistent_state_t * s, rgb_t rgb);
+
+// Button: the encoder changes the next component
+void state_next_mode(persistent_state_t * s);
+
+// What the button gestures do, returns true if the gesture did something:
+//   click         next encoder mode
+//   double click  next saved scene, 'scene' is true if the caller started one
+//   long press    power on/off
+bool state_gesture(persistent_state_t * s, gesture_t gesture, bool scene);
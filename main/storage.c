@@ -2,6 +2,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_log.h>
+#include <stdio.h>
 #include <esp_system.h>
 #include <nvs_flash.h>
 #include <nvs.h>
@@ -9,9 +10,10 @@
 static const char * const TAG = "Storage";
 
 static const int MAGIC = 0x0FA55AF0;
-static const int VERSION = 1;
+static const int VERSION = 6;
 static const char * const NAMESPACE = "storage";
 static const char * const FILENAME = "pvs";
+static const char * const SCHEDULE_KEY = "schedule";
 static const int STORE_SECONDS = 10;
 
 static unsigned int g_saved_checksum = 0; // 0 is an invalid checksum :)
@@ -156,6 +158,66 @@ void setup_save_timer()
   ESP_LOGI(TAG, "Started store timer.");
 }
 
+static esp_err_t scene_key(int slot, char key[8]){
+  if(slot < 0 || slot >= SCENE_COUNT) return ESP_ERR_INVALID_ARG;
+  snprintf(key, 8, "scene%d", slot);
+  return ESP_OK;
+}
+
+esp_err_t storage_save_scene(int slot, const fx_program_t * program){
+  nvs_handle_t handle;
+  char key[8];
+  esp_err_t err = scene_key(slot, key);
+  if (err != ESP_OK) return err;
+
+  err = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) return err;
+  err = nvs_set_blob(handle, key, program, sizeof(fx_program_t));
+  if (err == ESP_OK) err = nvs_commit(handle);
+  nvs_close(handle);
+  if (err == ESP_OK) ESP_LOGI(TAG, "Saved scene %d (%d bytes of code).", slot, program->len);
+  return err;
+}
+
+esp_err_t storage_load_scene(int slot, fx_program_t * program){
+  nvs_handle_t handle;
+  char key[8];
+  esp_err_t err = scene_key(slot, key);
+  if (err != ESP_OK) return err;
+
+  err = nvs_open(NAMESPACE, NVS_READONLY, &handle);
+  if (err != ESP_OK) return err;
+  size_t size = sizeof(fx_program_t);
+  err = nvs_get_blob(handle, key, program, &size);
+  if (err == ESP_OK && (size != sizeof(fx_program_t) || program->len > FX_MAX_CODE))
+    err = ESP_ERR_INVALID_SIZE; // Saved by another firmware version
+  nvs_close(handle);
+  return err;
+}
+
+esp_err_t storage_save_schedule(const schedule_table_t * table){
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) return err;
+  err = nvs_set_blob(handle, SCHEDULE_KEY, table, sizeof(schedule_table_t));
+  if (err == ESP_OK) err = nvs_commit(handle);
+  nvs_close(handle);
+  return err;
+}
+
+esp_err_t storage_load_schedule(schedule_table_t * table){
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(NAMESPACE, NVS_READONLY, &handle);
+  if (err != ESP_OK) return err;
+  size_t size = sizeof(schedule_table_t);
+  err = nvs_get_blob(handle, SCHEDULE_KEY, table, &size);
+  if (err == ESP_OK && (size != sizeof(schedule_table_t) || table->count > SCHEDULE_MAX_ENTRIES))
+    err = ESP_ERR_INVALID_SIZE; // Saved by another firmware version
+  nvs_close(handle);
+  if (err == ESP_OK) ESP_LOGI(TAG, "Loaded %d schedules.", table->count);
+  return err;
+}
+
 // initialize storage
 persistent_state_t * storage_initialize(default_initializer_fn di)
 {
@@ -1,15 +1,22 @@
 #pragma once
-#include "rgb.h"
+#include <esp_err.h>
+#include "state.h"
+#include "fx.h"
+#include "schedule_plan.h"
 
-typedef struct {
-  hsv_t hsv;
-  rgb_t rgb;
-  rgb_calibration_t cal;
-  int cursor_mode;
-} persistent_state_t;
+#define SCENE_COUNT (CONFIG_FX_SCENES)
 
 typedef void (*default_initializer_fn) (persistent_state_t *);
 
 // initialize storage
 // Read or write into the returned structure state that is to be persisted.
 persistent_state_t * storage_initialize(default_initializer_fn di);
+
+// Scenes are effect programs stored in their own NVS entries, 'slot' is
+// in [0, SCENE_COUNT). They are written when saved (not on the save timer).
+esp_err_t storage_save_scene(int slot, const fx_program_t * program);
+esp_err_t storage_load_scene(int slot, fx_program_t * program);
+
+// The daily schedules, written when they change and when an entry runs
+esp_err_t storage_save_schedule(const schedule_table_t * table);
+esp_err_t storage_load_schedule(schedule_table_t * table);
@@ -0,0 +1,177 @@
+#include "sync_node.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <esp_log.h>
+
+static const char *TAG = "timesync";
+
+#define MAGIC (0x4E595354) // "TSYN"
+
+enum {
+  MSG_ANNOUNCE = 1,
+  MSG_REQUEST,
+  MSG_RESPONSE,
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t type;
+  uint8_t reserved[3];
+  uint64_t node;  // Sender
+  int64_t t1;     // Request: follower send time (local)
+  int64_t t2;     // Response: leader receive time (shared)
+  int64_t t3;     // Response: leader send time (shared)
+} msg_t;
+
+void sync_node_init(sync_node_t * node, uint64_t self, int64_t (*clock)(void * arg), void * arg)
+{
+  memset(node, 0, sizeof(*node));
+  node->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+  node->clock = clock;
+  node->clock_arg = arg;
+  node->sock = -1;
+  clock_sync_init(&node->sync, self, clock(arg));
+}
+
+bool sync_node_open(sync_node_t * node, uint16_t port, const struct sockaddr_in * announce,
+		    int count)
+{
+  if(count > SYNC_NODE_MAX_ANNOUNCE) count = SYNC_NODE_MAX_ANNOUNCE;
+  memcpy(node->announce, announce, count * sizeof(*announce));
+  node->nannounce = count;
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if(sock < 0) return false;
+  int yes = 1;
+  setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+    close(sock);
+    return false;
+  }
+  node->sock = sock;
+  node->next_announce = node->next_request = 0;
+  return true;
+}
+
+void sync_node_close(sync_node_t * node)
+{
+  if(node->sock >= 0) close(node->sock);
+  node->sock = -1;
+}
+
+int64_t sync_node_offset(sync_node_t * node, int64_t local)
+{
+  portENTER_CRITICAL(&node->lock);
+  int64_t offset = clock_model_offset(&node->sync.model, local);
+  portEXIT_CRITICAL(&node->lock);
+  return offset;
+}
+
+bool sync_node_locked(sync_node_t * node)
+{
+  portENTER_CRITICAL(&node->lock);
+  bool locked = node->sync.locked;
+  portEXIT_CRITICAL(&node->lock);
+  return locked;
+}
+
+static void send_msg(sync_node_t * node, const struct sockaddr_in * to, uint8_t type, msg_t * msg)
+{
+  msg->magic = MAGIC;
+  msg->type = type;
+  msg->node = node->sync.self;
+  sendto(node->sock, msg, sizeof(*msg), 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static void log_leader(sync_node_t * node)
+{
+  ESP_LOGI(TAG, "Leader is now %012llx%s", (unsigned long long)node->sync.leader,
+	   clock_sync_leading(&node->sync) ? " (this node)" : "");
+}
+
+// New sample from a request/response exchange
+static void add_sample(sync_node_t * node, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+  portENTER_CRITICAL(&node->lock);
+  clock_sample_result_t result = clock_sync_sample(&node->sync, t1, t2, t3, t4);
+  portEXIT_CRITICAL(&node->lock);
+  if(result == CLOCK_SAMPLE_LOCKED){
+    ESP_LOGI(TAG, "Locked to leader (delay %lld us, drift %d ppb)",
+	     (long long)(t4 - t1 - (t3 - t2)), (int)node->sync.model.drift_ppb);
+  }
+}
+
+static void handle_msg(sync_node_t * node, const msg_t * msg, const struct sockaddr_in * from,
+		       int64_t t4)
+{
+  if(msg->magic != MAGIC || msg->node == node->sync.self) return;
+  switch(msg->type){
+  case MSG_ANNOUNCE: {
+    uint64_t leader = node->sync.leader;
+    portENTER_CRITICAL(&node->lock);
+    bool accepted = clock_sync_announce(&node->sync, msg->node, t4);
+    portEXIT_CRITICAL(&node->lock);
+    if(accepted) node->leader_addr = *from;
+    if(node->sync.leader != leader) log_leader(node);
+    break;
+  }
+  case MSG_REQUEST:
+    if(clock_sync_leading(&node->sync)){
+      msg_t resp;
+      memset(&resp, 0, sizeof(resp));
+      resp.t1 = msg->t1;
+      resp.t2 = t4 + clock_model_offset(&node->sync.model, t4);
+      int64_t t3 = node->clock(node->clock_arg);
+      resp.t3 = t3 + clock_model_offset(&node->sync.model, t3);
+      send_msg(node, from, MSG_RESPONSE, &resp);
+    }
+    break;
+  case MSG_RESPONSE:
+    if(msg->node == node->sync.leader) add_sample(node, msg->t1, msg->t2, msg->t3, t4);
+    break;
+  }
+}
+
+void sync_node_step(sync_node_t * node, int timeout_ms)
+{
+  int64_t now = node->clock(node->clock_arg);
+  portENTER_CRITICAL(&node->lock);
+  bool took_over = clock_sync_check(&node->sync, now);
+  portEXIT_CRITICAL(&node->lock);
+  if(took_over) log_leader(node);
+  if(now >= node->next_announce){
+    msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    for(int i = 0; i < node->nannounce; ++i){
+      send_msg(node, &node->announce[i], MSG_ANNOUNCE, &msg);
+    }
+    node->next_announce = now + CLOCK_SYNC_ANNOUNCE_US;
+  }
+  if(!clock_sync_leading(&node->sync) && now >= node->next_request){
+    msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.t1 = node->clock(node->clock_arg);
+    send_msg(node, &node->leader_addr, MSG_REQUEST, &msg);
+    node->next_request = now + CLOCK_SYNC_REQUEST_US;
+  }
+
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(node->sock, &fds);
+  struct timeval tv = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+  if(select(node->sock + 1, &fds, NULL, NULL, &tv) > 0){
+    msg_t msg;
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    int len = recvfrom(node->sock, &msg, sizeof(msg), 0, (struct sockaddr *)&from, &fromlen);
+    int64_t t4 = node->clock(node->clock_arg);
+    if(len == sizeof(msg)) handle_msg(node, &msg, &from, t4);
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <freertos/FreeRTOS.h>
+#include "clock_sync.h"
+
+/*
+ * A node of the time sync (timesync.h) on its UDP socket: the messages, who
+ * they go to and what is done with them. The leader is found from the
+ * announcements (clock_sync.c) and asked for the time at the address they
+ * came from.
+ *
+ *   sync_node_init(&node, id, clock, arg);
+ *   sync_node_open(&node, port, &broadcast, 1);
+ *   while(1) sync_node_step(&node, 50);     // One task
+ *   local + sync_node_offset(&node, local)  // The shared time, any task
+ *
+ * Plain BSD sockets (lwIP on the ESP32) and a FreeRTOS spinlock around the
+ * model; tools/syncnet.c runs several nodes over loopback.
+ */
+
+#define SYNC_NODE_MAX_ANNOUNCE (8)
+
+typedef struct {
+  clock_sync_t sync;       // Changed by the task only, under lock
+  portMUX_TYPE lock;
+  int64_t (*clock)(void * arg); // Local time in microseconds
+  void * clock_arg;
+  int sock;
+  struct sockaddr_in announce[SYNC_NODE_MAX_ANNOUNCE]; // Where announcements go
+  int nannounce;
+  struct sockaddr_in leader_addr;
+  int64_t next_announce;
+  int64_t next_request;
+} sync_node_t;
+
+void sync_node_init(sync_node_t * node, uint64_t self, int64_t (*clock)(void * arg), void * arg);
+
+// Binds the socket to 'port' on all interfaces, returns false on an error.
+// Announcements go to the 'count' addresses of 'announce' (the broadcast
+// address of the network).
+bool sync_node_open(sync_node_t * node, uint16_t port, const struct sockaddr_in * announce,
+		    int count);
+
+void sync_node_close(sync_node_t * node);
+
+// One pass of the task: takes the lead if the leader is gone, announces,
+// asks the leader for the time, then waits up to timeout_ms for a message
+void sync_node_step(sync_node_t * node, int timeout_ms);
+
+// Offset of the shared time at local time 'local', from any task
+int64_t sync_node_offset(sync_node_t * node, int64_t local);
+
+// True once the offset to the leader is known (always true on the leader)
+bool sync_node_locked(sync_node_t * node);
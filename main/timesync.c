@@ -0,0 +1,73 @@
+#include "timesync.h"
+#include "sync_node.h"
+#include "rtos.h"
+
+#include <string.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <lwip/sockets.h>
+
+#ifdef CONFIG_TIMESYNC_ENABLE
+
+static const char *TAG = "timesync";
+
+#define TIMESYNC_PORT (CONFIG_TIMESYNC_PORT)
+
+// Written by the task, the model is read from any task (sync_node.h)
+static sync_node_t g_node = {.lock = portMUX_INITIALIZER_UNLOCKED};
+RTOS_TASK_DEFINE(g_task, "timesync", CONFIG_TIMESYNC_STACK);
+
+static int64_t local_time(void * arg)
+{
+  return esp_timer_get_time();
+}
+
+int64_t timesync_now_us(void)
+{
+  int64_t local = esp_timer_get_time();
+  return local + sync_node_offset(&g_node, local);
+}
+
+int64_t timesync_next_tick(int64_t now, int64_t period_us)
+{
+  int64_t offset = sync_node_offset(&g_node, now);
+  int64_t shared = now + offset;
+  return (shared / period_us + 1) * period_us - offset;
+}
+
+bool timesync_locked(void)
+{
+  return sync_node_locked(&g_node);
+}
+
+static void timesync_task(void * arg)
+{
+  struct sockaddr_in broadcast;
+  memset(&broadcast, 0, sizeof(broadcast));
+  broadcast.sin_family = AF_INET;
+  broadcast.sin_port = htons(TIMESYNC_PORT);
+  broadcast.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+  if(!sync_node_open(&g_node, TIMESYNC_PORT, &broadcast, 1)){
+    ESP_LOGE(TAG, "Failed to bind port %d", TIMESYNC_PORT);
+    rtos_task_exit(&g_task);
+    return;
+  }
+  while(1) sync_node_step(&g_node, 50);
+}
+
+esp_err_t timesync_init(void)
+{
+  uint8_t mac[6];
+  ESP_ERROR_CHECK(esp_read_mac(mac, ESP_MAC_WIFI_STA));
+  uint64_t self = 0;
+  for(int i = 0; i < 6; ++i) self = (self << 8) | mac[i];
+  sync_node_init(&g_node, self, local_time, NULL);
+  ESP_LOGI(TAG, "Leader is now %012llx (this node)", self);
+  if(!rtos_task_start(&g_task, timesync_task, NULL, 7, tskNO_AFFINITY)){
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+#endif // CONFIG_TIMESYNC_ENABLE
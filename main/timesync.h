@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+/*
+ * Shared time between the controllers of a room.
+ *
+ * Every node announces itself by UDP broadcast; the node with the lowest id
+ * (its MAC address) is the leader and its clock defines the shared time.
+ * Followers measure their offset to the leader NTP style (four timestamps),
+ * keep the sample with the shortest round trip out of the last few and
+ * track both offset and drift, so the shared time stays continuous between
+ * measurements.
+ *
+ * Animations compute their phase from timesync_now_us() and the render loop
+ * schedules its ticks with timesync_next_tick(), so all boards agree.
+ */
+
+#ifdef CONFIG_TIMESYNC_ENABLE
+esp_err_t timesync_init(void);
+
+// Shared time (microseconds)
+int64_t timesync_now_us(void);
+
+// Local time (esp_timer) of the first multiple of period_us of the shared
+// time after local time 'now'.
+int64_t timesync_next_tick(int64_t now, int64_t period_us);
+
+// True once the offset to the leader is known (always true on the leader)
+bool timesync_locked(void);
+#else
+static inline int64_t timesync_now_us(void) { return esp_timer_get_time(); }
+static inline int64_t timesync_next_tick(int64_t now, int64_t period_us)
+{
+  return (now / period_us + 1) * period_us;
+}
+static inline bool timesync_locked(void) { return true; }
+#endif
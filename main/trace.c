@@ -0,0 +1,191 @@
+#include "trace.h"
+#include "rtos.h"
+#include "rgb.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#ifdef CONFIG_TRACE_ENABLE
+
+static const char *TAG = "trace";
+
+#define TRACE_EVENTS (CONFIG_TRACE_EVENTS)
+
+static const persistent_state_t * g_state = NULL;
+static trace_event_t * g_ring = NULL;
+static uint32_t g_head = 0;     // Next event written
+static uint32_t g_count = 0;
+static uint32_t g_dropped = 0;
+static int g_since_snapshot = TRACE_SNAPSHOT_EVERY; // Starts with one
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED; // Against downloads
+RTOS_BUFFER_DEFINE(g_ring_buffer, TRACE_EVENTS * sizeof(trace_event_t));
+RTOS_BUFFER_DEFINE(g_copy, TRACE_EVENTS * sizeof(trace_event_t)); // Of a download
+
+static void trace_snapshot(const persistent_state_t * s, trace_event_t * ev)
+{
+  ev->source = TRACE_SNAPSHOT;
+  ev->arg = s->cursor_mode;
+  ev->flags = s->on;
+  ev->data.state.hsv = s->hsv;
+  ev->data.state.rgb = s->rgb;
+  ev->data.state.transition_ms = s->transition_ms;
+}
+
+static void trace_record(trace_event_t * ev)
+{
+  if(!g_ring) return;
+  portENTER_CRITICAL(&g_lock);
+  g_ring[g_head] = *ev;
+  g_head = (g_head + 1) % TRACE_EVENTS;
+  if(g_count < TRACE_EVENTS){
+    g_count++;
+  } else {
+    g_dropped++;
+  }
+  g_since_snapshot++;
+  portEXIT_CRITICAL(&g_lock);
+}
+
+static uint32_t now_ms(void)
+{
+  return esp_timer_get_time() / 1000;
+}
+
+void trace_encoder(int steps)
+{
+  trace_event_t ev = {now_ms(), TRACE_ENCODER};
+  ev.data.steps = steps;
+  trace_record(&ev);
+}
+
+void trace_web_color(rgb_t rgb)
+{
+  trace_event_t ev = {now_ms(), TRACE_WEB_COLOR};
+  ev.data.rgb = rgb;
+  trace_record(&ev);
+}
+
+void trace_gesture(gesture_t gesture, bool applied)
+{
+  trace_event_t ev = {now_ms(), TRACE_GESTURE, gesture, applied};
+  trace_record(&ev);
+}
+
+void trace_control(const state_patch_t * patch)
+{
+  trace_event_t ev = {now_ms(), TRACE_CONTROL, patch->scene, patch->fields};
+  ev.data.patch.rgb = patch->rgb;
+  ev.data.patch.hsv = patch->hsv;
+  ev.data.patch.mode = patch->cursor_mode;
+  ev.data.patch.on = patch->on;
+  ev.data.patch.transition_ms = patch->transition_ms;
+  ev.data.patch.audio = patch->audio;
+  ev.data.patch.ramp_s = patch->ramp_s;
+  trace_record(&ev);
+}
+
+void trace_render(const persistent_state_t * state, rgb_t shown, bool effect, uint32_t time_ms)
+{
+  trace_event_t ev = {time_ms};
+  if(g_since_snapshot >= TRACE_SNAPSHOT_EVERY){
+    // Before the render: it applies the state as it is now
+    trace_snapshot(state, &ev);
+    trace_record(&ev);
+    g_since_snapshot = 0;
+  }
+  ev.source = TRACE_RENDER;
+  ev.arg = effect;
+  ev.flags = 0;
+  memset(&ev.data, 0, sizeof(ev.data));
+  ev.data.rgb = shown;
+  trace_record(&ev);
+}
+
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+  if(!g_ring){
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not recording");
+  }
+  // Copied at once, so the events keep their order while this is sent
+  trace_event_t * events = rtos_buffer_take(&g_copy);
+  if(!events){
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory");
+  }
+  trace_header_t header = {
+    .magic = TRACE_MAGIC,
+    .version = TRACE_VERSION,
+    .event_size = sizeof(trace_event_t),
+    .gamma_x10 = CONFIG_RGB_GAMMA,
+    .duty_max = RGB_DUTY_MAX,
+  };
+  portENTER_CRITICAL(&g_lock);
+  uint32_t first = (g_head + TRACE_EVENTS - g_count) % TRACE_EVENTS;
+  for(uint32_t i = 0; i < g_count; ++i){
+    events[i] = g_ring[(first + i) % TRACE_EVENTS];
+  }
+  header.count = g_count;
+  header.dropped = g_dropped;
+  portEXIT_CRITICAL(&g_lock);
+  header.state.time_ms = now_ms();
+  trace_snapshot(g_state, &header.state);
+  header.cal = g_state->cal;
+
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"leds.trace\"");
+  esp_err_t err = httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+  if(err == ESP_OK && header.count > 0){
+    err = httpd_resp_send_chunk(req, (const char *)events, header.count * sizeof(trace_event_t));
+  }
+  if(err == ESP_OK){
+    err = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  rtos_buffer_give(&g_copy, events);
+  ESP_LOGI(TAG, "Sent %d events", header.count);
+  return err;
+}
+
+static esp_err_t trace_delete_handler(httpd_req_t *req)
+{
+  portENTER_CRITICAL(&g_lock);
+  g_count = 0;
+  g_dropped = 0;
+  g_since_snapshot = TRACE_SNAPSHOT_EVERY;
+  portEXIT_CRITICAL(&g_lock);
+  httpd_resp_set_status(req, HTTPD_204);
+  return httpd_resp_send(req, NULL, 0);
+}
+
+esp_err_t trace_init(const persistent_state_t * state)
+{
+  g_state = state;
+  g_ring = rtos_buffer_take(&g_ring_buffer);
+  if(!g_ring) return ESP_ERR_NO_MEM;
+  memset(g_ring, 0, TRACE_EVENTS * sizeof(trace_event_t));
+  ESP_LOGI(TAG, "Recording the last %d events", TRACE_EVENTS);
+  return ESP_OK;
+}
+
+static const httpd_uri_t trace_get = {
+  .uri       = "/api/trace",
+  .method    = HTTP_GET,
+  .handler   = trace_get_handler,
+  .user_ctx  = NULL
+};
+
+static const httpd_uri_t trace_delete = {
+  .uri       = "/api/trace",
+  .method    = HTTP_DELETE,
+  .handler   = trace_delete_handler,
+  .user_ctx  = NULL
+};
+
+void trace_register(httpd_handle_t server)
+{
+  httpd_register_uri_handler(server, &trace_get);
+  httpd_register_uri_handler(server, &trace_delete);
+}
+
+#endif // CONFIG_TRACE_ENABLE
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdbool.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include "state.h"
+#include "patch.h"
+#include "gesture.h"
+#include "trace_format.h"
+
+/*
+ * Recording of the inputs of the main loop, to replay them on the host
+ * (tools/replay.c) when a sequence of inputs misbehaves:
+ *   GET /api/trace      the last CONFIG_TRACE_EVENTS events (trace_format.h)
+ *   DELETE /api/trace   start again
+ *
+ *   curl -o leds.trace http://leds.local/api/trace
+ *
+ * Only the main task records, the events cost a copy into a RAM ring.
+ */
+
+#ifdef CONFIG_TRACE_ENABLE
+esp_err_t trace_init(const persistent_state_t * state);
+void trace_register(httpd_handle_t server);
+
+void trace_encoder(int steps);
+void trace_web_color(rgb_t rgb);
+void trace_gesture(gesture_t gesture, bool applied);
+void trace_control(const state_patch_t * patch);
+// After each render, with the time the fade used
+void trace_render(const persistent_state_t * state, rgb_t shown, bool effect, uint32_t time_ms);
+#else
+static inline esp_err_t trace_init(const persistent_state_t * state) { return ESP_OK; }
+static inline void trace_register(httpd_handle_t server) {}
+static inline void trace_encoder(int steps) {}
+static inline void trace_web_color(rgb_t rgb) {}
+static inline void trace_gesture(gesture_t gesture, bool applied) {}
+static inline void trace_control(const state_patch_t * patch) {}
+static inline void trace_render(const persistent_state_t * state, rgb_t shown, bool effect,
+				uint32_t time_ms) {}
+#endif
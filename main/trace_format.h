@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include "color.h"
+#include "calib.h"
+
+/*
+ * Input trace, as downloaded from GET /api/trace (see trace.h):
+ *
+ *   trace_header_t   the state, calibration and output stage at the time of
+ *                    the download
+ *   trace_event_t    'count' events, oldest first
+ *
+ * Events are the inputs as the main loop applies them, the renders with the
+ * color shown, and a snapshot of the state every TRACE_SNAPSHOT_EVERY events
+ * so a replay can start from the oldest one left in the ring. Effects are
+ * not evaluated again, their frames are in the renders. Little endian,
+ * the layout is the same on the ESP32 and on the host.
+ */
+
+#define TRACE_MAGIC (0x45435254) // "TRCE"
+#define TRACE_VERSION (2)
+#define TRACE_SNAPSHOT_EVERY (64)
+
+enum {
+  TRACE_SNAPSHOT = 1, // arg: cursor mode, flags: on, data.state
+  TRACE_ENCODER,      // data.steps taken at a render
+  TRACE_WEB_COLOR,    // data.rgb
+  TRACE_GESTURE,      // arg: gesture_t, flags: 1 if it changed the state
+  TRACE_CONTROL,      // flags: patch fields, arg: scene, data.patch
+  TRACE_RENDER,       // arg: 1 while an effect runs, data.rgb: color shown
+};
+
+typedef struct {
+  uint32_t time_ms;   // esp_timer time / 1000, wrapping
+  uint8_t source;
+  uint8_t arg;
+  uint16_t flags;
+  union {
+    int32_t steps;
+    rgb_t rgb;
+    struct {
+      rgb_t rgb;
+      hsv_t hsv;
+      uint8_t mode;
+      uint8_t on;
+      uint32_t transition_ms;
+      uint8_t audio;
+      uint16_t ramp_s;
+    } patch;
+    struct {
+      hsv16_t hsv;
+      rgb16_t rgb;
+      uint32_t transition_ms;
+    } state;
+  } data;
+} trace_event_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t event_size;  // sizeof(trace_event_t)
+  uint32_t count;
+  uint32_t dropped;     // Overwritten since the start
+  trace_event_t state;  // TRACE_SNAPSHOT of the state at the download
+  rgb_calibration_t cal;
+  uint16_t gamma_x10;   // Output stage of the controller (rgb.h)
+  uint16_t duty_max;
+} trace_header_t;
+
+_Static_assert(sizeof(trace_event_t) == 24, "trace_event_t layout");
+_Static_assert(sizeof(trace_header_t) == 16 + 24 + 24 + 4, "trace_header_t layout");
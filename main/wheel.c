@@ -0,0 +1,138 @@
+#include "wheel.h"
+
+#include <string.h>
+
+#define MASK (WHEEL_SLOTS - 1)
+#define DETACHED (0xff) // Level of the nodes being expired or moved
+
+static inline int shift(int level)
+{
+  return level * WHEEL_BITS;
+}
+
+void wheel_init(wheel_t * wheel, uint64_t now)
+{
+  memset(wheel, 0, sizeof(*wheel));
+  wheel->now = now;
+}
+
+static void wheel_link(wheel_node_t ** head, wheel_node_t * node)
+{
+  node->next = *head;
+  if(node->next) node->next->pprev = &node->next;
+  *head = node;
+  node->pprev = head;
+}
+
+static void wheel_unlink(wheel_node_t * node)
+{
+  *node->pprev = node->next;
+  if(node->next) node->next->pprev = node->pprev;
+  node->next = NULL;
+  node->pprev = NULL;
+}
+
+// Puts a node in the wheel relative to wheel->now, its expiry is not before
+static void wheel_place(wheel_t * wheel, wheel_node_t * node)
+{
+  uint64_t at = node->expires;
+  uint64_t delta = at - wheel->now;
+  if(delta >= WHEEL_RANGE){
+    // Waits in the slot that moves down last in this turn of the top level
+    delta = WHEEL_RANGE - 1;
+    at = wheel->now + delta;
+  }
+  int level = 0;
+  while(delta >> shift(level + 1)) level++;
+  int slot = (at >> shift(level)) & MASK;
+  wheel_link(&wheel->slots[level][slot], node);
+  wheel->occupied[level] |= 1ULL << slot;
+  node->level = level;
+  node->slot = slot;
+}
+
+void wheel_insert(wheel_t * wheel, wheel_node_t * node, uint64_t expires)
+{
+  wheel_remove(wheel, node);
+  node->expires = expires < wheel->now ? wheel->now : expires;
+  wheel_place(wheel, node);
+  wheel->count++;
+}
+
+void wheel_remove(wheel_t * wheel, wheel_node_t * node)
+{
+  if(!node->pprev) return;
+  wheel_unlink(node);
+  if(node->level != DETACHED && !wheel->slots[node->level][node->slot]){
+    wheel->occupied[node->level] &= ~(1ULL << node->slot);
+  }
+  wheel->count--;
+}
+
+// Takes the nodes of a slot out into 'list', where wheel_remove still works
+static void wheel_detach(wheel_t * wheel, int level, int slot, wheel_node_t ** list)
+{
+  *list = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(1ULL << slot);
+  if(*list) (*list)->pprev = list;
+  for(wheel_node_t * n = *list; n; n = n->next){
+    n->level = DETACHED;
+  }
+}
+
+uint64_t wheel_next(const wheel_t * wheel)
+{
+  uint64_t t = wheel->now;
+  uint64_t next = WHEEL_NEVER;
+  for(int l = 0; l < WHEEL_LEVELS; ++l){
+    if(!wheel->occupied[l]) continue;
+    uint64_t turn = t >> shift(l + 1);
+    int index = (t >> shift(l)) & MASK;
+    // The current slot of an upper level moved down when this turn of the
+    // level below started, what is left in it belongs to the next turn
+    bool starts = (t & ((1ULL << shift(l)) - 1)) == 0;
+    uint64_t ahead = wheel->occupied[l] & (~0ULL << index);
+    if(!starts) ahead &= ~(1ULL << index);
+    uint64_t at;
+    if(ahead){
+      at = ((turn << WHEEL_BITS) + __builtin_ctzll(ahead)) << shift(l);
+    } else {
+      at = (turn + 1) << shift(l + 1); // Only slots behind, in the next turn
+    }
+    if(at < next) next = at;
+  }
+  return next;
+}
+
+void wheel_advance(wheel_t * wheel, uint64_t until, wheel_expired_fn expired, void * arg)
+{
+  while(wheel->now <= until){
+    uint64_t t = wheel_next(wheel);
+    if(t > until){
+      wheel->now = until + 1;
+      return;
+    }
+    wheel->now = t;
+    // From the top, a node can move down several levels at once
+    for(int l = WHEEL_LEVELS - 1; l > 0; --l){
+      if(t & ((1ULL << shift(l)) - 1)) continue;
+      wheel_node_t * list;
+      wheel_detach(wheel, l, (t >> shift(l)) & MASK, &list);
+      while(list){
+	wheel_node_t * n = list;
+	wheel_unlink(n);
+	wheel_place(wheel, n);
+      }
+    }
+    wheel_node_t * list;
+    wheel_detach(wheel, 0, t & MASK, &list);
+    wheel->now = t + 1; // Inserted again from 'expired', a node waits for the next advance
+    while(list){
+      wheel_node_t * n = list;
+      wheel_unlink(n);
+      wheel->count--;
+      expired(n, arg);
+    }
+  }
+}
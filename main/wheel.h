@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * WHEEL_LEVELS wheels of WHEEL_SLOTS slots, each slot of level l spans
+ * WHEEL_SLOTS^l ticks. A node goes in the lowest level whose range covers
+ * its delay, in the slot of its expiry time at that level, and moves down a
+ * level when the wheel above reaches its slot (a cascade). Inserting and
+ * removing are O(1), expiring costs at most WHEEL_LEVELS - 1 moves per node.
+ * A bitmap of the occupied slots of each level lets wheel_advance skip the
+ * ticks with nothing to do, so the caller can sleep until wheel_next.
+ *
+ * Ticks are whatever the caller counts in, nodes belong to the caller
+ * (embed them in the entries). Not thread safe.
+ */
+
+#define WHEEL_BITS (6)
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS (4)
+#define WHEEL_RANGE (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) // Longest delay, in ticks
+#define WHEEL_NEVER (UINT64_MAX)
+
+typedef struct wheel_node {
+  struct wheel_node * next;
+  struct wheel_node ** pprev; // NULL when not in the wheel
+  uint64_t expires;
+  uint8_t level;              // Where it is, to clear the bitmap
+  uint8_t slot;
+} wheel_node_t;
+
+typedef struct {
+  uint64_t now;                                   // Next tick to expire
+  wheel_node_t * slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  uint64_t occupied[WHEEL_LEVELS];                // Bit s: slots[l][s] is not empty
+  uint32_t count;
+} wheel_t;
+
+typedef void (*wheel_expired_fn)(wheel_node_t * node, void * arg);
+
+void wheel_init(wheel_t * wheel, uint64_t now);
+
+// Expire 'node' at tick 'expires', a past tick expires at the next advance.
+// Delays over WHEEL_RANGE wait in the top level and are placed again.
+void wheel_insert(wheel_t * wheel, wheel_node_t * node, uint64_t expires);
+
+// Fine for a node that is not in the wheel
+void wheel_remove(wheel_t * wheel, wheel_node_t * node);
+
+static inline bool wheel_pending(const wheel_node_t * node) { return node->pprev != NULL; }
+
+// The first tick with work to do (a node to expire or to move down), at
+// most the tick of the earliest node. WHEEL_NEVER for an empty wheel.
+uint64_t wheel_next(const wheel_t * wheel);
+
+// Expire the nodes up to tick 'until' (included), in the order of their
+// ticks. 'expired' may insert nodes again, a tick already passed expires at
+// the next advance.
+void wheel_advance(wheel_t * wheel, uint64_t until, wheel_expired_fn expired, void * arg);
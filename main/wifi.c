@@ -9,6 +9,7 @@
 #include <esp_event.h>
 #include <esp_log.h>
 #include <nvs_flash.h>
+#include "power.h"
 
 #include <lwip/err.h>
 #include <lwip/sys.h>
@@ -73,7 +74,12 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 
 void wifi_init_sta(void)
 {
+#ifdef CONFIG_STATIC_ALLOC
+  static StaticEventGroup_t event_group;
+  s_wifi_event_group = xEventGroupCreateStatic(&event_group);
+#else
   s_wifi_event_group = xEventGroupCreate();
+#endif
   
   ESP_ERROR_CHECK(esp_netif_init());
   
@@ -109,11 +115,20 @@ void wifi_init_sta(void)
 	.capable = true,
 	.required = false
       },
+#ifdef CONFIG_POWER_SAVE
+      // Beacons slept through, bounds the latency of the network
+      .listen_interval = POWER_LISTEN_INTERVAL,
+#endif
     },
   };
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
   ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
   ESP_ERROR_CHECK(esp_wifi_start() );
+#ifdef CONFIG_POWER_SAVE
+  // The minimum mode wakes up for every DTIM beacon, the maximum one uses
+  // the listen interval
+  ESP_ERROR_CHECK(esp_wifi_set_ps(POWER_LISTEN_INTERVAL > 1 ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM));
+#endif
 
   ESP_LOGI(TAG, "wifi_init_sta finished.");
   
@@ -0,0 +1,70 @@
+#include "ws_session.h"
+
+// The clients and the buffers are only touched from the httpd task,
+// g_async_jobs is filled by any task.
+POOL_DEFINE(g_ws_clients, ws_client_t, WS_MAX_CLIENTS);
+POOL_DEFINE(g_rx_buffers, ws_rx_buffer_t, WS_RX_BUFFERS);
+POOL_DEFINE(g_async_jobs, ws_job_t, WS_ASYNC_JOBS);
+static ws_client_t * g_clients = NULL; // Connected clients
+
+ws_client_t * ws_client_open(int fd)
+{
+  ws_client_t * client = pool_alloc(&g_ws_clients);
+  if(!client) return NULL;
+  client->fd = fd;
+  client->next = g_clients;
+  g_clients = client;
+  return client;
+}
+
+void ws_client_free(void * ctx)
+{
+  ws_client_t * client = ctx;
+  ws_client_drop_rx(client);
+  for(ws_client_t ** it = &g_clients; *it; it = &(*it)->next){
+    if(*it == client){
+      *it = client->next;
+      break;
+    }
+  }
+  pool_free(&g_ws_clients, client);
+}
+
+ws_client_t * ws_client_first(void)
+{
+  return g_clients;
+}
+
+bool ws_client_rx(ws_client_t * client)
+{
+  if(!client->rx) client->rx = pool_alloc(&g_rx_buffers);
+  return client->rx != NULL;
+}
+
+void ws_client_drop_rx(ws_client_t * client)
+{
+  pool_free(&g_rx_buffers, client->rx);
+  client->rx = NULL;
+  client->rx_len = 0;
+}
+
+static void ws_job_run(void * arg)
+{
+  ws_job_t * job = arg;
+  job->fn(job->hd, job->fd);
+  pool_free(&g_async_jobs, job);
+}
+
+bool ws_job_queue(ws_queue_fn_t queue, void * hd, int fd, ws_job_fn_t fn)
+{
+  ws_job_t * job = pool_alloc(&g_async_jobs);
+  if(!job) return false;
+  job->hd = hd;
+  job->fd = fd;
+  job->fn = fn;
+  if(queue(hd, ws_job_run, job) != 0){
+    pool_free(&g_async_jobs, job);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pool.h"
+
+/*
+ * Per connection state of the websocket clients and the jobs queued to the
+ * web server (http.c), in pools: connecting, reassembling messages and
+ * sending asynchronously never touch the heap.
+ *
+ * Clients and reassembly buffers belong to the httpd task. Jobs are queued
+ * from any task: ws_job_queue takes one and hands it to 'queue' (the
+ * signature of httpd_queue_work), the job is freed after it ran on the
+ * server, or at once if it could not be queued. tools/poolsoak.c runs this
+ * code under allocation storms.
+ */
+
+#define WS_MAX_CLIENTS (7) // max_open_sockets of HTTPD_DEFAULT_CONFIG
+#define WS_RX_BUFFER_SIZE (CONFIG_WS_RX_BUFFER_SIZE)
+#define WS_RX_BUFFERS (CONFIG_WS_RX_BUFFERS)
+#define WS_ASYNC_JOBS (CONFIG_HTTP_ASYNC_JOBS)
+
+// Buffer for large or fragmented websocket messages
+typedef struct {
+  uint8_t data[WS_RX_BUFFER_SIZE + 1]; // +1 for the NUL terminator
+} ws_rx_buffer_t;
+
+// Flow control: every color frame consumes a credit on the client side, the
+// credits are returned ("ack") once the frame is rendered.
+typedef struct ws_client {
+  struct ws_client * next;
+  int fd;
+  int unacked; // Color frames received but not yet acknowledged
+  ws_rx_buffer_t * rx; // Message being reassembled, NULL if none
+  size_t rx_len;
+  int rx_type; // httpd_ws_type_t of the message
+} ws_client_t;
+
+typedef void (*ws_job_fn_t)(void * hd, int fd);
+typedef int (*ws_queue_fn_t)(void * hd, void (*work)(void * arg), void * arg);
+
+typedef struct {
+  void * hd;
+  int fd;
+  ws_job_fn_t fn;
+} ws_job_t;
+
+// State of a new connection, NULL if there are too many
+ws_client_t * ws_client_open(int fd);
+
+// Forgets a connection, a free_ctx of the session
+void ws_client_free(void * client);
+
+// The connected clients, follow ->next
+ws_client_t * ws_client_first(void);
+
+// Gives the client a reassembly buffer if it has none, false if none is free
+bool ws_client_rx(ws_client_t * client);
+
+// Releases the reassembly buffer of a client
+void ws_client_drop_rx(ws_client_t * client);
+
+// Runs fn(hd, fd) on the server, returns false if no job is free or
+// 'queue' failed
+bool ws_job_queue(ws_queue_fn_t queue, void * hd, int fd, ws_job_fn_t fn);
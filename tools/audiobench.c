@@ -0,0 +1,212 @@
+/*
+ * Stream a WAV file through the firmware audio analysis and time it.
+ *
+ *   gcc -O2 -I../main -o audiobench audiobench.c ../main/audio_dsp.c -lm
+ *   ./audiobench music.wav [-v]
+ *   ./audiobench --click test.wav [bpm] [seconds]
+ *
+ * Prints the beats found, the tempo and the loudness, then processes the
+ * file again and again for a while and prints the blocks per second and the
+ * time per block. The ESP32 is roughly 10-20 times slower than a desktop, a
+ * block has to take well under its own length (16 ms at 16 kHz).
+ *
+ * 16 bit PCM, stereo is mixed down. -v prints every block.
+ *
+ * --click writes a drum track at 'bpm' (default 120) over noise, its tempo
+ * has to come out as 'bpm'.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "audio_dsp.h"
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t le32(const uint8_t * p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t * p)
+{
+  return p[0] | p[1] << 8;
+}
+
+// Mono samples of a 16 bit PCM WAV file
+static int16_t * read_wav(const char * path, size_t * count, uint32_t * rate)
+{
+  FILE * f = fopen(path, "rb");
+  if(!f){
+    perror(path);
+    exit(1);
+  }
+  uint8_t riff[12];
+  if(fread(riff, 1, 12, f) != 12 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)){
+    fprintf(stderr, "%s: not a WAV file\n", path);
+    exit(1);
+  }
+  int channels = 0;
+  uint8_t chunk[8];
+  while(fread(chunk, 1, 8, f) == 8){
+    uint32_t size = le32(chunk + 4);
+    if(memcmp(chunk, "fmt ", 4) == 0){
+      uint8_t fmt[16];
+      if(size < 16 || fread(fmt, 1, 16, f) != 16) break;
+      fseek(f, size - 16 + (size & 1), SEEK_CUR);
+      channels = le16(fmt + 2);
+      *rate = le32(fmt + 4);
+      if(le16(fmt) != 1 || le16(fmt + 14) != 16 || channels < 1){
+	fprintf(stderr, "%s: only 16 bit PCM\n", path);
+	exit(1);
+      }
+    } else if(memcmp(chunk, "data", 4) == 0 && channels > 0){
+      size_t frames = size / 2 / channels;
+      int16_t * raw = malloc(size);
+      frames = fread(raw, 2 * channels, frames, f);
+      int16_t * mono = malloc(frames * sizeof(int16_t) + 1);
+      for(size_t i = 0; i < frames; ++i){
+	int32_t sum = 0;
+	for(int c = 0; c < channels; ++c){
+	  sum += raw[i * channels + c];
+	}
+	mono[i] = sum / channels;
+      }
+      free(raw);
+      fclose(f);
+      *count = frames;
+      return mono;
+    } else {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fprintf(stderr, "%s: no audio\n", path);
+  exit(1);
+}
+
+static void put32(FILE * f, uint32_t v)
+{
+  uint8_t b[4] = {v, v >> 8, v >> 16, v >> 24};
+  fwrite(b, 1, 4, f);
+}
+
+static void put16(FILE * f, uint16_t v)
+{
+  uint8_t b[2] = {v, v >> 8};
+  fwrite(b, 1, 2, f);
+}
+
+// Kick on every beat, hi-hat between them, over quiet noise
+static int click(const char * path, int bpm, int seconds)
+{
+  const uint32_t rate = 16000;
+  size_t count = (size_t)rate * seconds;
+  int16_t * s = malloc(count * sizeof(int16_t));
+  double period = 60.0 / bpm;
+  double last = 0;
+  srand(1);
+  for(size_t i = 0; i < count; ++i){
+    double t = (double)i / rate;
+    double beat = fmod(t, period);
+    double half = fmod(t + period / 2, period);
+    double noise = (double)rand() / RAND_MAX * 2 - 1;
+    double hiss = (noise - last) / 2; // High-passed
+    last = noise;
+    double x = 0.02 * noise;
+    x += 0.6 * exp(-beat * 25) * sin(2 * M_PI * (50 + 80 * exp(-beat * 40)) * beat);
+    x += 0.2 * exp(-half * 60) * hiss;
+    s[i] = lrint(32767 * fmax(-1, fmin(1, x)));
+  }
+  FILE * f = fopen(path, "wb");
+  if(!f){
+    perror(path);
+    return 1;
+  }
+  fwrite("RIFF", 1, 4, f);
+  put32(f, 36 + count * 2);
+  fwrite("WAVEfmt ", 1, 8, f);
+  put32(f, 16);
+  put16(f, 1);
+  put16(f, 1);
+  put32(f, rate);
+  put32(f, rate * 2);
+  put16(f, 2);
+  put16(f, 16);
+  fwrite("data", 1, 4, f);
+  put32(f, count * 2);
+  fwrite(s, 2, count, f);
+  fclose(f);
+  free(s);
+  printf("%s: %d bpm, %d s\n", path, bpm, seconds);
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  if(argc >= 3 && strcmp(argv[1], "--click") == 0){
+    return click(argv[2], argc > 3 ? atoi(argv[3]) : 120, argc > 4 ? atoi(argv[4]) : 30);
+  }
+  const char * path = NULL;
+  bool verbose = false;
+  for(int i = 1; i < argc; ++i){
+    if(strcmp(argv[i], "-v") == 0){
+      verbose = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if(!path){
+    fprintf(stderr, "Usage: %s file.wav [-v]\n"
+	    "       %s --click file.wav [bpm] [seconds]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  size_t count;
+  uint32_t rate = 0;
+  int16_t * samples = read_wav(path, &count, &rate);
+  size_t blocks = count / AUDIO_BLOCK;
+  if(blocks == 0){
+    fprintf(stderr, "%s: shorter than a block\n", path);
+    return 1;
+  }
+  static audio_dsp_t dsp;
+  audio_dsp_init(&dsp, rate);
+  audio_features_t out;
+  double block_s = (double)AUDIO_BLOCK / rate;
+  uint32_t beats = 0;
+  uint64_t level = 0;
+  for(size_t b = 0; b < blocks; ++b){
+    audio_dsp_block(&dsp, samples + b * AUDIO_BLOCK, &out);
+    beats += out.beat;
+    level += out.level;
+    if(verbose){
+      printf("%8.3f level %5u balance %5u bpm %3u %s\n", b * block_s,
+	     out.level, out.balance, out.bpm, out.beat ? "beat" : "");
+    } else if(out.beat){
+      printf("%8.3f beat, %u bpm\n", b * block_s, out.bpm);
+    }
+  }
+  printf("%zu blocks of %.1f ms at %u Hz: %u beats, %u bpm, mean level %llu\n",
+	 blocks, block_s * 1e3, rate, beats, out.bpm, (unsigned long long)(level / blocks));
+
+  int rounds = 0;
+  double start = now_s(), elapsed;
+  do {
+    for(size_t b = 0; b < blocks; ++b){
+      audio_dsp_block(&dsp, samples + b * AUDIO_BLOCK, &out);
+    }
+    rounds++;
+  } while((elapsed = now_s() - start) < 0.5);
+  double per_block = elapsed / (rounds * blocks);
+  printf("%.0f blocks/s, %.2f us per block (%.2f%% of real time)\n",
+	 1 / per_block, per_block * 1e6, per_block / block_s * 100);
+  free(samples);
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Check the button filter and gesture recognizer against edge traces.
+ *
+ *   gcc -O2 -I../main -o buttoncheck buttoncheck.c ../main/gesture.c
+ *   ./buttoncheck              run the built in traces
+ *   ./buttoncheck trace.txt    run a trace file (button_trace.txt)
+ *
+ * A trace file has the raw edges of the pin, one per line: the time in ms
+ * and 1 for pressed or 0 for released (the level read by the ISR). Lines
+ * starting with '#' are comments, '# expect <gesture>' gives the gestures
+ * it has to produce in order. The edges go through the filter the ISR runs
+ * and the loop of the button task (gesture.h), with the default timing of
+ * Kconfig. Exits with 1 when a trace does not give its gestures.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gesture.h"
+
+static const gesture_timing_t timing = {
+  .lockout_us = 10 * 1000,
+  .min_press_us = 30 * 1000,
+  .double_us = 300 * 1000,
+  .long_us = 700 * 1000,
+  .repeat_us = 250 * 1000,
+};
+
+typedef struct {
+  double ms;
+  int pressed;
+} edge_t;
+
+#define MAX_GESTURES 32
+
+typedef struct {
+  gesture_t gestures[MAX_GESTURES];
+  int count;
+  bool verbose;
+  // The pin
+  const edge_t * edges;
+  int n;
+  gesture_filter_t filter;
+} result_t;
+
+static void deliver(void * arg, gesture_t g, int64_t now)
+{
+  result_t * res = arg;
+  if(res->verbose) printf("%10.1f ms  %s\n", now / 1000.0, gesture_name(g));
+  if(res->count < MAX_GESTURES) res->gestures[res->count++] = g;
+}
+
+// The level of the last edge before 'now', through the filter
+static bool sample(void * arg, int64_t now, bool * pressed)
+{
+  result_t * res = arg;
+  *pressed = false;
+  for(int i = 0; i < res->n && (int64_t)(res->edges[i].ms * 1000) <= now; ++i){
+    *pressed = res->edges[i].pressed;
+  }
+  return gesture_filter_edge(&res->filter, &timing, now, *pressed);
+}
+
+// The edges go through the ISR filter to the loop of button_task
+static void run(const edge_t * edges, int n, result_t * res)
+{
+  const gesture_io_t io = {deliver, sample, res};
+  gesture_loop_t loop;
+  gesture_loop_init(&loop, &timing, &io);
+  res->edges = edges;
+  res->n = n;
+  res->filter = (gesture_filter_t){false, -1000000};
+  int i = 0;
+  while(1){
+    int64_t deadline = gesture_loop_deadline(&loop);
+    int64_t next_edge = i < n ? (int64_t)(edges[i].ms * 1000) : GESTURE_NO_DEADLINE;
+    if(next_edge == GESTURE_NO_DEADLINE && deadline == GESTURE_NO_DEADLINE) break;
+    if(next_edge <= deadline){
+      bool pressed = edges[i++].pressed;
+      if(gesture_filter_edge(&res->filter, &timing, next_edge, pressed)){
+	gesture_loop_edge(&loop, next_edge, pressed);
+      }
+    } else {
+      gesture_loop_wake(&loop, deadline);
+    }
+  }
+}
+
+// A press with bounces on both edges
+#define BOUNCY_PRESS(t, len)						\
+  {t, 1}, {t + 0.2, 0}, {t + 0.5, 1}, {t + 0.9, 0}, {t + 1.4, 1},	\
+  {t + len, 0}, {t + len + 0.3, 1}, {t + len + 0.8, 0}, {t + len + 2.5, 1}, {t + len + 3, 0}
+
+typedef struct {
+  const char * name;
+  edge_t edges[64];
+  gesture_t expected[MAX_GESTURES];
+} trace_t;
+
+static const trace_t traces[] = {
+  {"clean click", {{0, 1}, {80, 0}}, {GESTURE_CLICK}},
+  {"bouncy click", {BOUNCY_PRESS(0, 90)}, {GESTURE_CLICK}},
+  {"double click", {BOUNCY_PRESS(0, 70), BOUNCY_PRESS(200, 60)}, {GESTURE_DOUBLE_CLICK}},
+  {"two slow clicks", {BOUNCY_PRESS(0, 70), BOUNCY_PRESS(500, 60)}, {GESTURE_CLICK, GESTURE_CLICK}},
+  {"triple click", {BOUNCY_PRESS(0, 70), BOUNCY_PRESS(180, 60), BOUNCY_PRESS(360, 60)},
+   {GESTURE_DOUBLE_CLICK, GESTURE_CLICK}},
+  {"long press", {BOUNCY_PRESS(0, 800)}, {GESTURE_LONG_PRESS}},
+  {"hold", {BOUNCY_PRESS(0, 1500)},
+   {GESTURE_LONG_PRESS, GESTURE_HOLD_REPEAT, GESTURE_HOLD_REPEAT, GESTURE_HOLD_REPEAT}},
+  {"click then long press", {BOUNCY_PRESS(0, 60), BOUNCY_PRESS(150, 1000)},
+   {GESTURE_LONG_PRESS, GESTURE_HOLD_REPEAT}},
+  {"spike", {{0, 1}, {0.05, 0}}, {GESTURE_NONE}},
+  {"spike missed by the isr", {{0, 0}, {0.05, 0}}, {GESTURE_NONE}},
+  {"short tap", {{0, 1}, {5, 0}}, {GESTURE_NONE}},
+  {"glitch before a press", {{0, 1}, {0.1, 0}, {3, 1}, {3.2, 0}, {3.4, 1}, {120, 0}}, {GESTURE_CLICK}},
+  {"glitch in the double click wait", {BOUNCY_PRESS(0, 70), {150, 1}, {150.1, 0}},
+   {GESTURE_CLICK}},
+};
+
+static bool check(const trace_t * t)
+{
+  int n = 0;
+  while(n < 64 && (n == 0 || t->edges[n].ms > 0)) n++;
+  result_t res = {0};
+  run(t->edges, n, &res);
+  int expected = 0;
+  while(expected < MAX_GESTURES && t->expected[expected] != GESTURE_NONE) expected++;
+  bool ok = res.count == expected &&
+    memcmp(res.gestures, t->expected, expected * sizeof(gesture_t)) == 0;
+  printf("%-32s %s:", t->name, ok ? "ok    " : "FAILED");
+  for(int i = 0; i < res.count; ++i) printf(" %s,", gesture_name(res.gestures[i]));
+  printf("\n");
+  return ok;
+}
+
+static gesture_t gesture_named(const char * name)
+{
+  for(gesture_t g = GESTURE_CLICK; g <= GESTURE_HOLD_REPEAT; ++g){
+    if(strcmp(name, gesture_name(g)) == 0) return g;
+  }
+  return GESTURE_NONE;
+}
+
+static int replay(const char * path)
+{
+  FILE * f = fopen(path, "r");
+  if(!f){
+    perror(path);
+    return 1;
+  }
+  static edge_t edges[100000];
+  static gesture_t expected[MAX_GESTURES];
+  int n = 0, nexpected = 0;
+  char line[128];
+  while(fgets(line, sizeof(line), f)){
+    line[strcspn(line, "\r\n")] = 0;
+    if(strncmp(line, "# expect ", 9) == 0){
+      gesture_t g = gesture_named(line + 9);
+      if(g == GESTURE_NONE || nexpected == MAX_GESTURES){
+	printf("%s: bad line \"%s\"\n", path, line);
+	fclose(f);
+	return 1;
+      }
+      expected[nexpected++] = g;
+    } else if(line[0] != '#' && n < 100000 &&
+	      sscanf(line, "%lf %d", &edges[n].ms, &edges[n].pressed) == 2){
+      n++;
+    }
+  }
+  fclose(f);
+  result_t res = {.verbose = true};
+  run(edges, n, &res);
+  printf("%d edges, %d gestures\n", n, res.count);
+  if(!nexpected) return 0;
+  bool ok = res.count == nexpected &&
+    memcmp(res.gestures, expected, nexpected * sizeof(gesture_t)) == 0;
+  printf(ok ? "OK\n" : "FAILED, expected %d gestures:", nexpected);
+  for(int i = 0; !ok && i < nexpected; ++i) printf(" %s,", gesture_name(expected[i]));
+  if(!ok) printf("\n");
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char ** argv)
+{
+  if(argc > 1) return replay(argv[1]);
+  int failed = 0;
+  for(size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); ++i){
+    if(!check(&traces[i])) failed = 1;
+  }
+  printf(failed ? "FAILED\n" : "OK\n");
+  return failed;
+}
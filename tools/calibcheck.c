@@ -0,0 +1,174 @@
+/*
+ * Check the folded calibration of the output stage against floating point.
+ *
+ *   gcc -O2 -I../main -o calibcheck calibcheck.c ../main/calib.c -lm
+ *   ./calibcheck [step]
+ *
+ * Folds several calibrations (calib_fold) at gamma 1 and 2.2 and runs
+ * every color of the 256^3 cube, every step values per channel, through
+ * calib_duty. The duties are compared to the calibration computed in
+ * doubles, clamped to 0..duty_max: the error may not exceed what the
+ * rounding of the tables allows, half a duty LSB for each rounded term.
+ * The calibrations have cross-talk, negative coefficients, offsets, gains
+ * that saturate and the largest values of the int16 entries.
+ *
+ * Then checks that black gives the offsets alone, and that the channel
+ * scales of the older firmware (calib_from_scale) give at gamma 1 what
+ * its 8 bit PWM did: value * (scale + 128) / 256, at 11 bits.
+ * Exits with 1 when a check fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "calib.h"
+
+#define DUTY_MAX ((1 << 11) - 1) // RGB_DUTY_MAX
+
+typedef struct {
+  const char * name;
+  rgb_calibration_t cal;
+} case_t;
+
+static const case_t g_cases[] = {
+  {"identity", {{{4096, 0, 0}, {0, 4096, 0}, {0, 0, 4096}}, {0, 0, 0}}},
+  {"white point", {{{4096, 0, 0}, {0, 2048, 0}, {0, 0, 2867}}, {0, 0, 0}}},
+  {"cross-talk", {{{3900, -250, -60}, {-180, 3700, -300}, {40, -420, 4000}}, {0, 0, 0}}},
+  {"negative", {{{-4096, 0, 0}, {2048, -2048, 0}, {4096, 4096, -8192}}, {0, 0, 0}}},
+  {"offsets", {{{3800, 0, 0}, {0, 3800, 0}, {0, 0, 3800}}, {200, -150, 4096}}},
+  {"saturating", {{{12288, 0, 0}, {4096, 4096, 4096}, {0, 0, 6000}}, {0, 0, -300}}},
+  {"extremes", {{{32767, -32768, 32767}, {-32768, -32768, -32768}, {32767, 32767, 32767}},
+		{32767, -32768, -32768}}},
+};
+
+static const float g_gammas[] = {1.0f, 2.2f};
+
+static int g_errors;
+
+// Largest error of calib_duty for output o: half an LSB for each rounded
+// product, for each table entry (half an LSB of lin times the gain) and one
+// for the truncated offset
+static double bound(const rgb_calibration_t * cal, int o)
+{
+  double b = cal->offset[o] ? 1 : 0;
+  for(int i = 0; i < 3; ++i){
+    if(cal->matrix[o][i]) b += 0.5 + 0.5 * abs(cal->matrix[o][i]) / RGB_CAL_ONE;
+  }
+  return b;
+}
+
+static double reference(const rgb_calibration_t * cal, float gamma, int o, rgb_t in)
+{
+  const uint8_t v[3] = {in.r, in.g, in.b};
+  double out = cal->offset[o] / (double)RGB_CAL_ONE;
+  for(int i = 0; i < 3; ++i){
+    out += cal->matrix[o][i] / (double)RGB_CAL_ONE * pow(v[i] / 255.0, gamma);
+  }
+  out *= DUTY_MAX;
+  return out < 0 ? 0 : out > DUTY_MAX ? DUTY_MAX : out;
+}
+
+static void check_case(const case_t * c, float gamma, int step)
+{
+  static calib_lut_t lut;
+  calib_fold(&lut, &c->cal, gamma, DUTY_MAX);
+  double worst[3] = {0}, limit[3];
+  long zero = 0, full = 0;
+  for(int o = 0; o < 3; ++o) limit[o] = bound(&c->cal, o);
+  for(int r = 0; r < 256; r += step){
+    for(int g = 0; g < 256; g += step){
+      for(int b = 0; b < 256; b += step){
+	rgb_t in = {r, g, b};
+	for(int o = 0; o < 3; ++o){
+	  uint32_t duty = calib_duty(&lut, o, in);
+	  double ref = reference(&c->cal, gamma, o, in);
+	  double error = fabs(duty - ref);
+	  zero += duty == 0;
+	  full += duty == DUTY_MAX;
+	  if(error > limit[o] + 1e-9 && error > worst[o]){
+	    printf("%s, gamma %.1f: output %d of %d,%d,%d is %u, %.2f expected\n",
+		   c->name, gamma, o, r, g, b, duty, ref);
+	    g_errors++;
+	  }
+	  if(error > worst[o]) worst[o] = error;
+	}
+      }
+    }
+  }
+  printf("%-12s gamma %.1f: error %.2f %.2f %.2f LSB (limit %.1f %.1f %.1f), "
+	 "%ld at 0, %ld at %d\n", c->name, gamma, worst[0], worst[1], worst[2],
+	 limit[0], limit[1], limit[2], zero, full, DUTY_MAX);
+}
+
+// Black is the offsets alone, truncated like calib_fold does
+static void check_black(const case_t * c)
+{
+  calib_lut_t lut;
+  calib_fold(&lut, &c->cal, 2.2f, DUTY_MAX);
+  for(int o = 0; o < 3; ++o){
+    int32_t expected = c->cal.offset[o] * DUTY_MAX / RGB_CAL_ONE;
+    expected = expected < 0 ? 0 : expected > DUTY_MAX ? DUTY_MAX : expected;
+    uint32_t duty = calib_duty(&lut, o, (rgb_t){0, 0, 0});
+    if(duty != (uint32_t)expected){
+      printf("%s: output %d of black is %u, %d expected\n", c->name, o, duty, expected);
+      g_errors++;
+    }
+  }
+}
+
+// The older firmware: duty = value * (scale + 128) / 256 at 8 bits,
+// clamped to 255. The 11 bit duty has to be within an LSB of that range
+// of an 8 bit step, and full when the old one was.
+static void check_scales(void)
+{
+  static const int scales[] = {0, 1, 50, 127, 128, 129, 200, 255};
+  int worst = 0;
+  for(size_t s = 0; s < sizeof(scales) / sizeof(*scales); ++s){
+    int scale = scales[s];
+    int16_t m = calib_from_scale(scale, 1.0f);
+    if(m != (scale + 128) * RGB_CAL_ONE / 256){
+      printf("scale %d: %d in the matrix, %d expected\n", scale, m,
+	     (scale + 128) * RGB_CAL_ONE / 256);
+      g_errors++;
+    }
+    rgb_calibration_t cal = {{{m, 0, 0}, {0, m, 0}, {0, 0, m}}, {0, 0, 0}};
+    calib_lut_t lut;
+    calib_fold(&lut, &cal, 1.0f, DUTY_MAX);
+    for(int v = 0; v < 256; ++v){
+      int old = v * (scale + 128) / 256;
+      if(old > 255) old = 255;
+      int lo = old * DUTY_MAX / 255 - 1;
+      int hi = old == 255 ? DUTY_MAX : (old + 1) * DUTY_MAX / 255 + 1;
+      if(old == 255) lo = DUTY_MAX;
+      for(int o = 0; o < 3; ++o){
+	rgb_t in = {o == 0 ? v : 0, o == 1 ? v : 0, o == 2 ? v : 0};
+	int duty = calib_duty(&lut, o, in);
+	if(duty < lo || duty > hi){
+	  printf("scale %d: %d gives %d, the old firmware %d (%d to %d)\n",
+		 scale, v, duty, old, lo, hi);
+	  g_errors++;
+	}
+	int d = abs(duty * 255 - old * DUTY_MAX);
+	if(d > worst) worst = d;
+      }
+    }
+  }
+  printf("old channel scales at gamma 1: within %.2f LSB of the 8 bit duties\n",
+	 worst / 255.0);
+}
+
+int main(int argc, char ** argv)
+{
+  int step = argc > 1 ? atoi(argv[1]) : 5;
+  if(step < 1) step = 1;
+  int ncases = sizeof(g_cases) / sizeof(*g_cases);
+  for(int c = 0; c < ncases; ++c){
+    for(size_t g = 0; g < sizeof(g_gammas) / sizeof(*g_gammas); ++g){
+      check_case(&g_cases[c], g_gammas[g], step);
+    }
+    check_black(&g_cases[c]);
+  }
+  check_scales();
+  printf("%d errors\n", g_errors);
+  return g_errors ? 1 : 0;
+}
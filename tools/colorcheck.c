@@ -0,0 +1,140 @@
+/*
+ * Check the color conversions and compare them with the 8 bit ones.
+ *
+ *   gcc -O2 -I../main -o colorcheck colorcheck.c ../main/color.c
+ *   ./colorcheck
+ *
+ * Round trips every 8 bit RGB color through the 16 bit HSV model (the path
+ * of a web color into the state and out to the LEDs), which must give the
+ * same color back, and measures the error of the 16 bit round trip and of
+ * the 8 bit functions. Exits with 1 when a check fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "color.h"
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int diff(int a, int b)
+{
+  return a > b ? a - b : b - a;
+}
+
+static int max3(int a, int b, int c)
+{
+  return a > b ? (a > c ? a : c) : (b > c ? b : c);
+}
+
+static uint32_t g_seed = 1;
+
+static uint16_t rand16(void)
+{
+  g_seed = g_seed * 1664525 + 1013904223;
+  return g_seed >> 16;
+}
+
+// Keep results alive in the benchmarks
+static volatile uint32_t g_sink;
+
+int main(void)
+{
+  int failed = 0;
+
+  // Every 8 bit color: rgb -> hsv16 -> rgb must be the identity
+  long mismatches = 0;
+  int worst8 = 0, worst16 = 0;
+  long legacy_changed = 0;
+  for(uint32_t c = 0; c < (1 << 24); ++c){
+    rgb_t in = {c >> 16, (c >> 8) & 0xff, c & 0xff};
+    rgb16_t wide = rgb_8_to_16(in);
+    rgb16_t back16 = hsv16_to_rgb16(rgb16_to_hsv16(wide));
+    rgb_t back = rgb_16_to_8(back16);
+    if(back.r != in.r || back.g != in.g || back.b != in.b) mismatches++;
+    int e16 = max3(diff(back16.r, wide.r), diff(back16.g, wide.g), diff(back16.b, wide.b));
+    if(e16 > worst16) worst16 = e16;
+
+    rgb_t legacy = hsv_to_rgb(rgb_to_hsv(in));
+    int e8 = max3(diff(legacy.r, in.r), diff(legacy.g, in.g), diff(legacy.b, in.b));
+    if(e8) legacy_changed++;
+    if(e8 > worst8) worst8 = e8;
+  }
+  printf("8 bit rgb through hsv16: %ld of %d colors changed, max error %d/65535\n",
+	 mismatches, 1 << 24, worst16);
+  printf("8 bit rgb through hsv:   %ld of %d colors changed, max error %d/255\n",
+	 legacy_changed, 1 << 24, worst8);
+  if(mismatches) failed = 1;
+
+  // Random 16 bit colors. Hue has 16 bits for the whole circle, so a round
+  // trip is off by a few steps; the state only converts once per edit, but
+  // even repeated round trips must stay below one 8 bit step.
+  int worst_once = 0, worst_drift = 0;
+  for(int i = 0; i < 1000000; ++i){
+    rgb16_t in = {rand16(), rand16(), rand16()};
+    rgb16_t once = hsv16_to_rgb16(rgb16_to_hsv16(in));
+    int e1 = max3(diff(in.r, once.r), diff(in.g, once.g), diff(in.b, once.b));
+    if(e1 > worst_once) worst_once = e1;
+    rgb16_t c = once;
+    for(int n = 0; n < 10; ++n) c = hsv16_to_rgb16(rgb16_to_hsv16(c));
+    int e = max3(diff(c.r, once.r), diff(c.g, once.g), diff(c.b, once.b));
+    if(e > worst_drift) worst_drift = e;
+  }
+  printf("16 bit round trip: max error %d/65535, after 10 more: %d/65535\n",
+	 worst_once, worst_drift);
+  if(worst_once > 8 || worst_drift >= 257) failed = 1;
+
+  // Brightness down to 1% and back up keeps the color
+  int worst_dim = 0;
+  for(int i = 0; i < 100000; ++i){
+    hsv16_t hsv = {rand16(), rand16(), rand16()};
+    rgb16_t before = hsv16_to_rgb16(hsv);
+    hsv16_t dim = rgb16_to_hsv16(hsv16_to_rgb16((hsv16_t){hsv.h, hsv.s, 655}));
+    dim.v = hsv.v;
+    rgb16_t after = hsv16_to_rgb16(dim);
+    int e = max3(diff(before.r, after.r), diff(before.g, after.g), diff(before.b, after.b));
+    if(e > worst_dim) worst_dim = e;
+  }
+  printf("Dim to 1%% through rgb and back: max error %d/65535\n", worst_dim);
+  if(worst_dim >= 257) failed = 1;
+
+  // Speed
+  const int n = 10000000;
+  double t0 = now_s();
+  for(int i = 0; i < n; ++i){
+    hsv_t h = {i, i >> 8, i >> 16};
+    rgb_t c = hsv_to_rgb(h);
+    g_sink += c.r + c.g + c.b;
+  }
+  double t1 = now_s();
+  for(int i = 0; i < n; ++i){
+    hsv16_t h = {i * 7, i >> 4, i >> 8};
+    rgb16_t c = hsv16_to_rgb16(h);
+    g_sink += c.r + c.g + c.b;
+  }
+  double t2 = now_s();
+  for(int i = 0; i < n; ++i){
+    rgb_t c = {i, i >> 8, i >> 16};
+    hsv_t h = rgb_to_hsv(c);
+    g_sink += h.h + h.s + h.v;
+  }
+  double t3 = now_s();
+  for(int i = 0; i < n; ++i){
+    rgb16_t c = {i * 7, i >> 4, i >> 8};
+    hsv16_t h = rgb16_to_hsv16(c);
+    g_sink += h.h + h.s + h.v;
+  }
+  double t4 = now_s();
+  printf("hsv_to_rgb     %6.2f ns   hsv16_to_rgb16 %6.2f ns\n",
+	 (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n);
+  printf("rgb_to_hsv     %6.2f ns   rgb16_to_hsv16 %6.2f ns\n",
+	 (t3 - t2) * 1e9 / n, (t4 - t3) * 1e9 / n);
+
+  printf(failed ? "FAILED\n" : "OK\n");
+  return failed;
+}
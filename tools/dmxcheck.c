@@ -0,0 +1,390 @@
+/*
+ * Check the E1.31 and Art-Net receiver with built packets.
+ *
+ *   gcc -O2 -I../main -o dmxcheck dmxcheck.c ../main/dmx_packet.c \
+ *       ../main/dmx_socket.c
+ *   ./dmxcheck
+ *
+ * Feeds packets of both protocols to the receiver of one fixture, with the
+ * time of their arrival: packets of other universes, previews, other start
+ * codes and short or damaged ones, then several sources with their
+ * priorities, the sequence numbers, the source timeout and the stream
+ * terminated option.
+ *
+ * Then sends packets over UDP on 127.0.0.1 to the sockets of the firmware
+ * (dmx_socket.c) on test ports, unicast to both ports and, where the host
+ * routes it, to the multicast group of the universe, and reads them back
+ * into the receiver. Exits with 1 on a difference.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dmx_packet.h"
+#include "dmx_socket.h"
+
+#define UNIVERSE 3
+#define ADDRESS 10
+#define TIMEOUT_US 2500000
+
+#define MS 1000LL
+
+// Not the standard ports, a console on the network must not get in
+#define TEST_E131_PORT 25568
+#define TEST_ARTNET_PORT 26454
+
+static const uint8_t E131_ID[12] = {'A','S','C','-','E','1','.','1','7',0,0,0};
+static const uint8_t ARTNET_ID[8] = {'A','r','t','-','N','e','t',0};
+
+static uint8_t g_packet[638];
+static int g_errors = 0;
+
+static void put16(uint8_t * p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static void put32(uint8_t * p, uint32_t v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v & 0xffff);
+}
+
+// The slots of a universe with 'color' at ADDRESS and other levels around it
+static void fill_slots(uint8_t * slots, int count, rgb_t color)
+{
+  for(int i = 0; i < count; ++i) slots[i] = i * 7;
+  if(count >= ADDRESS + 2){
+    slots[ADDRESS - 1] = color.r;
+    slots[ADDRESS] = color.g;
+    slots[ADDRESS + 1] = color.b;
+  }
+}
+
+// E1.31 data packet of the source 'cid' (the byte repeated), see ANSI E1.31-2018 §4-7
+static int e131(uint8_t cid, uint8_t priority, uint8_t sequence, uint8_t options,
+		uint16_t universe, int count, rgb_t color)
+{
+  uint8_t * p = g_packet;
+  int len = 126 + count;
+  memset(p, 0, sizeof(g_packet));
+  put16(p, 0x0010);
+  memcpy(p + 4, E131_ID, sizeof(E131_ID));
+  put16(p + 16, 0x7000 | (len - 16));
+  put32(p + 18, 0x00000004);
+  memset(p + 22, cid, 16);
+  put16(p + 38, 0x7000 | (len - 38));
+  put32(p + 40, 0x00000002);
+  snprintf((char *)p + 44, 64, "console %d", cid);
+  p[108] = priority;
+  p[111] = sequence;
+  p[112] = options;
+  put16(p + 113, universe);
+  put16(p + 115, 0x7000 | (len - 115));
+  p[117] = 0x02;
+  p[118] = 0xa1;
+  put16(p + 121, 1);
+  put16(p + 123, count + 1);
+  fill_slots(p + 126, count, color);
+  return len;
+}
+
+// Art-Net OpDmx packet, 'universe' is its 15 bit port address
+static int artnet(uint8_t sequence, uint16_t universe, int count, rgb_t color)
+{
+  uint8_t * p = g_packet;
+  memset(p, 0, sizeof(g_packet));
+  memcpy(p, ARTNET_ID, sizeof(ARTNET_ID));
+  p[8] = 0x00;
+  p[9] = 0x50;
+  put16(p + 10, 14);
+  p[12] = sequence;
+  p[14] = universe & 0xff;
+  p[15] = universe >> 8;
+  put16(p + 16, count);
+  fill_slots(p + 18, count, color);
+  return 18 + count;
+}
+
+static const char * const _results[] = {"ignored", "color", "released"};
+
+static void expect(const char * what, dmx_receiver_t * rx, int len, int64_t now,
+		   dmx_result_t expected, rgb_t color)
+{
+  rgb_t got = {0, 0, 0};
+  dmx_result_t result = dmx_receive(rx, g_packet, len, now, &got);
+  bool same = result == expected &&
+    (result != DMX_COLOR || (got.r == color.r && got.g == color.g && got.b == color.b));
+  if(!same){
+    printf("%s: %s", what, _results[result]);
+    if(result == DMX_COLOR) printf(" %d,%d,%d", got.r, got.g, got.b);
+    printf(", expected %s", _results[expected]);
+    if(expected == DMX_COLOR) printf(" %d,%d,%d", color.r, color.g, color.b);
+    printf("\n");
+    g_errors++;
+  }
+}
+
+static void expect_timeout(const char * what, dmx_receiver_t * rx, int64_t now, bool expected)
+{
+  if(dmx_timeout(rx, now) != expected){
+    printf("%s: timeout %s\n", what, expected ? "missed" : "too early");
+    g_errors++;
+  }
+}
+
+static void expect_sources(const char * what, dmx_receiver_t * rx, uint32_t expected)
+{
+  if(rx->sources != expected){
+    printf("%s: %u sources took the output, expected %u\n", what, rx->sources, expected);
+    g_errors++;
+  }
+}
+
+static void check_packets(void)
+{
+  dmx_receiver_t rx;
+  rgb_t c = {200, 100, 50}, none = {0, 0, 0};
+  int len;
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+
+  expect("E1.31", &rx, e131(1, 100, 0, 0, UNIVERSE, 512, c), 0, DMX_COLOR, c);
+  expect("E1.31, 12 slots", &rx, e131(1, 100, 1, 0, UNIVERSE, ADDRESS + 2, c), 0, DMX_COLOR, c);
+  expect("E1.31, too few slots", &rx, e131(1, 100, 2, 0, UNIVERSE, ADDRESS + 1, c), 0,
+	 DMX_IGNORED, none);
+  expect("E1.31, other universe", &rx, e131(1, 100, 3, 0, UNIVERSE + 1, 512, c), 0,
+	 DMX_IGNORED, none);
+  expect("E1.31, preview", &rx, e131(1, 100, 4, 0x80, UNIVERSE, 512, c), 0, DMX_IGNORED, none);
+  len = e131(1, 100, 5, 0, UNIVERSE, 512, c);
+  g_packet[125] = 0xdd;
+  expect("E1.31, other start code", &rx, len, 0, DMX_IGNORED, none);
+  len = e131(1, 100, 6, 0, UNIVERSE, 512, c);
+  g_packet[43] = 0x03;
+  expect("E1.31, other framing vector", &rx, len, 0, DMX_IGNORED, none);
+  len = e131(1, 100, 7, 0, UNIVERSE, 512, c);
+  expect("E1.31, truncated", &rx, len - 1, 0, DMX_IGNORED, none);
+  expect("E1.31, header only", &rx, 125, 0, DMX_IGNORED, none);
+  expect_sources("E1.31", &rx, 1);
+
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+  expect("Art-Net", &rx, artnet(1, UNIVERSE - 1, 512, c), 0, DMX_COLOR, c);
+  expect("Art-Net, odd length", &rx, artnet(2, UNIVERSE - 1, ADDRESS + 3, c), 0, DMX_COLOR, c);
+  expect("Art-Net, universe numbered as E1.31", &rx, artnet(3, UNIVERSE, 512, c), 0,
+	 DMX_IGNORED, none);
+  expect("Art-Net, other net", &rx, artnet(4, 0x100 | (UNIVERSE - 1), 512, c), 0,
+	 DMX_IGNORED, none);
+  len = artnet(5, UNIVERSE - 1, 512, c);
+  g_packet[9] = 0x52;
+  expect("Art-Net, OpNzs", &rx, len, 0, DMX_IGNORED, none);
+  len = artnet(6, UNIVERSE - 1, 512, c);
+  expect("Art-Net, truncated", &rx, len - 1, 0, DMX_IGNORED, none);
+  expect_sources("Art-Net", &rx, 1);
+}
+
+static void check_sequence(void)
+{
+  dmx_receiver_t rx;
+  rgb_t a = {1, 2, 3}, b = {4, 5, 6}, none = {0, 0, 0};
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+
+  expect("sequence 250", &rx, e131(1, 100, 250, 0, UNIVERSE, 512, a), 0, DMX_COLOR, a);
+  expect("sequence 250 again", &rx, e131(1, 100, 250, 0, UNIVERSE, 512, b), MS,
+	 DMX_IGNORED, none);
+  expect("sequence 249, late", &rx, e131(1, 100, 249, 0, UNIVERSE, 512, b), 2 * MS,
+	 DMX_IGNORED, none);
+  expect("sequence 4, wrapped", &rx, e131(1, 100, 4, 0, UNIVERSE, 512, b), 3 * MS, DMX_COLOR, b);
+  expect("sequence 240, 20 behind: a restart", &rx, e131(1, 100, 240, 0, UNIVERSE, 512, a),
+	 4 * MS, DMX_COLOR, a);
+
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+  expect("Art-Net sequence 9", &rx, artnet(9, UNIVERSE - 1, 512, a), 0, DMX_COLOR, a);
+  expect("Art-Net sequence 8, late", &rx, artnet(8, UNIVERSE - 1, 512, b), MS, DMX_IGNORED, none);
+  expect("Art-Net sequence 0, not sequenced", &rx, artnet(0, UNIVERSE - 1, 512, b), 2 * MS,
+	 DMX_COLOR, b);
+  expect("Art-Net sequence 0 again", &rx, artnet(0, UNIVERSE - 1, 512, a), 3 * MS, DMX_COLOR, a);
+  expect_sources("sequence", &rx, 1);
+}
+
+static void check_priority(void)
+{
+  dmx_receiver_t rx;
+  rgb_t a = {10, 0, 0}, b = {0, 20, 0}, art = {0, 0, 30}, none = {0, 0, 0};
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+
+  expect("A at 100", &rx, e131(1, 100, 0, 0, UNIVERSE, 512, a), 0, DMX_COLOR, a);
+  expect("B at 50 while A sends", &rx, e131(2, 50, 0, 0, UNIVERSE, 512, b), 10 * MS,
+	 DMX_IGNORED, none);
+  expect("B at 100 while A sends", &rx, e131(2, 100, 1, 0, UNIVERSE, 512, b), 20 * MS,
+	 DMX_IGNORED, none);
+  expect("Art-Net (100) while A sends", &rx, artnet(1, UNIVERSE - 1, 512, art), 30 * MS,
+	 DMX_IGNORED, none);
+  expect("A again", &rx, e131(1, 100, 1, 0, UNIVERSE, 512, a), 40 * MS, DMX_COLOR, a);
+  expect("B at 150 takes over", &rx, e131(2, 150, 2, 0, UNIVERSE, 512, b), 50 * MS,
+	 DMX_COLOR, b);
+  expect("A while B sends", &rx, e131(1, 100, 2, 0, UNIVERSE, 512, a), 60 * MS,
+	 DMX_IGNORED, none);
+  expect("A at 200 takes over", &rx, e131(1, 200, 3, 0, UNIVERSE, 512, a), 70 * MS,
+	 DMX_COLOR, a);
+  expect_sources("priority", &rx, 3);
+
+  // A silent source keeps the output until the timeout, for others too
+  int64_t last = 70 * MS;
+  expect("B at 150 before the timeout of A", &rx, e131(2, 150, 3, 0, UNIVERSE, 512, b),
+	 last + TIMEOUT_US - 1, DMX_IGNORED, none);
+  expect("B at 150 after the timeout of A", &rx, e131(2, 150, 4, 0, UNIVERSE, 512, b),
+	 last + TIMEOUT_US, DMX_COLOR, b);
+  last += TIMEOUT_US;
+  expect("Art-Net at B's timeout", &rx, artnet(2, UNIVERSE - 1, 512, art),
+	 last + TIMEOUT_US, DMX_COLOR, art);
+  expect_sources("timeout takeover", &rx, 5);
+}
+
+static void check_timeout(void)
+{
+  dmx_receiver_t rx;
+  rgb_t a = {10, 0, 0}, b = {0, 20, 0};
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+
+  expect_timeout("without a source", &rx, 10 * TIMEOUT_US, false);
+  expect("A", &rx, e131(1, 100, 0, 0, UNIVERSE, 512, a), 0, DMX_COLOR, a);
+  expect_timeout("A just sent", &rx, 0, false);
+  expect_timeout("A at the timeout", &rx, TIMEOUT_US, false);
+  expect("A keeps sending", &rx, e131(1, 100, 1, 0, UNIVERSE, 512, a), TIMEOUT_US, DMX_COLOR, a);
+  expect_timeout("A still there", &rx, 2 * TIMEOUT_US, false);
+  expect_timeout("A gone", &rx, 2 * TIMEOUT_US + 1, true);
+  expect_timeout("A gone, once", &rx, 2 * TIMEOUT_US + 2, false);
+  // A lower priority takes the output at once after the timeout
+  expect("B at 10 after A", &rx, e131(2, 10, 0, 0, UNIVERSE, 512, b), 2 * TIMEOUT_US + 3,
+	 DMX_COLOR, b);
+  // A comes back from any sequence number, as a new source
+  expect("A back at 200", &rx, e131(1, 200, 1, 0, UNIVERSE, 512, a), 2 * TIMEOUT_US + 4,
+	 DMX_COLOR, a);
+  expect_sources("timeout", &rx, 3);
+}
+
+static void check_terminate(void)
+{
+  dmx_receiver_t rx;
+  rgb_t a = {10, 0, 0}, b = {0, 20, 0}, none = {0, 0, 0};
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+
+  expect("A", &rx, e131(1, 100, 0, 0, UNIVERSE, 512, a), 0, DMX_COLOR, a);
+  expect("B at 50 terminates", &rx, e131(2, 50, 0, 0x40, UNIVERSE, 512, b), MS,
+	 DMX_IGNORED, none);
+  expect("A after B terminated", &rx, e131(1, 100, 1, 0, UNIVERSE, 512, a), 2 * MS,
+	 DMX_COLOR, a);
+  expect("A, out of order terminate", &rx, e131(1, 100, 0, 0x40, UNIVERSE, 512, a), 3 * MS,
+	 DMX_IGNORED, none);
+  expect("A terminates", &rx, e131(1, 100, 2, 0x40, UNIVERSE, 512, a), 4 * MS,
+	 DMX_RELEASED, none);
+  expect_timeout("after the terminate", &rx, 10 * TIMEOUT_US, false);
+  // The output is free at once, for any priority
+  expect("B at 50 after A terminated", &rx, e131(2, 50, 1, 0, UNIVERSE, 512, b), 5 * MS,
+	 DMX_COLOR, b);
+  expect("B at 50, terminate of another universe", &rx,
+	 e131(2, 50, 2, 0x40, UNIVERSE + 1, 512, b), 6 * MS, DMX_IGNORED, none);
+  expect("B still there", &rx, e131(2, 50, 3, 0, UNIVERSE, 512, b), 7 * MS, DMX_COLOR, b);
+  expect_sources("terminate", &rx, 2);
+}
+
+// Sends the packet built in g_packet to 'ip':'port'
+static bool send_to(int sender, const char * ip, uint16_t port, int len)
+{
+  struct sockaddr_in to;
+  memset(&to, 0, sizeof(to));
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  to.sin_addr.s_addr = inet_addr(ip);
+  return sendto(sender, g_packet, len, 0, (struct sockaddr *)&to, sizeof(to)) == len;
+}
+
+// Reads a packet from the sockets into the receiver
+static void expect_read(const char * what, dmx_socket_t * sock, dmx_receiver_t * rx,
+			int64_t now, dmx_result_t expected, rgb_t color)
+{
+  int len = dmx_socket_read(sock, 500, g_packet, sizeof(g_packet));
+  if(len <= 0){
+    printf("%s: nothing received\n", what);
+    g_errors++;
+    return;
+  }
+  expect(what, rx, len, now, expected, color);
+}
+
+static void check_loopback(void)
+{
+  rgb_t a = {200, 100, 50}, b = {1, 2, 3};
+  dmx_socket_t sock;
+  if(!dmx_socket_open(&sock, TEST_E131_PORT, TEST_ARTNET_PORT, UNIVERSE) ||
+     sock.socks[DMX_SOCKET_E131] < 0 || sock.socks[DMX_SOCKET_ARTNET] < 0){
+    printf("loopback: ports %d and %d not bound\n", TEST_E131_PORT, TEST_ARTNET_PORT);
+    g_errors++;
+    dmx_socket_close(&sock);
+    return;
+  }
+  int sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  dmx_receiver_t rx;
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+
+  uint8_t buf[sizeof(g_packet)];
+  if(dmx_socket_read(&sock, 20, buf, sizeof(buf)) != 0){
+    printf("loopback: a packet out of nowhere\n");
+    g_errors++;
+  }
+
+  send_to(sender, "127.0.0.1", TEST_E131_PORT, e131(1, 100, 1, 0, UNIVERSE, 512, a));
+  expect_read("loopback E1.31", &sock, &rx, 1 * MS, DMX_COLOR, a);
+  send_to(sender, "127.0.0.1", TEST_ARTNET_PORT, artnet(1, UNIVERSE - 1, 512, b));
+  expect_read("loopback Art-Net, E1.31 keeps the output", &sock, &rx, 2 * MS, DMX_IGNORED, b);
+
+  // Two of each at once: the sockets take turns
+  for(int i = 0; i < 2; ++i){
+    send_to(sender, "127.0.0.1", TEST_E131_PORT, e131(1, 100, 2 + i, 0, UNIVERSE, 512, a));
+    send_to(sender, "127.0.0.1", TEST_ARTNET_PORT, artnet(2 + i, UNIVERSE - 1, 512, b));
+  }
+  usleep(10000);
+  char order[5] = "";
+  for(int i = 0; i < 4; ++i){
+    int len = dmx_socket_read(&sock, 500, g_packet, sizeof(g_packet));
+    order[i] = len <= 0 ? '-' : g_packet[0] == 'A' ? 'a' : 'e';
+  }
+  if(strcmp(order, "eaea") != 0 && strcmp(order, "aeae") != 0){
+    printf("loopback: read %s of eaea (e E1.31, a Art-Net)\n", order);
+    g_errors++;
+  }
+
+  // The group of the universe, looped back to this host if it routes
+  // multicast at all (a sandbox without a network does not)
+  dmx_receiver_init(&rx, UNIVERSE, ADDRESS, TIMEOUT_US);
+  char group[16];
+  snprintf(group, sizeof(group), "239.255.%d.%d", UNIVERSE >> 8, UNIVERSE & 0xff);
+  if(!sock.multicast){
+    printf("loopback: multicast group not joined here, skipped\n");
+  } else if(!send_to(sender, group, TEST_E131_PORT, e131(1, 100, 3, 0, UNIVERSE, 512, b))){
+    printf("loopback: no route to %s here, skipped\n", group);
+  } else {
+    expect_read("loopback E1.31 multicast", &sock, &rx, 3 * MS, DMX_COLOR, b);
+  }
+  close(sender);
+  dmx_socket_close(&sock);
+  if(dmx_socket_read(&sock, 0, buf, sizeof(buf)) != -1){
+    printf("loopback: read after close\n");
+    g_errors++;
+  }
+}
+
+int main(void)
+{
+  check_packets();
+  check_sequence();
+  check_priority();
+  check_timeout();
+  check_terminate();
+  check_loopback();
+  printf("%d errors\n", g_errors);
+  return g_errors ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+# Memory footprint of the firmware, per module, from the linker map
+#
+#   python3 footprint.py build/leds.map [--ram-kb 96] [--flash-kb 1152] [--all]
+#
+# Sizes of .text (IRAM code included), .data, .bss and .rodata of every file
+# of main/, the web page files (main/webfiles.h) apart, then the largest
+# ESP-IDF libraries. Static RAM is .data + .bss: with CONFIG_STATIC_ALLOC the
+# task stacks, queues and buffers of the firmware are in it. Flash is what
+# the image holds: .text + .data + .rodata.
+#
+# The build runs it with the budgets of CONFIG_FOOTPRINT_RAM_KB and
+# CONFIG_FOOTPRINT_FLASH_KB (CMakeLists.txt). Exits with 1 over a budget.
+import argparse
+import os
+import re
+import sys
+from collections import defaultdict
+
+KINDS = ("text", "data", "bss", "rodata")
+MAIN = "libmain.a"
+WEB = "web files"
+LIBS_SHOWN = 12
+
+INPUT = re.compile(r"^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+NAME_ONLY = re.compile(r"^ (\S+)$")
+NEXT_LINE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+
+
+def kind(output):
+    # Output sections of the ESP32 linker script: .iram0.text, .dram0.data,
+    # .dram0.bss, .flash.rodata, .flash.text, .rtc.*, .noinit
+    if "noload" in output:
+        return None
+    if "bss" in output or "noinit" in output:
+        return "bss"
+    if "rodata" in output or output == ".flash.appdesc":
+        return "rodata"
+    if "data" in output:
+        return "data"
+    if "text" in output or "vectors" in output or output.startswith(".iram"):
+        return "text"
+    return None
+
+
+def module(source, section):
+    # esp-idf/main/libmain.a(leds.c.obj) -> leds.c, others by library
+    m = re.match(r"(.*\.a)\((.*)\)$", source)
+    if not m:
+        return os.path.basename(source)
+    library, member = os.path.basename(m.group(1)), m.group(2)
+    if library != MAIN:
+        return library
+    if ".web_file_" in section:
+        return WEB
+    return re.sub(r"\.(obj|o)$", "", member)
+
+
+def read_map(name):
+    sizes = defaultdict(lambda: dict.fromkeys(KINDS, 0))
+    output = None
+    pending = None
+    started = False
+    for line in open(name, errors="replace"):
+        line = line.rstrip("\n")
+        if not started:
+            started = line.startswith("Linker script and memory map")
+            continue
+        if line.startswith("."):
+            output = kind(line.split()[0])
+            pending = None
+            continue
+        if output is None:
+            continue
+        m = INPUT.match(line)
+        if m:
+            section, size, source = m.group(1), int(m.group(3), 16), m.group(4)
+        elif pending:
+            m = NEXT_LINE.match(line)
+            section, pending = pending, None
+            if not m:
+                continue
+            size, source = int(m.group(2), 16), m.group(3)
+        else:
+            m = NAME_ONLY.match(line)
+            if m and not m.group(1).startswith("*"):
+                pending = m.group(1)
+            continue
+        if section.startswith("*") or size == 0:
+            continue
+        sizes[module(source.strip(), section)][output] += size
+    if not started:
+        sys.exit(f"{name}: not a linker map")
+    return sizes
+
+
+def row(name, s):
+    return f"{name:<24}{s['text']:>9}{s['data']:>9}{s['bss']:>9}{s['rodata']:>9}"
+
+
+def add(total, s):
+    for k in KINDS:
+        total[k] += s[k]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Memory footprint per module")
+    parser.add_argument("map", help="linker map of the firmware, build/leds.map")
+    parser.add_argument("--ram-kb", type=int, default=0,
+                        help="static RAM budget, .data + .bss, 0 for none")
+    parser.add_argument("--flash-kb", type=int, default=0,
+                        help="flash budget, .text + .data + .rodata, 0 for none")
+    parser.add_argument("--all", action="store_true", help="list every library")
+    args = parser.parse_args()
+
+    sizes = read_map(args.map)
+    firmware = sorted(n for n in sizes if n.endswith(".c") or n == WEB)
+    libraries = sorted((n for n in sizes if n not in firmware),
+                       key=lambda n: -sum(sizes[n].values()))
+
+    print(row("module", dict(zip(KINDS, KINDS))))
+    main_total = dict.fromkeys(KINDS, 0)
+    for n in firmware:
+        print(row(n, sizes[n]))
+        add(main_total, sizes[n])
+    print(row("main", main_total))
+    print()
+    others = dict.fromkeys(KINDS, 0)
+    shown = libraries if args.all else libraries[:LIBS_SHOWN]
+    for n in libraries:
+        if n in shown:
+            print(row(n, sizes[n]))
+        else:
+            add(others, sizes[n])
+    if len(shown) < len(libraries):
+        print(row(f"{len(libraries) - len(shown)} more", others))
+
+    total = dict.fromkeys(KINDS, 0)
+    for s in sizes.values():
+        add(total, s)
+    print(row("total", total))
+    print()
+
+    failed = False
+    for what, used, budget in (
+            ("static RAM", total["data"] + total["bss"], args.ram_kb),
+            ("flash", total["text"] + total["data"] + total["rodata"], args.flash_kb)):
+        line = f"{what:<11}{used / 1024:8.1f} KB"
+        if budget:
+            line += f" of {budget} KB"
+            if used > budget * 1024:
+                line += f", {(used - budget * 1024) / 1024:.1f} KB over budget"
+                failed = True
+        print(line)
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,138 @@
+/*
+ * Check the effects compiler and time the evaluation of its programs.
+ *
+ *   gcc -O2 -I../main -o fxbench fxbench.c ../main/fx.c ../main/json.c ../main/color.c
+ *   ./fxbench [evaluations]
+ *
+ * Compiles every kind of effect with the firmware compiler, checks a few
+ * outputs (levels out of range are clamped, a static color is exact), then
+ * evaluates each program over a sweep of times and fixtures and prints the
+ * time per fx_eval call. The ESP32 is roughly 10-20 times slower than a
+ * desktop. Exits with 1 on a wrong output.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fx.h"
+
+typedef struct {
+  const char * name;
+  const char * json;
+} effect_t;
+
+static const effect_t g_effects[] = {
+  {"static", "{\"effect\":\"static\",\"color\":[255,30,0]}"},
+  {"breathe", "{\"effect\":\"breathe\",\"color\":[255,30,0],\"period\":4000,\"min\":20}"},
+  {"hue", "{\"effect\":\"hue\",\"period\":10000}"},
+  {"strobe", "{\"effect\":\"strobe\",\"color\":[255,255,255],\"period\":100,\"duty\":64}"},
+  {"candle", "{\"effect\":\"candle\"}"},
+  {"gradient", "{\"effect\":\"gradient\",\"color\":[255,0,0],\"to\":[0,0,255],"
+   "\"fixtures\":16,\"period\":8000}"},
+  {"keyframes", "{\"effect\":\"keyframes\",\"loop\":true,\"frames\":["
+   "{\"t\":0,\"color\":[255,0,0]},{\"t\":1000,\"color\":[0,255,0]},"
+   "{\"t\":2000,\"color\":[0,0,255]},{\"t\":3000,\"color\":[255,0,0]}]}"},
+};
+
+#define N_EFFECTS (sizeof(g_effects) / sizeof(g_effects[0]))
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool compile(const char * json, fx_program_t * program)
+{
+  fx_request_t request;
+  if(!fx_compile_json(json, strlen(json), &request) || !request.has_effect) return false;
+  *program = request.program;
+  return true;
+}
+
+// Share of 'steps' times over 'period' ms at which the effect is lit
+static double lit(const fx_program_t * program, uint32_t period, int steps)
+{
+  int on = 0;
+  for(int i = 0; i < steps; ++i){
+    rgb_t c = fx_eval(program, (uint64_t)i * period / steps, 0);
+    on += c.r || c.g || c.b;
+  }
+  return (double)on / steps;
+}
+
+static int check(void)
+{
+  int errors = 0;
+  fx_program_t p;
+  compile(g_effects[0].json, &p);
+  rgb_t c = fx_eval(&p, 1234, 5);
+  if(c.r != 255 || c.g != 30 || c.b != 0){
+    printf("static: %d,%d,%d, expected 255,30,0\n", c.r, c.g, c.b);
+    errors++;
+  }
+
+  // Duty in 0..255 of the period, whatever was asked for
+  static const struct {
+    int duty;
+    double lit;
+  } duties[] = {{-5, 0}, {0, 0}, {64, 0.25}, {255, 1}, {300, 1}, {70000, 1}};
+  for(size_t i = 0; i < sizeof(duties) / sizeof(duties[0]); ++i){
+    char json[96];
+    snprintf(json, sizeof(json), "{\"effect\":\"strobe\",\"period\":1000,\"duty\":%d}",
+	     duties[i].duty);
+    double got = compile(json, &p) ? lit(&p, 1000, 1000) : -1;
+    if(got < duties[i].lit - 0.01 || got > duties[i].lit + 0.01){
+      printf("strobe duty %d: lit %.3f of the period, expected %.3f\n",
+	     duties[i].duty, got, duties[i].lit);
+      errors++;
+    }
+  }
+
+  // min and max bound the brightness of breathe
+  if(!compile("{\"effect\":\"breathe\",\"period\":1000,\"min\":-40,\"max\":900}", &p)){
+    printf("breathe: rejected\n");
+    return errors + 1;
+  }
+  int low = 255, high = 0;
+  for(uint32_t t = 0; t < 1000; ++t){
+    c = fx_eval(&p, t, 0);
+    int v = c.r > c.g ? (c.r > c.b ? c.r : c.b) : (c.g > c.b ? c.g : c.b);
+    if(v < low) low = v;
+    if(v > high) high = v;
+  }
+  if(low != 0 || high != 255){
+    printf("breathe min -40 max 900: %d..%d, expected 0..255\n", low, high);
+    errors++;
+  }
+  return errors;
+}
+
+int main(int argc, char ** argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 2000000;
+  int errors = check();
+
+  uint32_t acc = 0;
+  for(size_t i = 0; i < N_EFFECTS; ++i){
+    fx_program_t p;
+    if(!compile(g_effects[i].json, &p)){
+      printf("%s: rejected\n", g_effects[i].name);
+      errors++;
+      continue;
+    }
+    double start = now_s();
+    for(int k = 0; k < n; ++k){
+      // 50 Hz ticks over 16 fixtures
+      rgb_t c = fx_eval(&p, (uint32_t)(k / 16) * 20, k % 16);
+      acc += c.r + c.g + c.b;
+    }
+    double ns = (now_s() - start) * 1e9 / n;
+    printf("%-10s %2d bytes of code  %5.1f ns per fx_eval\n", g_effects[i].name, p.len, ns);
+  }
+  if(acc == 1) printf("\n"); // Keep the loop
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
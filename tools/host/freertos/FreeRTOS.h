@@ -0,0 +1,12 @@
+#pragma once
+/*
+ * Just enough of FreeRTOS for main/pool.c and sync_node.c on the host
+ * (tools/poolsoak.c, syncnet.c): the spinlocks are mutexes.
+ */
+#include <pthread.h>
+
+typedef pthread_mutex_t portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
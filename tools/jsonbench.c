@@ -0,0 +1,119 @@
+/*
+ * Throughput of the streaming JSON reader on a large batch document.
+ *
+ *   gcc -O2 -I../main -o jsonbench jsonbench.c ../main/patch_json.c \
+ *       ../main/json.c ../main/patch.c ../main/color.c
+ *   ./jsonbench [patches]
+ *
+ * Builds a POST /api/batch body of random patches (colors, modes,
+ * transitions, calibration arrays) and feeds it in 128 byte chunks, as
+ * api.c receives it, to the reader alone (a callback that accepts
+ * everything) and to the patch reader. Prints MB/s for both. Exits with 1
+ * if the document is not read whole.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "patch_json.h"
+
+#define CHUNK 128
+#define ROUNDS 5
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool accept_cb(json_reader_t * r, json_event_t event, void * arg)
+{
+  (void)r;
+  (*(long *)arg)++;
+  return event <= JSON_NULL;
+}
+
+static size_t add_patch(char * out, size_t size)
+{
+  switch(rand() % 5){
+  case 0:
+    return snprintf(out, size, "{\"rgb\":{\"r\":%d,\"g\":%d,\"b\":%d}}",
+		    rand() % 256, rand() % 256, rand() % 256);
+  case 1:
+    return snprintf(out, size, "{\"hsv\":{\"h\":%d,\"s\":%d,\"v\":%d},\"transition_ms\":%d}",
+		    rand() % 256, rand() % 256, rand() % 256, rand() % 5000);
+  case 2:
+    return snprintf(out, size, "{\"mode\":\"%s\",\"on\":%s}",
+		    patch_json_modes[rand() % 3], rand() % 2 ? "true" : "false");
+  case 3:
+    return snprintf(out, size, "{\"cal\":{\"matrix\":[%d,0,0,0,%d,0,0,0,%d],\"offset\":[0,0,%d]}}",
+		    4096 - rand() % 100, 2048 + rand() % 100, 2848, rand() % 10);
+  default:
+    return snprintf(out, size, "{ \"hsv\" : { \"v\" : %d.%d } }", rand() % 256, rand() % 10);
+  }
+}
+
+// Feeds the document in chunks, returns the seconds taken or -1 on an error
+static double feed(json_reader_t * reader, const char * doc, size_t len)
+{
+  double start = now_s();
+  for(size_t i = 0; i < len; i += CHUNK){
+    size_t n = len - i < CHUNK ? len - i : CHUNK;
+    if(!json_reader_feed(reader, doc + i, n)) return -1;
+  }
+  if(!json_reader_finish(reader)) return -1;
+  return now_s() - start;
+}
+
+int main(int argc, char ** argv)
+{
+  int patches = argc > 1 ? atoi(argv[1]) : 200000;
+  size_t size = (size_t)patches * 96 + 16;
+  char * doc = malloc(size);
+  size_t len = 0;
+  srand(1);
+  doc[len++] = '[';
+  for(int i = 0; i < patches; ++i){
+    if(i) doc[len++] = ',';
+    len += add_patch(doc + len, size - len);
+  }
+  doc[len++] = ']';
+  double mb = len / 1e6;
+
+  double best_raw = 1e9, best_patch = 1e9;
+  long events = 0;
+  int count = 0;
+  for(int round = 0; round < ROUNDS; ++round){
+    json_reader_t reader;
+    events = 0;
+    json_reader_init(&reader, accept_cb, &events);
+    double t = feed(&reader, doc, len);
+    if(t < 0){
+      printf("reader: document rejected\n");
+      return 1;
+    }
+    if(t < best_raw) best_raw = t;
+
+    patch_reader_t pr;
+    patch_reader_init(&pr, &reader, 2, 4);
+    t = feed(&reader, doc, len);
+    if(t < 0){
+      printf("patch reader: document rejected\n");
+      return 1;
+    }
+    if(t < best_patch) best_patch = t;
+    count = pr.count;
+  }
+  if(count != patches){
+    printf("patch reader: %d patches read of %d\n", count, patches);
+    return 1;
+  }
+  printf("%d patches, %.1f MB, %ld events\n", patches, mb, events);
+  printf("reader:       %6.1f MB/s\n", mb / best_raw);
+  printf("patch reader: %6.1f MB/s (%.0f ns per patch)\n",
+	 mb / best_patch, best_patch * 1e9 / patches);
+  free(doc);
+  return 0;
+}
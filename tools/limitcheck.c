@@ -0,0 +1,113 @@
+/*
+ * Check the current limiter against a plain sum over the channels.
+ *
+ *   gcc -O2 -I../main -o limitcheck limitcheck.c ../main/limit.c
+ *   ./limitcheck [frames]
+ *
+ * Random frames change a few channels of a fixture (3 channels, 11 bit
+ * duty) and of a pixel strip (3 x 1000 channels, 8 bit duty) under random
+ * budgets. The running sum has to match the sum of all channels, the draw
+ * after limiting has to fit the budget and be no further below it than the
+ * rounding, and the statistics have to count what happened. Then times a
+ * change with both sizes: it should not depend on the number of channels.
+ * Exits with 1 on a difference.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "limit.h"
+
+#define STRIP (3 * 1000)
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint16_t g_ma[STRIP];
+static uint32_t g_duty[STRIP];
+
+static int check(uint32_t count, uint32_t duty_max, int frames)
+{
+  limit_t l;
+  int errors = 0;
+  uint32_t limited = 0, peak = 0, min_scale = LIMIT_SCALE_ONE;
+  uint32_t full_ma = 0;
+  for(uint32_t i = 0; i < count; ++i){
+    g_ma[i] = 5 + rand() % 400;
+    full_ma += g_ma[i];
+  }
+  limit_init(&l, count, g_ma, g_duty, duty_max, 0);
+  for(int f = 0; f < frames; ++f){
+    if(f % 100 == 0) l.budget_ma = rand() % 4 ? rand() % (full_ma + 1) : 0;
+    uint32_t changes = rand() % 2 ? 1u + rand() % 3 : rand() % (count + 1);
+    for(uint32_t c = 0; c < changes; ++c){
+      limit_set(&l, rand() % count, rand() % 3 ? rand() % (duty_max + 1) : duty_max);
+    }
+    uint32_t scale = limit_frame(&l);
+
+    uint64_t sum = 0, out = 0;
+    for(uint32_t i = 0; i < count; ++i){
+      sum += (uint64_t)g_duty[i] * g_ma[i];
+      out += (uint64_t)limit_apply(&l, g_duty[i]) * g_ma[i];
+    }
+    uint64_t budget = (uint64_t)l.budget_ma * duty_max;
+    bool over = l.budget_ma && sum > budget;
+    // Each channel loses less than one step to the rounding, the scale less
+    // than 1/65536 of the draw
+    uint64_t slack = (uint64_t)full_ma + sum / LIMIT_SCALE_ONE + 1;
+    bool bad = sum != l.sum ||
+      (over ? out > budget || out + slack < budget : scale != LIMIT_SCALE_ONE || out != sum);
+    if(bad && errors++ < 10){
+      printf("%u channels, frame %d: sum %llu (running %llu), out %llu, budget %llu, scale %u\n",
+	     count, f, (unsigned long long)sum, (unsigned long long)l.sum,
+	     (unsigned long long)out, (unsigned long long)budget, scale);
+    }
+    if(over){
+      limited++;
+      if(scale < min_scale) min_scale = scale;
+    }
+    if(sum / duty_max > peak) peak = sum / duty_max;
+  }
+  if(l.stats.frames != (uint32_t)frames || l.stats.limited != limited ||
+     l.stats.peak_ma != peak || l.stats.min_scale != min_scale){
+    printf("%u channels: stats %u frames, %u limited, peak %u mA, min scale %u, "
+	   "expected %d, %u, %u, %u\n", count, l.stats.frames, l.stats.limited,
+	   l.stats.peak_ma, l.stats.min_scale, frames, limited, peak, min_scale);
+    errors++;
+  }
+  printf("%u channels: %d frames, %u limited (down to %.1f%%), peak %u mA, %d errors\n",
+	 count, frames, limited, 100.0 * min_scale / LIMIT_SCALE_ONE, peak, errors);
+  return errors;
+}
+
+// Time of one change and its frame, in ns
+static double bench(uint32_t count)
+{
+  limit_t l;
+  const int n = 10000000;
+  limit_init(&l, count, g_ma, g_duty, 255, 1000);
+  uint32_t acc = 0;
+  double start = now_s();
+  for(int i = 0; i < n; ++i){
+    limit_set(&l, (i * 7919u) % count, i & 255);
+    acc += limit_frame(&l);
+  }
+  double ns = (now_s() - start) * 1e9 / n;
+  if(acc == 1) printf("\n"); // Keep the loop
+  return ns;
+}
+
+int main(int argc, char ** argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 20000;
+  srand(1);
+  int errors = check(3, 2047, frames);
+  errors += check(STRIP, 255, frames);
+  double small = bench(3), strip = bench(STRIP);
+  printf("change and frame: %.1f ns with 3 channels, %.1f ns with %d\n", small, strip, STRIP);
+  return errors ? 1 : 0;
+}
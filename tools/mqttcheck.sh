@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# Check the MQTT client of a fixture against a local broker.
+#
+#   sudo apt install mosquitto mosquitto-clients
+#   mosquitto -p 1883 &
+#   ./mqttcheck.sh [broker host] [topic base]
+#
+# The fixture is built with CONFIG_MQTT_ENABLE and CONFIG_MQTT_URI pointing
+# to this machine (mqtt://<ip of this machine>). The topic base defaults to
+# leds/leds (CONFIG_MQTT_TOPIC_PREFIX/CONFIG_HOSTNAME). Changes the color of
+# the fixture, exits with 1 when a check fails.
+
+HOST=${1:-localhost}
+BASE=${2:-leds/leds}
+DISCOVERY=homeassistant/light/${BASE##*/}/config
+PUBLISH_MS=250
+failed=0
+
+pass() { echo "ok      $1"; }
+fail() { echo "FAILED  $1"; failed=1; }
+
+# Retained message of a topic, empty if there is none
+retained() {
+  mosquitto_sub -h "$HOST" -t "$1" -C 1 -W 2 2>/dev/null
+}
+
+# Wait until the retained state contains $1
+wait_state() {
+  for i in $(seq 20); do
+    retained "$BASE/state" | grep -q "$1" && return 0
+    sleep 0.1
+  done
+  return 1
+}
+
+set_topic() {
+  mosquitto_pub -h "$HOST" -t "$BASE/$1" -m "$2"
+}
+
+echo "Waiting for the fixture on $HOST..."
+for i in $(seq 30); do
+  [ "$(retained "$BASE/status")" = online ] && break
+  sleep 1
+done
+[ "$(retained "$BASE/status")" = online ] && pass "online" || { fail "online"; exit 1; }
+
+retained "$DISCOVERY" | python3 -c 'import json,sys; d=json.load(sys.stdin); assert d["schema"]=="template"' \
+  && pass "discovery" || fail "discovery"
+
+set_topic rgb/set '{"r":10,"g":20,"b":30}'
+wait_state '"rgb":{"r":10,"g":20,"b":30}' && pass "rgb/set" || fail "rgb/set"
+
+set_topic hsv/set '{"v":40}'
+wait_state '"v":40' && pass "hsv/set" || fail "hsv/set"
+
+set_topic set '{"on":false,"transition_ms":0}'
+wait_state '"on":false' && pass "set off" || fail "set off"
+set_topic set '{"on":true}'
+wait_state '"on":true' && pass "set on" || fail "set on"
+
+set_topic cal/set '{"offset":[0,0,0]}'
+wait_state '"offset":\[0,0,0\]' && pass "cal/set" || fail "cal/set"
+
+set_topic rgb/set 'not json'
+set_topic scene/set '99999'
+[ "$(retained "$BASE/status")" = online ] && pass "bad commands ignored" || fail "bad commands ignored"
+
+# A burst of 100 changes in about a second must be coalesced, and the last
+# one must win
+mosquitto_sub -h "$HOST" -t "$BASE/state" -W 4 > /tmp/mqttcheck.$$ 2>/dev/null &
+sub=$!
+sleep 0.5
+start=$(date +%s%N)
+for v in $(seq 100 199); do
+  set_topic hsv/set "{\"v\":$v}"
+done
+ms=$(( ($(date +%s%N) - start) / 1000000 ))
+wait $sub
+count=$(( $(wc -l < /tmp/mqttcheck.$$) - 1 )) # The first one is the retained state
+max=$(( ms / PUBLISH_MS + 3 ))
+tail -1 /tmp/mqttcheck.$$ | grep -q '"v":199' && pass "burst: last state sent" || fail "burst: last state sent"
+[ "$count" -le "$max" ] && pass "burst: $count messages for 100 changes in $ms ms" \
+    || fail "burst: $count messages for 100 changes in $ms ms (at most $max)"
+rm -f /tmp/mqttcheck.$$
+
+# Nothing is sent when nothing changes
+set_topic hsv/set '{"v":199}'
+n=$(mosquitto_sub -h "$HOST" -t "$BASE/state" -W 1 2>/dev/null | wc -l)
+[ "$n" -le 1 ] && pass "no message without a change" || fail "no message without a change"
+
+[ $failed = 0 ] && echo OK || echo FAILED
+exit $failed
@@ -0,0 +1,173 @@
+/*
+ * Check the JSON patch parser of the REST API and MQTT.
+ *
+ *   gcc -O2 -I../main -o patchcheck patchcheck.c ../main/patch_json.c \
+ *       ../main/json.c ../main/patch.c ../main/color.c
+ *   ./patchcheck
+ *
+ * Parses documents and batches with known patches, accepted or rejected,
+ * fed whole and one byte at a time (as they arrive from a socket), and
+ * compares what was read with the expected fields. Exits with 1 on a
+ * difference.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "patch_json.h"
+
+#define SCENES 4
+
+typedef struct {
+  const char * json;
+  bool ok;
+  int count;              // Patches in a batch, -1 for a single document
+  const char * expected;  // What was read, as describe() prints it
+} test_t;
+
+static const test_t g_tests[] = {
+  {"{\"rgb\":{\"r\":255,\"g\":30,\"b\":0}}", true, -1, "rgb 255,30,0"},
+  {"{\"hsv\":{\"v\":128}}", true, -1, "v 128"},
+  {" { \"hsv\" : { \"h\" : 5 , \"s\" : 6 } } ", true, -1, "h 5 s 6"},
+  {"{\"rgb\":{\"r\":300,\"g\":-5,\"b\":12.6}}", true, -1, "rgb 255,0,13"},
+  {"{\"mode\":\"value\",\"transition_ms\":500}", true, -1, "mode 2 transition 500"},
+  {"{\"mode\":1}", true, -1, "mode 1"},
+  {"{\"on\":false}", true, -1, "on 0"},
+  {"{\"on\":true,\"hsv\":{\"v\":0}}", true, -1, "v 0 on 1"},
+  {"{\"scene\":3}", true, -1, "scene 3"},
+  {"{\"audio\":\"hue\"}", true, -1, "audio 2"},
+  {"{\"cal\":{\"matrix\":[4096,0,0,0,2048,0,0,0,2848],\"offset\":[1,-2,3]}}", true, -1,
+   "matrix 4096,0,0,0,2048,0,0,0,2848 offset 1,-2,3"},
+  {"{\"cal\":{\"offset\":[0,0,40000]}}", true, -1, "offset 0,0,32767"},
+  {"{}", true, -1, ""},
+
+  {"", false, -1, NULL},
+  {"[]", false, -1, NULL},
+  {"{\"rgb\":{\"r\":1}", false, -1, NULL},
+  {"{\"rgb\":{\"r\":1}}}", false, -1, NULL},
+  {"{\"rgb\":{\"r\":1}}{\"rgb\":{\"r\":1}}", false, -1, NULL},
+  {"{\"rgb\":{\"x\":1}}", false, -1, NULL},
+  {"{\"rgb\":1}", false, -1, NULL},
+  {"{\"red\":{\"r\":1}}", false, -1, NULL},
+  {"{\"rgb\":{\"r\":\"1\"}}", false, -1, NULL},
+  {"{\"mode\":3}", false, -1, NULL},
+  {"{\"mode\":\"hues\"}", false, -1, NULL},
+  {"{\"transition_ms\":-1}", false, -1, NULL},
+  {"{\"scene\":4}", false, -1, NULL},
+  {"{\"on\":1}", false, -1, NULL},
+  {"{\"audio\":\"loud\"}", false, -1, NULL},
+  {"{\"cal\":{\"matrix\":[1,2,3]}}", false, -1, NULL},
+  {"{\"cal\":{\"offset\":[1,2,3,4]}}", false, -1, NULL},
+  {"{\"cal\":{\"r\":1}}", false, -1, NULL},
+  {"{\"rgb\":{\"r\":{\"x\":1}}}", false, -1, NULL},
+
+  // Batches: merged in order, a color replaces the other kind of color
+  {"[{\"rgb\":{\"r\":1,\"g\":2,\"b\":3}},{\"hsv\":{\"v\":9}},{\"transition_ms\":100}]",
+   true, 3, "v 9 transition 100"},
+  {"[{\"hsv\":{\"v\":9}},{\"rgb\":{\"g\":2}},{\"rgb\":{\"g\":7}}]", true, 3, "g 7"},
+  {"[{\"scene\":1},{\"rgb\":{\"r\":1}}]", true, 2, "r 1"},
+  {"[{\"rgb\":{\"r\":1}},{\"scene\":1}]", true, 2, "scene 1"},
+  {"[]", true, 0, ""},
+  {"[{\"rgb\":{\"r\":1}},{\"mode\":7}]", false, 0, NULL},
+  {"[{\"rgb\":{\"r\":1}},3]", false, 0, NULL},
+  {"{\"rgb\":{\"r\":1}}", false, 0, NULL}, // Not an array
+};
+
+#define N_TESTS (sizeof(g_tests) / sizeof(g_tests[0]))
+
+// The fields set in the patch, as text
+static void describe(const state_patch_t * p, char * out, size_t size)
+{
+  uint32_t f = p->fields;
+  size_t n = 0;
+#define ADD(...) n += snprintf(out + n, n < size ? size - n : 0, __VA_ARGS__)
+  out[0] = 0;
+  if((f & PATCH_RGB) == PATCH_RGB){
+    ADD(" rgb %d,%d,%d", p->rgb.r, p->rgb.g, p->rgb.b);
+  } else {
+    if(f & PATCH_RGB_R) ADD(" r %d", p->rgb.r);
+    if(f & PATCH_RGB_G) ADD(" g %d", p->rgb.g);
+    if(f & PATCH_RGB_B) ADD(" b %d", p->rgb.b);
+  }
+  if(f & PATCH_HSV_H) ADD(" h %d", p->hsv.h);
+  if(f & PATCH_HSV_S) ADD(" s %d", p->hsv.s);
+  if(f & PATCH_HSV_V) ADD(" v %d", p->hsv.v);
+  if(f & PATCH_CAL_MATRIX){
+    const int16_t * m = &p->cal.matrix[0][0];
+    ADD(" matrix %d,%d,%d,%d,%d,%d,%d,%d,%d", m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8]);
+  }
+  if(f & PATCH_CAL_OFFSET) ADD(" offset %d,%d,%d", p->cal.offset[0], p->cal.offset[1], p->cal.offset[2]);
+  if(f & PATCH_MODE) ADD(" mode %d", p->cursor_mode);
+  if(f & PATCH_TRANSITION) ADD(" transition %u", (unsigned)p->transition_ms);
+  if(f & PATCH_POWER) ADD(" on %d", p->on);
+  if(f & PATCH_SCENE) ADD(" scene %d", p->scene);
+  if(f & PATCH_AUDIO) ADD(" audio %d", p->audio);
+  if(f & ~(PATCH_RGB | PATCH_HSV | PATCH_CAL | PATCH_MODE | PATCH_TRANSITION |
+	   PATCH_POWER | PATCH_SCENE | PATCH_AUDIO)){
+    ADD(" other %08x", (unsigned)f);
+  }
+#undef ADD
+  if(out[0] == ' ') memmove(out, out + 1, strlen(out));
+}
+
+// Parse the document fed in chunks of 'chunk' bytes
+static bool parse(const test_t * t, size_t chunk, state_patch_t * out, int * count)
+{
+  patch_reader_t pr;
+  json_reader_t reader;
+  patch_reader_init(&pr, &reader, t->count >= 0 ? 2 : 1, SCENES);
+  size_t len = strlen(t->json);
+  for(size_t i = 0; i < len; i += chunk){
+    size_t n = len - i < chunk ? len - i : chunk;
+    if(!json_reader_feed(&reader, t->json + i, n)) return false;
+  }
+  if(!json_reader_finish(&reader)) return false;
+  *out = pr.merged;
+  *count = pr.count;
+  return true;
+}
+
+int main(void)
+{
+  int errors = 0;
+  for(size_t i = 0; i < N_TESTS; ++i){
+    const test_t * t = &g_tests[i];
+    bool batch = t->count >= 0;
+    for(int whole = 0; whole <= 1; ++whole){
+      size_t size = whole ? strlen(t->json) + 1 : 1;
+      state_patch_t patch = {0};
+      int count = 0;
+      bool ok = parse(t, size, &patch, &count);
+      // A single document is one patch
+      if(ok && !batch) ok = count == 1;
+      char got[160] = "";
+      if(ok) describe(&patch, got, sizeof(got));
+      bool good = ok == t->ok &&
+	(!ok || (strcmp(got, t->expected) == 0 && (!batch || count == t->count)));
+      if(!good){
+	printf("%s (%s): %s", t->json, whole ? "whole" : "by byte",
+	       ok ? "accepted" : "rejected");
+	if(ok) printf(" as \"%s\", %d patches", got, count);
+	if(t->ok) printf(", expected \"%s\"", t->expected);
+	printf("\n");
+	errors++;
+      }
+    }
+  }
+
+  // The single document function used by MQTT
+  state_patch_t patch = {0};
+  const char * doc = "{\"hsv\":{\"h\":1,\"s\":2,\"v\":3}}";
+  if(!patch_json_parse(doc, strlen(doc), SCENES, &patch) || patch.fields != PATCH_HSV ||
+     patch.hsv.h != 1 || patch.hsv.s != 2 || patch.hsv.v != 3){
+    printf("patch_json_parse: %s not read\n", doc);
+    errors++;
+  }
+  doc = "[{\"hsv\":{\"v\":3}}]";
+  if(patch_json_parse(doc, strlen(doc), SCENES, &patch)){
+    printf("patch_json_parse: %s accepted\n", doc);
+    errors++;
+  }
+
+  printf("%d documents, %d errors\n", (int)N_TESTS, errors);
+  return errors ? 1 : 0;
+}
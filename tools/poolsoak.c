@@ -0,0 +1,439 @@
+/*
+ * Soak the client and job code of the web server with allocation storms.
+ *
+ *   make poolsoak        (the pool sizes are the Kconfig defaults)
+ *   ./poolsoak [rounds]
+ *
+ * Runs main/ws_session.c, the per connection state and the asynchronous
+ * jobs of http.c, on its pools (main/pool.c). host/ has the few FreeRTOS
+ * and log definitions they need, the spinlocks are mutexes.
+ *   clients      connections opened and closed at random by one task (the
+ *                httpd task), often beyond the capacity, while they take and
+ *                drop reassembly buffers
+ *   async jobs   queued by several threads (the tasks that notify the
+ *                clients) and run by another one (the httpd task); the
+ *                queue refuses some, which ws_job_queue frees at once
+ * Every client and buffer is filled with its owner while it is held and
+ * checked when it is released, so two owners of one show up, and must be
+ * zeroed when it is taken; the list of connected clients must be the ones
+ * held. Every job must run once with its own arguments. The counters of
+ * each pool must match what the storms did.
+ *
+ * malloc, calloc and realloc are counted during the storms: connecting,
+ * reassembling and sending asynchronously must never take memory from the
+ * heap. Exits with 1 on a difference.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ws_session.h"
+
+#define NOTIFIERS 4
+#define JOBS_PER_NOTIFIER 20000
+
+static int g_errors = 0;
+static pthread_mutex_t g_errors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void error(const char * fmt, ...)
+{
+  pthread_mutex_lock(&g_errors_lock);
+  if(g_errors++ < 20){
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+  }
+  pthread_mutex_unlock(&g_errors_lock);
+}
+
+// The heap of glibc, counted while g_counting is set
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void * p, size_t size);
+static volatile int g_counting = 0;
+static long g_heap_allocs = 0;
+
+void * malloc(size_t size)
+{
+  if(g_counting) __atomic_add_fetch(&g_heap_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size)
+{
+  if(g_counting) __atomic_add_fetch(&g_heap_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(n, size);
+}
+
+void * realloc(void * p, size_t size)
+{
+  if(g_counting) __atomic_add_fetch(&g_heap_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(p, size);
+}
+
+static uint32_t next_rand(uint32_t * seed)
+{
+  *seed = *seed * 1664525 + 1013904223;
+  return *seed >> 8;
+}
+
+static pool_t * g_found;
+static const char * g_find;
+
+static void find_cb(pool_t * pool, void * arg)
+{
+  (void)arg;
+  if(strcmp(pool->name, g_find) == 0) g_found = pool;
+}
+
+// A pool of ws_session.c, once it was used
+static pool_t * find_pool(const char * name)
+{
+  g_found = NULL;
+  g_find = name;
+  pool_for_each(find_cb, NULL);
+  return g_found;
+}
+
+typedef struct {
+  uint32_t allocs, exhausted;
+  size_t high_water;
+} counts_t;
+
+static void expect_stats(const char * name, const counts_t * c)
+{
+  pool_t * pool = find_pool(name);
+  if(!pool){
+    error("%s: never used", name);
+    return;
+  }
+  pool_stats_t st;
+  pool_get_stats(pool, &st);
+  if(st.in_use != 0) error("%s: %zu items in use after the storms", name, st.in_use);
+  if(st.allocs != c->allocs) error("%s: %u allocations counted, expected %u", name, st.allocs, c->allocs);
+  if(st.exhausted != c->exhausted){
+    error("%s: %u exhausted counted, expected %u", name, st.exhausted, c->exhausted);
+  }
+  if(st.high_water != c->high_water){
+    error("%s: high water mark %zu, expected %zu", name, st.high_water, c->high_water);
+  }
+}
+
+static bool filled(const uint8_t * p, size_t len, uint8_t value)
+{
+  for(size_t i = 0; i < len; ++i){
+    if(p[i] != value) return false;
+  }
+  return true;
+}
+
+typedef struct {
+  ws_client_t * client;
+  int owner;
+} held_t;
+
+// The connected clients have to be the ones held
+static void check_list(const held_t * held, size_t n)
+{
+  size_t listed = 0;
+  for(ws_client_t * c = ws_client_first(); c; c = c->next){
+    bool found = false;
+    for(size_t i = 0; i < n; ++i) found |= held[i].client == c;
+    if(!found) error("clients: client %d listed but not connected", c->fd);
+    if(++listed > n) break;
+  }
+  if(listed != n) error("clients: %zu listed, %zu connected", listed, n);
+}
+
+// Releases the buffer of a client after checking nobody else wrote it
+static void drop_rx(held_t * h)
+{
+  if(!filled(h->client->rx->data, sizeof(h->client->rx->data), h->owner)){
+    error("rx: buffer changed while held by %d", h->owner);
+  }
+  ws_client_drop_rx(h->client);
+  if(h->client->rx || h->client->rx_len) error("rx: buffer still set on %d", h->owner);
+}
+
+static void close_client(held_t * h)
+{
+  ws_client_t * c = h->client;
+  if(c->fd != h->owner || c->unacked != h->owner || c->rx_type != h->owner){
+    error("clients: client changed while held by %d (fd %d)", h->owner, c->fd);
+  }
+  if(c->rx && !filled(c->rx->data, sizeof(c->rx->data), h->owner)){
+    error("rx: buffer changed while held by %d", h->owner);
+  }
+  ws_client_free(c);
+}
+
+// The httpd task: connections opened and closed, buffers taken and dropped
+static void storm_clients(int steps, uint32_t seed, counts_t * clients, counts_t * rx)
+{
+  held_t held[2 * WS_MAX_CLIENTS];
+  size_t n = 0, with_rx = 0;
+  static int next_owner = 0;
+  for(int s = 0; s < steps; ++s){
+    uint32_t r = next_rand(&seed);
+    int op = n == 0 ? 0 : r % 4;
+    if(op == 0 && n < 2 * WS_MAX_CLIENTS){
+      int owner = 1 + next_owner++ % 250;
+      ws_client_t * c = ws_client_open(owner);
+      if(!c){
+	if(n < WS_MAX_CLIENTS) error("clients: exhausted with %zu of %d connected", n, WS_MAX_CLIENTS);
+	clients->exhausted++;
+	continue;
+      }
+      if(c->fd != owner || c->unacked || c->rx || c->rx_len || c->rx_type){
+	error("clients: new client %d not zeroed", owner);
+      }
+      c->unacked = c->rx_type = owner;
+      clients->allocs++;
+      held[n++] = (held_t){c, owner};
+      if(n > clients->high_water) clients->high_water = n;
+    } else if(op == 1 && n > 0){
+      size_t i = (r >> 4) % n;
+      if(held[i].client->rx) with_rx--;
+      close_client(&held[i]);
+      held[i] = held[--n];
+    } else if(op == 2 && n > 0){
+      held_t * h = &held[(r >> 4) % n];
+      if(h->client->rx) continue;
+      if(!ws_client_rx(h->client)){
+	if(with_rx < WS_RX_BUFFERS) error("rx: exhausted with %zu of %d held", with_rx, WS_RX_BUFFERS);
+	rx->exhausted++;
+	continue;
+      }
+      if(!filled(h->client->rx->data, sizeof(h->client->rx->data), 0)){
+	error("rx: new buffer of %d not zeroed", h->owner);
+      }
+      memset(h->client->rx->data, h->owner, sizeof(h->client->rx->data));
+      h->client->rx_len = h->owner;
+      rx->allocs++;
+      with_rx++;
+      if(with_rx > rx->high_water) rx->high_water = with_rx;
+    } else if(op == 3 && n > 0){
+      held_t * h = &held[(r >> 4) % n];
+      if(!h->client->rx) continue;
+      drop_rx(h);
+      with_rx--;
+    }
+    check_list(held, n);
+  }
+  while(n > 0) close_client(&held[--n]);
+  check_list(held, 0);
+}
+
+// Async jobs: the notifiers queue them, the httpd task runs them. The
+// threads run for all the rounds, so the C library does not take memory for
+// new ones.
+#define QUEUE_LEN 64
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct {
+    void (*work)(void * arg);
+    ws_job_t * job;
+    int fd;
+  } items[QUEUE_LEN];
+  int head, count;
+  long ran;
+  bool stop;
+} g_queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+static pthread_barrier_t g_round_start, g_round_end;
+static int g_server; // Its address is the server handle
+
+typedef struct {
+  pthread_t thread;
+  int id;
+  uint32_t seed;
+  uint32_t allocs, exhausted;
+  uint32_t queued;     // Run by the httpd task
+  uint32_t refused;    // By the queue, freed by ws_job_queue
+  bool called;         // The queue was called by the last ws_job_queue
+} notifier_t;
+
+static __thread notifier_t * t_notifier;
+
+// httpd_queue_work: refuses a quarter of the jobs
+static int queue_work(void * hd, void (*work)(void * arg), void * arg)
+{
+  notifier_t * nt = t_notifier;
+  ws_job_t * job = arg;
+  nt->called = true;
+  if(hd != &g_server || job->hd != hd || job->fn == NULL){
+    error("jobs: job of %d queued with wrong arguments", nt->id);
+  }
+  if(next_rand(&nt->seed) % 4 == 0){
+    nt->refused++;
+    return -1;
+  }
+  nt->queued++;
+  pthread_mutex_lock(&g_queue.lock);
+  int i = (g_queue.head + g_queue.count) % QUEUE_LEN;
+  g_queue.items[i].work = work;
+  g_queue.items[i].job = job;
+  g_queue.items[i].fd = job->fd;
+  if(g_queue.count++ == 0) pthread_cond_signal(&g_queue.cond);
+  pthread_mutex_unlock(&g_queue.lock);
+  return 0;
+}
+
+static void job_run(void * hd, int fd)
+{
+  if(hd != &g_server || fd < 0 || fd / JOBS_PER_NOTIFIER >= NOTIFIERS){
+    error("jobs: job ran with fd %d", fd);
+  }
+  g_queue.ran++; // Only the httpd thread
+}
+
+static void * notifier(void * arg)
+{
+  notifier_t * nt = arg;
+  t_notifier = nt;
+  nt->seed = nt->id + 1;
+  while(1){
+    pthread_barrier_wait(&g_round_start);
+    if(g_queue.stop) return NULL;
+    int waits = 0;
+    for(int i = 0; i < JOBS_PER_NOTIFIER; ){
+      nt->called = false;
+      if(ws_job_queue(queue_work, &g_server, nt->id * JOBS_PER_NOTIFIER + i, job_run)){
+	i++;
+	waits = 0;
+      } else if(!nt->called){
+	nt->exhausted++;
+	if(++waits == 1000000){
+	  error("jobs: notifier %d found no free job a million times, jobs leak", nt->id);
+	  break;
+	}
+	sched_yield();
+	continue;
+      }
+      if(next_rand(&nt->seed) % 8 == 0) sched_yield();
+    }
+    pthread_barrier_wait(&g_round_end);
+  }
+}
+
+static void * httpd(void * arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&g_queue.lock);
+  while(1){
+    while(g_queue.count == 0 && !g_queue.stop){
+      pthread_cond_wait(&g_queue.cond, &g_queue.lock);
+    }
+    if(g_queue.count == 0) break;
+    int i = g_queue.head;
+    void (*work)(void * arg) = g_queue.items[i].work;
+    ws_job_t * job = g_queue.items[i].job;
+    int fd = g_queue.items[i].fd;
+    g_queue.head = (g_queue.head + 1) % QUEUE_LEN;
+    g_queue.count--;
+    pthread_mutex_unlock(&g_queue.lock);
+    if(job->fd != fd){
+      error("jobs: job changed while queued, fd %d (%d)", job->fd, fd);
+    }
+    work(job);
+    pthread_mutex_lock(&g_queue.lock);
+  }
+  pthread_mutex_unlock(&g_queue.lock);
+  return NULL;
+}
+
+static notifier_t g_notifiers[NOTIFIERS];
+static pthread_t g_httpd;
+
+static void threads_start(void)
+{
+  pthread_barrier_init(&g_round_start, NULL, NOTIFIERS + 1);
+  pthread_barrier_init(&g_round_end, NULL, NOTIFIERS + 1);
+  pthread_create(&g_httpd, NULL, httpd, NULL);
+  for(int i = 0; i < NOTIFIERS; ++i){
+    g_notifiers[i].id = i;
+    pthread_create(&g_notifiers[i].thread, NULL, notifier, &g_notifiers[i]);
+  }
+}
+
+static void threads_stop(void)
+{
+  pthread_mutex_lock(&g_queue.lock);
+  g_queue.stop = true;
+  pthread_cond_broadcast(&g_queue.cond);
+  pthread_mutex_unlock(&g_queue.lock);
+  pthread_barrier_wait(&g_round_start);
+  for(int i = 0; i < NOTIFIERS; ++i) pthread_join(g_notifiers[i].thread, NULL);
+  pthread_join(g_httpd, NULL);
+}
+
+// A round of the notifiers, until the httpd task ran all their jobs
+static void storm_threads(void)
+{
+  pthread_barrier_wait(&g_round_start);
+  pthread_barrier_wait(&g_round_end);
+  long queued = 0;
+  for(int i = 0; i < NOTIFIERS; ++i) queued += g_notifiers[i].queued;
+  while(1){
+    pthread_mutex_lock(&g_queue.lock);
+    bool done = g_queue.ran >= queued;
+    pthread_mutex_unlock(&g_queue.lock);
+    if(done) break;
+    sched_yield();
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 10;
+  counts_t clients = {0}, rx = {0}, jobs = {0};
+  printf("%d rounds\n", rounds); // stdio takes its buffer before the first round
+  threads_start();
+  for(int round = 0; round < rounds; ++round){
+    g_counting = 1;
+    storm_clients(100000, round + 1, &clients, &rx);
+    storm_threads();
+    g_counting = 0;
+  }
+  threads_stop();
+  if(g_heap_allocs){
+    error("heap: %ld allocations during the storms", g_heap_allocs);
+  }
+
+  uint32_t queued = 0;
+  for(int i = 0; i < NOTIFIERS; ++i){
+    jobs.allocs += g_notifiers[i].queued + g_notifiers[i].refused;
+    jobs.exhausted += g_notifiers[i].exhausted;
+    queued += g_notifiers[i].queued;
+  }
+  if(g_queue.ran != queued){
+    error("jobs: %ld queued jobs ran of %u", g_queue.ran, queued);
+  }
+  expect_stats("g_ws_clients", &clients);
+  expect_stats("g_rx_buffers", &rx);
+  // Exhausted only while the notifiers and the queue held every job
+  pool_stats_t st;
+  pool_t * pool = find_pool("g_async_jobs");
+  if(pool){
+    pool_get_stats(pool, &st);
+    jobs.high_water = jobs.exhausted ? WS_ASYNC_JOBS : st.high_water;
+  }
+  expect_stats("g_async_jobs", &jobs);
+
+  static const char * const names[] = {"g_ws_clients", "g_rx_buffers", "g_async_jobs"};
+  for(int i = 0; i < 3; ++i){
+    pool = find_pool(names[i]);
+    if(!pool) continue;
+    pool_get_stats(pool, &st);
+    printf("%-13s %2zu x %5zu bytes: %9u allocations, %8u exhausted, high water %zu\n",
+	   st.name, st.capacity, st.item_size, st.allocs, st.exhausted, st.high_water);
+  }
+  printf("%ld heap allocations during the storms\n", g_heap_allocs);
+  printf("%d errors\n", g_errors);
+  return g_errors ? 1 : 0;
+}
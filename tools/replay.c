@@ -0,0 +1,495 @@
+/*
+ * Replay an input trace from the controller with the firmware state code.
+ *
+ *   gcc -O2 -I../main -o replay replay.c ../main/state.c ../main/patch.c \
+ *       ../main/color.c ../main/calib.c ../main/fade.c ../main/gesture.c -lm
+ *   curl -o leds.trace http://leds.local/api/trace
+ *   ./replay leds.trace [--realtime] [-v]
+ *   ./replay --record test.trace [events]
+ *
+ * Starts from the oldest snapshot of the state in the trace and applies the
+ * inputs in order, as the main loop does. Each render is compared with the
+ * color the controller showed, each snapshot with the replayed state, and
+ * the end with the state at the download. Exits with 1 on a difference.
+ *
+ * Without --realtime the trace runs as fast as it can, a few times over, and
+ * the time per event and per render (fade plus calibration) is printed.
+ * --realtime keeps the recorded timing, to watch a sequence with -v.
+ *
+ * --record writes a trace of random inputs through the same code, to check
+ * the tool itself (a replay of it must match).
+ *
+ * Calibration changes are not in the trace, the renders are computed with
+ * the calibration and output stage (gamma, PWM range) at the download. Effects are not evaluated again, their
+ * frames are taken from the trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "state.h"
+#include "patch.h"
+#include "fade.h"
+#include "calib.h"
+#include "gesture.h"
+#include "trace_format.h"
+
+#define RECORD_EVENTS (512)
+#define RECORD_GAMMA_X10 (10)   // The output stage of the default build (rgb.h)
+#define RECORD_DUTY_MAX (2047)
+
+typedef struct {
+  persistent_state_t state;
+  fade_t fade;
+  calib_lut_t lut;
+  bool synced;               // The fade is known, renders are compared
+  int32_t ramp_ms;           // Transition of the next render (PATCH_RAMP), -1 for none
+  bool verbose;
+  bool quiet;                // Timing rounds, no reports
+  uint64_t duties;           // Sum of the duties, so they are computed
+  uint32_t renders;
+  uint32_t color_errors;
+  uint32_t state_errors;
+} replay_t;
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool rgb_equal(rgb_t a, rgb_t b)
+{
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static void state_from_snapshot(persistent_state_t * s, const trace_event_t * ev)
+{
+  s->cursor_mode = ev->arg;
+  s->on = ev->flags;
+  s->hsv = ev->data.state.hsv;
+  s->rgb = ev->data.state.rgb;
+  s->transition_ms = ev->data.state.transition_ms;
+}
+
+static void snapshot_from_state(trace_event_t * ev, const persistent_state_t * s)
+{
+  ev->source = TRACE_SNAPSHOT;
+  ev->arg = s->cursor_mode;
+  ev->flags = s->on;
+  memset(&ev->data, 0, sizeof(ev->data));
+  ev->data.state.hsv = s->hsv;
+  ev->data.state.rgb = s->rgb;
+  ev->data.state.transition_ms = s->transition_ms;
+}
+
+// Calibration aside
+static bool state_equal(const persistent_state_t * a, const persistent_state_t * b)
+{
+  return a->cursor_mode == b->cursor_mode && a->on == b->on &&
+    a->transition_ms == b->transition_ms &&
+    memcmp(&a->hsv, &b->hsv, sizeof(a->hsv)) == 0 &&
+    memcmp(&a->rgb, &b->rgb, sizeof(a->rgb)) == 0;
+}
+
+static void print_state(const char * what, const persistent_state_t * s)
+{
+  printf("  %s: hsv %04x %04x %04x rgb %04x %04x %04x mode %d %s %ums\n", what,
+	 s->hsv.h, s->hsv.s, s->hsv.v, s->rgb.r, s->rgb.g, s->rgb.b,
+	 s->cursor_mode, s->on ? "on" : "off", s->transition_ms);
+}
+
+static state_patch_t patch_from_event(const trace_event_t * ev)
+{
+  state_patch_t patch;
+  memset(&patch, 0, sizeof(patch));
+  patch.fields = ev->flags & ~PATCH_CAL;
+  patch.rgb = ev->data.patch.rgb;
+  patch.hsv = ev->data.patch.hsv;
+  patch.cursor_mode = ev->data.patch.mode;
+  patch.on = ev->data.patch.on;
+  patch.transition_ms = ev->data.patch.transition_ms;
+  patch.audio = ev->data.patch.audio;
+  patch.ramp_s = ev->data.patch.ramp_s;
+  patch.scene = ev->arg;
+  return patch;
+}
+
+// The render step of the main loop (fade_render), returns the color shown.
+// The frames of the effects are the ones recorded.
+static rgb_t render(fade_t * fade, const persistent_state_t * s, bool effect, rgb_t frame,
+		    int32_t * ramp_ms, uint32_t time_ms)
+{
+  fade_render(fade, s, s->on && effect ? &frame : NULL, ramp_ms, time_ms);
+  return fade->shown;
+}
+
+static void replay_event(replay_t * r, const trace_event_t * ev)
+{
+  persistent_state_t * s = &r->state;
+  switch(ev->source){
+  case TRACE_SNAPSHOT: {
+    persistent_state_t recorded = *s;
+    state_from_snapshot(&recorded, ev);
+    if(!state_equal(s, &recorded)){
+      r->state_errors++;
+      if(!r->quiet){
+	printf("%10u: state differs\n", ev->time_ms);
+	print_state("recorded", &recorded);
+	print_state("replayed", s);
+      }
+      *s = recorded;
+    }
+    break;
+  }
+  case TRACE_ENCODER:
+    state_step(s, ev->data.steps);
+    break;
+  case TRACE_WEB_COLOR:
+    state_set_rgb(s, ev->data.rgb);
+    break;
+  case TRACE_GESTURE:
+    // A double click did something if a scene was saved, which is recorded
+    if(state_gesture(s, ev->arg, ev->flags & 1) != (ev->flags & 1)){
+      r->state_errors++;
+      if(!r->quiet){
+	printf("%10u: %s %s\n", ev->time_ms, gesture_name(ev->arg),
+	       ev->flags & 1 ? "applied, not replayed" : "replayed, not applied");
+      }
+    }
+    break;
+  case TRACE_CONTROL: {
+    state_patch_t patch = patch_from_event(ev);
+    patch_apply(s, &patch);
+    if(patch.fields & PATCH_RAMP) r->ramp_ms = patch.ramp_s * 1000;
+    break;
+  }
+  case TRACE_RENDER: {
+    rgb_t recorded = ev->data.rgb;
+    rgb_t target = s->on ? rgb_16_to_8(s->rgb) : (rgb_t){0, 0, 0};
+    if(!r->synced){
+      // A fade in progress at the start of the trace is unknown, follow the
+      // recording until it is over
+      fade_set(&r->fade, recorded);
+      r->synced = (s->on && ev->arg) || rgb_equal(recorded, target);
+      r->ramp_ms = -1;
+    } else {
+      rgb_t shown = render(&r->fade, s, ev->arg, recorded, &r->ramp_ms, ev->time_ms);
+      if(!rgb_equal(shown, recorded)){
+	r->color_errors++;
+	if(!r->quiet){
+	  printf("%10u: shown %02x%02x%02x, replayed %02x%02x%02x\n", ev->time_ms,
+		 recorded.r, recorded.g, recorded.b, shown.r, shown.g, shown.b);
+	}
+	fade_set(&r->fade, recorded);
+	r->synced = false;
+      }
+    }
+    for(int o = 0; o < 3; ++o){
+      r->duties += calib_duty(&r->lut, o, r->fade.shown);
+    }
+    r->renders++;
+    if(r->verbose){
+      printf("%10u: %02x%02x%02x%s\n", ev->time_ms, r->fade.shown.r, r->fade.shown.g,
+	     r->fade.shown.b, ev->arg ? " effect" : "");
+    }
+    break;
+  }
+  default:
+    if(!r->quiet) printf("%10u: unknown event %d\n", ev->time_ms, ev->source);
+    r->state_errors++;
+    break;
+  }
+}
+
+static void sleep_until(double t)
+{
+  double left = t - now_s();
+  if(left <= 0) return;
+  struct timespec ts = {(time_t)left, (long)((left - (time_t)left) * 1e9)};
+  nanosleep(&ts, NULL);
+}
+
+// Replays from the first snapshot, returns the number of events applied
+static uint32_t replay(replay_t * r, const trace_header_t * header, const trace_event_t * events,
+		       bool realtime)
+{
+  uint32_t first = 0;
+  while(first < header->count && events[first].source != TRACE_SNAPSHOT){
+    first++;
+  }
+  if(first == header->count){
+    fprintf(stderr, "No snapshot in the trace\n");
+    exit(1);
+  }
+  memset(&r->state, 0, sizeof(r->state));
+  r->state.cal = header->cal;
+  state_from_snapshot(&r->state, &events[first]);
+  memset(&r->fade, 0, sizeof(r->fade));
+  r->synced = false;
+  r->ramp_ms = -1;
+
+  double start = now_s();
+  for(uint32_t i = first; i < header->count; ++i){
+    if(realtime){
+      sleep_until(start + (uint32_t)(events[i].time_ms - events[first].time_ms) * 1e-3);
+    }
+    replay_event(r, &events[i]);
+  }
+  return header->count - first;
+}
+
+static void *read_file(const char * path, size_t * size)
+{
+  FILE * f = fopen(path, "rb");
+  if(!f){
+    perror(path);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  void * data = malloc(*size ? *size : 1);
+  if(fread(data, 1, *size, f) != *size){
+    perror(path);
+    exit(1);
+  }
+  fclose(f);
+  return data;
+}
+
+static int check(const char * path, bool realtime, bool verbose)
+{
+  size_t size;
+  uint8_t * data = read_file(path, &size);
+  const trace_header_t * header = (const trace_header_t *)data;
+  if(size < sizeof(*header) || header->magic != TRACE_MAGIC ||
+     header->version != TRACE_VERSION || header->event_size != sizeof(trace_event_t) ||
+     header->gamma_x10 < 10 || header->duty_max == 0 || header->duty_max >= 4096 ||
+     size < sizeof(*header) + (size_t)header->count * sizeof(trace_event_t)){
+    fprintf(stderr, "%s: not a trace (version %d)\n", path, TRACE_VERSION);
+    return 1;
+  }
+  const trace_event_t * events = (const trace_event_t *)(data + sizeof(*header));
+
+  static replay_t r;
+  memset(&r, 0, sizeof(r));
+  r.verbose = verbose;
+  calib_fold(&r.lut, &header->cal, header->gamma_x10 / 10.0f, header->duty_max);
+  uint32_t applied = replay(&r, header, events, realtime);
+  uint32_t span = header->count ? events[header->count - 1].time_ms - events[0].time_ms : 0;
+  printf("%u events over %.1fs (%u dropped), %u replayed, %u renders, gamma %.1f, "
+	 "duty up to %u\n", header->count, span * 1e-3, header->dropped, applied, r.renders,
+	 header->gamma_x10 / 10.0, header->duty_max);
+
+  persistent_state_t last = r.state;
+  state_from_snapshot(&last, &header->state);
+  if(!state_equal(&r.state, &last)){
+    r.state_errors++;
+    printf("State at the download differs\n");
+    print_state("recorded", &last);
+    print_state("replayed", &r.state);
+  }
+  printf("%u color differences, %u state differences\n", r.color_errors, r.state_errors);
+  int result = (r.color_errors || r.state_errors) ? 1 : 0;
+
+  if(!realtime && applied > 0){
+    // Timing only, the results are the same every round
+    static replay_t t;
+    t = r;
+    t.verbose = false;
+    t.quiet = true;
+    int rounds = 0;
+    double start = now_s(), elapsed;
+    do {
+      replay(&t, header, events, false);
+      rounds++;
+    } while((elapsed = now_s() - start) < 0.5);
+    printf("%.1fM events/s, %.0fns per render\n",
+	   applied * rounds / elapsed * 1e-6,
+	   t.renders ? elapsed / (t.renders - r.renders) * 1e9 : 0.0);
+  }
+  free(data);
+  return result;
+}
+
+/*
+ * A trace of random inputs, recorded as the controller does (trace.c) with
+ * the main loop applying them.
+ */
+
+typedef struct {
+  trace_event_t * ring;
+  uint32_t size;
+  uint32_t head;
+  uint32_t count;
+  uint32_t dropped;
+  int since_snapshot;
+} recorder_t;
+
+static void record_event(recorder_t * rec, const trace_event_t * ev)
+{
+  rec->ring[rec->head] = *ev;
+  rec->head = (rec->head + 1) % rec->size;
+  if(rec->count < rec->size){
+    rec->count++;
+  } else {
+    rec->dropped++;
+  }
+  rec->since_snapshot++;
+}
+
+static int record(const char * path, uint32_t size)
+{
+  recorder_t rec = {calloc(size, sizeof(trace_event_t)), size, 0, 0, 0, TRACE_SNAPSHOT_EVERY};
+  persistent_state_t s;
+  memset(&s, 0, sizeof(s));
+  s.rgb = rgb_8_to_16((rgb_t){255, 30, 0});
+  s.hsv = rgb16_to_hsv16(s.rgb);
+  // The default calibration of leds.c
+  static const int32_t scales[3] = {128, 0, 50};
+  for(int c = 0; c < 3; ++c){
+    s.cal.matrix[c][c] = calib_from_scale(scales[c], RECORD_GAMMA_X10 / 10.0f);
+  }
+  s.cursor_mode = MODE_VALUE;
+  s.on = true;
+  fade_t fade;
+  fade_set(&fade, rgb_16_to_8(s.rgb));
+  bool effect = false;
+  int32_t ramp_ms = -1;
+  uint32_t time_ms = 0xfffff000; // Wraps during the trace
+  srand(1);
+
+  // Three times the ring, so it wraps
+  for(uint32_t n = 0; n < 3 * size; ){
+    time_ms += 10 + rand() % 40;
+    trace_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.time_ms = time_ms;
+    switch(rand() % 8){
+    case 0:
+      ev.source = TRACE_ENCODER;
+      ev.data.steps = rand() % 33 - 16;
+      record_event(&rec, &ev);
+      state_step(&s, ev.data.steps);
+      effect = false;
+      break;
+    case 1:
+      ev.source = TRACE_WEB_COLOR;
+      ev.data.rgb = (rgb_t){rand(), rand(), rand()};
+      record_event(&rec, &ev);
+      state_set_rgb(&s, ev.data.rgb);
+      effect = false;
+      break;
+    case 2:
+      ev.source = TRACE_GESTURE;
+      ev.arg = GESTURE_CLICK + rand() % 4;
+      bool scene = ev.arg == GESTURE_DOUBLE_CLICK && rand() % 2; // If one is saved
+      if(scene) effect = true;
+      ev.flags = state_gesture(&s, ev.arg, scene);
+      record_event(&rec, &ev);
+      break;
+    case 3: {
+      state_patch_t patch;
+      memset(&patch, 0, sizeof(patch));
+      const uint32_t choices[] = {
+	PATCH_RGB, PATCH_HSV_V, PATCH_HSV | PATCH_TRANSITION, PATCH_POWER, PATCH_MODE,
+	PATCH_TRANSITION, PATCH_EFFECT, PATCH_SCENE, PATCH_CAL_OFFSET | PATCH_RGB_G,
+	PATCH_RGB | PATCH_RAMP, PATCH_POWER | PATCH_RAMP,
+      };
+      patch.fields = choices[rand() % (sizeof(choices) / sizeof(choices[0]))];
+      patch.rgb = (rgb_t){rand(), rand(), rand()};
+      patch.hsv = (hsv_t){rand(), rand(), rand()};
+      patch.cursor_mode = rand() % 3;
+      patch.on = rand() % 2;
+      patch.transition_ms = rand() % 2000;
+      patch.scene = rand() % 8;
+      patch.ramp_s = rand() % 3;
+      ev.source = TRACE_CONTROL;
+      ev.arg = patch.scene;
+      ev.flags = patch.fields;
+      ev.data.patch.rgb = patch.rgb;
+      ev.data.patch.hsv = patch.hsv;
+      ev.data.patch.mode = patch.cursor_mode;
+      ev.data.patch.on = patch.on;
+      ev.data.patch.transition_ms = patch.transition_ms;
+      ev.data.patch.ramp_s = patch.ramp_s;
+      record_event(&rec, &ev);
+      patch_apply(&s, &patch);
+      if(patch.fields & PATCH_RAMP) ramp_ms = patch.ramp_s * 1000;
+      if(patch.fields & (PATCH_RGB | PATCH_HSV)) effect = false;
+      if(patch.fields & (PATCH_EFFECT | PATCH_SCENE)) effect = true;
+      break;
+    }
+    default:
+      break; // Only a render
+    }
+    if(rec.since_snapshot >= TRACE_SNAPSHOT_EVERY){
+      snapshot_from_state(&ev, &s);
+      record_event(&rec, &ev);
+      rec.since_snapshot = 0;
+    }
+    rgb_t frame = {time_ms / 4, 255 - time_ms / 8, 128};
+    memset(&ev, 0, sizeof(ev));
+    ev.time_ms = time_ms;
+    ev.source = TRACE_RENDER;
+    ev.arg = effect;
+    ev.data.rgb = render(&fade, &s, effect, frame, &ramp_ms, time_ms);
+    record_event(&rec, &ev);
+    n = rec.count + rec.dropped;
+  }
+
+  trace_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.event_size = sizeof(trace_event_t);
+  header.count = rec.count;
+  header.dropped = rec.dropped;
+  header.state.time_ms = time_ms;
+  snapshot_from_state(&header.state, &s);
+  header.cal = s.cal;
+  header.gamma_x10 = RECORD_GAMMA_X10;
+  header.duty_max = RECORD_DUTY_MAX;
+
+  FILE * f = fopen(path, "wb");
+  if(!f){
+    perror(path);
+    return 1;
+  }
+  fwrite(&header, sizeof(header), 1, f);
+  uint32_t first = (rec.head + rec.size - rec.count) % rec.size;
+  for(uint32_t i = 0; i < rec.count; ++i){
+    fwrite(&rec.ring[(first + i) % rec.size], sizeof(trace_event_t), 1, f);
+  }
+  fclose(f);
+  printf("%s: %u events\n", path, rec.count);
+  free(rec.ring);
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  if(argc >= 3 && strcmp(argv[1], "--record") == 0){
+    return record(argv[2], argc > 3 ? atoi(argv[3]) : RECORD_EVENTS);
+  }
+  const char * path = NULL;
+  bool realtime = false, verbose = false;
+  for(int i = 1; i < argc; ++i){
+    if(strcmp(argv[i], "--realtime") == 0){
+      realtime = true;
+    } else if(strcmp(argv[i], "-v") == 0){
+      verbose = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if(!path){
+    fprintf(stderr, "Usage: %s trace [--realtime] [-v]\n"
+	    "       %s --record trace [events]\n", argv[0], argv[0]);
+    return 2;
+  }
+  return check(path, realtime, verbose);
+}
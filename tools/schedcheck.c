@@ -0,0 +1,277 @@
+/*
+ * Check the timer wheel and the schedules against plain reference code.
+ *
+ *   gcc -O2 -I../main -o schedcheck schedcheck.c ../main/wheel.c \
+ *       ../main/schedule_plan.c
+ *   ./schedcheck [days] [seed]
+ *
+ * The wheel gets random inserts, removals and advances of all sizes and has
+ * to expire every node at its tick, in order, compared with a list that is
+ * searched for the earliest node.
+ *
+ * Then 'days' days (default 365) of random schedules run in simulated time,
+ * sleeping until schedule_due as the firmware does, with reboots (the
+ * controller off for up to three days), clock jumps both ways and tables
+ * edited now and then. Each update has to run the entry a brute-force
+ * search finds (weekdays from gmtime), with the right lateness, and nothing
+ * may run late while the clock runs normally. Exits with 1 on a difference.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wheel.h"
+#include "schedule_plan.h"
+
+#define NODES (200)
+#define MAX_SLEEP (15 * 60) // The firmware wakes up at least this often
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rand64(void)
+{
+  return (uint64_t)rand() << 33 ^ (uint64_t)rand() << 11 ^ rand();
+}
+
+/* Wheel */
+
+static wheel_node_t g_nodes[NODES];
+static bool g_in[NODES];         // Reference: in the wheel
+static uint64_t g_expires[NODES];
+static uint64_t g_last;          // Tick of the last expiry
+static int g_errors = 0;
+
+static void node_expired(wheel_node_t * node, void * arg)
+{
+  wheel_t * w = arg;
+  int i = node - g_nodes;
+  uint64_t tick = w->now - 1;
+  if(!g_in[i] || g_expires[i] != tick || node->expires != tick || tick < g_last){
+    if(g_errors++ < 10){
+      printf("node %d expired at %llu, due %llu (in %d), last %llu\n", i,
+	     (unsigned long long)tick, (unsigned long long)g_expires[i], g_in[i],
+	     (unsigned long long)g_last);
+    }
+  }
+  // The earliest of the reference has to be this tick
+  for(int j = 0; j < NODES; ++j){
+    if(g_in[j] && j != i && g_expires[j] < tick && g_errors++ < 10){
+      printf("node %d (due %llu) missed at %llu\n", j, (unsigned long long)g_expires[j],
+	     (unsigned long long)tick);
+    }
+  }
+  g_in[i] = false;
+  g_last = tick;
+  // Some come back right away
+  if(rand() % 4 == 0){
+    g_in[i] = true;
+    g_expires[i] = w->now + rand64() % 5000;
+    wheel_insert(w, node, g_expires[i]);
+  }
+}
+
+static int check_wheel(int rounds)
+{
+  static wheel_t w;
+  uint64_t start = rand64() % 1000000;
+  wheel_init(&w, start);
+  g_last = start;
+  memset(g_in, 0, sizeof(g_in));
+  uint64_t expired = 0;
+  for(int r = 0; r < rounds; ++r){
+    int i = rand() % NODES;
+    switch(rand() % 4){
+    case 0:
+    case 1: {
+      // Delays of every level, a few past the range
+      int bits = rand() % 27;
+      uint64_t delay = rand64() % (1ULL << bits);
+      g_in[i] = true;
+      g_expires[i] = w.now + delay;
+      wheel_insert(&w, &g_nodes[i], g_expires[i]);
+      break;
+    }
+    case 2:
+      wheel_remove(&w, &g_nodes[i]);
+      g_in[i] = false;
+      break;
+    case 3: {
+      uint64_t until = w.now + rand64() % (1ULL << (rand() % 22));
+      uint64_t before = w.count;
+      wheel_advance(&w, until, node_expired, &w);
+      expired += before - w.count;
+      for(int j = 0; j < NODES; ++j){
+	if(g_in[j] && g_expires[j] <= until && g_errors++ < 10){
+	  printf("node %d (due %llu) left after an advance to %llu\n", j,
+		 (unsigned long long)g_expires[j], (unsigned long long)until);
+	}
+      }
+      break;
+    }
+    }
+    uint32_t count = 0;
+    for(int j = 0; j < NODES; ++j){
+      count += g_in[j];
+      if(g_in[j] != wheel_pending(&g_nodes[j]) && g_errors++ < 10){
+	printf("node %d pending %d, expected %d\n", j, wheel_pending(&g_nodes[j]), g_in[j]);
+      }
+    }
+    if(count != w.count && g_errors++ < 10){
+      printf("count %u, expected %u\n", w.count, count);
+    }
+    uint64_t next = wheel_next(&w);
+    for(int j = 0; j < NODES; ++j){
+      if(g_in[j] && g_expires[j] < next && g_errors++ < 10){
+	printf("next %llu after node %d (due %llu)\n", (unsigned long long)next, j,
+	       (unsigned long long)g_expires[j]);
+      }
+    }
+  }
+  printf("wheel: %d operations, %llu expired, %d errors\n", rounds,
+	 (unsigned long long)expired, g_errors);
+  return g_errors;
+}
+
+/* Schedules */
+
+typedef struct {
+  int runs;
+  int entry;        // Last run
+  uint32_t late;
+} runs_t;
+
+static schedule_table_t g_table;
+static runs_t g_runs;
+
+static void run_recorded(const schedule_entry_t * entry, uint32_t late, void * arg)
+{
+  (void)arg;
+  g_runs.runs++;
+  g_runs.entry = entry - g_table.entries;
+  g_runs.late = late;
+}
+
+static int weekday(int64_t local)
+{
+  time_t t = local;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  return tm.tm_wday;
+}
+
+// Latest entry due in (from, to], ties to the last one, -1 if none
+static int expected(int64_t from, int64_t to, int64_t * at)
+{
+  int found = -1;
+  *at = INT64_MIN;
+  for(int64_t day = from / SCHEDULE_DAY - 1; day <= to / SCHEDULE_DAY; ++day){
+    int wd = weekday(day * SCHEDULE_DAY);
+    for(int i = 0; i < g_table.count; ++i){
+      const schedule_entry_t * e = &g_table.entries[i];
+      int64_t t = day * SCHEDULE_DAY + e->minute * 60;
+      if(t > from && t <= to && (e->days & (1 << wd)) && t >= *at){
+	found = i;
+	*at = t;
+      }
+    }
+  }
+  return found;
+}
+
+static void random_table(void)
+{
+  memset(&g_table, 0, sizeof(g_table));
+  g_table.count = 1 + rand() % SCHEDULE_MAX_ENTRIES;
+  for(int i = 0; i < g_table.count; ++i){
+    schedule_entry_t * e = &g_table.entries[i];
+    e->minute = rand() % 1440;
+    e->days = rand() % 8 == 0 ? SCHEDULE_ALL_DAYS : rand() & SCHEDULE_ALL_DAYS;
+    e->action = rand() % SCHEDULE_ACTIONS;
+    e->ramp_s = rand() % 3600;
+  }
+  // Some at the same time
+  if(g_table.count > 1) g_table.entries[1].minute = g_table.entries[0].minute;
+}
+
+static int check_schedules(int days)
+{
+  static schedule_t s;
+  int errors = 0;
+  int updates = 0, boots = 1, jumps = 0, edits = 0;
+  int64_t now = schedule_local_time(2026, 1, 1, 0, 0, 0) + rand() % SCHEDULE_DAY;
+  int64_t end = now + (int64_t)days * SCHEDULE_DAY;
+  random_table();
+  g_table.last_run = now;
+  schedule_plan_init(&s, &g_table, run_recorded, NULL);
+  schedule_update(&s, now);
+  int64_t horizon = now; // Everything due up to here was dealt with
+
+  double start = now_s();
+  while(now < end){
+    int64_t from = horizon;
+    bool normal = false;
+    int event = rand() % 1000;
+    if(event < 3){
+      // Off for a while, the table survives in flash
+      now += rand64() % (3 * SCHEDULE_DAY);
+      schedule_plan_init(&s, &g_table, run_recorded, NULL);
+      from = g_table.last_run > now - SCHEDULE_CATCH_UP ? g_table.last_run : now - SCHEDULE_CATCH_UP;
+      boots++;
+    } else if(event < 6){
+      now += rand64() % (2 * SCHEDULE_DAY);
+      jumps++;
+    } else if(event < 9){
+      now -= rand64() % (2 * SCHEDULE_DAY);
+      from = now; // Nothing is due
+      jumps++;
+    } else if(event < 10){
+      random_table();
+      memset(&g_runs, 0, sizeof(g_runs));
+      schedule_changed(&s, now);
+      if(g_runs.runs){
+	printf("ran %d after an edit\n", g_runs.entry);
+	errors++;
+      }
+      horizon = now;
+      edits++;
+      continue;
+    } else {
+      int64_t due = schedule_due(&s);
+      now = due < now + MAX_SLEEP ? due : now + MAX_SLEEP;
+      normal = true;
+    }
+    memset(&g_runs, 0, sizeof(g_runs));
+    schedule_update(&s, now);
+    updates++;
+    int64_t at;
+    int want = from < now ? expected(from, now, &at) : -1;
+    if(now > horizon) horizon = now;
+    bool bad = g_runs.runs != (want >= 0) ||
+      (want >= 0 && (g_runs.entry != want || g_runs.late != now - at)) ||
+      (normal && g_runs.runs && g_runs.late != 0);
+    if(bad && errors++ < 10){
+      printf("%lld: ran %d (%d, %u s late), expected %d (%lld s late)%s\n",
+	     (long long)now, g_runs.runs ? g_runs.entry : -1, g_runs.runs, g_runs.late,
+	     want, want >= 0 ? (long long)(now - at) : 0LL, normal ? "" : " after a jump");
+    }
+  }
+  double elapsed = now_s() - start;
+  printf("schedules: %d days in %.1f ms, %d updates, %d boots, %d jumps, %d edits, %d errors\n",
+	 days, elapsed * 1e3, updates, boots, jumps, edits, errors);
+  return errors;
+}
+
+int main(int argc, char ** argv)
+{
+  int days = argc > 1 ? atoi(argv[1]) : 365;
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  int errors = check_wheel(200000);
+  errors += check_schedules(days);
+  return errors ? 1 : 0;
+}
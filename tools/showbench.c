@@ -0,0 +1,88 @@
+/*
+ * Check a show file with the firmware decoder and time its playback.
+ *
+ *   gcc -O2 -I../main -o showbench showbench.c ../main/show_format.c
+ *   ./showbench show.bin [fixture]
+ *
+ * Decodes every frame in order for all channels and for a single fixture
+ * (what a controller does), then seeks to random frames, and prints the
+ * time per frame. The ESP32 is roughly 10-20 times slower than a desktop.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "show_format.h"
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Play all frames 'rounds' times, returns the time per frame in seconds
+static double play(show_decoder_t * d, uint8_t * out, uint32_t first, uint32_t count, int rounds)
+{
+  uint32_t frames = d->header->frames;
+  double start = now_s();
+  for(int r = 0; r < rounds; ++r){
+    for(uint32_t f = 0; f < frames; ++f){
+      if(!show_seek(d, f, out, first, count)){
+	fprintf(stderr, "Decode error at frame %u\n", f);
+	exit(1);
+      }
+    }
+  }
+  return (now_s() - start) / rounds / frames;
+}
+
+int main(int argc, char ** argv)
+{
+  if(argc < 2){
+    fprintf(stderr, "Usage: %s show.bin [fixture]\n", argv[0]);
+    return 1;
+  }
+  FILE * f = fopen(argv[1], "rb");
+  if(!f){
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint32_t * file = malloc(size + 4); // Aligned like the flash mapping
+  if(fread(file, 1, size, f) != (size_t)size){
+    perror(argv[1]);
+    return 1;
+  }
+  fclose(f);
+
+  show_decoder_t d;
+  if(!show_open(&d, file, size)){
+    fprintf(stderr, "%s: not a valid show\n", argv[1]);
+    return 1;
+  }
+  const show_header_t * h = d.header;
+  uint32_t fixture = argc > 2 ? atoi(argv[2]) : 0;
+  printf("%u fixtures, %u frames at %u fps (%.1f s), key frame every %u, %u bytes\n",
+	 h->fixtures, h->frames, h->fps, (double)h->frames / h->fps,
+	 h->keyframe_interval, h->data_len);
+
+  uint8_t * all = calloc(d.channels, 1);
+  uint8_t one[3] = {0};
+  int rounds = 1 + 20000000 / (h->data_len + 1);
+  printf("all channels:  %8.3f us/frame\n", 1e6 * play(&d, all, 0, d.channels, rounds));
+  printf("fixture %-5u: %8.3f us/frame\n", fixture, 1e6 * play(&d, one, 3 * fixture, 3, rounds));
+
+  // Random access, the worst case is a whole key frame interval per seek
+  srand(1);
+  int seeks = 10000;
+  double start = now_s();
+  for(int i = 0; i < seeks; ++i){
+    if(!show_seek(&d, rand() % h->frames, one, 3 * fixture, 3)) return 1;
+  }
+  printf("random seek:   %8.3f us\n", 1e6 * (now_s() - start) / seeks);
+  return 0;
+}
@@ -0,0 +1,152 @@
+# Encode a show for the flash show player (format in main/show_format.h)
+#
+# Input is either CSV, one frame per line with r,g,b of every fixture, or raw
+# bytes (.raw), 3 * fixtures bytes per frame. The encoded show is decoded again
+# and compared with the input before it is written.
+#
+# Upload it with: curl --data-binary @show.bin http://leds.local/api/show
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x5748534C
+VERSION = 1
+LOOP = 1
+SKIP, FILL, COPY = 0x00, 0x40, 0x80
+RUN_MAX = 64
+HEADER = "<IBBHHHIIII"
+
+
+def read_frames(name, channels):
+    if name.endswith(".raw"):
+        data = open(name, "rb").read()
+        if len(data) % channels:
+            sys.exit(f"{name}: size is not a multiple of {channels}")
+        return [data[i:i + channels] for i in range(0, len(data), channels)]
+    frames = []
+    for n, line in enumerate(open(name), 1):
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        values = [max(0, min(255, int(v))) for v in line.split(",")]
+        if len(values) != channels:
+            sys.exit(f"{name}:{n}: expected {channels} values, got {len(values)}")
+        frames.append(bytes(values))
+    return frames
+
+
+def same_run(frame, i):
+    n = 1
+    while i + n < len(frame) and n < RUN_MAX and frame[i + n] == frame[i]:
+        n += 1
+    return n
+
+
+def unchanged_run(frame, prev, i):
+    n = 0
+    while i + n < len(frame) and n < RUN_MAX and frame[i + n] == prev[i + n]:
+        n += 1
+    return n
+
+
+def encode_frame(frame, prev):
+    """prev is None for key frames"""
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        skip = unchanged_run(frame, prev, i) if prev is not None else 0
+        if skip:
+            out += bytes([SKIP | (skip - 1)])
+            i += skip
+            continue
+        fill = same_run(frame, i)
+        if fill >= 3:
+            out += bytes([FILL | (fill - 1), frame[i]])
+            i += fill
+            continue
+        # Literal bytes until something cheaper starts
+        n = 1
+        while i + n < len(frame) and n < RUN_MAX:
+            if prev is not None and unchanged_run(frame, prev, i + n) >= 2:
+                break
+            if same_run(frame, i + n) >= 3:
+                break
+            n += 1
+        out += bytes([COPY | (n - 1)]) + frame[i:i + n]
+        i += n
+    return bytes(out)
+
+
+def encode(frames, fixtures, fps, interval, loop):
+    index = []
+    data = bytearray()
+    prev = None
+    for n, frame in enumerate(frames):
+        key = n % interval == 0
+        if key:
+            index.append(len(data))
+        data += encode_frame(frame, None if key else prev)
+        prev = frame
+    body = struct.pack(f"<{len(index)}I", *index) + bytes(data)
+    header = struct.pack(HEADER, MAGIC, VERSION, LOOP if loop else 0, fixtures,
+                         fps, interval, len(frames), len(index), len(data),
+                         zlib.crc32(body))
+    return header + body
+
+
+def decode(show):
+    (magic, version, flags, fixtures, fps, interval, count, keyframes,
+     data_len, crc) = struct.unpack_from(HEADER, show)
+    assert magic == MAGIC and version == VERSION
+    body = show[struct.calcsize(HEADER):]
+    assert zlib.crc32(body) == crc
+    data = body[4 * keyframes:]
+    assert len(data) == data_len
+    channels = 3 * fixtures
+    frame = bytearray(channels)
+    pos = 0
+    for _ in range(count):
+        c = 0
+        while c < channels:
+            run = data[pos]
+            pos += 1
+            n = (run & (RUN_MAX - 1)) + 1
+            kind = run & ~(RUN_MAX - 1)
+            if kind == FILL:
+                frame[c:c + n] = bytes([data[pos]]) * n
+                pos += 1
+            elif kind == COPY:
+                frame[c:c + n] = data[pos:pos + n]
+                pos += n
+            c += n
+        yield bytes(frame)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Encode a show for the flash show player")
+    parser.add_argument("input", help="frames, .csv or .raw")
+    parser.add_argument("output")
+    parser.add_argument("--fixtures", type=int, required=True)
+    parser.add_argument("--fps", type=int, default=50)
+    parser.add_argument("--keyframe-interval", type=int, default=50,
+                        help="frames between key frames, bounds the cost of a seek")
+    parser.add_argument("--loop", action="store_true")
+    args = parser.parse_args()
+
+    frames = read_frames(args.input, 3 * args.fixtures)
+    if not frames:
+        sys.exit("No frames")
+    show = encode(frames, args.fixtures, args.fps, args.keyframe_interval, args.loop)
+    for n, (a, b) in enumerate(zip(frames, decode(show))):
+        if a != b:
+            sys.exit(f"Frame {n} does not decode back to the input")
+
+    open(args.output, "wb").write(show)
+    raw = len(frames) * 3 * args.fixtures
+    print(f"{len(frames)} frames, {len(frames) / args.fps:.1f} s, "
+          f"{len(show)} bytes ({100 * len(show) / raw:.1f}% of {raw})")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,238 @@
+/*
+ * Run the time sync of several controllers over UDP on this host.
+ *
+ *   gcc -O2 -I../main -Ihost -o syncnet syncnet.c ../main/sync_node.c \
+ *       ../main/clock_sync.c -lpthread
+ *   ./syncnet [seconds] [seed]
+ *
+ * Where syncsim.c runs the model of the time sync (clock_sync.c) on a
+ * simulated network, this runs the task of the firmware (sync_node.c, the
+ * messages, sockets and locks of timesync.c) on NODES threads, each on its
+ * own port of 127.0.0.1 and with its own clock: off by up to +-80 ppm from
+ * the monotonic clock and started at a random time. The firmware broadcasts
+ * its announcements to one port, here every node announces to the port of
+ * each node. The leader leaves at a third of the run (its thread stops and
+ * its socket is closed) and comes back at two thirds.
+ *
+ * Every 10 ms the shared time of each locked follower is compared to the
+ * one of its leader at the same instant. After SETTLE_S from a leader
+ * change the error has to stay below MAX_ERROR_US, the next id has to lead
+ * before the first one comes back, and at the end all nodes follow the
+ * lowest id. Followers have to settle on each of the three leaders.
+ * Exits with 1 otherwise. Prints the median, 99th percentile and largest
+ * error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sync_node.h"
+
+#define NODES 5
+#define BASE_PORT 25577        // Test ports, one per node
+#define STEP_MS 50             // The select timeout of timesync.c
+#define PROBE_US (10 * 1000)
+#define SETTLE_S 3
+#define MAX_ERROR_US 1000
+
+typedef struct {
+  sync_node_t node;
+  double skew;         // Local clock rate - 1
+  int64_t phase;       // Local time at true time 0
+  volatile bool up;
+  pthread_t thread;
+  uint64_t leader;     // Seen by the last probe
+  int64_t changed;     // True time of the last leader change
+} host_t;
+
+static host_t g_hosts[NODES];
+static struct sockaddr_in g_ports[NODES];
+static struct timespec g_start;
+
+static double uniform(void)
+{
+  return (rand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+// Microseconds since the start
+static int64_t true_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec - g_start.tv_sec) * 1000000LL + (ts.tv_nsec - g_start.tv_nsec) / 1000;
+}
+
+static int64_t local_at(const host_t * h, int64_t t)
+{
+  return h->phase + t + (int64_t)(t * h->skew);
+}
+
+static int64_t local_time(void * arg)
+{
+  return local_at(arg, true_time());
+}
+
+static int64_t shared_at(host_t * h, int64_t t)
+{
+  int64_t local = local_at(h, t);
+  return local + sync_node_offset(&h->node, local);
+}
+
+static uint64_t leader_of(host_t * h)
+{
+  portENTER_CRITICAL(&h->node.lock);
+  uint64_t leader = h->node.sync.leader;
+  portEXIT_CRITICAL(&h->node.lock);
+  return leader;
+}
+
+static void * run_node(void * arg)
+{
+  host_t * h = arg;
+  while(h->up) sync_node_step(&h->node, STEP_MS);
+  return NULL;
+}
+
+static bool start_node(int i, int64_t now)
+{
+  host_t * h = &g_hosts[i];
+  sync_node_init(&h->node, i, local_time, h);
+  if(!sync_node_open(&h->node, BASE_PORT + i, g_ports, NODES)){
+    printf("node %d: port %d not bound\n", i, BASE_PORT + i);
+    return false;
+  }
+  h->leader = i;
+  h->changed = now;
+  h->up = true;
+  pthread_create(&h->thread, NULL, run_node, h);
+  return true;
+}
+
+static void stop_node(int i)
+{
+  host_t * h = &g_hosts[i];
+  h->up = false;
+  pthread_join(h->thread, NULL);
+  sync_node_close(&h->node);
+}
+
+// All running nodes have to follow 'leader'
+static int expect_leader(int leader, int64_t now)
+{
+  int failed = 0;
+  for(int i = 0; i < NODES; ++i){
+    if(g_hosts[i].up && leader_of(&g_hosts[i]) != (uint64_t)leader){
+      printf("node %d follows %llu at %.2f s, expected %d\n", i,
+	     (unsigned long long)leader_of(&g_hosts[i]), now / 1e6, leader);
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+static int compare_error(const void * a, const void * b)
+{
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char ** argv)
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 36;
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  int64_t end = seconds * 1000000LL;
+  int64_t leave = end / 3, rejoin = 2 * end / 3;
+
+  clock_gettime(CLOCK_MONOTONIC, &g_start);
+  for(int i = 0; i < NODES; ++i){
+    g_ports[i].sin_family = AF_INET;
+    g_ports[i].sin_port = htons(BASE_PORT + i);
+    g_ports[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+  int failed = 0;
+  for(int i = 0; i < NODES; ++i){
+    g_hosts[i].skew = (uniform() * 160 - 80) * 1e-6;
+    g_hosts[i].phase = (int64_t)(uniform() * 100e6);
+    if(!start_node(i, 0)) failed = 1;
+  }
+
+  size_t nerrors = 0, max_errors = (size_t)(end / PROBE_US + 1) * NODES;
+  int64_t * errors = malloc(max_errors * sizeof(*errors));
+  int64_t worst = 0, worst_at = 0;
+  int worst_node = 0;
+  bool left = false, back = false;
+  size_t settled[3] = {0}; // Probes with the first leader, the next one, the first again
+  for(int64_t next = 0; !failed && next < end; next += PROBE_US){
+    int64_t now = true_time();
+    if(now < next){
+      struct timespec ts = {0, (next - now) * 1000};
+      nanosleep(&ts, NULL);
+    }
+    now = true_time();
+    if(!left && now >= leave){
+      stop_node(0);
+      left = true;
+    }
+    if(!back && now >= rejoin){
+      failed |= expect_leader(1, now); // Took over
+      failed |= !start_node(0, now);
+      back = true;
+    }
+
+    for(int i = 0; i < NODES; ++i){
+      host_t * h = &g_hosts[i];
+      if(!h->up) continue;
+      uint64_t leader = leader_of(h);
+      if(leader != h->leader){
+	h->leader = leader;
+	h->changed = now;
+      }
+    }
+    for(int i = 0; i < NODES; ++i){
+      host_t * h = &g_hosts[i];
+      host_t * leader = &g_hosts[h->leader];
+      // Both have to be settled: a leader that just started following
+      // another one moves its time to the new leader
+      if(!h->up || h->leader == (uint64_t)i || !sync_node_locked(&h->node) || !leader->up ||
+	 now - h->changed < SETTLE_S * 1000000LL || now - leader->changed < SETTLE_S * 1000000LL){
+	continue;
+      }
+      int64_t error = llabs(shared_at(h, now) - shared_at(leader, now));
+      errors[nerrors++] = error;
+      settled[left + back]++;
+      if(error > worst){
+	worst = error;
+	worst_at = now;
+	worst_node = i;
+      }
+    }
+  }
+
+  int64_t now = true_time();
+  failed |= expect_leader(0, now);
+  for(int i = 0; i < 3; ++i){
+    if(!settled[i]){
+      printf("no follower settled %s\n", i == 0 ? "at first" : i == 1 ? "on the next leader" :
+	     "on the first leader back");
+      failed = 1;
+    }
+  }
+  for(int i = 0; i < NODES; ++i){
+    if(g_hosts[i].up) stop_node(i);
+  }
+  if(!nerrors){
+    printf("no locked follower\n");
+    return 1;
+  }
+  qsort(errors, nerrors, sizeof(*errors), compare_error);
+  printf("%d nodes on 127.0.0.1, %d s\n", NODES, seconds);
+  printf("error: median %lld us, 99%% %lld us, max %lld us (node %d at %.2f s)\n",
+	 (long long)errors[nerrors / 2], (long long)errors[nerrors * 99 / 100],
+	 (long long)worst, worst_node, worst_at / 1e6);
+  if(worst >= MAX_ERROR_US) failed = 1;
+  free(errors);
+  return failed;
+}
@@ -0,0 +1,242 @@
+/*
+ * Simulate the time sync of several controllers on a WiFi network.
+ *
+ *   gcc -O2 -I../main -o syncsim syncsim.c ../main/clock_sync.c -lm
+ *   ./syncsim [seconds] [seed]
+ *
+ * Runs the leader election and clock model of timesync.c (clock_sync.c)
+ * on NODES nodes whose crystals are off by up to +-80 ppm and whose clocks
+ * start at random times. Messages take 0.3 to 0.7 ms plus an exponential
+ * jitter (mean 1.5 ms), some are late by up to 40 ms and some are lost;
+ * the leader answers after up to 0.3 ms. The leader leaves at a third of
+ * the run and comes back at two thirds.
+ *
+ * Every 10 ms the shared time of each locked follower is compared to the
+ * one of its leader. After SETTLE_S from a leader change the error has to
+ * stay below MAX_ERROR_US, the next id has to lead before the first one
+ * comes back, and at the end all nodes follow the lowest id.
+ * Exits with 1 otherwise. Prints the time to lock and the median, 99th
+ * percentile and largest error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "clock_sync.h"
+
+#define NODES 5
+#define QUEUE 256
+#define STEP_US 1000           // The loop of the timesync task
+#define PROBE_US (10 * 1000)
+#define SETTLE_S 30
+#define MAX_ERROR_US 1000
+
+enum { ANNOUNCE, REQUEST, RESPONSE };
+
+typedef struct {
+  double skew;        // Local clock rate - 1
+  int64_t phase;      // Local time at true time 0
+  bool up;
+  clock_sync_t sync;
+  int64_t next_announce, next_request;
+  int64_t changed;    // True time of the last leader change
+} node_t;
+
+typedef struct {
+  int64_t at;         // True delivery time
+  int type, from, to;
+  int64_t t1, t2, t3;
+} msg_t;
+
+static node_t g_nodes[NODES];
+static msg_t g_queue[QUEUE];
+static int g_queued;
+static long g_sent, g_lost;
+static int g_locks;
+static int64_t g_lock_time;
+
+static double uniform(void)
+{
+  return (rand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+static int64_t local_time(const node_t * n, int64_t t)
+{
+  return n->phase + t + (int64_t)(t * n->skew);
+}
+
+static int64_t shared_time(const node_t * n, int64_t t)
+{
+  int64_t local = local_time(n, t);
+  return local + clock_model_offset(&n->sync.model, local);
+}
+
+// One way delay of a message, or -1 if it is lost
+static int64_t delay_us(void)
+{
+  if(uniform() < 0.02) return -1;
+  double d = 300 + 400 * uniform() - 1500 * log(uniform());
+  if(uniform() < 0.05) d += 40000 * uniform();  // Retries, power save
+  return (int64_t)d;
+}
+
+static void send(int64_t now, int type, int from, int to, int64_t t1, int64_t t2, int64_t t3)
+{
+  g_sent++;
+  int64_t d = delay_us();
+  if(d < 0 || g_queued == QUEUE){
+    g_lost++;
+    return;
+  }
+  g_queue[g_queued++] = (msg_t){now + d, type, from, to, t1, t2, t3};
+}
+
+static void deliver(const msg_t * m)
+{
+  node_t * n = &g_nodes[m->to];
+  if(!n->up) return;
+  int64_t t4 = local_time(n, m->at);
+  uint64_t leader = n->sync.leader;
+  switch(m->type){
+  case ANNOUNCE:
+    clock_sync_announce(&n->sync, m->from, t4);
+    break;
+  case REQUEST:
+    if(clock_sync_leading(&n->sync)){
+      int64_t reply = m->at + (int64_t)(300 * uniform());
+      send(reply, RESPONSE, m->to, m->from, m->t1, shared_time(n, m->at),
+	   shared_time(n, reply));
+    }
+    break;
+  case RESPONSE:
+    if((uint64_t)m->from == n->sync.leader &&
+       clock_sync_sample(&n->sync, m->t1, m->t2, m->t3, t4) == CLOCK_SAMPLE_LOCKED){
+      g_lock_time += m->at - n->changed;
+      g_locks++;
+    }
+    break;
+  }
+  if(n->sync.leader != leader) n->changed = m->at;
+}
+
+static void run_node(int i, int64_t now)
+{
+  node_t * n = &g_nodes[i];
+  int64_t local = local_time(n, now);
+  if(clock_sync_check(&n->sync, local)) n->changed = now;
+  if(local >= n->next_announce){
+    for(int to = 0; to < NODES; ++to){
+      if(to != i) send(now, ANNOUNCE, i, to, 0, 0, 0);
+    }
+    n->next_announce = local + CLOCK_SYNC_ANNOUNCE_US;
+  }
+  if(!clock_sync_leading(&n->sync) && local >= n->next_request){
+    send(now, REQUEST, i, (int)n->sync.leader, local, 0, 0);
+    n->next_request = local + CLOCK_SYNC_REQUEST_US;
+  }
+}
+
+static void start_node(int i, int64_t now)
+{
+  node_t * n = &g_nodes[i];
+  n->up = true;
+  clock_sync_init(&n->sync, i, local_time(n, now));
+  n->next_announce = n->next_request = 0;
+  n->changed = now;
+}
+
+// All running nodes have to follow 'leader'
+static int expect_leader(int leader, int64_t now)
+{
+  int failed = 0;
+  for(int i = 0; i < NODES; ++i){
+    if(g_nodes[i].up && g_nodes[i].sync.leader != (uint64_t)leader){
+      printf("node %d follows %llu at %.2f s, expected %d\n", i,
+	     (unsigned long long)g_nodes[i].sync.leader, now / 1e6, leader);
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+static int compare_error(const void * a, const void * b)
+{
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char ** argv)
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 600;
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  int64_t end = seconds * 1000000LL;
+  int64_t leave = end / 3, rejoin = 2 * end / 3;
+
+  for(int i = 0; i < NODES; ++i){
+    g_nodes[i].skew = (uniform() * 160 - 80) * 1e-6;
+    g_nodes[i].phase = (int64_t)(uniform() * 100e6);
+    start_node(i, (int64_t)(uniform() * 2e6));
+  }
+
+  size_t nerrors = 0, max_errors = (size_t)(end / PROBE_US) * NODES;
+  int64_t * errors = malloc(max_errors * sizeof(*errors));
+  int64_t worst = 0, worst_at = 0;
+  int worst_node = 0;
+  int failed = 0;
+  for(int64_t now = 0; now < end; now += STEP_US){
+    if(now == leave) g_nodes[0].up = false;
+    if(now == rejoin){
+      failed |= expect_leader(1, now); // Took over
+      start_node(0, now);
+    }
+
+    // Deliver in time order up to now
+    while(1){
+      int first = -1;
+      for(int q = 0; q < g_queued; ++q){
+	if(g_queue[q].at <= now && (first < 0 || g_queue[q].at < g_queue[first].at)) first = q;
+      }
+      if(first < 0) break;
+      msg_t m = g_queue[first];
+      g_queue[first] = g_queue[--g_queued];
+      deliver(&m);
+    }
+    for(int i = 0; i < NODES; ++i){
+      if(g_nodes[i].up) run_node(i, now);
+    }
+
+    if(now % PROBE_US) continue;
+    for(int i = 0; i < NODES; ++i){
+      const node_t * n = &g_nodes[i];
+      const node_t * leader = &g_nodes[n->sync.leader];
+      // Both have to be settled: a leader that just started following
+      // another one moves its time to the new leader
+      if(!n->up || clock_sync_leading(&n->sync) || !n->sync.locked || !leader->up ||
+	 now - n->changed < SETTLE_S * 1000000LL || now - leader->changed < SETTLE_S * 1000000LL){
+	continue;
+      }
+      int64_t error = llabs(shared_time(n, now) - shared_time(leader, now));
+      errors[nerrors++] = error;
+      if(error > worst){
+	worst = error;
+	worst_at = now;
+	worst_node = i;
+      }
+    }
+  }
+
+  failed |= expect_leader(0, end);
+  if(!nerrors){
+    printf("no locked follower\n");
+    return 1;
+  }
+  qsort(errors, nerrors, sizeof(*errors), compare_error);
+  printf("%d nodes, %d s, %ld messages (%ld lost), %d locks in %.1f s on average\n",
+	 NODES, seconds, g_sent, g_lost, g_locks, g_locks ? g_lock_time / 1e6 / g_locks : 0);
+  printf("error: median %lld us, 99%% %lld us, max %lld us (node %d at %.2f s)\n",
+	 (long long)errors[nerrors / 2], (long long)errors[nerrors * 99 / 100],
+	 (long long)worst, worst_node, worst_at / 1e6);
+  if(worst >= MAX_ERROR_US) failed = 1;
+  free(errors);
+  return failed;
+}